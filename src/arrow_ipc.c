@@ -0,0 +1,1211 @@
+#include "arrow_ipc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifndef MINGW
+#include <sys/mman.h>
+#endif
+
+// Columnar binary files in the Arrow IPC format.
+// The writer puts every column in one record batch, numbers in their field
+// storage types and enum fields dictionary encoded, so Arrow libraries such
+// as pyarrow read them as tables. Files are written in the random access file
+// format (the stream format wrapped with magic and a footer) or as a plain
+// stream.
+// The reader maps the file and uses buffers in the value types above straight
+// from the mapping. Other integer and float types, nulls and data split over
+// several record batches are converted into allocated buffers instead.
+// Only the parts of the FlatBuffers encoding that the Arrow metadata uses are
+// implemented here, on little endian hosts.
+
+#define ARROW_MAGIC "ARROW1"
+#define ARROW_CONTINUATION 0xFFFFFFFFu
+#define ARROW_METADATA_V5 4
+#define ARROW_METADATA_V4 3
+#define ARROW_ALIGN(SIZE) (((SIZE) + 7) & ~(int64_t)7)
+
+enum {
+	ARROW_HEADER_SCHEMA = 1,
+	ARROW_HEADER_DICTIONARY = 2,
+	ARROW_HEADER_RECORD_BATCH = 3
+};
+
+// Members of the Type union in Schema.fbs.
+enum {
+	ARROW_ID_NULL = 1,
+	ARROW_ID_INT,
+	ARROW_ID_FLOAT,
+	ARROW_ID_BINARY,
+	ARROW_ID_UTF8,
+	ARROW_ID_BOOL,
+	ARROW_ID_DECIMAL,
+	ARROW_ID_DATE,
+	ARROW_ID_TIME,
+	ARROW_ID_TIMESTAMP,
+	ARROW_ID_INTERVAL,
+	ARROW_ID_LIST,
+	ARROW_ID_STRUCT,
+	ARROW_ID_UNION,
+	ARROW_ID_FIXED_BINARY,
+	ARROW_ID_FIXED_LIST,
+	ARROW_ID_MAP,
+	ARROW_ID_DURATION,
+	ARROW_ID_LARGE_BINARY,
+	ARROW_ID_LARGE_UTF8,
+	ARROW_ID_LARGE_LIST,
+	ARROW_ID_RUN_END
+};
+
+static const int ArrowTypeWidths[] = {8, 4, 4, 1, 2, 4, 0};
+
+// FieldNode, Buffer and Block structs as laid out in the metadata.
+typedef struct {
+	int64_t Length, NullCount;
+} arrow_node_t;
+
+typedef struct {
+	int64_t Offset, Length;
+} arrow_buffer_t;
+
+typedef struct {
+	int64_t Offset;
+	int32_t MetadataLength, Padding;
+	int64_t BodyLength;
+} arrow_block_t;
+
+static inline uint16_t fb_u16(const uint8_t *Data) {
+	uint16_t Value;
+	memcpy(&Value, Data, 2);
+	return Value;
+}
+
+static inline uint32_t fb_u32(const uint8_t *Data) {
+	uint32_t Value;
+	memcpy(&Value, Data, 4);
+	return Value;
+}
+
+static inline int64_t fb_i64(const uint8_t *Data) {
+	int64_t Value;
+	memcpy(&Value, Data, 8);
+	return Value;
+}
+
+// FlatBuffers tables are read in place, every offset is checked against the
+// size of the metadata before it is followed.
+typedef struct {
+	const uint8_t *Data;
+	uint32_t Size, Position, VTable, VSize, TSize;
+} fb_table_t;
+
+static int fb_table_at(fb_table_t *Table, const uint8_t *Data, uint32_t Size, uint32_t Position) {
+	if (Size < 4 || Position > Size - 4) return 0;
+	int64_t VTable = (int64_t)Position - (int32_t)fb_u32(Data + Position);
+	if (VTable < 0 || VTable > (int64_t)Size - 4) return 0;
+	uint32_t VSize = fb_u16(Data + VTable), TSize = fb_u16(Data + VTable + 2);
+	if (VSize < 4 || (VSize & 1) || VTable + VSize > Size) return 0;
+	if (TSize < 4 || (uint64_t)Position + TSize > Size) return 0;
+	Table->Data = Data;
+	Table->Size = Size;
+	Table->Position = Position;
+	Table->VTable = VTable;
+	Table->VSize = VSize;
+	Table->TSize = TSize;
+	return 1;
+}
+
+// Returns the position of a field, or 0 if it is absent.
+static uint32_t fb_field(const fb_table_t *Table, int Slot, uint32_t Width) {
+	uint32_t Entry = 4 + 2 * Slot;
+	if (Entry + 2 > Table->VSize) return 0;
+	uint32_t Offset = fb_u16(Table->Data + Table->VTable + Entry);
+	if (!Offset || Offset + Width > Table->TSize) return 0;
+	return Table->Position + Offset;
+}
+
+static int64_t fb_int(const fb_table_t *Table, int Slot, int Width, int64_t Default) {
+	uint32_t Position = fb_field(Table, Slot, Width);
+	if (!Position) return Default;
+	const uint8_t *Data = Table->Data + Position;
+	switch (Width) {
+	case 1: return (int8_t)Data[0];
+	case 2: return (int16_t)fb_u16(Data);
+	case 4: return (int32_t)fb_u32(Data);
+	default: return fb_i64(Data);
+	}
+}
+
+// Follows an offset field, returning the position it points to or 0.
+static uint32_t fb_target(const fb_table_t *Table, int Slot) {
+	uint32_t Position = fb_field(Table, Slot, 4);
+	if (!Position) return 0;
+	uint64_t Target = (uint64_t)Position + fb_u32(Table->Data + Position);
+	return Target < Table->Size ? Target : 0;
+}
+
+static int fb_child(const fb_table_t *Table, int Slot, fb_table_t *Child) {
+	uint32_t Position = fb_target(Table, Slot);
+	return Position && fb_table_at(Child, Table->Data, Table->Size, Position);
+}
+
+// Returns the position of the first element of a vector field, or 0.
+static uint32_t fb_vector(const fb_table_t *Table, int Slot, uint32_t Width, uint32_t *Count) {
+	uint32_t Position = fb_target(Table, Slot);
+	if (!Position || Position > Table->Size - 4) return 0;
+	uint32_t Length = fb_u32(Table->Data + Position);
+	if (Length > (Table->Size - Position - 4) / Width) return 0;
+	*Count = Length;
+	return Position + 4;
+}
+
+static const char *fb_string(const fb_table_t *Table, int Slot, uint32_t *Length) {
+	uint32_t Position = fb_vector(Table, Slot, 1, Length);
+	return Position ? (const char *)Table->Data + Position : 0;
+}
+
+static int fb_element(const fb_table_t *Table, uint32_t Elements, uint32_t Index, fb_table_t *Element) {
+	uint32_t Position = Elements + 4 * Index;
+	uint64_t Target = (uint64_t)Position + fb_u32(Table->Data + Position);
+	return Target < Table->Size && fb_table_at(Element, Table->Data, Table->Size, Target);
+}
+
+// FlatBuffers are built back to front, children before their parents. Refs
+// are distances from the end of the buffer, which do not change as it grows.
+typedef struct {
+	uint8_t *Data;
+	uint32_t Capacity, Size, TableStart, NumSlots;
+	uint32_t Slots[8];
+} fb_builder_t;
+
+static void fb_push(fb_builder_t *Builder, const void *Data, uint32_t Size) {
+	if (!Size) return;
+	if (Builder->Size + Size > Builder->Capacity) {
+		uint32_t Capacity = Builder->Capacity ? 2 * Builder->Capacity : 4096;
+		while (Capacity < Builder->Size + Size) Capacity *= 2;
+		uint8_t *Buffer = malloc(Capacity);
+		if (Builder->Data) memcpy(Buffer + Capacity - Builder->Size, Builder->Data + Builder->Capacity - Builder->Size, Builder->Size);
+		free(Builder->Data);
+		Builder->Data = Buffer;
+		Builder->Capacity = Capacity;
+	}
+	Builder->Size += Size;
+	memcpy(Builder->Data + Builder->Capacity - Builder->Size, Data, Size);
+}
+
+// Pads so that the next Size bytes end on a multiple of Align.
+static void fb_align(fb_builder_t *Builder, uint32_t Size, uint32_t Align) {
+	static const uint8_t Padding[8] = {0,};
+	fb_push(Builder, Padding, (Align - (Builder->Size + Size) % Align) % Align);
+}
+
+static void fb_start_table(fb_builder_t *Builder) {
+	memset(Builder->Slots, 0, sizeof(Builder->Slots));
+	Builder->NumSlots = 0;
+	Builder->TableStart = Builder->Size;
+}
+
+static void fb_add_slot(fb_builder_t *Builder, int Slot) {
+	Builder->Slots[Slot] = Builder->Size;
+	if (Builder->NumSlots <= Slot) Builder->NumSlots = Slot + 1;
+}
+
+static void fb_add_scalar(fb_builder_t *Builder, int Slot, int64_t Value, uint32_t Width) {
+	fb_align(Builder, Width, Width);
+	fb_push(Builder, &Value, Width);
+	fb_add_slot(Builder, Slot);
+}
+
+static void fb_add_offset(fb_builder_t *Builder, int Slot, uint32_t Ref) {
+	fb_align(Builder, 4, 4);
+	uint32_t Offset = Builder->Size + 4 - Ref;
+	fb_push(Builder, &Offset, 4);
+	fb_add_slot(Builder, Slot);
+}
+
+// Writes the table's offset to its vtable, which goes right before it.
+static uint32_t fb_end_table(fb_builder_t *Builder) {
+	int32_t VTableOffset = 0;
+	fb_align(Builder, 4, 4);
+	fb_push(Builder, &VTableOffset, 4);
+	uint32_t Table = Builder->Size;
+	uint16_t VTable[2 + 8];
+	VTable[0] = 4 + 2 * Builder->NumSlots;
+	VTable[1] = Table - Builder->TableStart;
+	for (int I = 0; I < Builder->NumSlots; ++I) VTable[2 + I] = Builder->Slots[I] ? Table - Builder->Slots[I] : 0;
+	fb_push(Builder, VTable, VTable[0]);
+	VTableOffset = Builder->Size - Table;
+	memcpy(Builder->Data + Builder->Capacity - Table, &VTableOffset, 4);
+	return Table;
+}
+
+static uint32_t fb_add_string(fb_builder_t *Builder, const char *Text) {
+	uint32_t Length = strlen(Text);
+	fb_align(Builder, Length + 1, 4);
+	fb_push(Builder, "", 1);
+	fb_push(Builder, Text, Length);
+	fb_push(Builder, &Length, 4);
+	return Builder->Size;
+}
+
+static uint32_t fb_add_structs(fb_builder_t *Builder, const void *Structs, uint32_t Count, uint32_t Width) {
+	fb_align(Builder, Count * Width, 4);
+	fb_align(Builder, Count * Width, 8);
+	fb_push(Builder, Structs, Count * Width);
+	fb_push(Builder, &Count, 4);
+	return Builder->Size;
+}
+
+static uint32_t fb_add_tables(fb_builder_t *Builder, const uint32_t *Refs, uint32_t Count) {
+	fb_align(Builder, 0, 4);
+	for (uint32_t I = Count; I--;) {
+		uint32_t Offset = Builder->Size + 4 - Refs[I];
+		fb_push(Builder, &Offset, 4);
+	}
+	fb_push(Builder, &Count, 4);
+	return Builder->Size;
+}
+
+// Adds the root offset and returns the size of the finished buffer, which is
+// padded to a multiple of 8 bytes.
+static uint32_t fb_finish(fb_builder_t *Builder, uint32_t Root) {
+	fb_align(Builder, 4, 8);
+	uint32_t Offset = Builder->Size + 4 - Root;
+	fb_push(Builder, &Offset, 4);
+	return Builder->Size;
+}
+
+static inline const uint8_t *fb_data(fb_builder_t *Builder) {
+	return Builder->Data + Builder->Capacity - Builder->Size;
+}
+
+typedef struct {
+	const char *Name;
+	const void *Values;
+	const char **EnumNames;
+	arrow_text_fn TextFn;
+	void *Data;
+	int64_t TextSize;
+	int EnumSize;
+	arrow_type_t Type;
+} arrow_output_t;
+
+struct arrow_writer_t {
+	FILE *File;
+	arrow_output_t *Columns;
+	arrow_block_t *Blocks;
+	fb_builder_t Builder[1];
+	int64_t Position;
+	int NumRows, NumColumns, NumAdded, NumBlocks, Stream, Error;
+};
+
+// Columns are only recorded until arrow_writer_close, so their values, names
+// and text must stay valid until then.
+arrow_writer_t *arrow_writer_open(const char *FileName, int NumRows, int NumColumns, int Stream) {
+	FILE *File = fopen(FileName, "wb");
+	if (!File) return 0;
+	arrow_writer_t *Writer = calloc(1, sizeof(arrow_writer_t));
+	Writer->File = File;
+	Writer->Columns = calloc(NumColumns + 1, sizeof(arrow_output_t));
+	Writer->Blocks = calloc(NumColumns + 1, sizeof(arrow_block_t));
+	Writer->NumRows = NumRows;
+	Writer->NumColumns = NumColumns;
+	Writer->Stream = Stream;
+	return Writer;
+}
+
+// Dictionary encoded columns pass their indices as Values, which must have
+// an integer type.
+void arrow_writer_column(arrow_writer_t *Writer, const char *Name, arrow_type_t Type, const void *Values, const char **EnumNames, int EnumSize) {
+	if (Writer->NumAdded == Writer->NumColumns) return;
+	arrow_output_t *Column = Writer->Columns + Writer->NumAdded++;
+	Column->Name = Name;
+	Column->Type = Type;
+	Column->Values = Values;
+	Column->EnumNames = EnumNames;
+	Column->EnumSize = EnumSize;
+}
+
+void arrow_writer_text(arrow_writer_t *Writer, const char *Name, arrow_text_fn TextFn, void *Data) {
+	if (Writer->NumAdded == Writer->NumColumns) return;
+	arrow_output_t *Column = Writer->Columns + Writer->NumAdded++;
+	Column->Name = Name;
+	Column->Type = ARROW_UTF8;
+	Column->TextFn = TextFn;
+	Column->Data = Data;
+}
+
+static void arrow_put(arrow_writer_t *Writer, const void *Data, size_t Size) {
+	if (Size && fwrite(Data, 1, Size, Writer->File) != Size) Writer->Error = 1;
+	Writer->Position += Size;
+}
+
+static void arrow_pad(arrow_writer_t *Writer) {
+	static const char Padding[8] = {0,};
+	if (Writer->Position % 8) arrow_put(Writer, Padding, 8 - Writer->Position % 8);
+}
+
+// The strings of a text column, or the names of a dictionary.
+static inline const char *arrow_output_text(arrow_output_t *Column, int Index) {
+	return Column->TextFn ? Column->TextFn(Index, Column->Data) : Column->EnumNames[Index];
+}
+
+static int arrow_output_count(arrow_writer_t *Writer, arrow_output_t *Column) {
+	return Column->TextFn ? Writer->NumRows : Column->EnumSize;
+}
+
+// Strings are measured again while writing rather than keeping every offset.
+static void arrow_put_offsets(arrow_writer_t *Writer, arrow_output_t *Column) {
+	int Count = arrow_output_count(Writer, Column), Large = Column->TextSize > INT32_MAX;
+	int64_t Offsets[1024], Offset = 0;
+	int32_t Narrow[1024];
+	int Size = 0;
+	for (int I = 0; I <= Count; ++I) {
+		Offsets[Size++] = Offset;
+		if (I < Count) Offset += strlen(arrow_output_text(Column, I));
+		if (Size < 1024 && I < Count) continue;
+		if (Large) {
+			arrow_put(Writer, Offsets, Size * sizeof(int64_t));
+		} else {
+			for (int J = 0; J < Size; ++J) Narrow[J] = Offsets[J];
+			arrow_put(Writer, Narrow, Size * sizeof(int32_t));
+		}
+		Size = 0;
+	}
+	arrow_pad(Writer);
+}
+
+static void arrow_put_text(arrow_writer_t *Writer, arrow_output_t *Column) {
+	int Count = arrow_output_count(Writer, Column);
+	for (int I = 0; I < Count; ++I) {
+		const char *Text = arrow_output_text(Column, I);
+		arrow_put(Writer, Text, strlen(Text));
+	}
+	arrow_pad(Writer);
+}
+
+static uint32_t arrow_build_int(fb_builder_t *Builder, int BitWidth, int Signed) {
+	fb_start_table(Builder);
+	fb_add_scalar(Builder, 0, BitWidth, 4);
+	fb_add_scalar(Builder, 1, Signed, 1);
+	return fb_end_table(Builder);
+}
+
+static uint32_t arrow_build_field(fb_builder_t *Builder, arrow_output_t *Column, int Id) {
+	uint32_t Name = fb_add_string(Builder, Column->Name);
+	uint32_t Children = fb_add_tables(Builder, 0, 0);
+	uint32_t Type, Dictionary = 0;
+	int TypeId;
+	if (Column->TextFn || Column->EnumNames) {
+		TypeId = Column->TextSize > INT32_MAX ? ARROW_ID_LARGE_UTF8 : ARROW_ID_UTF8;
+		fb_start_table(Builder);
+		Type = fb_end_table(Builder);
+		if (Column->EnumNames) {
+			uint32_t IndexType = arrow_build_int(Builder, 8 * ArrowTypeWidths[Column->Type], Column->Type == ARROW_INT32);
+			fb_start_table(Builder);
+			fb_add_scalar(Builder, 0, Id, 8);
+			fb_add_offset(Builder, 1, IndexType);
+			Dictionary = fb_end_table(Builder);
+		}
+	} else if (Column->Type == ARROW_FLOAT64 || Column->Type == ARROW_FLOAT32) {
+		TypeId = ARROW_ID_FLOAT;
+		fb_start_table(Builder);
+		fb_add_scalar(Builder, 0, Column->Type == ARROW_FLOAT64 ? 2 : 1, 2);
+		Type = fb_end_table(Builder);
+	} else {
+		TypeId = ARROW_ID_INT;
+		Type = arrow_build_int(Builder, 8 * ArrowTypeWidths[Column->Type], Column->Type == ARROW_INT32);
+	}
+	fb_start_table(Builder);
+	fb_add_offset(Builder, 0, Name);
+	fb_add_scalar(Builder, 1, 0, 1);
+	fb_add_scalar(Builder, 2, TypeId, 1);
+	fb_add_offset(Builder, 3, Type);
+	if (Dictionary) fb_add_offset(Builder, 4, Dictionary);
+	fb_add_offset(Builder, 5, Children);
+	return fb_end_table(Builder);
+}
+
+static uint32_t arrow_build_schema(arrow_writer_t *Writer) {
+	fb_builder_t *Builder = Writer->Builder;
+	uint32_t *Fields = malloc((Writer->NumColumns + 1) * sizeof(uint32_t));
+	for (int I = 0; I < Writer->NumColumns; ++I) Fields[I] = arrow_build_field(Builder, Writer->Columns + I, I);
+	uint32_t Vector = fb_add_tables(Builder, Fields, Writer->NumColumns);
+	free(Fields);
+	fb_start_table(Builder);
+	fb_add_scalar(Builder, 0, 0, 2);
+	fb_add_offset(Builder, 1, Vector);
+	return fb_end_table(Builder);
+}
+
+static uint32_t arrow_build_batch(fb_builder_t *Builder, int64_t Length, arrow_node_t *Nodes, int NumNodes, arrow_buffer_t *Buffers, int NumBuffers) {
+	uint32_t NodesRef = fb_add_structs(Builder, Nodes, NumNodes, sizeof(arrow_node_t));
+	uint32_t BuffersRef = fb_add_structs(Builder, Buffers, NumBuffers, sizeof(arrow_buffer_t));
+	fb_start_table(Builder);
+	fb_add_scalar(Builder, 0, Length, 8);
+	fb_add_offset(Builder, 1, NodesRef);
+	fb_add_offset(Builder, 2, BuffersRef);
+	return fb_end_table(Builder);
+}
+
+// Writes a message around the header just built, the caller writes the body.
+// Dictionary and record batch messages are also listed in the footer.
+static void arrow_put_message(arrow_writer_t *Writer, int HeaderType, uint32_t Header, int64_t BodyLength) {
+	fb_builder_t *Builder = Writer->Builder;
+	fb_start_table(Builder);
+	fb_add_scalar(Builder, 0, ARROW_METADATA_V5, 2);
+	fb_add_scalar(Builder, 1, HeaderType, 1);
+	fb_add_offset(Builder, 2, Header);
+	fb_add_scalar(Builder, 3, BodyLength, 8);
+	uint32_t Size = fb_finish(Builder, fb_end_table(Builder));
+	if (HeaderType != ARROW_HEADER_SCHEMA) {
+		arrow_block_t *Block = Writer->Blocks + Writer->NumBlocks++;
+		Block->Offset = Writer->Position;
+		Block->MetadataLength = Size + 8;
+		Block->BodyLength = BodyLength;
+	}
+	uint32_t Prefix[2] = {ARROW_CONTINUATION, Size};
+	arrow_put(Writer, Prefix, 8);
+	arrow_put(Writer, fb_data(Builder), Size);
+	Builder->Size = 0;
+}
+
+static void arrow_put_dictionary(arrow_writer_t *Writer, arrow_output_t *Column, int Id) {
+	int64_t OffsetsSize = (int64_t)(Column->EnumSize + 1) * (Column->TextSize > INT32_MAX ? 8 : 4);
+	arrow_node_t Node = {Column->EnumSize, 0};
+	arrow_buffer_t Buffers[3] = {{0, 0}, {0, OffsetsSize}, {ARROW_ALIGN(OffsetsSize), Column->TextSize}};
+	fb_builder_t *Builder = Writer->Builder;
+	uint32_t Batch = arrow_build_batch(Builder, Column->EnumSize, &Node, 1, Buffers, 3);
+	fb_start_table(Builder);
+	fb_add_scalar(Builder, 0, Id, 8);
+	fb_add_offset(Builder, 1, Batch);
+	uint32_t Header = fb_end_table(Builder);
+	arrow_put_message(Writer, ARROW_HEADER_DICTIONARY, Header, Buffers[2].Offset + ARROW_ALIGN(Column->TextSize));
+	arrow_put_offsets(Writer, Column);
+	arrow_put_text(Writer, Column);
+}
+
+static void arrow_put_batch(arrow_writer_t *Writer) {
+	int NumRows = Writer->NumRows, NumColumns = Writer->NumColumns;
+	arrow_node_t *Nodes = malloc((NumColumns + 1) * sizeof(arrow_node_t));
+	arrow_buffer_t *Buffers = malloc((3 * NumColumns + 1) * sizeof(arrow_buffer_t));
+	int NumBuffers = 0;
+	int64_t BodyLength = 0;
+	for (int I = 0; I < NumColumns; ++I) {
+		arrow_output_t *Column = Writer->Columns + I;
+		Nodes[I].Length = NumRows;
+		Nodes[I].NullCount = 0;
+		Buffers[NumBuffers++] = (arrow_buffer_t){BodyLength, 0};
+		if (Column->TextFn) {
+			int64_t Size = (int64_t)(NumRows + 1) * (Column->TextSize > INT32_MAX ? 8 : 4);
+			Buffers[NumBuffers++] = (arrow_buffer_t){BodyLength, Size};
+			BodyLength += ARROW_ALIGN(Size);
+			Buffers[NumBuffers++] = (arrow_buffer_t){BodyLength, Column->TextSize};
+			BodyLength += ARROW_ALIGN(Column->TextSize);
+		} else {
+			int64_t Size = (int64_t)NumRows * ArrowTypeWidths[Column->Type];
+			Buffers[NumBuffers++] = (arrow_buffer_t){BodyLength, Size};
+			BodyLength += ARROW_ALIGN(Size);
+		}
+	}
+	uint32_t Header = arrow_build_batch(Writer->Builder, NumRows, Nodes, NumColumns, Buffers, NumBuffers);
+	arrow_put_message(Writer, ARROW_HEADER_RECORD_BATCH, Header, BodyLength);
+	free(Nodes);
+	free(Buffers);
+	for (int I = 0; I < NumColumns; ++I) {
+		arrow_output_t *Column = Writer->Columns + I;
+		if (Column->TextFn) {
+			arrow_put_offsets(Writer, Column);
+			arrow_put_text(Writer, Column);
+		} else {
+			arrow_put(Writer, Column->Values, (size_t)NumRows * ArrowTypeWidths[Column->Type]);
+			arrow_pad(Writer);
+		}
+	}
+}
+
+// The footer repeats the schema and lists the other messages for readers
+// of the file format.
+static void arrow_put_footer(arrow_writer_t *Writer) {
+	fb_builder_t *Builder = Writer->Builder;
+	uint32_t Schema = arrow_build_schema(Writer);
+	int NumDictionaries = Writer->NumBlocks - 1;
+	uint32_t Dictionaries = fb_add_structs(Builder, Writer->Blocks, NumDictionaries, sizeof(arrow_block_t));
+	uint32_t Batches = fb_add_structs(Builder, Writer->Blocks + NumDictionaries, 1, sizeof(arrow_block_t));
+	fb_start_table(Builder);
+	fb_add_scalar(Builder, 0, ARROW_METADATA_V5, 2);
+	fb_add_offset(Builder, 1, Schema);
+	fb_add_offset(Builder, 2, Dictionaries);
+	fb_add_offset(Builder, 3, Batches);
+	uint32_t Size = fb_finish(Builder, fb_end_table(Builder));
+	arrow_put(Writer, fb_data(Builder), Size);
+	arrow_put(Writer, &Size, 4);
+	arrow_put(Writer, ARROW_MAGIC, 6);
+}
+
+// Writes the file and closes it, returning 0 or -1 if any write failed.
+int arrow_writer_close(arrow_writer_t *Writer) {
+	if (Writer->NumAdded == Writer->NumColumns) {
+		setvbuf(Writer->File, 0, _IOFBF, 1 << 20);
+		for (int I = 0; I < Writer->NumColumns; ++I) {
+			arrow_output_t *Column = Writer->Columns + I;
+			if (!Column->TextFn && !Column->EnumNames) continue;
+			int Count = arrow_output_count(Writer, Column);
+			for (int J = 0; J < Count; ++J) Column->TextSize += strlen(arrow_output_text(Column, J));
+		}
+		if (!Writer->Stream) arrow_put(Writer, ARROW_MAGIC "\0\0", 8);
+		arrow_put_message(Writer, ARROW_HEADER_SCHEMA, arrow_build_schema(Writer), 0);
+		for (int I = 0; I < Writer->NumColumns; ++I) {
+			if (Writer->Columns[I].EnumNames) arrow_put_dictionary(Writer, Writer->Columns + I, I);
+		}
+		arrow_put_batch(Writer);
+		uint32_t End[2] = {ARROW_CONTINUATION, 0};
+		arrow_put(Writer, End, 8);
+		if (!Writer->Stream) arrow_put_footer(Writer);
+	} else {
+		Writer->Error = 1;
+	}
+	if (fclose(Writer->File)) Writer->Error = 1;
+	int Error = Writer->Error;
+	free(Writer->Builder->Data);
+	free(Writer->Columns);
+	free(Writer->Blocks);
+	free(Writer);
+	return Error ? -1 : 0;
+}
+
+typedef enum {
+	ARROW_KIND_SKIP,
+	ARROW_KIND_INT,
+	ARROW_KIND_FLOAT,
+	ARROW_KIND_BOOL,
+	ARROW_KIND_TEXT,
+	ARROW_KIND_DICTIONARY
+} arrow_kind_t;
+
+// The buffers of one column in one record batch.
+typedef struct {
+	const uint8_t *Validity, *Data;
+	const char *Chars;
+	int64_t Length, NullCount;
+} arrow_part_t;
+
+typedef struct {
+	const char *Text;
+	int64_t Length;
+} arrow_entry_t;
+
+typedef struct {
+	arrow_entry_t *Entries;
+	int64_t Id;
+	int Size, Space, Large, Used;
+} arrow_dictionary_t;
+
+typedef struct {
+	arrow_column_t Column[1];
+	arrow_part_t *Parts;
+	arrow_kind_t Kind;
+	int NumParts, MaxParts, NumNodes, NumBuffers, Width, Signed, Large, Dictionary;
+} arrow_field_t;
+
+struct arrow_file_t {
+	const uint8_t *Data;
+	size_t Size;
+	arrow_field_t *Fields;
+	arrow_dictionary_t *Dictionaries;
+	arrow_column_t **Columns;
+	void **Buffers;
+	const char *Error;
+	int64_t NumRows;
+	int NumFields, NumDictionaries, NumColumns, NumBuffers, MaxBuffers;
+};
+
+static int arrow_fail(arrow_file_t *File, const char *Error) {
+	if (!File->Error) File->Error = Error;
+	return 0;
+}
+
+// Allocates a buffer that lives as long as the file.
+static void *arrow_file_alloc(arrow_file_t *File, size_t Size) {
+	if (File->NumBuffers == File->MaxBuffers) {
+		File->MaxBuffers = File->MaxBuffers ? 2 * File->MaxBuffers : 16;
+		File->Buffers = realloc(File->Buffers, File->MaxBuffers * sizeof(void *));
+	}
+	return File->Buffers[File->NumBuffers++] = malloc(Size ? Size : 1);
+}
+
+// Counts the field nodes and buffers a field and its children take up in a
+// record batch, so that columns of unsupported types can be skipped.
+static int arrow_field_layout(const fb_table_t *Field, int Depth, int *NumNodes, int *NumBuffers) {
+	if (Depth > 64) return 0;
+	++*NumNodes;
+	if (fb_target(Field, 4)) {
+		*NumBuffers += 2;
+		return 1;
+	}
+	switch (fb_int(Field, 2, 1, 0) & 0xFF) {
+	case ARROW_ID_NULL: case ARROW_ID_RUN_END:
+		break;
+	case ARROW_ID_STRUCT: case ARROW_ID_FIXED_LIST:
+		*NumBuffers += 1;
+		break;
+	case ARROW_ID_INT: case ARROW_ID_FLOAT: case ARROW_ID_BOOL: case ARROW_ID_DECIMAL:
+	case ARROW_ID_DATE: case ARROW_ID_TIME: case ARROW_ID_TIMESTAMP: case ARROW_ID_INTERVAL:
+	case ARROW_ID_FIXED_BINARY: case ARROW_ID_DURATION:
+	case ARROW_ID_LIST: case ARROW_ID_MAP: case ARROW_ID_LARGE_LIST:
+		*NumBuffers += 2;
+		break;
+	case ARROW_ID_BINARY: case ARROW_ID_UTF8: case ARROW_ID_LARGE_BINARY: case ARROW_ID_LARGE_UTF8:
+		*NumBuffers += 3;
+		break;
+	default:
+		return 0;
+	}
+	uint32_t NumChildren = 0, Children = fb_vector(Field, 5, 4, &NumChildren);
+	for (uint32_t I = 0; I < NumChildren; ++I) {
+		fb_table_t Child[1];
+		if (!fb_element(Field, Children, I, Child)) return 0;
+		if (!arrow_field_layout(Child, Depth + 1, NumNodes, NumBuffers)) return 0;
+	}
+	return 1;
+}
+
+static void arrow_field_kind(arrow_file_t *File, arrow_field_t *Field, const fb_table_t *Table) {
+	int TypeId = fb_int(Table, 2, 1, 0) & 0xFF;
+	fb_table_t Type[1], Encoding[1], Index[1];
+	if (fb_child(Table, 4, Encoding)) {
+		if (TypeId != ARROW_ID_UTF8 && TypeId != ARROW_ID_LARGE_UTF8) return;
+		if (fb_child(Encoding, 1, Index)) {
+			Field->Width = fb_int(Index, 0, 4, 0) / 8;
+			Field->Signed = fb_int(Index, 1, 1, 0);
+		} else {
+			Field->Width = 4;
+			Field->Signed = 1;
+		}
+		if (Field->Width != 1 && Field->Width != 2 && Field->Width != 4 && Field->Width != 8) return;
+		int64_t Id = fb_int(Encoding, 0, 8, 0);
+		int Dictionary = 0;
+		while (Dictionary < File->NumDictionaries && File->Dictionaries[Dictionary].Id != Id) ++Dictionary;
+		if (Dictionary == File->NumDictionaries) {
+			File->Dictionaries[Dictionary].Id = Id;
+			File->Dictionaries[Dictionary].Large = TypeId == ARROW_ID_LARGE_UTF8;
+			++File->NumDictionaries;
+		}
+		Field->Dictionary = Dictionary;
+		Field->Kind = ARROW_KIND_DICTIONARY;
+		return;
+	}
+	int HasType = fb_child(Table, 3, Type);
+	switch (TypeId) {
+	case ARROW_ID_INT:
+		if (!HasType) return;
+		Field->Width = fb_int(Type, 0, 4, 0) / 8;
+		Field->Signed = fb_int(Type, 1, 1, 0);
+		if (Field->Width == 1 || Field->Width == 2 || Field->Width == 4 || Field->Width == 8) Field->Kind = ARROW_KIND_INT;
+		break;
+	case ARROW_ID_FLOAT:
+		if (!HasType) return;
+		switch (fb_int(Type, 0, 2, 0)) {
+		case 1: Field->Width = 4; Field->Kind = ARROW_KIND_FLOAT; break;
+		case 2: Field->Width = 8; Field->Kind = ARROW_KIND_FLOAT; break;
+		}
+		break;
+	case ARROW_ID_BOOL:
+		Field->Kind = ARROW_KIND_BOOL;
+		break;
+	case ARROW_ID_UTF8: case ARROW_ID_LARGE_UTF8:
+		Field->Large = TypeId == ARROW_ID_LARGE_UTF8;
+		Field->Kind = ARROW_KIND_TEXT;
+		break;
+	}
+}
+
+static int arrow_read_schema(arrow_file_t *File, const fb_table_t *Schema) {
+	if (File->Fields) return arrow_fail(File, "more than one schema");
+	if (fb_int(Schema, 0, 2, 0)) return arrow_fail(File, "big endian data is not supported");
+	uint32_t NumFields = 0, Fields = fb_vector(Schema, 1, 4, &NumFields);
+	if (!Fields) return arrow_fail(File, "invalid schema");
+	File->Fields = calloc(NumFields + 1, sizeof(arrow_field_t));
+	File->Dictionaries = calloc(NumFields + 1, sizeof(arrow_dictionary_t));
+	File->NumFields = NumFields;
+	for (uint32_t I = 0; I < NumFields; ++I) {
+		arrow_field_t *Field = File->Fields + I;
+		fb_table_t Table[1];
+		if (!fb_element(Schema, Fields, I, Table)) return arrow_fail(File, "invalid schema");
+		if (!arrow_field_layout(Table, 0, &Field->NumNodes, &Field->NumBuffers)) return arrow_fail(File, "unsupported column type");
+		uint32_t Length = 0;
+		const char *Name = fb_string(Table, 0, &Length);
+		char *Copy = arrow_file_alloc(File, Length + 1);
+		if (Name) memcpy(Copy, Name, Length);
+		Copy[Length] = 0;
+		Field->Column->Name = Copy;
+		arrow_field_kind(File, Field, Table);
+	}
+	return 1;
+}
+
+static inline int64_t arrow_part_offset(const arrow_part_t *Part, int Large, int64_t Index) {
+	return Large ? fb_i64(Part->Data + 8 * Index) : (int32_t)fb_u32(Part->Data + 4 * Index);
+}
+
+static inline int arrow_part_null(const arrow_part_t *Part, int64_t Index) {
+	if (!Part->NullCount) return 0;
+	if (!Part->Validity) return 1;
+	return !((Part->Validity[Index / 8] >> (Index % 8)) & 1);
+}
+
+static inline int64_t arrow_part_integer(const arrow_field_t *Field, const arrow_part_t *Part, int64_t Index) {
+	const uint8_t *Data = Part->Data + Field->Width * Index;
+	switch (Field->Width) {
+	case 1: return Field->Signed ? (int8_t)Data[0] : Data[0];
+	case 2: return Field->Signed ? (int16_t)fb_u16(Data) : fb_u16(Data);
+	case 4: return Field->Signed ? (int32_t)fb_u32(Data) : fb_u32(Data);
+	default: return fb_i64(Data);
+	}
+}
+
+static double arrow_part_value(const arrow_field_t *Field, const arrow_part_t *Part, int64_t Index) {
+	switch (Field->Kind) {
+	case ARROW_KIND_BOOL:
+		return (Part->Data[Index / 8] >> (Index % 8)) & 1;
+	case ARROW_KIND_FLOAT:
+		if (Field->Width == 4) {
+			float Value;
+			memcpy(&Value, Part->Data + 4 * Index, 4);
+			return Value;
+		} else {
+			double Value;
+			memcpy(&Value, Part->Data + 8 * Index, 8);
+			return Value;
+		}
+	default:
+		if (Field->Width == 8 && !Field->Signed) return (double)(uint64_t)fb_i64(Part->Data + 8 * Index);
+		return arrow_part_integer(Field, Part, Index);
+	}
+}
+
+// Checks the buffers of a column in a record batch against its length.
+static int arrow_read_part(arrow_file_t *File, arrow_field_t *Field, arrow_part_t *Part, const uint8_t **Buffers, const int64_t *Sizes) {
+	int64_t Length = Part->Length;
+	if (Part->NullCount) {
+		if (Sizes[0]) {
+			if (Sizes[0] < (Length + 7) / 8) return arrow_fail(File, "invalid validity buffer");
+			Part->Validity = Buffers[0];
+		} else if (Part->NullCount != Length) {
+			return arrow_fail(File, "missing validity buffer");
+		}
+	}
+	Part->Data = Buffers[1];
+	switch (Field->Kind) {
+	case ARROW_KIND_BOOL:
+		if (Sizes[1] < (Length + 7) / 8) return arrow_fail(File, "invalid values buffer");
+		break;
+	case ARROW_KIND_TEXT: {
+		if (!Length) break;
+		int OffsetWidth = Field->Large ? 8 : 4;
+		if (Sizes[1] / OffsetWidth < Length + 1) return arrow_fail(File, "invalid offsets buffer");
+		int64_t Previous = arrow_part_offset(Part, Field->Large, 0);
+		if (Previous < 0) return arrow_fail(File, "invalid offsets buffer");
+		for (int64_t I = 1; I <= Length; ++I) {
+			int64_t Offset = arrow_part_offset(Part, Field->Large, I);
+			if (Offset < Previous) return arrow_fail(File, "invalid offsets buffer");
+			Previous = Offset;
+		}
+		if (Previous > Sizes[2]) return arrow_fail(File, "invalid string buffer");
+		Part->Chars = (const char *)Buffers[2];
+		break;
+	}
+	default:
+		if (Sizes[1] / Field->Width < Length) return arrow_fail(File, "invalid values buffer");
+		break;
+	}
+	return 1;
+}
+
+static int arrow_read_batch(arrow_file_t *File, const fb_table_t *Batch, const uint8_t *Body, int64_t BodyLength, arrow_field_t *Fields, int NumFields, int64_t *Length) {
+	if (fb_target(Batch, 3)) return arrow_fail(File, "compressed buffers are not supported");
+	int64_t NumRows = *Length = fb_int(Batch, 0, 8, 0);
+	uint32_t NumNodes = 0, NumBuffers = 0;
+	uint32_t Nodes = fb_vector(Batch, 1, sizeof(arrow_node_t), &NumNodes);
+	uint32_t Buffers = fb_vector(Batch, 2, sizeof(arrow_buffer_t), &NumBuffers);
+	if (NumRows < 0 || NumRows > INT32_MAX || !Nodes || !Buffers) return arrow_fail(File, "invalid record batch");
+	uint32_t Node = 0, Buffer = 0;
+	for (int I = 0; I < NumFields; ++I) {
+		arrow_field_t *Field = Fields + I;
+		if (Node + Field->NumNodes > NumNodes || Buffer + Field->NumBuffers > NumBuffers) return arrow_fail(File, "invalid record batch");
+		if (Field->Kind != ARROW_KIND_SKIP) {
+			const uint8_t *NodeData = Batch->Data + Nodes + sizeof(arrow_node_t) * Node;
+			arrow_part_t Part[1] = {{0,}};
+			Part->Length = fb_i64(NodeData);
+			Part->NullCount = fb_i64(NodeData + 8);
+			if (Part->Length != NumRows || Part->NullCount < 0 || Part->NullCount > NumRows) return arrow_fail(File, "invalid record batch");
+			const uint8_t *Pointers[3];
+			int64_t Sizes[3];
+			for (int J = 0; J < Field->NumBuffers; ++J) {
+				const uint8_t *BufferData = Batch->Data + Buffers + sizeof(arrow_buffer_t) * (Buffer + J);
+				int64_t Offset = fb_i64(BufferData), Size = fb_i64(BufferData + 8);
+				if (Offset < 0 || Size < 0 || Offset > BodyLength || Size > BodyLength - Offset) return arrow_fail(File, "invalid buffer");
+				Pointers[J] = Body + Offset;
+				Sizes[J] = Size;
+			}
+			if (!arrow_read_part(File, Field, Part, Pointers, Sizes)) return 0;
+			if (Field->NumParts == Field->MaxParts) {
+				Field->MaxParts = Field->MaxParts ? 2 * Field->MaxParts : 4;
+				Field->Parts = realloc(Field->Parts, Field->MaxParts * sizeof(arrow_part_t));
+			}
+			Field->Parts[Field->NumParts++] = Part[0];
+		}
+		Node += Field->NumNodes;
+		Buffer += Field->NumBuffers;
+	}
+	return 1;
+}
+
+static int arrow_read_dictionary(arrow_file_t *File, const fb_table_t *Message, const uint8_t *Body, int64_t BodyLength) {
+	int64_t Id = fb_int(Message, 0, 8, 0);
+	fb_table_t Batch[1];
+	if (!fb_child(Message, 1, Batch)) return arrow_fail(File, "invalid dictionary batch");
+	arrow_dictionary_t *Dictionary = 0;
+	for (int I = 0; I < File->NumDictionaries; ++I) {
+		if (File->Dictionaries[I].Id == Id) Dictionary = File->Dictionaries + I;
+	}
+	// Dictionaries of skipped columns are not kept
+	if (!Dictionary) return 1;
+	if (!fb_int(Message, 2, 1, 0)) {
+		if (Dictionary->Used) return arrow_fail(File, "replacement dictionaries are not supported");
+		Dictionary->Size = 0;
+	}
+	arrow_field_t Field[1] = {{.Kind = ARROW_KIND_TEXT, .NumNodes = 1, .NumBuffers = 3, .Large = Dictionary->Large}};
+	int64_t Length;
+	if (!arrow_read_batch(File, Batch, Body, BodyLength, Field, 1, &Length)) {
+		free(Field->Parts);
+		return 0;
+	}
+	if (Length > INT32_MAX - 1 - Dictionary->Size) {
+		free(Field->Parts);
+		return arrow_fail(File, "dictionary is too large");
+	}
+	if (Dictionary->Size + Length > Dictionary->Space) {
+		int Space = Dictionary->Space ? Dictionary->Space : 64;
+		while (Space < Dictionary->Size + Length) Space = Space < INT32_MAX / 2 ? 2 * Space : INT32_MAX;
+		Dictionary->Entries = realloc(Dictionary->Entries, Space * sizeof(arrow_entry_t));
+		Dictionary->Space = Space;
+	}
+	arrow_part_t *Part = Field->Parts;
+	for (int64_t I = 0; I < Length; ++I) {
+		arrow_entry_t *Entry = Dictionary->Entries + Dictionary->Size++;
+		if (arrow_part_null(Part, I)) {
+			Entry->Text = "";
+			Entry->Length = 0;
+		} else {
+			int64_t Start = arrow_part_offset(Part, Field->Large, I);
+			Entry->Text = Part->Chars + Start;
+			Entry->Length = arrow_part_offset(Part, Field->Large, I + 1) - Start;
+		}
+	}
+	free(Field->Parts);
+	return 1;
+}
+
+static int arrow_read_messages(arrow_file_t *File) {
+	const uint8_t *Data = File->Data;
+	size_t Size = File->Size, Position = 0;
+	if (Size >= 8 && !memcmp(Data, ARROW_MAGIC, 6)) Position = 8;
+	while (Position + 4 <= Size) {
+		// Streams written before the continuation marker start with the length.
+		uint32_t Length = fb_u32(Data + Position);
+		Position += 4;
+		if (Length == ARROW_CONTINUATION) {
+			if (Position + 4 > Size) return arrow_fail(File, "truncated message");
+			Length = fb_u32(Data + Position);
+			Position += 4;
+		}
+		if (!Length) break;
+		if (Length > Size - Position) return arrow_fail(File, "truncated message");
+		const uint8_t *Metadata = Data + Position;
+		fb_table_t Message[1], Header[1];
+		if (Length < 4 || !fb_table_at(Message, Metadata, Length, fb_u32(Metadata))) return arrow_fail(File, "invalid message");
+		Position += Length;
+		int64_t BodyLength = fb_int(Message, 3, 8, 0);
+		if (BodyLength < 0 || BodyLength > Size - Position) return arrow_fail(File, "truncated message");
+		const uint8_t *Body = Data + Position;
+		Position += BodyLength;
+		if (fb_int(Message, 0, 2, 0) < ARROW_METADATA_V4) return arrow_fail(File, "unsupported metadata version");
+		if (!fb_child(Message, 2, Header)) return arrow_fail(File, "invalid message");
+		switch (fb_int(Message, 1, 1, 0) & 0xFF) {
+		case ARROW_HEADER_SCHEMA:
+			if (!arrow_read_schema(File, Header)) return 0;
+			break;
+		case ARROW_HEADER_DICTIONARY:
+			if (!File->Fields) return arrow_fail(File, "missing schema");
+			if (!arrow_read_dictionary(File, Header, Body, BodyLength)) return 0;
+			break;
+		case ARROW_HEADER_RECORD_BATCH: {
+			if (!File->Fields) return arrow_fail(File, "missing schema");
+			int64_t NumRows;
+			if (!arrow_read_batch(File, Header, Body, BodyLength, File->Fields, File->NumFields, &NumRows)) return 0;
+			if (NumRows > INT32_MAX - File->NumRows) return arrow_fail(File, "too many rows");
+			File->NumRows += NumRows;
+			for (int I = 0; I < File->NumDictionaries; ++I) File->Dictionaries[I].Used = 1;
+			break;
+		}
+		}
+	}
+	if (!File->Fields) return arrow_fail(File, "missing schema");
+	return 1;
+}
+
+// Uses the values of a column straight from the mapping when they are in a
+// single aligned buffer, otherwise joins the parts into a new buffer.
+static const void *arrow_join_values(arrow_file_t *File, arrow_field_t *Field, int *Mapped) {
+	int Width = Field->Width;
+	if (Field->NumParts == 1 && !((uintptr_t)Field->Parts->Data % Width)) {
+		*Mapped = 1;
+		return Field->Parts->Data;
+	}
+	uint8_t *Values = arrow_file_alloc(File, File->NumRows * Width), *Next = Values;
+	for (int I = 0; I < Field->NumParts; ++I) {
+		memcpy(Next, Field->Parts[I].Data, Field->Parts[I].Length * Width);
+		Next += Field->Parts[I].Length * Width;
+	}
+	*Mapped = 0;
+	return Values;
+}
+
+static int arrow_finish_values(arrow_file_t *File, arrow_field_t *Field, int HasNulls) {
+	arrow_column_t *Column = Field->Column;
+	if (!HasNulls) {
+		int Native = 1;
+		if (Field->Kind == ARROW_KIND_FLOAT) {
+			Column->Type = Field->Width == 8 ? ARROW_FLOAT64 : ARROW_FLOAT32;
+		} else if (Field->Kind == ARROW_KIND_INT && Field->Signed) {
+			Column->Type = ARROW_INT32;
+			Native = Field->Width == 4;
+		} else if (Field->Kind == ARROW_KIND_INT) {
+			Column->Type = Field->Width == 1 ? ARROW_UINT8 : Field->Width == 2 ? ARROW_UINT16 : ARROW_UINT32;
+			Native = Field->Width != 8;
+		} else {
+			Native = 0;
+		}
+		if (Native) {
+			Column->Values = arrow_join_values(File, Field, &Column->Mapped);
+			return 1;
+		}
+	}
+	double *Values = arrow_file_alloc(File, File->NumRows * sizeof(double)), *Next = Values;
+	for (int I = 0; I < Field->NumParts; ++I) {
+		arrow_part_t *Part = Field->Parts + I;
+		for (int64_t J = 0; J < Part->Length; ++J) *Next++ = arrow_part_null(Part, J) ? NAN : arrow_part_value(Field, Part, J);
+	}
+	Column->Type = ARROW_FLOAT64;
+	Column->Values = Values;
+	return 1;
+}
+
+// Dictionaries that do not start with "" get one prepended, which nulls are
+// also mapped to, and their indices are shifted to match.
+static int arrow_finish_dictionary(arrow_file_t *File, arrow_field_t *Field, int HasNulls) {
+	arrow_column_t *Column = Field->Column;
+	arrow_dictionary_t *Dictionary = File->Dictionaries + Field->Dictionary;
+	int Size = Dictionary->Size, Shift = !Size || Dictionary->Entries[0].Length;
+	int64_t NamesSize = 0;
+	for (int I = 0; I < Size; ++I) NamesSize += Dictionary->Entries[I].Length + 1;
+	char *Chars = arrow_file_alloc(File, NamesSize);
+	const char **Names = arrow_file_alloc(File, (Size + Shift) * sizeof(const char *));
+	if (Shift) Names[0] = "";
+	for (int I = 0; I < Size; ++I) {
+		arrow_entry_t *Entry = Dictionary->Entries + I;
+		memcpy(Chars, Entry->Text, Entry->Length);
+		Chars[Entry->Length] = 0;
+		Names[I + Shift] = Chars;
+		Chars += Entry->Length + 1;
+	}
+	Column->EnumNames = Names;
+	Column->EnumSize = Size + Shift;
+	for (int I = 0; I < Field->NumParts; ++I) {
+		arrow_part_t *Part = Field->Parts + I;
+		for (int64_t J = 0; J < Part->Length; ++J) {
+			if (arrow_part_null(Part, J)) continue;
+			int64_t Index = arrow_part_integer(Field, Part, J);
+			if (Index < 0 || Index >= Size) return arrow_fail(File, "dictionary index out of range");
+		}
+	}
+	// Checked indices are never negative, so signed ones can be read as unsigned
+	if (!Shift && !HasNulls && Field->Width != 8) {
+		Column->Type = Field->Width == 1 ? ARROW_UINT8 : Field->Width == 2 ? ARROW_UINT16 : ARROW_UINT32;
+		Column->Values = arrow_join_values(File, Field, &Column->Mapped);
+		return 1;
+	}
+	uint32_t *Values = arrow_file_alloc(File, File->NumRows * sizeof(uint32_t)), *Next = Values;
+	for (int I = 0; I < Field->NumParts; ++I) {
+		arrow_part_t *Part = Field->Parts + I;
+		for (int64_t J = 0; J < Part->Length; ++J) *Next++ = arrow_part_null(Part, J) ? 0 : arrow_part_integer(Field, Part, J) + Shift;
+	}
+	Column->Type = ARROW_UINT32;
+	Column->Values = Values;
+	return 1;
+}
+
+static int arrow_finish_text(arrow_file_t *File, arrow_field_t *Field) {
+	arrow_column_t *Column = Field->Column;
+	Column->Type = ARROW_UTF8;
+	if (Field->NumParts == 1 && Field->Parts->Length && !((uintptr_t)Field->Parts->Data % (Field->Large ? 8 : 4))) {
+		Column->Values = Field->Parts->Data;
+		Column->Chars = Field->Parts->Chars;
+		Column->LargeOffsets = Field->Large;
+		Column->Mapped = 1;
+		return 1;
+	}
+	int64_t CharsSize = 0;
+	for (int I = 0; I < Field->NumParts; ++I) {
+		arrow_part_t *Part = Field->Parts + I;
+		if (Part->Length) CharsSize += arrow_part_offset(Part, Field->Large, Part->Length) - arrow_part_offset(Part, Field->Large, 0);
+	}
+	int64_t *Offsets = arrow_file_alloc(File, (File->NumRows + 1) * sizeof(int64_t)), *Next = Offsets;
+	char *Chars = arrow_file_alloc(File, CharsSize);
+	int64_t Position = 0;
+	*Next++ = 0;
+	for (int I = 0; I < Field->NumParts; ++I) {
+		arrow_part_t *Part = Field->Parts + I;
+		if (!Part->Length) continue;
+		int64_t First = arrow_part_offset(Part, Field->Large, 0);
+		int64_t Last = arrow_part_offset(Part, Field->Large, Part->Length);
+		memcpy(Chars + Position, Part->Chars + First, Last - First);
+		for (int64_t J = 1; J <= Part->Length; ++J) *Next++ = Position + arrow_part_offset(Part, Field->Large, J) - First;
+		Position += Last - First;
+	}
+	Column->Values = Offsets;
+	Column->Chars = Chars;
+	Column->LargeOffsets = 1;
+	return 1;
+}
+
+static int arrow_finish_field(arrow_file_t *File, arrow_field_t *Field) {
+	int HasNulls = 0;
+	for (int I = 0; I < Field->NumParts; ++I) if (Field->Parts[I].NullCount) HasNulls = 1;
+	switch (Field->Kind) {
+	case ARROW_KIND_TEXT: return arrow_finish_text(File, Field);
+	case ARROW_KIND_DICTIONARY: return arrow_finish_dictionary(File, Field, HasNulls);
+	default: return arrow_finish_values(File, Field, HasNulls);
+	}
+}
+
+static int arrow_file_map(arrow_file_t *File, const char *FileName) {
+#ifdef MINGW
+	FILE *Input = fopen(FileName, "rb");
+	if (!Input) return arrow_fail(File, "cannot open file");
+	fseek(Input, 0, SEEK_END);
+	long Size = ftell(Input);
+	rewind(Input);
+	uint8_t *Data = Size > 0 ? malloc(Size) : 0;
+	if (!Data || fread(Data, 1, Size, Input) != Size) {
+		free(Data);
+		fclose(Input);
+		return arrow_fail(File, "cannot read file");
+	}
+	fclose(Input);
+	File->Data = Data;
+	File->Size = Size;
+	return 1;
+#else
+	int Fd = open(FileName, O_RDONLY);
+	if (Fd < 0) return arrow_fail(File, "cannot open file");
+	struct stat Stat[1];
+	if (fstat(Fd, Stat) || !Stat->st_size) {
+		close(Fd);
+		return arrow_fail(File, "empty file");
+	}
+	// Private writable pages let fields be edited in place without changing
+	// the file.
+	void *Data = mmap(0, Stat->st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, Fd, 0);
+	close(Fd);
+	if (Data == MAP_FAILED) return arrow_fail(File, "cannot map file");
+	File->Data = Data;
+	File->Size = Stat->st_size;
+	return 1;
+#endif
+}
+
+// Returns 1 if the file starts like an Arrow file or stream, which text never
+// does.
+int arrow_file_check(const char *FileName) {
+	FILE *File = fopen(FileName, "rb");
+	if (!File) return 0;
+	uint8_t Header[8];
+	size_t Size = fread(Header, 1, 8, File);
+	fclose(File);
+	if (Size >= 6 && !memcmp(Header, ARROW_MAGIC, 6)) return 1;
+	return Size == 8 && fb_u32(Header) == ARROW_CONTINUATION;
+}
+
+// Columns of unsupported types are left out, Error is set if the file can
+// not be read at all.
+arrow_file_t *arrow_file_open(const char *FileName, const char **Error) {
+	arrow_file_t *File = calloc(1, sizeof(arrow_file_t));
+	if (arrow_file_map(File, FileName) && arrow_read_messages(File)) {
+		File->Columns = calloc(File->NumFields + 1, sizeof(arrow_column_t *));
+		for (int I = 0; I < File->NumFields; ++I) {
+			arrow_field_t *Field = File->Fields + I;
+			if (Field->Kind == ARROW_KIND_SKIP) continue;
+			if (!arrow_finish_field(File, Field)) break;
+			File->Columns[File->NumColumns++] = Field->Column;
+		}
+	}
+	for (int I = 0; I < File->NumFields; ++I) {
+		free(File->Fields[I].Parts);
+		File->Fields[I].Parts = 0;
+	}
+	if (File->Error) {
+		*Error = File->Error;
+		arrow_file_close(File);
+		return 0;
+	}
+	return File;
+}
+
+int arrow_file_num_rows(arrow_file_t *File) {
+	return File->NumRows;
+}
+
+int arrow_file_num_columns(arrow_file_t *File) {
+	return File->NumColumns;
+}
+
+arrow_column_t *arrow_file_column(arrow_file_t *File, int Index) {
+	return File->Columns[Index];
+}
+
+const char *arrow_column_text(const arrow_column_t *Column, int Row, size_t *Length) {
+	int64_t Start, End;
+	if (Column->LargeOffsets) {
+		const int64_t *Offsets = Column->Values;
+		Start = Offsets[Row];
+		End = Offsets[Row + 1];
+	} else {
+		const int32_t *Offsets = Column->Values;
+		Start = Offsets[Row];
+		End = Offsets[Row + 1];
+	}
+	*Length = End - Start;
+	return Column->Chars + Start;
+}
+
+void arrow_file_close(arrow_file_t *File) {
+	for (int I = 0; I < File->NumBuffers; ++I) free(File->Buffers[I]);
+	for (int I = 0; I < File->NumDictionaries; ++I) free(File->Dictionaries[I].Entries);
+	free(File->Buffers);
+	free(File->Fields);
+	free(File->Dictionaries);
+	free(File->Columns);
+	if (File->Data) {
+#ifdef MINGW
+		free((void *)File->Data);
+#else
+		munmap((void *)File->Data, File->Size);
+#endif
+	}
+	free(File);
+}
@@ -0,0 +1,49 @@
+#ifndef ARROW_IPC_H
+#define ARROW_IPC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct arrow_file_t arrow_file_t;
+typedef struct arrow_writer_t arrow_writer_t;
+
+// Value types, in the same order as field_storage_t up to ARROW_UINT32.
+typedef enum {
+	ARROW_FLOAT64,
+	ARROW_FLOAT32,
+	ARROW_INT32,
+	ARROW_UINT8,
+	ARROW_UINT16,
+	ARROW_UINT32,
+	ARROW_UTF8
+} arrow_type_t;
+
+// Values holds one value per row, or the string offsets of ARROW_UTF8 columns
+// (64-bit if LargeOffsets is set). Dictionary encoded columns have EnumNames,
+// with EnumNames[0] always "", and Values holds their indices. Mapped is set
+// when Values points into the file mapping rather than converted buffers.
+typedef struct {
+	const char *Name;
+	const void *Values;
+	const char *Chars;
+	const char **EnumNames;
+	int EnumSize, LargeOffsets, Mapped;
+	arrow_type_t Type;
+} arrow_column_t;
+
+typedef const char *(*arrow_text_fn)(int Row, void *Data);
+
+int arrow_file_check(const char *FileName);
+arrow_file_t *arrow_file_open(const char *FileName, const char **Error);
+int arrow_file_num_rows(arrow_file_t *File);
+int arrow_file_num_columns(arrow_file_t *File);
+arrow_column_t *arrow_file_column(arrow_file_t *File, int Index);
+const char *arrow_column_text(const arrow_column_t *Column, int Row, size_t *Length);
+void arrow_file_close(arrow_file_t *File);
+
+arrow_writer_t *arrow_writer_open(const char *FileName, int NumRows, int NumColumns, int Stream);
+void arrow_writer_column(arrow_writer_t *Writer, const char *Name, arrow_type_t Type, const void *Values, const char **EnumNames, int EnumSize);
+void arrow_writer_text(arrow_writer_t *Writer, const char *Name, arrow_text_fn TextFn, void *Data);
+int arrow_writer_close(arrow_writer_t *Writer);
+
+#endif
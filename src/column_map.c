@@ -0,0 +1,70 @@
+#include "column_map.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifndef MINGW
+#include <sys/mman.h>
+#endif
+
+// Out of core column storage.
+// Once a scratch directory is set, large columns are kept in shared mappings
+// of unlinked files in it instead of on the heap, so the kernel writes cold
+// pages back to the file and evicts them rather than needing RAM or swap for
+// every column. The files are removed from the directory as soon as they are
+// created and disappear with their mappings, even if the viewer crashes.
+// Columns smaller than COLUMN_MAP_MIN_SIZE are left to the caller.
+
+#define COLUMN_MAP_MIN_SIZE (1 << 20)
+
+static char *ScratchTemplate = 0;
+
+// Returns 0 if the directory can not hold scratch files.
+int column_map_init(const char *Directory) {
+#ifdef MINGW
+	fprintf(stderr, "Out of core columns are not supported on this platform\n");
+	return 0;
+#else
+	struct stat Stat[1];
+	if (stat(Directory, Stat) || !S_ISDIR(Stat->st_mode) || access(Directory, W_OK)) {
+		fprintf(stderr, "Scratch directory %s is not writable\n", Directory);
+		return 0;
+	}
+	free(ScratchTemplate);
+	ScratchTemplate = malloc(strlen(Directory) + strlen("/data-viewer-XXXXXX") + 1);
+	sprintf(ScratchTemplate, "%s/data-viewer-XXXXXX", Directory);
+	return 1;
+#endif
+}
+
+int column_map_enabled(void) {
+	return ScratchTemplate != 0;
+}
+
+// Returns zero filled storage, or 0 if the column should be allocated on the
+// heap instead.
+void *column_map_alloc(size_t Size) {
+#ifdef MINGW
+	return 0;
+#else
+	if (!ScratchTemplate || Size < COLUMN_MAP_MIN_SIZE) return 0;
+	char FileName[strlen(ScratchTemplate) + 1];
+	strcpy(FileName, ScratchTemplate);
+	int Fd = mkstemp(FileName);
+	if (Fd < 0) return 0;
+	unlink(FileName);
+	// Reserving the blocks up front avoids SIGBUS on a full disk later
+	void *Values = MAP_FAILED;
+	if (!posix_fallocate(Fd, 0, Size)) Values = mmap(0, Size, PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+	close(Fd);
+	return Values == MAP_FAILED ? 0 : Values;
+#endif
+}
+
+void column_map_free(void *Values, size_t Size) {
+#ifndef MINGW
+	munmap(Values, Size);
+#endif
+}
@@ -0,0 +1,11 @@
+#ifndef COLUMN_MAP_H
+#define COLUMN_MAP_H
+
+#include <stddef.h>
+
+int column_map_init(const char *Directory);
+int column_map_enabled(void);
+void *column_map_alloc(size_t Size);
+void column_map_free(void *Values, size_t Size);
+
+#endif
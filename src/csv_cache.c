@@ -0,0 +1,364 @@
+#include "csv_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifndef MINGW
+#include <sys/mman.h>
+#endif
+
+// Binary sidecar cache for CSV files.
+// After a large CSV file is parsed, its columns, enum names, statistics, file
+// names and the sorted orders for the current axes are written
+// to <file>.dvcache. The cache is keyed by the size and modification time of
+// the CSV file and a hash of sampled blocks of its contents, and is memory
+// mapped instead of parsing the CSV file when the key matches.
+// Sections must be written in order: columns, file names and then the orders.
+
+#define CSV_CACHE_MAGIC "DVCACHE"
+#define CSV_CACHE_VERSION 2
+#define CSV_CACHE_BYTE_ORDER 0x01020304
+#define CSV_CACHE_MIN_SIZE (16 << 20)
+#define CSV_CACHE_HASH_BLOCK (1 << 20)
+#define CSV_CACHE_HASH_SAMPLES 16
+#define CSV_CACHE_SAMPLE_SIZE 4096
+
+typedef struct {
+	char Magic[8];
+	uint32_t Version, ByteOrder;
+	csv_cache_key_t Key;
+	uint64_t NumRows, NumColumns;
+	uint64_t ColumnsOffset, NamesOffset, NamesSize, NameOffsetsOffset, OrdersOffset;
+	int32_t OrdersXIndex, OrdersYIndex;
+} csv_cache_header_t;
+
+typedef struct {
+	uint64_t NameOffset, EnumOffset, EnumSize, ValuesOffset;
+	double Min, Max, Sum, Sum2;
+} csv_cache_entry_t;
+
+struct csv_cache_t {
+	const char *Data;
+	const csv_cache_header_t *Header;
+	const uint64_t *NameOffsets;
+	csv_loader_column_t *Columns;
+	const double **Values;
+	csv_cache_orders_t Orders[1];
+	size_t Size;
+	int NumRows, NumColumns;
+};
+
+struct csv_cache_writer_t {
+	FILE *File;
+	char *FileName, *TempName;
+	csv_cache_header_t Header[1];
+	csv_cache_entry_t *Entries;
+	uint64_t *NameOffsets;
+	uint64_t Position;
+	int NumColumns, NumNames;
+};
+
+static uint64_t csv_cache_hash_block(uint64_t Hash, const unsigned char *Block, size_t Length) {
+	for (size_t I = 0; I < Length; ++I) Hash = (Hash ^ Block[I]) * 1099511628211ull;
+	return Hash;
+}
+
+int csv_cache_key(const char *CsvFileName, csv_cache_key_t *Key) {
+#ifdef MINGW
+	return 0;
+#else
+	int Fd = open(CsvFileName, O_RDONLY);
+	if (Fd < 0) return 0;
+	struct stat Stat[1];
+	if (fstat(Fd, Stat)) {
+		close(Fd);
+		return 0;
+	}
+	memset(Key, 0, sizeof(csv_cache_key_t));
+	Key->Size = Stat->st_size;
+	Key->Time = Stat->st_mtim.tv_sec;
+	Key->TimeNsec = Stat->st_mtim.tv_nsec;
+	// Hashing the whole file would cost as much as parsing it, so only the
+	// first and last blocks and a few samples in between are hashed.
+	unsigned char *Buffer = malloc(CSV_CACHE_HASH_BLOCK);
+	uint64_t Hash = 14695981039346656037ull;
+	ssize_t Length = pread(Fd, Buffer, CSV_CACHE_HASH_BLOCK, 0);
+	if (Length > 0) Hash = csv_cache_hash_block(Hash, Buffer, Length);
+	for (int I = 1; I <= CSV_CACHE_HASH_SAMPLES; ++I) {
+		off_t Offset = (Key->Size / (CSV_CACHE_HASH_SAMPLES + 1)) * I;
+		Length = pread(Fd, Buffer, CSV_CACHE_SAMPLE_SIZE, Offset);
+		if (Length > 0) Hash = csv_cache_hash_block(Hash, Buffer, Length);
+	}
+	if (Key->Size > CSV_CACHE_HASH_BLOCK) {
+		Length = pread(Fd, Buffer, CSV_CACHE_HASH_BLOCK, Key->Size - CSV_CACHE_HASH_BLOCK);
+		if (Length > 0) Hash = csv_cache_hash_block(Hash, Buffer, Length);
+	}
+	free(Buffer);
+	close(Fd);
+	Key->Hash = Hash;
+	return 1;
+#endif
+}
+
+static char *csv_cache_file_name_for(const char *CsvFileName, const char *Suffix) {
+	char *FileName = malloc(strlen(CsvFileName) + strlen(Suffix) + 1);
+	strcpy(stpcpy(FileName, CsvFileName), Suffix);
+	return FileName;
+}
+
+static int csv_cache_string_valid(csv_cache_t *Cache, uint64_t Offset) {
+	return Offset < Cache->Size && memchr(Cache->Data + Offset, 0, Cache->Size - Offset);
+}
+
+static int csv_cache_array_valid(csv_cache_t *Cache, uint64_t Offset, uint64_t Count, size_t Size) {
+	return !(Offset % 8) && Offset <= Cache->Size && Count <= (Cache->Size - Offset) / Size;
+}
+
+static int csv_cache_validate(csv_cache_t *Cache, csv_cache_key_t *Key) {
+	const csv_cache_header_t *Header = Cache->Header;
+	if (memcmp(Header->Magic, CSV_CACHE_MAGIC, 8)) return 0;
+	if (Header->Version != CSV_CACHE_VERSION || Header->ByteOrder != CSV_CACHE_BYTE_ORDER) return 0;
+	if (memcmp(&Header->Key, Key, sizeof(csv_cache_key_t))) return 0;
+	if (Header->NumRows > INT32_MAX || Header->NumColumns > INT32_MAX) return 0;
+	uint64_t NumRows = Header->NumRows;
+	if (!csv_cache_array_valid(Cache, Header->ColumnsOffset, Header->NumColumns, sizeof(csv_cache_entry_t))) return 0;
+	if (!csv_cache_array_valid(Cache, Header->NameOffsetsOffset, NumRows, sizeof(uint64_t))) return 0;
+	if (Header->NamesOffset > Cache->Size || Header->NamesSize > Cache->Size - Header->NamesOffset) return 0;
+	if (NumRows && (!Header->NamesSize || Cache->Data[Header->NamesOffset + Header->NamesSize - 1])) return 0;
+	const uint64_t *NameOffsets = (const uint64_t *)(Cache->Data + Header->NameOffsetsOffset);
+	for (uint64_t I = 0; I < NumRows; ++I) if (NameOffsets[I] >= Header->NamesSize) return 0;
+	const csv_cache_entry_t *Entries = (const csv_cache_entry_t *)(Cache->Data + Header->ColumnsOffset);
+	for (uint64_t I = 0; I < Header->NumColumns; ++I) {
+		const csv_cache_entry_t *Entry = Entries + I;
+		if (!csv_cache_string_valid(Cache, Entry->NameOffset)) return 0;
+		if (!csv_cache_array_valid(Cache, Entry->ValuesOffset, NumRows, sizeof(double))) return 0;
+		if (Entry->EnumOffset) {
+			if (!Entry->EnumSize || Entry->EnumSize > INT32_MAX) return 0;
+			if (!csv_cache_array_valid(Cache, Entry->EnumOffset, Entry->EnumSize, sizeof(uint64_t))) return 0;
+			const uint64_t *EnumOffsets = (const uint64_t *)(Cache->Data + Entry->EnumOffset);
+			for (uint64_t J = 0; J < Entry->EnumSize; ++J) {
+				if (!csv_cache_string_valid(Cache, EnumOffsets[J])) return 0;
+			}
+		}
+	}
+	if (Header->OrdersOffset) {
+		if (!csv_cache_array_valid(Cache, Header->OrdersOffset, 2 * NumRows, sizeof(int32_t))) return 0;
+		const int32_t *Orders = (const int32_t *)(Cache->Data + Header->OrdersOffset);
+		for (uint64_t I = 0; I < 2 * NumRows; ++I) if (Orders[I] < 0 || Orders[I] >= (int64_t)NumRows) return 0;
+	}
+	return 1;
+}
+
+csv_cache_t *csv_cache_open(const char *CsvFileName, csv_cache_key_t *Key) {
+#ifdef MINGW
+	return 0;
+#else
+	char *FileName = csv_cache_file_name_for(CsvFileName, ".dvcache");
+	int Fd = open(FileName, O_RDONLY);
+	free(FileName);
+	if (Fd < 0) return 0;
+	struct stat Stat[1];
+	if (fstat(Fd, Stat) || Stat->st_size < sizeof(csv_cache_header_t)) {
+		close(Fd);
+		return 0;
+	}
+	// Writable so that values used in place can be edited, privately
+	const char *Data = mmap(0, Stat->st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, Fd, 0);
+	close(Fd);
+	if (Data == MAP_FAILED) return 0;
+	csv_cache_t *Cache = calloc(1, sizeof(csv_cache_t));
+	Cache->Data = Data;
+	Cache->Size = Stat->st_size;
+	const csv_cache_header_t *Header = Cache->Header = (const csv_cache_header_t *)Data;
+	if (!csv_cache_validate(Cache, Key)) {
+		munmap((void *)Data, Cache->Size);
+		free(Cache);
+		return 0;
+	}
+	int NumRows = Cache->NumRows = Header->NumRows;
+	int NumColumns = Cache->NumColumns = Header->NumColumns;
+	Cache->NameOffsets = (const uint64_t *)(Data + Header->NameOffsetsOffset);
+	Cache->Columns = calloc(NumColumns, sizeof(csv_loader_column_t));
+	Cache->Values = calloc(NumColumns, sizeof(const double *));
+	const csv_cache_entry_t *Entries = (const csv_cache_entry_t *)(Data + Header->ColumnsOffset);
+	for (int I = 0; I < NumColumns; ++I) {
+		const csv_cache_entry_t *Entry = Entries + I;
+		csv_loader_column_t *Column = Cache->Columns + I;
+		Column->Name = Data + Entry->NameOffset;
+		Column->Min = Entry->Min;
+		Column->Max = Entry->Max;
+		Column->Sum = Entry->Sum;
+		Column->Sum2 = Entry->Sum2;
+		if (Entry->EnumOffset) {
+			const uint64_t *EnumOffsets = (const uint64_t *)(Data + Entry->EnumOffset);
+			Column->EnumSize = Entry->EnumSize;
+			Column->EnumNames = malloc(Column->EnumSize * sizeof(const char *));
+			for (int J = 0; J < Column->EnumSize; ++J) Column->EnumNames[J] = Data + EnumOffsets[J];
+		}
+		Cache->Values[I] = (const double *)(Data + Entry->ValuesOffset);
+	}
+	if (Header->OrdersOffset) {
+		const int32_t *Orders = (const int32_t *)(Data + Header->OrdersOffset);
+		Cache->Orders->SortedX = Orders;
+		Cache->Orders->SortedY = Orders + NumRows;
+	}
+	madvise((void *)Data, Cache->Size, MADV_SEQUENTIAL);
+	return Cache;
+#endif
+}
+
+int csv_cache_num_rows(csv_cache_t *Cache) {
+	return Cache->NumRows;
+}
+
+int csv_cache_num_columns(csv_cache_t *Cache) {
+	return Cache->NumColumns;
+}
+
+csv_loader_column_t *csv_cache_column(csv_cache_t *Cache, int Index) {
+	return Cache->Columns + Index;
+}
+
+const double *csv_cache_values(csv_cache_t *Cache, int Index) {
+	return Cache->Values[Index];
+}
+
+const char *csv_cache_file_names(csv_cache_t *Cache, size_t *Size) {
+	*Size = Cache->Header->NamesSize;
+	return Cache->Data + Cache->Header->NamesOffset;
+}
+
+const char *csv_cache_file_name(csv_cache_t *Cache, int Row) {
+	return Cache->Data + Cache->Header->NamesOffset + Cache->NameOffsets[Row];
+}
+
+const csv_cache_orders_t *csv_cache_orders(csv_cache_t *Cache, int XIndex, int YIndex) {
+	if (!Cache->Orders->SortedX) return 0;
+	if (Cache->Header->OrdersXIndex != XIndex || Cache->Header->OrdersYIndex != YIndex) return 0;
+	return Cache->Orders;
+}
+
+void csv_cache_close(csv_cache_t *Cache) {
+	for (int I = 0; I < Cache->NumColumns; ++I) free(Cache->Columns[I].EnumNames);
+	free(Cache->Columns);
+	free(Cache->Values);
+#ifndef MINGW
+	munmap((void *)Cache->Data, Cache->Size);
+#endif
+	free(Cache);
+}
+
+static void csv_cache_put(csv_cache_writer_t *Writer, const void *Data, size_t Size) {
+	fwrite(Data, 1, Size, Writer->File);
+	Writer->Position += Size;
+}
+
+static void csv_cache_align(csv_cache_writer_t *Writer) {
+	static const char Padding[8] = {0,};
+	if (Writer->Position % 8) csv_cache_put(Writer, Padding, 8 - Writer->Position % 8);
+}
+
+csv_cache_writer_t *csv_cache_create(const char *CsvFileName, csv_cache_key_t *Key, int NumRows, int NumColumns) {
+#ifdef MINGW
+	return 0;
+#else
+	if (Key->Size < CSV_CACHE_MIN_SIZE) return 0;
+	char *TempName = csv_cache_file_name_for(CsvFileName, ".dvcache.tmp");
+	FILE *File = fopen(TempName, "wb");
+	if (!File) {
+		free(TempName);
+		return 0;
+	}
+	csv_cache_writer_t *Writer = calloc(1, sizeof(csv_cache_writer_t));
+	Writer->File = File;
+	Writer->TempName = TempName;
+	Writer->FileName = csv_cache_file_name_for(CsvFileName, ".dvcache");
+	csv_cache_header_t *Header = Writer->Header;
+	memcpy(Header->Magic, CSV_CACHE_MAGIC, 8);
+	Header->Version = CSV_CACHE_VERSION;
+	Header->ByteOrder = CSV_CACHE_BYTE_ORDER;
+	Header->Key = *Key;
+	Header->NumRows = NumRows;
+	Header->NumColumns = NumColumns;
+	Header->OrdersXIndex = Header->OrdersYIndex = -1;
+	Writer->Entries = calloc(NumColumns, sizeof(csv_cache_entry_t));
+	Writer->NameOffsets = malloc(NumRows * sizeof(uint64_t) + 1);
+	csv_cache_put(Writer, Header, sizeof(csv_cache_header_t));
+	return Writer;
+#endif
+}
+
+void csv_cache_write_column(csv_cache_writer_t *Writer, csv_loader_column_t *Column, const double *Values) {
+	if (Writer->NumColumns == Writer->Header->NumColumns) return;
+	csv_cache_entry_t *Entry = Writer->Entries + Writer->NumColumns++;
+	Entry->NameOffset = Writer->Position;
+	csv_cache_put(Writer, Column->Name, strlen(Column->Name) + 1);
+	if (Column->EnumNames) {
+		uint64_t *EnumOffsets = malloc(Column->EnumSize * sizeof(uint64_t));
+		for (int I = 0; I < Column->EnumSize; ++I) {
+			EnumOffsets[I] = Writer->Position;
+			csv_cache_put(Writer, Column->EnumNames[I], strlen(Column->EnumNames[I]) + 1);
+		}
+		csv_cache_align(Writer);
+		Entry->EnumOffset = Writer->Position;
+		Entry->EnumSize = Column->EnumSize;
+		csv_cache_put(Writer, EnumOffsets, Column->EnumSize * sizeof(uint64_t));
+		free(EnumOffsets);
+	}
+	csv_cache_align(Writer);
+	Entry->ValuesOffset = Writer->Position;
+	csv_cache_put(Writer, Values, Writer->Header->NumRows * sizeof(double));
+	Entry->Min = Column->Min;
+	Entry->Max = Column->Max;
+	Entry->Sum = Column->Sum;
+	Entry->Sum2 = Column->Sum2;
+}
+
+void csv_cache_write_file_name(csv_cache_writer_t *Writer, const char *FileName) {
+	csv_cache_header_t *Header = Writer->Header;
+	if (Writer->NumNames == Header->NumRows) return;
+	if (!Writer->NumNames) Header->NamesOffset = Writer->Position;
+	size_t Length = strlen(FileName) + 1;
+	Writer->NameOffsets[Writer->NumNames++] = Header->NamesSize;
+	Header->NamesSize += Length;
+	csv_cache_put(Writer, FileName, Length);
+}
+
+void csv_cache_write_orders(csv_cache_writer_t *Writer, int XIndex, int YIndex, csv_cache_orders_t *Orders) {
+	csv_cache_header_t *Header = Writer->Header;
+	csv_cache_align(Writer);
+	Header->OrdersOffset = Writer->Position;
+	Header->OrdersXIndex = XIndex;
+	Header->OrdersYIndex = YIndex;
+	csv_cache_put(Writer, Orders->SortedX, Header->NumRows * sizeof(int32_t));
+	csv_cache_put(Writer, Orders->SortedY, Header->NumRows * sizeof(int32_t));
+}
+
+int csv_cache_finish(csv_cache_writer_t *Writer) {
+	csv_cache_header_t *Header = Writer->Header;
+	int Success = Writer->NumColumns == Header->NumColumns && Writer->NumNames == Header->NumRows;
+	if (Success) {
+		if (!Header->NumRows) Header->NamesOffset = Writer->Position;
+		csv_cache_align(Writer);
+		Header->NameOffsetsOffset = Writer->Position;
+		csv_cache_put(Writer, Writer->NameOffsets, Header->NumRows * sizeof(uint64_t));
+		Header->ColumnsOffset = Writer->Position;
+		csv_cache_put(Writer, Writer->Entries, Header->NumColumns * sizeof(csv_cache_entry_t));
+		fseek(Writer->File, 0, SEEK_SET);
+		fwrite(Header, 1, sizeof(csv_cache_header_t), Writer->File);
+		Success = !ferror(Writer->File);
+	}
+	if (fclose(Writer->File)) Success = 0;
+	if (!Success || rename(Writer->TempName, Writer->FileName)) {
+		unlink(Writer->TempName);
+		Success = 0;
+	}
+	free(Writer->Entries);
+	free(Writer->NameOffsets);
+	free(Writer->FileName);
+	free(Writer->TempName);
+	free(Writer);
+	return Success;
+}
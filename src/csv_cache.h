@@ -0,0 +1,37 @@
+#ifndef CSV_CACHE_H
+#define CSV_CACHE_H
+
+#include <stdint.h>
+#include "csv_loader.h"
+
+typedef struct csv_cache_t csv_cache_t;
+typedef struct csv_cache_writer_t csv_cache_writer_t;
+
+typedef struct {
+	uint64_t Size, Hash;
+	int64_t Time, TimeNsec;
+} csv_cache_key_t;
+
+typedef struct {
+	const int32_t *SortedX, *SortedY;
+} csv_cache_orders_t;
+
+int csv_cache_key(const char *CsvFileName, csv_cache_key_t *Key);
+
+csv_cache_t *csv_cache_open(const char *CsvFileName, csv_cache_key_t *Key);
+int csv_cache_num_rows(csv_cache_t *Cache);
+int csv_cache_num_columns(csv_cache_t *Cache);
+csv_loader_column_t *csv_cache_column(csv_cache_t *Cache, int Index);
+const double *csv_cache_values(csv_cache_t *Cache, int Index);
+const char *csv_cache_file_names(csv_cache_t *Cache, size_t *Size);
+const char *csv_cache_file_name(csv_cache_t *Cache, int Row);
+const csv_cache_orders_t *csv_cache_orders(csv_cache_t *Cache, int XIndex, int YIndex);
+void csv_cache_close(csv_cache_t *Cache);
+
+csv_cache_writer_t *csv_cache_create(const char *CsvFileName, csv_cache_key_t *Key, int NumRows, int NumColumns);
+void csv_cache_write_column(csv_cache_writer_t *Writer, csv_loader_column_t *Column, const double *Values);
+void csv_cache_write_file_name(csv_cache_writer_t *Writer, const char *FileName);
+void csv_cache_write_orders(csv_cache_writer_t *Writer, int XIndex, int YIndex, csv_cache_orders_t *Orders);
+int csv_cache_finish(csv_cache_writer_t *Writer);
+
+#endif
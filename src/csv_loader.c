@@ -0,0 +1,1035 @@
+#include "csv_loader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifndef MINGW
+#include <sys/mman.h>
+#endif
+
+#include "libcsv/csv.h"
+#include "csv_scan.h"
+#include "csv_stream.h"
+#include "fast_strtod.h"
+#include "enum_dict.h"
+
+// Parallel CSV loader.
+// The file is memory mapped and split into one chunk per thread. Chunk
+// boundaries are moved forward to the next newline that is not inside a
+// quoted field. Since a chunk cannot know whether it starts inside quotes,
+// the boundary pass records the first newline for both possibilities and the
+// right one is chosen once the quote parity of every preceding chunk is known.
+// All of this runs on a background thread. Each chunk is parsed by its own
+// thread into fixed size row blocks which are passed to the main thread
+// through a lock free queue per chunk; csv_loader_next returns the blocks in
+// file order, so the first chunk can be shown while the rest are parsed. The
+// boundary pass also counts line ends, an upper bound on the number of rows,
+// so the caller can allocate its storage once. Parsing uses the
+// structural scanner from csv_scan.c, decoding fields the same way as libcsv;
+// if a file uses quoting the scanner cannot follow (such as quotes inside
+// unquoted fields) it is reparsed serially with libcsv instead. Enum values are
+// given local codes per chunk and merged in chunk order, which assigns the same
+// codes as a serial load (in order of first appearance). The names of new enum
+// values travel with each block since the worker's dictionary keeps growing.
+// Column types are guessed from a sample of rows; if a chunk finds text in a
+// numeric column it converts its own values to enum codes, and the caller is
+// asked (with CSV_LOADER_RETYPE) to convert the rows it has already received.
+// Empty fields, including those missing from short rows, are missing values:
+// nan in numeric columns and the empty name in enum columns. Only a field that
+// is not entirely a number makes a column text.
+// Numbers in enum columns are named by their shortest round trip form (see
+// csv_enum_name), so the names do not depend on how the column was typed.
+// A load can be projected onto a subset of the columns, the others are only
+// scanned past. The offset of every row is kept in file order so that the
+// mapping can be handed over as a csv_index_t, which loads any other column
+// later with one parallel pass over the rows (or a serial libcsv pass if the
+// file had to be reparsed).
+
+#define MIN_CHUNK_SIZE (1 << 20)
+#define MAX_THREADS 256
+#define PARSE_BLOCK_SIZE (1 << 20)
+#define SCAN_BLOCK_SIZE (1 << 16)
+#define LOADER_BLOCK_SIZE (1 << 16)
+#define TYPE_SAMPLE_ROWS 1024
+#define TYPE_SAMPLE_BLOCK_SIZE 4096
+
+typedef struct csv_block_t csv_block_t;
+
+typedef struct {
+	char *Names;
+	int NumNames, IsEnum;
+	double Min, Max, Sum, Sum2;
+} csv_block_column_t;
+
+struct csv_block_t {
+	csv_loader_block_t Public;
+	csv_block_t *Next;
+	csv_block_column_t *Columns;
+	double *Data;
+	char *Names;
+	size_t *NameOffsets, *RowOffsets;
+	size_t NamesSize, NamesCapacity;
+};
+
+typedef struct {
+	enum_dict_t Dict[1];
+	int *Remap;
+	int Published, RemapSize, IsEnum;
+} csv_segment_column_t;
+
+typedef struct {
+	csv_loader_t *Loader;
+	const char *Start, *End;
+	csv_segment_column_t *Columns;
+	csv_block_t *Block;
+	// Queue of finished blocks, Head is owned by the main thread and Tail by the worker
+	csv_block_t *Head, *Tail;
+	char *Buffer;
+	size_t BufferSize;
+	char Number[FAST_DTOA_SIZE];
+	int Index, Finished;
+	// Boundary pass results
+	const char *Newlines[2];
+	size_t NumQuotes, NumLines;
+} csv_segment_t;
+
+struct csv_loader_t {
+	const char *Data;
+	size_t Size, DataStart;
+	csv_segment_t *Segments;
+	csv_loader_column_t *Columns;
+	char *IsEnum, *Selected;
+	enum_dict_t *Dicts;
+	csv_scan_fn *Scan;
+	pthread_t Thread, Threads[MAX_THREADS];
+	size_t BytesParsed;
+	// Offsets of the rows returned so far, while Indexed is set
+	size_t *RowOffsets;
+	int NumRows, RowCapacity, Indexed;
+	int NumSegments, NumColumns, Capacity, Current, Last, Retyped, Fd;
+	int Ready, Irregular, Reparsing, Cancelled, Stopped;
+};
+
+static const char *csv_row_end(const char *Start, const char *End) {
+	int Quoted = 0;
+	for (const char *P = Start; P < End; ++P) {
+		if (*P == '"') {
+			Quoted = !Quoted;
+		} else if ((*P == '\n' || *P == '\r') && !Quoted) {
+			return P + 1;
+		}
+	}
+	return End;
+}
+
+static void *csv_boundary_thread(csv_segment_t *Segment) {
+	const char *FileEnd = Segment->Loader->Data + Segment->Loader->Size;
+	size_t NumQuotes = 0, NumLines = 0;
+	Segment->Newlines[0] = Segment->Newlines[1] = 0;
+	for (const char *P = Segment->Start; P < Segment->End; ++P) {
+		if (*P == '"') {
+			++NumQuotes;
+		} else if (*P == '\n') {
+			++NumLines;
+			int Parity = NumQuotes & 1;
+			if (!Segment->Newlines[Parity]) Segment->Newlines[Parity] = P;
+		} else if (*P == '\r') {
+			if (P + 1 == FileEnd || P[1] != '\n') ++NumLines;
+		}
+	}
+	Segment->NumQuotes = NumQuotes;
+	Segment->NumLines = NumLines;
+	return 0;
+}
+
+static void csv_header_field_fn(void *Text, size_t Size, csv_loader_t *Loader) {
+	int Index = Loader->NumColumns++;
+	if (Index == 0) return;
+	Loader->Columns = realloc(Loader->Columns, Index * sizeof(csv_loader_column_t));
+	csv_loader_column_t *Column = Loader->Columns + (Index - 1);
+	memset(Column, 0, sizeof(csv_loader_column_t));
+	char *Name = malloc(Size + 1);
+	memcpy(Name, Text, Size);
+	Name[Size] = 0;
+	Column->Name = Name;
+}
+
+static void csv_header_row_fn(int Char, csv_loader_t *Loader) {
+}
+
+typedef struct {
+	csv_loader_t *Loader;
+	int Index, NumRows;
+} csv_types_t;
+
+static void csv_types_field_fn(void *Text, size_t Size, csv_types_t *Types) {
+	csv_loader_t *Loader = Types->Loader;
+	int Index = Types->Index++;
+	if (Index == 0 || Index > Loader->NumColumns || Types->NumRows >= TYPE_SAMPLE_ROWS) return;
+	// Empty fields are missing values and say nothing about the type.
+	if (!Loader->Selected[Index - 1] || !Size) return;
+	char *End;
+	fast_strtod(Text, &End);
+	if (End != (char *)Text + Size) Loader->IsEnum[Index - 1] = 1;
+}
+
+static void csv_types_row_fn(int Char, csv_types_t *Types) {
+	Types->Index = 0;
+	++Types->NumRows;
+}
+
+static csv_block_t *csv_block_new(csv_segment_t *Segment) {
+	csv_loader_t *Loader = Segment->Loader;
+	int NumColumns = Loader->NumColumns;
+	csv_block_t *Block = calloc(1, sizeof(csv_block_t));
+	Block->Public.Values = calloc(NumColumns + 1, sizeof(double *));
+	int NumSelected = 0;
+	for (int J = 0; J < NumColumns; ++J) NumSelected += Loader->Selected[J];
+	Block->Data = calloc((size_t)NumSelected * LOADER_BLOCK_SIZE, sizeof(double));
+	for (int J = 0, K = 0; J < NumColumns; ++J) {
+		if (Loader->Selected[J]) Block->Public.Values[J] = Block->Data + (size_t)(K++) * LOADER_BLOCK_SIZE;
+	}
+	Block->Columns = calloc(NumColumns, sizeof(csv_block_column_t));
+	for (int J = 0; J < NumColumns; ++J) {
+		Block->Columns[J].Min = INFINITY;
+		Block->Columns[J].Max = -INFINITY;
+		Block->Columns[J].IsEnum = Segment->Columns[J].IsEnum;
+	}
+	Block->NameOffsets = malloc(LOADER_BLOCK_SIZE * sizeof(size_t));
+	Block->RowOffsets = malloc(LOADER_BLOCK_SIZE * sizeof(size_t));
+	return Block;
+}
+
+static void csv_block_free(csv_loader_t *Loader, csv_block_t *Block) {
+	if (Block->Columns) for (int J = 0; J < Loader->NumColumns; ++J) free(Block->Columns[J].Names);
+	free(Block->Columns);
+	free(Block->Public.Values);
+	free(Block->Data);
+	free(Block->Names);
+	free(Block->NameOffsets);
+	free(Block->RowOffsets);
+	free(Block);
+}
+
+// Hands the current block to the main thread along with the names of any
+// enum values seen for the first time in it.
+static void csv_segment_publish(csv_segment_t *Segment) {
+	csv_loader_t *Loader = Segment->Loader;
+	csv_block_t *Block = Segment->Block;
+	for (int J = 0; J < Loader->NumColumns; ++J) {
+		csv_segment_column_t *Column = Segment->Columns + J;
+		enum_dict_t *Dict = Column->Dict;
+		if (Column->Published == Dict->Size - 1) continue;
+		size_t Length = 0;
+		for (int Code = Column->Published + 1; Code < Dict->Size; ++Code) Length += strlen(Dict->Names[Code]) + 1;
+		char *Names = Block->Columns[J].Names = malloc(Length);
+		for (int Code = Column->Published + 1; Code < Dict->Size; ++Code) Names = stpcpy(Names, Dict->Names[Code]) + 1;
+		Block->Columns[J].NumNames = Dict->Size - 1 - Column->Published;
+		Column->Published = Dict->Size - 1;
+	}
+	Block->Public.Names = Block->Names;
+	Block->Public.NameOffsets = Block->NameOffsets;
+	__atomic_store_n(&Segment->Tail->Next, Block, __ATOMIC_RELEASE);
+	Segment->Tail = Block;
+	Segment->Block = csv_block_new(Segment);
+}
+
+// Names a field of an enum column. Numbers are named by their shortest round
+// trip form and missing values (empty or nan) by the empty name, the same as
+// numbers converted by csv_loader_encode, so a value has the same name whether
+// its column was typed from the sample, converted later or loaded on demand.
+size_t csv_enum_name(const char **Text, size_t Size, char *Number) {
+	if (!Size) return 0;
+	char *End;
+	double Value = fast_strtod(*Text, &End);
+	if (End != *Text + Size) return Size;
+	if (isnan(Value)) return 0;
+	*Text = Number;
+	return fast_dtoa(Value, Number);
+}
+
+// Switches a column to enum values after text is found in it, converting the
+// numbers already in the current block.
+static void csv_segment_retype(csv_segment_t *Segment, int Index) {
+	csv_block_t *Block = Segment->Block;
+	csv_segment_column_t *Local = Segment->Columns + Index;
+	double *Values = Block->Public.Values[Index];
+	char Buffer[FAST_DTOA_SIZE];
+	for (int I = 0; I < Block->Public.NumRows; ++I) {
+		if (isnan(Values[I])) {
+			Values[I] = 0;
+			continue;
+		}
+		int Length = fast_dtoa(Values[I], Buffer);
+		Values[I] = enum_dict_insert(Local->Dict, Buffer, Length);
+	}
+	Local->IsEnum = Block->Columns[Index].IsEnum = 1;
+}
+
+static void csv_segment_field_fn(void *Text, size_t Size, csv_segment_t *Segment) {
+	csv_block_t *Block = Segment->Block;
+	int Index = Segment->Index++;
+	int Row = Block->Public.NumRows;
+	if (Index == 0) {
+		if (Block->NamesSize + Size + 1 > Block->NamesCapacity) {
+			size_t Capacity = Block->NamesCapacity ? 2 * Block->NamesCapacity : 65536;
+			while (Capacity < Block->NamesSize + Size + 1) Capacity *= 2;
+			Block->Names = realloc(Block->Names, Capacity);
+			Block->NamesCapacity = Capacity;
+		}
+		memcpy(Block->Names + Block->NamesSize, Text, Size);
+		Block->NameOffsets[Row] = Block->NamesSize;
+		Block->NamesSize += Size;
+		Block->Names[Block->NamesSize++] = 0;
+	} else if (Index <= Segment->Loader->NumColumns && Segment->Loader->Selected[Index - 1]) {
+		csv_segment_column_t *Local = Segment->Columns + (Index - 1);
+		csv_block_column_t *Column = Block->Columns + (Index - 1);
+		double Value;
+		if (!Local->IsEnum) {
+			// Empty fields are missing values, only text converts a column.
+			char *End;
+			Value = Size ? fast_strtod(Text, &End) : NAN;
+			if (Size && End != (char *)Text + Size) csv_segment_retype(Segment, Index - 1);
+		}
+		if (Local->IsEnum) {
+			const char *Name = Text;
+			Size = csv_enum_name(&Name, Size, Segment->Number);
+			Value = Size ? enum_dict_insert(Local->Dict, Name, Size) : 0;
+		}
+		Block->Public.Values[Index - 1][Row] = Value;
+		if (isnan(Value)) return;
+		if (Column->Min > Value) Column->Min = Value;
+		if (Column->Max < Value) Column->Max = Value;
+		Column->Sum += Value;
+		Column->Sum2 += Value * Value;
+	}
+}
+
+static void csv_segment_row_fn(int Char, csv_segment_t *Segment) {
+	// Fields missing from short rows are empty.
+	while (Segment->Index && Segment->Index <= Segment->Loader->NumColumns) csv_segment_field_fn("", 0, Segment);
+	Segment->Index = 0;
+	if (++Segment->Block->Public.NumRows == LOADER_BLOCK_SIZE) csv_segment_publish(Segment);
+}
+
+static inline int csv_is_space(char Char) {
+	return Char == ' ' || Char == '\t';
+}
+
+static int csv_is_blank(const char *Start, const char *End) {
+	while (Start < End) if (!csv_is_space(*Start++)) return 0;
+	return 1;
+}
+
+// Decodes a field as libcsv does into *Buffer, returning its length or -1 for
+// quoting that libcsv would read differently.
+static ssize_t csv_decode_field(const char *Start, const char *End, char **BufferPtr, size_t *BufferSize) {
+	while (Start < End && csv_is_space(*Start)) ++Start;
+	while (End > Start && csv_is_space(End[-1])) --End;
+	size_t Length = End - Start;
+	if (Length + 1 > *BufferSize) {
+		size_t Size = *BufferSize ? 2 * *BufferSize : 256;
+		while (Size < Length + 1) Size *= 2;
+		*BufferPtr = realloc(*BufferPtr, Size);
+		*BufferSize = Size;
+	}
+	char *Buffer = *BufferPtr;
+	size_t Size = 0;
+	if (Length && Start[0] == '"') {
+		if (Length < 2 || End[-1] != '"') return -1;
+		++Start;
+		--End;
+		const char *Quote;
+		while ((Quote = memchr(Start, '"', End - Start))) {
+			if (Quote + 1 == End || Quote[1] != '"') return -1;
+			memcpy(Buffer + Size, Start, Quote + 1 - Start);
+			Size += Quote + 1 - Start;
+			Start = Quote + 2;
+		}
+		memcpy(Buffer + Size, Start, End - Start);
+		Size += End - Start;
+	} else {
+		if (memchr(Start, '"', Length)) return -1;
+		memcpy(Buffer, Start, Length);
+		Size = Length;
+	}
+	Buffer[Size] = 0;
+	return Size;
+}
+
+// Passes a field to csv_segment_field_fn, returning 0 for irregular quoting.
+// Fields outside the projection are only decoded if they need a quote check.
+static int csv_segment_field(csv_segment_t *Segment, const char *Start, const char *End) {
+	csv_loader_t *Loader = Segment->Loader;
+	int Index = Segment->Index;
+	if (!Index) {
+		csv_block_t *Block = Segment->Block;
+		Block->RowOffsets[Block->Public.NumRows] = Start - Loader->Data;
+	} else if (Index > Loader->NumColumns || !Loader->Selected[Index - 1]) {
+		if (memchr(Start, '"', End - Start) && csv_decode_field(Start, End, &Segment->Buffer, &Segment->BufferSize) < 0) return 0;
+		++Segment->Index;
+		return 1;
+	}
+	ssize_t Size = csv_decode_field(Start, End, &Segment->Buffer, &Segment->BufferSize);
+	if (Size < 0) return 0;
+	csv_segment_field_fn(Segment->Buffer, Size, Segment);
+	return 1;
+}
+
+static int csv_segment_scan(csv_segment_t *Segment) {
+	csv_loader_t *Loader = Segment->Loader;
+	csv_scan_fn *Scan = Loader->Scan;
+	uint32_t *Indices = malloc(SCAN_BLOCK_SIZE * sizeof(uint32_t));
+	uint64_t Quoted = 0;
+	const char *Field = Segment->Start, *End = Segment->End;
+	int Regular = 1;
+	for (const char *Block = Segment->Start; Regular && Block < End;) {
+		if (__atomic_load_n(&Loader->Cancelled, __ATOMIC_RELAXED)) {
+			free(Indices);
+			return 1;
+		}
+		size_t Length = End - Block;
+		if (Length > SCAN_BLOCK_SIZE) Length = SCAN_BLOCK_SIZE;
+		size_t Count = Scan(Block, Length, &Quoted, Indices);
+		for (size_t I = 0; I < Count; ++I) {
+			const char *Separator = Block + Indices[I];
+			if (*Separator != ',' && !Segment->Index && csv_is_blank(Field, Separator)) {
+				// libcsv skips empty rows
+			} else if (!csv_segment_field(Segment, Field, Separator)) {
+				Regular = 0;
+				break;
+			} else if (*Separator != ',') {
+				csv_segment_row_fn(*Separator, Segment);
+			}
+			Field = Separator + 1;
+		}
+		__atomic_add_fetch(&Loader->BytesParsed, Length, __ATOMIC_RELAXED);
+		Block += Length;
+	}
+	if (Regular && Quoted) Regular = 0;
+	if (Regular && (Segment->Index || !csv_is_blank(Field, End))) {
+		if (csv_segment_field(Segment, Field, End)) {
+			csv_segment_row_fn(-1, Segment);
+		} else {
+			Regular = 0;
+		}
+	}
+	free(Indices);
+	return Regular;
+}
+
+static void csv_segment_parse(csv_segment_t *Segment) {
+	csv_loader_t *Loader = Segment->Loader;
+	struct csv_parser Parser[1];
+	csv_init(Parser, CSV_APPEND_NULL);
+	const char *Start = Segment->Start;
+	while (Start < Segment->End) {
+		if (__atomic_load_n(&Loader->Cancelled, __ATOMIC_RELAXED)) break;
+		size_t Length = Segment->End - Start;
+		if (Length > PARSE_BLOCK_SIZE) Length = PARSE_BLOCK_SIZE;
+		csv_parse(Parser, Start, Length, (void *)csv_segment_field_fn, (void *)csv_segment_row_fn, Segment);
+		__atomic_add_fetch(&Loader->BytesParsed, Length, __ATOMIC_RELAXED);
+		Start += Length;
+	}
+	csv_fini(Parser, (void *)csv_segment_field_fn, (void *)csv_segment_row_fn, Segment);
+	csv_free(Parser);
+}
+
+static void csv_segment_finish(csv_segment_t *Segment) {
+	if (Segment->Block->Public.NumRows) csv_segment_publish(Segment);
+	__atomic_store_n(&Segment->Finished, 1, __ATOMIC_RELEASE);
+}
+
+static void *csv_segment_thread(csv_segment_t *Segment) {
+	csv_loader_t *Loader = Segment->Loader;
+	if (!csv_segment_scan(Segment)) __atomic_store_n(&Loader->Irregular, 1, __ATOMIC_RELEASE);
+	csv_segment_finish(Segment);
+	return 0;
+}
+
+static void csv_segment_init(csv_segment_t *Segment) {
+	csv_loader_t *Loader = Segment->Loader;
+	Segment->Columns = calloc(Loader->NumColumns, sizeof(csv_segment_column_t));
+	for (int J = 0; J < Loader->NumColumns; ++J) {
+		Segment->Columns[J].IsEnum = Loader->IsEnum[J];
+		enum_dict_init(Segment->Columns[J].Dict, EnumDictMalloc);
+	}
+	Segment->Block = csv_block_new(Segment);
+	Segment->Head = Segment->Tail = calloc(1, sizeof(csv_block_t));
+}
+
+static void csv_segment_free(csv_segment_t *Segment) {
+	csv_loader_t *Loader = Segment->Loader;
+	if (Segment->Columns) for (int J = 0; J < Loader->NumColumns; ++J) {
+		csv_segment_column_t *Column = Segment->Columns + J;
+		free(Column->Remap);
+		enum_dict_free(Column->Dict);
+	}
+	free(Segment->Columns);
+	free(Segment->Buffer);
+	for (csv_block_t *Block = Segment->Head; Block;) {
+		csv_block_t *Next = Block->Next;
+		csv_block_free(Loader, Block);
+		Block = Next;
+	}
+	if (Segment->Block) csv_block_free(Loader, Segment->Block);
+	memset(Segment, 0, sizeof(csv_segment_t));
+	Segment->Loader = Loader;
+}
+
+// Finds the row boundaries and capacity, parses every chunk in parallel and
+// then reparses the file serially if the chunks found irregular quoting.
+static void *csv_loader_thread(csv_loader_t *Loader) {
+	int NumSegments = Loader->NumSegments;
+	csv_segment_t *Segments = Loader->Segments;
+	for (int I = 1; I < NumSegments; ++I) {
+		pthread_create(Loader->Threads + I, 0, (void *)csv_boundary_thread, Segments + I);
+	}
+	csv_boundary_thread(Segments);
+	for (int I = 1; I < NumSegments; ++I) pthread_join(Loader->Threads[I], 0);
+	size_t NumLines = 0;
+	for (int I = 0; I < NumSegments; ++I) NumLines += Segments[I].NumLines;
+	Loader->Capacity = NumLines < INT_MAX ? NumLines + 1 : INT_MAX;
+	if (NumSegments > 1) {
+		const char *End = Loader->Data + Loader->Size;
+		int Quoted = 0;
+		const char *Starts[NumSegments + 1];
+		Starts[0] = Segments[0].Start;
+		for (int I = 1; I < NumSegments; ++I) {
+			Quoted ^= Segments[I - 1].NumQuotes & 1;
+			const char *Newline = Segments[I].Newlines[Quoted];
+			Starts[I] = Newline ? Newline + 1 : 0;
+		}
+		Starts[NumSegments] = End;
+		for (int I = NumSegments; --I > 0;) if (!Starts[I]) Starts[I] = Starts[I + 1];
+		for (int I = 0; I < NumSegments; ++I) {
+			Segments[I].Start = Starts[I];
+			Segments[I].End = Starts[I + 1];
+		}
+	}
+	for (int I = 0; I <= NumSegments; ++I) csv_segment_init(Segments + I);
+	__atomic_store_n(&Loader->Ready, 1, __ATOMIC_RELEASE);
+	for (int I = 0; I < NumSegments; ++I) {
+		pthread_create(Loader->Threads + I, 0, (void *)csv_segment_thread, Segments + I);
+	}
+	for (int I = 0; I < NumSegments; ++I) pthread_join(Loader->Threads[I], 0);
+	if (Loader->Irregular && !__atomic_load_n(&Loader->Cancelled, __ATOMIC_RELAXED)) {
+		csv_segment_t *Serial = Segments + NumSegments;
+		Serial->Start = Loader->Data + Loader->DataStart;
+		Serial->End = Loader->Data + Loader->Size;
+		__atomic_store_n(&Loader->BytesParsed, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&Loader->Reparsing, 1, __ATOMIC_RELEASE);
+		csv_segment_parse(Serial);
+		csv_segment_finish(Serial);
+	}
+	return 0;
+}
+
+csv_loader_t *csv_loader_open(const char *FileName, int NumThreads, const char **Projection) {
+#ifdef MINGW
+	return 0;
+#else
+	int Fd = open(FileName, O_RDONLY);
+	if (Fd < 0) return 0;
+	struct stat Stat[1];
+	if (fstat(Fd, Stat) || !S_ISREG(Stat->st_mode) || !Stat->st_size) {
+		close(Fd);
+		return 0;
+	}
+	const char *Data = mmap(0, Stat->st_size, PROT_READ, MAP_PRIVATE, Fd, 0);
+	if (Data == MAP_FAILED) {
+		close(Fd);
+		return 0;
+	}
+	// Compressed files are streamed through the serial loader instead.
+	if (csv_stream_compressed(Data, Stat->st_size)) {
+		munmap((void *)Data, Stat->st_size);
+		close(Fd);
+		return 0;
+	}
+	madvise((void *)Data, Stat->st_size, MADV_SEQUENTIAL);
+	csv_loader_t *Loader = calloc(1, sizeof(csv_loader_t));
+	Loader->Fd = Fd;
+	Loader->Data = Data;
+	Loader->Size = Stat->st_size;
+	Loader->Scan = csv_scan_kernel();
+	const char *End = Data + Loader->Size;
+
+	struct csv_parser Parser[1];
+	const char *HeaderEnd = csv_row_end(Data, End);
+	csv_init(Parser, CSV_APPEND_NULL);
+	csv_parse(Parser, Data, HeaderEnd - Data, (void *)csv_header_field_fn, (void *)csv_header_row_fn, Loader);
+	csv_fini(Parser, (void *)csv_header_field_fn, (void *)csv_header_row_fn, Loader);
+	csv_free(Parser);
+	Loader->NumColumns = Loader->NumColumns ? Loader->NumColumns - 1 : 0;
+	Loader->IsEnum = calloc(Loader->NumColumns + 1, 1);
+	Loader->Selected = malloc(Loader->NumColumns + 1);
+	memset(Loader->Selected, !Projection, Loader->NumColumns + 1);
+	if (Projection) for (const char **Name = Projection; *Name; ++Name) {
+		for (int J = 0; J < Loader->NumColumns; ++J) {
+			if (!strcmp(Loader->Columns[J].Name, *Name)) Loader->Selected[J] = 1;
+		}
+	}
+	Loader->DataStart = HeaderEnd - Data;
+	Loader->Indexed = 1;
+
+	// Column types are decided by the first TYPE_SAMPLE_ROWS rows, as in the
+	// serial loader. Columns that turn out to contain text later are converted.
+	csv_types_t Types[1] = {{Loader, 0, 0}};
+	csv_init(Parser, CSV_APPEND_NULL);
+	for (const char *Sample = HeaderEnd; Sample < End && Types->NumRows < TYPE_SAMPLE_ROWS;) {
+		size_t Length = End - Sample;
+		if (Length > TYPE_SAMPLE_BLOCK_SIZE) Length = TYPE_SAMPLE_BLOCK_SIZE;
+		csv_parse(Parser, Sample, Length, (void *)csv_types_field_fn, (void *)csv_types_row_fn, Types);
+		Sample += Length;
+	}
+	csv_fini(Parser, (void *)csv_types_field_fn, (void *)csv_types_row_fn, Types);
+	csv_free(Parser);
+
+	Loader->Dicts = malloc(Loader->NumColumns * sizeof(enum_dict_t));
+	for (int J = 0; J < Loader->NumColumns; ++J) {
+		enum_dict_init(Loader->Dicts + J, EnumDictMalloc);
+		csv_loader_column_t *Column = Loader->Columns + J;
+		Column->Min = INFINITY;
+		Column->Max = -INFINITY;
+		if (Loader->IsEnum[J]) {
+			Column->EnumSize = 1;
+			Column->EnumNames = malloc(sizeof(const char *));
+			Column->EnumNames[0] = "";
+		}
+	}
+
+	size_t DataSize = Loader->Size - Loader->DataStart;
+	int NumSegments = DataSize / MIN_CHUNK_SIZE;
+	if (NumSegments > NumThreads) NumSegments = NumThreads;
+	if (NumSegments > MAX_THREADS) NumSegments = MAX_THREADS;
+	if (NumSegments < 1) NumSegments = 1;
+	Loader->NumSegments = NumSegments;
+	Loader->Last = NumSegments - 1;
+	// The extra segment is used if the file has to be reparsed serially.
+	csv_segment_t *Segments = Loader->Segments = calloc(NumSegments + 1, sizeof(csv_segment_t));
+	for (int I = 0; I <= NumSegments; ++I) {
+		csv_segment_t *Segment = Segments + I;
+		Segment->Loader = Loader;
+		Segment->Start = HeaderEnd + (DataSize * I) / NumSegments;
+		Segment->End = HeaderEnd + (DataSize * (I + 1)) / NumSegments;
+	}
+	pthread_create(&Loader->Thread, 0, (void *)csv_loader_thread, Loader);
+	return Loader;
+#endif
+}
+
+double csv_loader_progress(csv_loader_t *Loader) {
+	size_t DataSize = Loader->Size - Loader->DataStart;
+	if (!DataSize) return 1.0;
+	return (double)__atomic_load_n(&Loader->BytesParsed, __ATOMIC_RELAXED) / DataSize;
+}
+
+int csv_loader_capacity(csv_loader_t *Loader) {
+	return Loader->Capacity;
+}
+
+int csv_loader_num_columns(csv_loader_t *Loader) {
+	return Loader->NumColumns;
+}
+
+int csv_loader_selected(csv_loader_t *Loader, int Index) {
+	return Loader->Selected[Index];
+}
+
+csv_loader_column_t *csv_loader_column(csv_loader_t *Loader, int Index) {
+	return Loader->Columns + Index;
+}
+
+static void csv_loader_reset(csv_loader_t *Loader) {
+	for (int J = 0; J < Loader->NumColumns; ++J) {
+		csv_loader_column_t *Column = Loader->Columns + J;
+		Column->Min = INFINITY;
+		Column->Max = -INFINITY;
+		Column->Sum = Column->Sum2 = 0.0;
+		if (Loader->IsEnum[J]) {
+			Column->EnumSize = 1;
+		} else {
+			free(Column->EnumNames);
+			Column->EnumNames = 0;
+			Column->EnumSize = 0;
+		}
+		enum_dict_free(Loader->Dicts + J);
+	}
+	for (int I = 0; I < Loader->NumSegments; ++I) csv_segment_free(Loader->Segments + I);
+	Loader->Current = Loader->Last = Loader->NumSegments;
+	// libcsv does not report positions, so the serial reparse has no row index.
+	free(Loader->RowOffsets);
+	Loader->RowOffsets = 0;
+	Loader->NumRows = Loader->RowCapacity = Loader->Indexed = 0;
+}
+
+static void csv_loader_names(csv_loader_column_t *Column, enum_dict_t *Dict) {
+	int EnumSize = Dict->Size;
+	if (EnumSize == Column->EnumSize) return;
+	Column->EnumNames = realloc(Column->EnumNames, EnumSize * sizeof(const char *));
+	// Names never move, only the new ones are added.
+	memcpy(Column->EnumNames + Column->EnumSize, Dict->Names + Column->EnumSize, (EnumSize - Column->EnumSize) * sizeof(const char *));
+	Column->EnumSize = EnumSize;
+}
+
+static void csv_loader_encode(enum_dict_t *Dict, double *Values, int Count) {
+	char Buffer[FAST_DTOA_SIZE];
+	for (int I = 0; I < Count; ++I) {
+		if (isnan(Values[I])) {
+			Values[I] = 0;
+			continue;
+		}
+		int Length = fast_dtoa(Values[I], Buffer);
+		Values[I] = enum_dict_insert(Dict, Buffer, Length);
+	}
+}
+
+// Converts the chunk local enum codes in a block to file wide codes and adds
+// the block to the column statistics.
+static void csv_loader_merge(csv_loader_t *Loader, csv_segment_t *Segment, csv_block_t *Block) {
+	int NumRows = Block->Public.NumRows;
+	if (Loader->Indexed) {
+		if (Loader->NumRows + NumRows > Loader->RowCapacity) {
+			int RowCapacity = Loader->RowCapacity ? 2 * Loader->RowCapacity : LOADER_BLOCK_SIZE;
+			while (RowCapacity < Loader->NumRows + NumRows) RowCapacity *= 2;
+			Loader->RowOffsets = realloc(Loader->RowOffsets, RowCapacity * sizeof(size_t));
+			Loader->RowCapacity = RowCapacity;
+		}
+		memcpy(Loader->RowOffsets + Loader->NumRows, Block->RowOffsets, NumRows * sizeof(size_t));
+	}
+	Loader->NumRows += NumRows;
+	for (int J = 0; J < Loader->NumColumns; ++J) {
+		if (!Loader->Selected[J]) continue;
+		csv_loader_column_t *Column = Loader->Columns + J;
+		csv_block_column_t *Source = Block->Columns + J;
+		if (Column->Min > Source->Min) Column->Min = Source->Min;
+		if (Column->Max < Source->Max) Column->Max = Source->Max;
+		Column->Sum += Source->Sum;
+		Column->Sum2 += Source->Sum2;
+		if (!Column->EnumNames) continue;
+		enum_dict_t *Dict = Loader->Dicts + J;
+		if (!Source->IsEnum) {
+			// The column was converted after text was found in an earlier chunk.
+			csv_loader_encode(Dict, Block->Public.Values[J], NumRows);
+			csv_loader_names(Column, Dict);
+			continue;
+		}
+		csv_segment_column_t *Local = Segment->Columns + J;
+		if (Source->NumNames) {
+			int RemapSize = (Local->RemapSize ?: 1) + Source->NumNames;
+			int *Remap = Local->Remap = realloc(Local->Remap, RemapSize * sizeof(int));
+			Remap[0] = 0;
+			const char *Name = Source->Names;
+			for (int Code = Local->RemapSize ?: 1; Code < RemapSize; ++Code) {
+				size_t Length = strlen(Name);
+				Remap[Code] = enum_dict_insert(Dict, Name, Length);
+				Name += Length + 1;
+			}
+			Local->RemapSize = RemapSize;
+			csv_loader_names(Column, Dict);
+		}
+		if (Local->Remap) {
+			int *Remap = Local->Remap;
+			double *Values = Block->Public.Values[J];
+			for (int I = 0; I < NumRows; ++I) Values[I] = Remap[(int)Values[I]];
+		}
+	}
+}
+
+csv_loader_status_t csv_loader_next(csv_loader_t *Loader, csv_loader_block_t **Result) {
+	if (!__atomic_load_n(&Loader->Ready, __ATOMIC_ACQUIRE)) return CSV_LOADER_WAIT;
+	for (;;) {
+		if (Loader->Last < Loader->NumSegments && __atomic_load_n(&Loader->Irregular, __ATOMIC_ACQUIRE)) {
+			if (!__atomic_load_n(&Loader->Reparsing, __ATOMIC_ACQUIRE)) return CSV_LOADER_WAIT;
+			csv_loader_reset(Loader);
+			return CSV_LOADER_RESET;
+		}
+		if (Loader->Current > Loader->Last) return CSV_LOADER_DONE;
+		csv_segment_t *Segment = Loader->Segments + Loader->Current;
+		int Finished = __atomic_load_n(&Segment->Finished, __ATOMIC_ACQUIRE);
+		csv_block_t *Block = __atomic_load_n(&Segment->Head->Next, __ATOMIC_ACQUIRE);
+		if (Block) {
+			// Rows already returned must be converted before a column with text.
+			for (int J = 0; J < Loader->NumColumns; ++J) {
+				if (Block->Columns[J].IsEnum && !Loader->Columns[J].EnumNames) {
+					Loader->Retyped = J;
+					return CSV_LOADER_RETYPE;
+				}
+			}
+			csv_block_free(Loader, Segment->Head);
+			Segment->Head = Block;
+			csv_loader_merge(Loader, Segment, Block);
+			*Result = &Block->Public;
+			return CSV_LOADER_ROWS;
+		}
+		if (!Finished) return CSV_LOADER_WAIT;
+		csv_segment_free(Segment);
+		++Loader->Current;
+	}
+}
+
+int csv_loader_retyped(csv_loader_t *Loader) {
+	return Loader->Retyped;
+}
+
+void csv_loader_convert(csv_loader_t *Loader, int Index, double *Values, int Count) {
+	csv_loader_column_t *Column = Loader->Columns + Index;
+	enum_dict_t *Dict = Loader->Dicts + Index;
+	csv_loader_encode(Dict, Values, Count);
+	Column->EnumNames = malloc(sizeof(const char *));
+	Column->EnumNames[0] = "";
+	Column->EnumSize = 1;
+	csv_loader_names(Column, Dict);
+}
+
+static void csv_loader_stop(csv_loader_t *Loader) {
+	if (Loader->Stopped) return;
+	__atomic_store_n(&Loader->Cancelled, 1, __ATOMIC_RELAXED);
+	pthread_join(Loader->Thread, 0);
+	Loader->Stopped = 1;
+}
+
+void csv_loader_close(csv_loader_t *Loader) {
+	csv_loader_stop(Loader);
+	for (int I = 0; I <= Loader->NumSegments; ++I) csv_segment_free(Loader->Segments + I);
+	free(Loader->Segments);
+	for (int J = 0; J < Loader->NumColumns; ++J) enum_dict_free(Loader->Dicts + J);
+	free(Loader->Dicts);
+	for (int J = 0; J < Loader->NumColumns; ++J) {
+		free((void *)Loader->Columns[J].Name);
+		free(Loader->Columns[J].EnumNames);
+	}
+	free(Loader->Columns);
+	free(Loader->IsEnum);
+	free(Loader->Selected);
+	free(Loader->RowOffsets);
+#ifndef MINGW
+	if (Loader->Data) munmap((void *)Loader->Data, Loader->Size);
+#endif
+	if (Loader->Fd >= 0) close(Loader->Fd);
+	free(Loader);
+}
+
+struct csv_index_t {
+	const char *Data;
+	size_t Size, DataStart;
+	size_t *RowOffsets;
+	enum_dict_t Dict[1];
+	int NumRows, NumColumns, Fd;
+};
+
+// Takes over the mapped file and row offsets of a loader that has returned
+// all the rows it will, stopping its threads first.
+csv_index_t *csv_loader_index(csv_loader_t *Loader) {
+	csv_loader_stop(Loader);
+	csv_index_t *Index = calloc(1, sizeof(csv_index_t));
+	enum_dict_init(Index->Dict, EnumDictMalloc);
+	Index->Data = Loader->Data;
+	Index->Size = Loader->Size;
+	Index->DataStart = Loader->DataStart;
+	Index->Fd = Loader->Fd;
+	Index->NumRows = Loader->NumRows;
+	Index->NumColumns = Loader->NumColumns;
+	if (Loader->Indexed) {
+		Index->RowOffsets = Loader->RowOffsets;
+		Loader->RowOffsets = 0;
+	}
+#ifndef MINGW
+	madvise((void *)Index->Data, Index->Size, MADV_NORMAL);
+#endif
+	Loader->Data = 0;
+	Loader->Fd = -1;
+	return Index;
+}
+
+int csv_index_num_rows(csv_index_t *Index) {
+	return Index->NumRows;
+}
+
+typedef struct {
+	csv_index_t *Index;
+	double *Values;
+	enum_dict_t Dict[1];
+	char *Buffer;
+	size_t BufferSize;
+	char Number[FAST_DTOA_SIZE];
+	int Start, End, Column, IsEnum;
+	// Used by the serial pass
+	int Field, Row;
+} csv_index_part_t;
+
+// Stores the value of a field, switching the part to enum codes the first
+// time text is found. Empty fields are missing values.
+static void csv_index_value(csv_index_part_t *Part, int Row, const char *Text, size_t Size) {
+	if (!Part->IsEnum) {
+		char *End;
+		double Number = Size ? fast_strtod(Text, &End) : NAN;
+		if (!Size || End == Text + Size) {
+			Part->Values[Row] = Number;
+			return;
+		}
+		csv_loader_encode(Part->Dict, Part->Values + Part->Start, Row - Part->Start);
+		Part->IsEnum = 1;
+	}
+	Size = csv_enum_name(&Text, Size, Part->Number);
+	Part->Values[Row] = Size ? enum_dict_insert(Part->Dict, Text, Size) : 0;
+}
+
+// Finds field Column of the row starting at Row, following quotes.
+static const char *csv_index_field(const char *Row, const char *End, int Column, const char **FieldEnd) {
+	int Quoted = 0;
+	const char *P = Row;
+	while (Column > 0) {
+		if (P == End) return 0;
+		char Char = *P++;
+		if (Char == '"') {
+			Quoted = !Quoted;
+		} else if (!Quoted) {
+			if (Char == ',') --Column;
+			else if (Char == '\n' || Char == '\r') return 0;
+		}
+	}
+	const char *Start = P;
+	for (; P < End; ++P) {
+		char Char = *P;
+		if (Char == '"') {
+			Quoted = !Quoted;
+		} else if (!Quoted && (Char == ',' || Char == '\n' || Char == '\r')) {
+			break;
+		}
+	}
+	*FieldEnd = P;
+	return Start;
+}
+
+static void *csv_index_thread(csv_index_part_t *Part) {
+	csv_index_t *Index = Part->Index;
+	const char *FileEnd = Index->Data + Index->Size;
+	for (int Row = Part->Start; Row < Part->End; ++Row) {
+		const char *FieldEnd, *Field = csv_index_field(Index->Data + Index->RowOffsets[Row], FileEnd, Part->Column, &FieldEnd);
+		ssize_t Size = Field ? csv_decode_field(Field, FieldEnd, &Part->Buffer, &Part->BufferSize) : -1;
+		// Fields missing from short rows are empty.
+		if (Size < 0) {
+			csv_index_value(Part, Row, "", 0);
+		} else {
+			csv_index_value(Part, Row, Part->Buffer, Size);
+		}
+	}
+	return 0;
+}
+
+static void csv_index_serial_field_fn(void *Text, size_t Size, csv_index_part_t *Part) {
+	if (Part->Field++ == Part->Column && Part->Row < Part->End) csv_index_value(Part, Part->Row, Text, Size);
+}
+
+static void csv_index_serial_row_fn(int Char, csv_index_part_t *Part) {
+	if (Part->Field <= Part->Column && Part->Row < Part->End) csv_index_value(Part, Part->Row, "", 0);
+	Part->Field = 0;
+	++Part->Row;
+}
+
+// Loads column Index of the file into Values, which must have room for
+// csv_index_num_rows values. Column receives the statistics and enum names,
+// the names are valid until the next call.
+void csv_index_load(csv_index_t *Index, int Column, double *Values, csv_loader_column_t *Result, int NumThreads) {
+	int NumRows = Index->NumRows;
+	memset(Values, 0, NumRows * sizeof(double));
+	int NumParts = 1;
+	if (Index->RowOffsets) {
+		NumParts = NumRows / LOADER_BLOCK_SIZE;
+		if (NumParts > NumThreads) NumParts = NumThreads;
+		if (NumParts > MAX_THREADS) NumParts = MAX_THREADS;
+		if (NumParts < 1) NumParts = 1;
+	}
+	csv_index_part_t *Parts = calloc(NumParts, sizeof(csv_index_part_t));
+	for (int I = 0; I < NumParts; ++I) {
+		csv_index_part_t *Part = Parts + I;
+		Part->Index = Index;
+		enum_dict_init(Part->Dict, EnumDictMalloc);
+		Part->Values = Values;
+		Part->Column = Column + 1;
+		Part->Start = ((size_t)NumRows * I) / NumParts;
+		Part->End = ((size_t)NumRows * (I + 1)) / NumParts;
+	}
+	if (Index->RowOffsets) {
+		pthread_t Threads[NumParts];
+		for (int I = 1; I < NumParts; ++I) pthread_create(Threads + I, 0, (void *)csv_index_thread, Parts + I);
+		csv_index_thread(Parts);
+		for (int I = 1; I < NumParts; ++I) pthread_join(Threads[I], 0);
+	} else {
+		struct csv_parser Parser[1];
+		csv_init(Parser, CSV_APPEND_NULL);
+		const char *Start = Index->Data + Index->DataStart, *End = Index->Data + Index->Size;
+		while (Start < End && Parts->Row < NumRows) {
+			size_t Length = End - Start;
+			if (Length > PARSE_BLOCK_SIZE) Length = PARSE_BLOCK_SIZE;
+			csv_parse(Parser, Start, Length, (void *)csv_index_serial_field_fn, (void *)csv_index_serial_row_fn, Parts);
+			Start += Length;
+		}
+		csv_fini(Parser, (void *)csv_index_serial_field_fn, (void *)csv_index_serial_row_fn, Parts);
+		csv_free(Parser);
+	}
+	// Part codes are merged in row order, so codes follow first appearance.
+	enum_dict_t *Dict = Index->Dict;
+	enum_dict_free(Dict);
+	int IsEnum = 0;
+	for (int I = 0; I < NumParts; ++I) IsEnum |= Parts[I].IsEnum;
+	memset(Result, 0, sizeof(csv_loader_column_t));
+	if (IsEnum) for (int I = 0; I < NumParts; ++I) {
+		csv_index_part_t *Part = Parts + I;
+		double *PartValues = Values + Part->Start;
+		int Count = Part->End - Part->Start;
+		if (!Part->IsEnum) {
+			csv_loader_encode(Dict, PartValues, Count);
+			continue;
+		}
+		enum_dict_t *Local = Part->Dict;
+		int *Remap = malloc(Local->Size * sizeof(int));
+		Remap[0] = 0;
+		for (int Code = 1; Code < Local->Size; ++Code) {
+			const char *Name = Local->Names[Code];
+			Remap[Code] = enum_dict_insert(Dict, Name, strlen(Name));
+		}
+		for (int J = 0; J < Count; ++J) PartValues[J] = Remap[(int)PartValues[J]];
+		free(Remap);
+	}
+	for (int I = 0; I < NumParts; ++I) {
+		enum_dict_free(Parts[I].Dict);
+		free(Parts[I].Buffer);
+	}
+	free(Parts);
+	if (IsEnum) {
+		Result->EnumNames = Dict->Names;
+		Result->EnumSize = Dict->Size;
+	}
+	double Min = INFINITY, Max = -INFINITY, Sum = 0.0, Sum2 = 0.0;
+	for (int I = 0; I < NumRows; ++I) {
+		double Value = Values[I];
+		if (isnan(Value)) continue;
+		if (Min > Value) Min = Value;
+		if (Max < Value) Max = Value;
+		Sum += Value;
+		Sum2 += Value * Value;
+	}
+	Result->Min = Min;
+	Result->Max = Max;
+	Result->Sum = Sum;
+	Result->Sum2 = Sum2;
+}
+
+void csv_index_close(csv_index_t *Index) {
+	enum_dict_free(Index->Dict);
+	free(Index->RowOffsets);
+#ifndef MINGW
+	munmap((void *)Index->Data, Index->Size);
+#endif
+	close(Index->Fd);
+	free(Index);
+}
@@ -0,0 +1,48 @@
+#ifndef CSV_LOADER_H
+#define CSV_LOADER_H
+
+#include <stddef.h>
+
+typedef struct csv_loader_t csv_loader_t;
+typedef struct csv_index_t csv_index_t;
+
+typedef struct {
+	const char *Name;
+	const char **EnumNames;
+	int EnumSize;
+	double Min, Max, Sum, Sum2;
+} csv_loader_column_t;
+
+typedef struct {
+	double **Values;
+	const char *Names;
+	const size_t *NameOffsets;
+	int NumRows;
+} csv_loader_block_t;
+
+typedef enum {
+	CSV_LOADER_WAIT,
+	CSV_LOADER_ROWS,
+	CSV_LOADER_RESET,
+	CSV_LOADER_RETYPE,
+	CSV_LOADER_DONE
+} csv_loader_status_t;
+
+csv_loader_t *csv_loader_open(const char *FileName, int NumThreads, const char **Projection);
+double csv_loader_progress(csv_loader_t *Loader);
+int csv_loader_capacity(csv_loader_t *Loader);
+int csv_loader_num_columns(csv_loader_t *Loader);
+int csv_loader_selected(csv_loader_t *Loader, int Index);
+csv_loader_column_t *csv_loader_column(csv_loader_t *Loader, int Index);
+csv_loader_status_t csv_loader_next(csv_loader_t *Loader, csv_loader_block_t **Block);
+int csv_loader_retyped(csv_loader_t *Loader);
+void csv_loader_convert(csv_loader_t *Loader, int Index, double *Values, int Count);
+void csv_loader_close(csv_loader_t *Loader);
+size_t csv_enum_name(const char **Text, size_t Size, char *Number);
+
+csv_index_t *csv_loader_index(csv_loader_t *Loader);
+int csv_index_num_rows(csv_index_t *Index);
+void csv_index_load(csv_index_t *Index, int Column, double *Values, csv_loader_column_t *Result, int NumThreads);
+void csv_index_close(csv_index_t *Index);
+
+#endif
@@ -0,0 +1,130 @@
+#include "csv_scan.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CSV_SCAN_X86
+#endif
+
+// Structural scanner for the CSV loader.
+// Each 64 byte block is turned into bitmasks of quotes and separators. A prefix
+// xor of the quote mask marks the bytes inside quoted fields, leaving only the
+// separators that end fields or rows. The kernel is chosen at runtime from the
+// features of the CPU.
+
+static size_t csv_scan_generic(const char *Data, size_t Length, uint64_t *Quoted, uint32_t *Indices) {
+	size_t Count = 0;
+	int InQuote = *Quoted != 0;
+	for (size_t I = 0; I < Length; ++I) {
+		switch (Data[I]) {
+		case '"':
+			InQuote = !InQuote;
+			break;
+		case ',': case '\r': case '\n':
+			if (!InQuote) Indices[Count++] = I;
+			break;
+		}
+	}
+	*Quoted = InQuote ? ~(uint64_t)0 : 0;
+	return Count;
+}
+
+#ifdef CSV_SCAN_X86
+
+static inline uint64_t csv_prefix_xor(uint64_t Bits) {
+	Bits ^= Bits << 1;
+	Bits ^= Bits << 2;
+	Bits ^= Bits << 4;
+	Bits ^= Bits << 8;
+	Bits ^= Bits << 16;
+	Bits ^= Bits << 32;
+	return Bits;
+}
+
+static inline size_t csv_flatten(uint64_t Bits, uint32_t Base, uint32_t *Indices) {
+	size_t Count = 0;
+	while (Bits) {
+		Indices[Count++] = Base + __builtin_ctzll(Bits);
+		Bits &= Bits - 1;
+	}
+	return Count;
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t csv_mask_avx2(__m256i Lo, __m256i Hi, char Char) {
+	__m256i Pattern = _mm256_set1_epi8(Char);
+	uint32_t MaskLo = _mm256_movemask_epi8(_mm256_cmpeq_epi8(Lo, Pattern));
+	uint32_t MaskHi = _mm256_movemask_epi8(_mm256_cmpeq_epi8(Hi, Pattern));
+	return MaskLo | ((uint64_t)MaskHi << 32);
+}
+
+__attribute__((target("avx2")))
+static size_t csv_scan_avx2(const char *Data, size_t Length, uint64_t *Quoted, uint32_t *Indices) {
+	size_t Count = 0;
+	uint64_t InQuote = *Quoted;
+	char Tail[64];
+	for (size_t Offset = 0; Offset < Length; Offset += 64) {
+		const char *Block = Data + Offset;
+		if (Length - Offset < 64) {
+			memset(Tail, 0, 64);
+			memcpy(Tail, Block, Length - Offset);
+			Block = Tail;
+		}
+		__m256i Lo = _mm256_loadu_si256((const __m256i *)Block);
+		__m256i Hi = _mm256_loadu_si256((const __m256i *)(Block + 32));
+		uint64_t Quotes = csv_mask_avx2(Lo, Hi, '"');
+		uint64_t Separators = csv_mask_avx2(Lo, Hi, ',') | csv_mask_avx2(Lo, Hi, '\n') | csv_mask_avx2(Lo, Hi, '\r');
+		uint64_t Inside = csv_prefix_xor(Quotes) ^ InQuote;
+		InQuote = (uint64_t)((int64_t)Inside >> 63);
+		Count += csv_flatten(Separators & ~Inside, Offset, Indices + Count);
+	}
+	*Quoted = InQuote;
+	return Count;
+}
+
+__attribute__((target("sse4.2")))
+static inline uint64_t csv_mask_sse42(__m128i A, __m128i B, __m128i C, __m128i D, char Char) {
+	__m128i Pattern = _mm_set1_epi8(Char);
+	uint64_t MaskA = _mm_movemask_epi8(_mm_cmpeq_epi8(A, Pattern));
+	uint64_t MaskB = _mm_movemask_epi8(_mm_cmpeq_epi8(B, Pattern));
+	uint64_t MaskC = _mm_movemask_epi8(_mm_cmpeq_epi8(C, Pattern));
+	uint64_t MaskD = _mm_movemask_epi8(_mm_cmpeq_epi8(D, Pattern));
+	return MaskA | (MaskB << 16) | (MaskC << 32) | (MaskD << 48);
+}
+
+__attribute__((target("sse4.2")))
+static size_t csv_scan_sse42(const char *Data, size_t Length, uint64_t *Quoted, uint32_t *Indices) {
+	size_t Count = 0;
+	uint64_t InQuote = *Quoted;
+	char Tail[64];
+	for (size_t Offset = 0; Offset < Length; Offset += 64) {
+		const char *Block = Data + Offset;
+		if (Length - Offset < 64) {
+			memset(Tail, 0, 64);
+			memcpy(Tail, Block, Length - Offset);
+			Block = Tail;
+		}
+		__m128i A = _mm_loadu_si128((const __m128i *)Block);
+		__m128i B = _mm_loadu_si128((const __m128i *)(Block + 16));
+		__m128i C = _mm_loadu_si128((const __m128i *)(Block + 32));
+		__m128i D = _mm_loadu_si128((const __m128i *)(Block + 48));
+		uint64_t Quotes = csv_mask_sse42(A, B, C, D, '"');
+		uint64_t Separators = csv_mask_sse42(A, B, C, D, ',') | csv_mask_sse42(A, B, C, D, '\n') | csv_mask_sse42(A, B, C, D, '\r');
+		uint64_t Inside = csv_prefix_xor(Quotes) ^ InQuote;
+		InQuote = (uint64_t)((int64_t)Inside >> 63);
+		Count += csv_flatten(Separators & ~Inside, Offset, Indices + Count);
+	}
+	*Quoted = InQuote;
+	return Count;
+}
+
+#endif
+
+csv_scan_fn *csv_scan_kernel(void) {
+#ifdef CSV_SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return csv_scan_avx2;
+	if (__builtin_cpu_supports("sse4.2")) return csv_scan_sse42;
+#endif
+	return csv_scan_generic;
+}
@@ -0,0 +1,14 @@
+#ifndef CSV_SCAN_H
+#define CSV_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Finds the offsets of all commas, carriage returns and newlines in Data that
+// are not inside quotes. *Quoted carries the quote state between calls (0 or
+// ~0). Indices must have room for Length entries. Returns the number found.
+typedef size_t csv_scan_fn(const char *Data, size_t Length, uint64_t *Quoted, uint32_t *Indices);
+
+csv_scan_fn *csv_scan_kernel(void);
+
+#endif
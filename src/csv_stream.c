@@ -0,0 +1,257 @@
+#include "csv_stream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <zlib.h>
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#define STREAM_INPUT_SIZE (1 << 18)
+#define STREAM_RING_SIZE (1 << 22)
+
+typedef enum {
+	CSV_STREAM_PLAIN,
+	CSV_STREAM_GZIP,
+	CSV_STREAM_ZSTD
+} csv_stream_format_t;
+
+struct csv_stream_t {
+	FILE *File;
+	unsigned char *Input;
+	char *Ring;
+	const char *Error;
+	pthread_t Thread;
+	pthread_mutex_t Lock[1];
+	pthread_cond_t Readable[1], Writable[1];
+	size_t InputSize, InputOffset, Position;
+	size_t Head, Tail;
+	csv_stream_format_t Format;
+	int Threaded, Finished, Closed;
+};
+
+static csv_stream_format_t csv_stream_format(const unsigned char *Header, size_t Size) {
+	if (Size >= 2 && Header[0] == 0x1F && Header[1] == 0x8B) return CSV_STREAM_GZIP;
+	if (Size >= 4 && Header[0] == 0x28 && Header[1] == 0xB5 && Header[2] == 0x2F && Header[3] == 0xFD) return CSV_STREAM_ZSTD;
+	return CSV_STREAM_PLAIN;
+}
+
+int csv_stream_compressed(const void *Header, size_t Size) {
+	return csv_stream_format(Header, Size) != CSV_STREAM_PLAIN;
+}
+
+// Refills the input buffer from the file, returning 0 at the end of the file.
+static size_t csv_stream_fill(csv_stream_t *Stream) {
+	size_t Count = fread(Stream->Input, 1, STREAM_INPUT_SIZE, Stream->File);
+	__atomic_add_fetch(&Stream->Position, Count, __ATOMIC_RELAXED);
+	return Count;
+}
+
+// Waits for free space in the ring and returns the contiguous part of it, or
+// 0 if the reader has closed the stream.
+static char *csv_stream_reserve(csv_stream_t *Stream, size_t *Space) {
+	pthread_mutex_lock(Stream->Lock);
+	while (Stream->Tail - Stream->Head == STREAM_RING_SIZE && !Stream->Closed) {
+		pthread_cond_wait(Stream->Writable, Stream->Lock);
+	}
+	size_t Available = STREAM_RING_SIZE - (Stream->Tail - Stream->Head);
+	int Closed = Stream->Closed;
+	pthread_mutex_unlock(Stream->Lock);
+	if (Closed) return 0;
+	size_t Offset = Stream->Tail % STREAM_RING_SIZE;
+	if (Available > STREAM_RING_SIZE - Offset) Available = STREAM_RING_SIZE - Offset;
+	*Space = Available;
+	return Stream->Ring + Offset;
+}
+
+static void csv_stream_commit(csv_stream_t *Stream, size_t Count) {
+	if (!Count) return;
+	pthread_mutex_lock(Stream->Lock);
+	Stream->Tail += Count;
+	pthread_cond_signal(Stream->Readable);
+	pthread_mutex_unlock(Stream->Lock);
+}
+
+static void csv_stream_finish(csv_stream_t *Stream, const char *Error) {
+	pthread_mutex_lock(Stream->Lock);
+	Stream->Error = Error;
+	Stream->Finished = 1;
+	pthread_cond_broadcast(Stream->Readable);
+	pthread_mutex_unlock(Stream->Lock);
+}
+
+// Inflates straight into the ring. A full output buffer may leave data inside
+// zlib, so more input is only read once a call stops filling the output.
+static void *csv_stream_gzip_thread(csv_stream_t *Stream) {
+	z_stream Z[1];
+	memset(Z, 0, sizeof(z_stream));
+	if (inflateInit2(Z, 15 + 32) != Z_OK) {
+		csv_stream_finish(Stream, "failed to initialise zlib");
+		return 0;
+	}
+	Z->next_in = Stream->Input;
+	Z->avail_in = Stream->InputSize;
+	const char *Error = 0;
+	int Status = Z_OK, Full = 0;
+	while (!Error) {
+		if (!Z->avail_in && !Full) {
+			Z->next_in = Stream->Input;
+			Z->avail_in = csv_stream_fill(Stream);
+			if (!Z->avail_in) {
+				if (Status != Z_STREAM_END) Error = "truncated gzip data";
+				break;
+			}
+		}
+		// Concatenated gzip members each have their own header.
+		if (Status == Z_STREAM_END) inflateReset(Z);
+		size_t Space;
+		char *Output = csv_stream_reserve(Stream, &Space);
+		if (!Output) break;
+		Z->next_out = (Bytef *)Output;
+		Z->avail_out = Space;
+		Status = inflate(Z, Z_NO_FLUSH);
+		csv_stream_commit(Stream, Space - Z->avail_out);
+		Full = Status != Z_STREAM_END && !Z->avail_out;
+		if (Status != Z_OK && Status != Z_STREAM_END && Status != Z_BUF_ERROR) Error = Z->msg ?: "corrupt gzip data";
+	}
+	inflateEnd(Z);
+	csv_stream_finish(Stream, Error);
+	return 0;
+}
+
+#ifdef USE_ZSTD
+static void *csv_stream_zstd_thread(csv_stream_t *Stream) {
+	ZSTD_DStream *Z = ZSTD_createDStream();
+	if (!Z || ZSTD_isError(ZSTD_initDStream(Z))) {
+		if (Z) ZSTD_freeDStream(Z);
+		csv_stream_finish(Stream, "failed to initialise zstd");
+		return 0;
+	}
+	ZSTD_inBuffer In = {Stream->Input, Stream->InputSize, 0};
+	const char *Error = 0;
+	size_t Hint = 1;
+	int Full = 0;
+	while (!Error) {
+		if (In.pos == In.size && !Full) {
+			In.size = csv_stream_fill(Stream);
+			In.pos = 0;
+			if (!In.size) {
+				if (Hint) Error = "truncated zstd data";
+				break;
+			}
+		}
+		size_t Space;
+		char *Output = csv_stream_reserve(Stream, &Space);
+		if (!Output) break;
+		ZSTD_outBuffer Out = {Output, Space, 0};
+		Hint = ZSTD_decompressStream(Z, &Out, &In);
+		csv_stream_commit(Stream, Out.pos);
+		Full = Hint && Out.pos == Out.size;
+		if (ZSTD_isError(Hint)) Error = ZSTD_getErrorName(Hint);
+	}
+	ZSTD_freeDStream(Z);
+	csv_stream_finish(Stream, Error);
+	return 0;
+}
+#endif
+
+// Opens a plain, gzip or zstd file. Compressed files are decompressed on a
+// separate thread into a ring buffer so that parsing overlaps decompression.
+csv_stream_t *csv_stream_open(const char *FileName) {
+	FILE *File = fopen(FileName, "rb");
+	if (!File) return 0;
+	csv_stream_t *Stream = calloc(1, sizeof(csv_stream_t));
+	Stream->File = File;
+	Stream->Input = malloc(STREAM_INPUT_SIZE);
+	Stream->InputSize = Stream->Position = fread(Stream->Input, 1, 4, File);
+	Stream->Format = csv_stream_format(Stream->Input, Stream->InputSize);
+	if (Stream->Format == CSV_STREAM_PLAIN) return Stream;
+	pthread_mutex_init(Stream->Lock, 0);
+	pthread_cond_init(Stream->Readable, 0);
+	pthread_cond_init(Stream->Writable, 0);
+	void *(*Decompress)(csv_stream_t *) = csv_stream_gzip_thread;
+	if (Stream->Format == CSV_STREAM_ZSTD) {
+#ifdef USE_ZSTD
+		Decompress = csv_stream_zstd_thread;
+#else
+		Stream->Error = "zstd support not enabled";
+		Stream->Finished = 1;
+		return Stream;
+#endif
+	}
+	Stream->Ring = malloc(STREAM_RING_SIZE);
+	if (pthread_create(&Stream->Thread, 0, (void *)Decompress, Stream)) {
+		Stream->Error = "failed to start decompression thread";
+		Stream->Finished = 1;
+		return Stream;
+	}
+	Stream->Threaded = 1;
+	return Stream;
+}
+
+// Returns up to Size bytes of (decompressed) data, blocking until some are
+// available, or 0 at the end of the stream.
+size_t csv_stream_read(csv_stream_t *Stream, void *Buffer, size_t Size) {
+	if (Stream->Format == CSV_STREAM_PLAIN) {
+		size_t Count = Stream->InputSize - Stream->InputOffset;
+		if (Count) {
+			if (Count > Size) Count = Size;
+			memcpy(Buffer, Stream->Input + Stream->InputOffset, Count);
+			Stream->InputOffset += Count;
+			return Count;
+		}
+		Count = fread(Buffer, 1, Size, Stream->File);
+		Stream->Position += Count;
+		return Count;
+	}
+	pthread_mutex_lock(Stream->Lock);
+	while (Stream->Head == Stream->Tail && !Stream->Finished) {
+		pthread_cond_wait(Stream->Readable, Stream->Lock);
+	}
+	size_t Available = Stream->Tail - Stream->Head;
+	pthread_mutex_unlock(Stream->Lock);
+	if (!Available) return 0;
+	size_t Offset = Stream->Head % STREAM_RING_SIZE;
+	if (Available > STREAM_RING_SIZE - Offset) Available = STREAM_RING_SIZE - Offset;
+	if (Available > Size) Available = Size;
+	memcpy(Buffer, Stream->Ring + Offset, Available);
+	pthread_mutex_lock(Stream->Lock);
+	Stream->Head += Available;
+	pthread_cond_signal(Stream->Writable);
+	pthread_mutex_unlock(Stream->Lock);
+	return Available;
+}
+
+// Returns the number of bytes consumed from the underlying file, for progress.
+size_t csv_stream_position(csv_stream_t *Stream) {
+	return __atomic_load_n(&Stream->Position, __ATOMIC_RELAXED);
+}
+
+// Returns the reason a compressed stream ended early, or 0.
+const char *csv_stream_error(csv_stream_t *Stream) {
+	if (Stream->Format == CSV_STREAM_PLAIN) return ferror(Stream->File) ? "read error" : 0;
+	pthread_mutex_lock(Stream->Lock);
+	const char *Error = Stream->Error;
+	pthread_mutex_unlock(Stream->Lock);
+	return Error;
+}
+
+void csv_stream_close(csv_stream_t *Stream) {
+	if (Stream->Format != CSV_STREAM_PLAIN) {
+		if (Stream->Threaded) {
+			pthread_mutex_lock(Stream->Lock);
+			Stream->Closed = 1;
+			pthread_cond_broadcast(Stream->Writable);
+			pthread_mutex_unlock(Stream->Lock);
+			pthread_join(Stream->Thread, 0);
+		}
+		pthread_cond_destroy(Stream->Writable);
+		pthread_cond_destroy(Stream->Readable);
+		pthread_mutex_destroy(Stream->Lock);
+	}
+	fclose(Stream->File);
+	free(Stream->Ring);
+	free(Stream->Input);
+	free(Stream);
+}
@@ -0,0 +1,16 @@
+#ifndef CSV_STREAM_H
+#define CSV_STREAM_H
+
+#include <stddef.h>
+
+typedef struct csv_stream_t csv_stream_t;
+
+int csv_stream_compressed(const void *Header, size_t Size);
+
+csv_stream_t *csv_stream_open(const char *FileName);
+size_t csv_stream_read(csv_stream_t *Stream, void *Buffer, size_t Size);
+size_t csv_stream_position(csv_stream_t *Stream);
+const char *csv_stream_error(csv_stream_t *Stream);
+void csv_stream_close(csv_stream_t *Stream);
+
+#endif
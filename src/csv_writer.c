@@ -0,0 +1,253 @@
+#include "csv_writer.h"
+#include "fast_strtod.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Buffered CSV output.
+// Fields are formatted straight into a large buffer, numbers with fast_dtoa
+// and strings quoted only when libcsv would otherwise read them differently.
+// csv_writer_rows formats chunks of rows on several threads into separate
+// in memory writers and appends the chunks to the file in order.
+
+#define CSV_WRITER_BUFFER_SIZE (1 << 20)
+#define CSV_WRITER_CHUNK_ROWS 16384
+
+struct csv_writer_t {
+	FILE *File;
+	char *Buffer;
+	size_t Size, Capacity;
+	int Fields, Blank, Error;
+};
+
+static csv_writer_t *csv_writer_new(FILE *File) {
+	csv_writer_t *Writer = malloc(sizeof(csv_writer_t));
+	Writer->File = File;
+	Writer->Buffer = malloc(CSV_WRITER_BUFFER_SIZE);
+	Writer->Capacity = CSV_WRITER_BUFFER_SIZE;
+	Writer->Size = 0;
+	Writer->Fields = Writer->Blank = Writer->Error = 0;
+	return Writer;
+}
+
+csv_writer_t *csv_writer_open(const char *FileName, const char *Mode) {
+	FILE *File = fopen(FileName, Mode);
+	if (!File) return 0;
+	return csv_writer_new(File);
+}
+
+static void csv_writer_flush(csv_writer_t *Writer) {
+	if (Writer->Size && fwrite(Writer->Buffer, 1, Writer->Size, Writer->File) != Writer->Size) Writer->Error = 1;
+	Writer->Size = 0;
+}
+
+// Returns space for at least Size more bytes. Writers without a file (the
+// chunks of csv_writer_rows) grow instead of flushing.
+static char *csv_writer_reserve(csv_writer_t *Writer, size_t Size) {
+	if (Writer->Size + Size > Writer->Capacity) {
+		if (Writer->File) csv_writer_flush(Writer);
+		if (Writer->Size + Size > Writer->Capacity) {
+			size_t Capacity = Writer->Capacity * 2;
+			while (Capacity < Writer->Size + Size) Capacity *= 2;
+			Writer->Buffer = realloc(Writer->Buffer, Capacity);
+			Writer->Capacity = Capacity;
+		}
+	}
+	return Writer->Buffer + Writer->Size;
+}
+
+static void csv_writer_append(csv_writer_t *Writer, const char *Data, size_t Size) {
+	if (Writer->File && Size >= Writer->Capacity) {
+		csv_writer_flush(Writer);
+		if (fwrite(Data, 1, Size, Writer->File) != Size) Writer->Error = 1;
+		return;
+	}
+	memcpy(csv_writer_reserve(Writer, Size), Data, Size);
+	Writer->Size += Size;
+}
+
+static inline void csv_writer_separator(csv_writer_t *Writer) {
+	if (Writer->Fields++) {
+		*csv_writer_reserve(Writer, 1) = ',';
+		++Writer->Size;
+	}
+}
+
+// Quotes are needed for delimiters, quotes and line breaks, and for leading
+// or trailing blanks which libcsv strips from unquoted fields.
+static int csv_needs_quotes(const char *Text, size_t Length) {
+	if (!Length) return 0;
+	if (Text[0] == ' ' || Text[0] == '\t') return 1;
+	if (Text[Length - 1] == ' ' || Text[Length - 1] == '\t') return 1;
+	for (const char *End = Text + Length; Text < End; ++Text) {
+		char Char = *Text;
+		if (Char == ',' || Char == '"' || Char == '\n' || Char == '\r') return 1;
+	}
+	return 0;
+}
+
+void csv_writer_text(csv_writer_t *Writer, const char *Text, size_t Length) {
+	csv_writer_separator(Writer);
+	Writer->Blank = !Length;
+	if (!csv_needs_quotes(Text, Length)) {
+		csv_writer_append(Writer, Text, Length);
+		return;
+	}
+	char *Output = csv_writer_reserve(Writer, 2 * Length + 2), *Start = Output;
+	*Output++ = '"';
+	for (const char *End = Text + Length; Text < End; ++Text) {
+		if (*Text == '"') *Output++ = '"';
+		*Output++ = *Text;
+	}
+	*Output++ = '"';
+	Writer->Size += Output - Start;
+}
+
+void csv_writer_real(csv_writer_t *Writer, double Value) {
+	csv_writer_separator(Writer);
+	Writer->Blank = 0;
+	Writer->Size += fast_dtoa(Value, csv_writer_reserve(Writer, FAST_DTOA_SIZE));
+}
+
+void csv_writer_integer(csv_writer_t *Writer, int64_t Value) {
+	csv_writer_separator(Writer);
+	Writer->Blank = 0;
+	char Digits[20], *Output = csv_writer_reserve(Writer, 21), *Start = Output;
+	uint64_t Magnitude = Value;
+	if (Value < 0) {
+		*Output++ = '-';
+		Magnitude = -Magnitude;
+	}
+	int Length = 0;
+	do Digits[Length++] = '0' + Magnitude % 10; while (Magnitude /= 10);
+	while (Length) *Output++ = Digits[--Length];
+	Writer->Size += Output - Start;
+}
+
+// A row with a single empty field is quoted, since libcsv skips blank lines.
+void csv_writer_end_row(csv_writer_t *Writer) {
+	if (Writer->Fields == 1 && Writer->Blank) csv_writer_append(Writer, "\"\"", 2);
+	*csv_writer_reserve(Writer, 1) = '\n';
+	++Writer->Size;
+	Writer->Fields = 0;
+}
+
+typedef struct {
+	pthread_mutex_t Lock[1];
+	pthread_cond_t Ready[1], Free[1];
+	csv_writer_row_fn RowFn;
+	void *Data;
+	csv_writer_t **Chunks;
+	char *Done;
+	int NumRows, NumChunks, Window, Next, Written;
+} csv_writer_job_t;
+
+static void *csv_writer_thread(csv_writer_job_t *Job) {
+	pthread_mutex_lock(Job->Lock);
+	for (;;) {
+		while (Job->Next < Job->NumChunks && Job->Next >= Job->Written + Job->Window) {
+			pthread_cond_wait(Job->Free, Job->Lock);
+		}
+		if (Job->Next == Job->NumChunks) break;
+		int Chunk = Job->Next++;
+		pthread_mutex_unlock(Job->Lock);
+		csv_writer_t *Writer = Job->Chunks[Chunk % Job->Window];
+		int Start = Chunk * CSV_WRITER_CHUNK_ROWS, End = Start + CSV_WRITER_CHUNK_ROWS;
+		if (End > Job->NumRows) End = Job->NumRows;
+		for (int Row = Start; Row < End; ++Row) Job->RowFn(Writer, Row, Job->Data);
+		pthread_mutex_lock(Job->Lock);
+		Job->Done[Chunk % Job->Window] = 1;
+		pthread_cond_broadcast(Job->Ready);
+	}
+	pthread_mutex_unlock(Job->Lock);
+	return 0;
+}
+
+static void csv_writer_rows_serial(csv_writer_t *Writer, int NumRows, csv_writer_row_fn RowFn, csv_writer_progress_fn ProgressFn, void *Data) {
+	for (int Row = 0; Row < NumRows; ++Row) {
+		RowFn(Writer, Row, Data);
+		if (ProgressFn && (Row + 1) % CSV_WRITER_CHUNK_ROWS == 0) ProgressFn(Row + 1, Data);
+	}
+	if (ProgressFn) ProgressFn(NumRows, Data);
+}
+
+static void csv_writer_job_free(csv_writer_job_t *Job) {
+	for (int I = 0; I < Job->Window; ++I) {
+		free(Job->Chunks[I]->Buffer);
+		free(Job->Chunks[I]);
+	}
+	free(Job->Chunks);
+	free(Job->Done);
+	pthread_cond_destroy(Job->Free);
+	pthread_cond_destroy(Job->Ready);
+	pthread_mutex_destroy(Job->Lock);
+}
+
+// Calls RowFn for each row, which should write its fields and end the row.
+// With more than one thread, RowFn is called concurrently for different rows
+// and ProgressFn is called on the calling thread as chunks are written.
+void csv_writer_rows(csv_writer_t *Writer, int NumRows, int NumThreads, csv_writer_row_fn RowFn, csv_writer_progress_fn ProgressFn, void *Data) {
+	int NumChunks = (NumRows + CSV_WRITER_CHUNK_ROWS - 1) / CSV_WRITER_CHUNK_ROWS;
+	if (NumThreads > NumChunks) NumThreads = NumChunks;
+	if (NumThreads <= 1) {
+		csv_writer_rows_serial(Writer, NumRows, RowFn, ProgressFn, Data);
+		return;
+	}
+	csv_writer_job_t Job[1];
+	pthread_mutex_init(Job->Lock, 0);
+	pthread_cond_init(Job->Ready, 0);
+	pthread_cond_init(Job->Free, 0);
+	Job->RowFn = RowFn;
+	Job->Data = Data;
+	Job->NumRows = NumRows;
+	Job->NumChunks = NumChunks;
+	Job->Window = 2 * NumThreads;
+	Job->Next = Job->Written = 0;
+	Job->Chunks = malloc(Job->Window * sizeof(csv_writer_t *));
+	Job->Done = calloc(Job->Window, 1);
+	for (int I = 0; I < Job->Window; ++I) Job->Chunks[I] = csv_writer_new(0);
+	pthread_t *Threads = malloc(NumThreads * sizeof(pthread_t));
+	int NumStarted = 0;
+	while (NumStarted < NumThreads) {
+		if (pthread_create(Threads + NumStarted, 0, (void *)csv_writer_thread, Job)) break;
+		++NumStarted;
+	}
+	if (!NumStarted) {
+		free(Threads);
+		csv_writer_job_free(Job);
+		csv_writer_rows_serial(Writer, NumRows, RowFn, ProgressFn, Data);
+		return;
+	}
+	for (int Chunk = 0; Chunk < NumChunks; ++Chunk) {
+		int Slot = Chunk % Job->Window;
+		pthread_mutex_lock(Job->Lock);
+		while (!Job->Done[Slot]) pthread_cond_wait(Job->Ready, Job->Lock);
+		pthread_mutex_unlock(Job->Lock);
+		csv_writer_t *Formatted = Job->Chunks[Slot];
+		csv_writer_append(Writer, Formatted->Buffer, Formatted->Size);
+		Formatted->Size = 0;
+		pthread_mutex_lock(Job->Lock);
+		Job->Done[Slot] = 0;
+		++Job->Written;
+		pthread_cond_broadcast(Job->Free);
+		pthread_mutex_unlock(Job->Lock);
+		if (ProgressFn) {
+			int Rows = (Chunk + 1) * CSV_WRITER_CHUNK_ROWS;
+			ProgressFn(Rows < NumRows ? Rows : NumRows, Data);
+		}
+	}
+	for (int I = 0; I < NumStarted; ++I) pthread_join(Threads[I], 0);
+	free(Threads);
+	csv_writer_job_free(Job);
+}
+
+// Flushes and closes the file, returning 0 or -1 if any write failed.
+int csv_writer_close(csv_writer_t *Writer) {
+	csv_writer_flush(Writer);
+	if (fclose(Writer->File)) Writer->Error = 1;
+	int Error = Writer->Error;
+	free(Writer->Buffer);
+	free(Writer);
+	return Error ? -1 : 0;
+}
@@ -0,0 +1,20 @@
+#ifndef CSV_WRITER_H
+#define CSV_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct csv_writer_t csv_writer_t;
+
+typedef void (*csv_writer_row_fn)(csv_writer_t *Writer, int Row, void *Data);
+typedef void (*csv_writer_progress_fn)(int Rows, void *Data);
+
+csv_writer_t *csv_writer_open(const char *FileName, const char *Mode);
+void csv_writer_text(csv_writer_t *Writer, const char *Text, size_t Length);
+void csv_writer_real(csv_writer_t *Writer, double Value);
+void csv_writer_integer(csv_writer_t *Writer, int64_t Value);
+void csv_writer_end_row(csv_writer_t *Writer);
+void csv_writer_rows(csv_writer_t *Writer, int NumRows, int NumThreads, csv_writer_row_fn RowFn, csv_writer_progress_fn ProgressFn, void *Data);
+int csv_writer_close(csv_writer_t *Writer);
+
+#endif
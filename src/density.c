@@ -0,0 +1,139 @@
+#include "density.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Density pyramid for drawing many points zoomed out.
+// Points are binned into the finest level with running counts and colour
+// channel sums, then each coarser level sums 2 x 2 bins of the one below in
+// a scratch buffer. The finest sums are kept so points can be added and
+// removed as rows are filtered, each level stores its counts and average
+// colours, recomputed when a level is next read after a change.
+
+#define DENSITY_SIZE (1 << DENSITY_MAX_LEVEL)
+
+struct density_t {
+	density_level_t Levels[DENSITY_MAX_LEVEL + 1];
+	uint64_t *Sums;
+	double MinX, MinY, ScaleX, ScaleY;
+	int Dirty;
+};
+
+density_t *density_new(void) {
+	return calloc(1, sizeof(density_t));
+}
+
+// Points outside the bounds are counted in the nearest edge bin.
+void density_begin(density_t *Density, double MinX, double MinY, double MaxX, double MaxY) {
+	double Width = MaxX > MinX ? MaxX - MinX : 1.0;
+	double Height = MaxY > MinY ? MaxY - MinY : 1.0;
+	Density->MinX = MinX;
+	Density->MinY = MinY;
+	Density->ScaleX = DENSITY_SIZE / Width;
+	Density->ScaleY = DENSITY_SIZE / Height;
+	for (int Level = 0; Level <= DENSITY_MAX_LEVEL; ++Level) {
+		density_level_t *Bins = Density->Levels + Level;
+		Bins->Size = 1 << Level;
+		Bins->MinX = MinX;
+		Bins->MinY = MinY;
+		Bins->BinX = Width / Bins->Size;
+		Bins->BinY = Height / Bins->Size;
+	}
+	if (!Density->Sums) Density->Sums = malloc(4 * DENSITY_SIZE * DENSITY_SIZE * sizeof(uint64_t));
+	memset(Density->Sums, 0, 4 * DENSITY_SIZE * DENSITY_SIZE * sizeof(uint64_t));
+	Density->Dirty = 1;
+}
+
+static inline int density_bin(double Value, double Min, double Scale) {
+	double Bin = (Value - Min) * Scale;
+	if (!(Bin >= 0.0)) return 0;
+	if (Bin >= DENSITY_SIZE) return DENSITY_SIZE - 1;
+	return (int)Bin;
+}
+
+void density_add(density_t *Density, const double *X, const double *Y, const uint32_t *Colours, int Count) {
+	uint64_t *Sums = Density->Sums;
+	for (int I = 0; I < Count; ++I) {
+		int BinX = density_bin(X[I], Density->MinX, Density->ScaleX);
+		int BinY = density_bin(Y[I], Density->MinY, Density->ScaleY);
+		uint64_t *Sum = Sums + 4 * (BinY * DENSITY_SIZE + BinX);
+		uint32_t Colour = Colours[I];
+		Sum[0] += 1;
+		Sum[1] += (Colour >> 16) & 0xFF;
+		Sum[2] += (Colour >> 8) & 0xFF;
+		Sum[3] += Colour & 0xFF;
+	}
+	Density->Dirty = 1;
+}
+
+// Points must be removed with the colours they were added with.
+void density_remove(density_t *Density, const double *X, const double *Y, const uint32_t *Colours, int Count) {
+	uint64_t *Sums = Density->Sums;
+	for (int I = 0; I < Count; ++I) {
+		int BinX = density_bin(X[I], Density->MinX, Density->ScaleX);
+		int BinY = density_bin(Y[I], Density->MinY, Density->ScaleY);
+		uint64_t *Sum = Sums + 4 * (BinY * DENSITY_SIZE + BinX);
+		uint32_t Colour = Colours[I];
+		Sum[0] -= 1;
+		Sum[1] -= (Colour >> 16) & 0xFF;
+		Sum[2] -= (Colour >> 8) & 0xFF;
+		Sum[3] -= Colour & 0xFF;
+	}
+	Density->Dirty = 1;
+}
+
+// The level below the finest is summed from the kept sums into the scratch
+// buffer, then bins of each coarser level are written at lower indices than
+// any bin of the level below that is still to be read, so the scratch sums
+// shrink in place.
+void density_finish(density_t *Density) {
+	if (!Density->Dirty) return;
+	uint64_t *Scratch = malloc(DENSITY_SIZE * DENSITY_SIZE * sizeof(uint64_t));
+	for (int Level = DENSITY_MAX_LEVEL; Level >= 0; --Level) {
+		int Size = 1 << Level;
+		uint64_t *Sums = Level < DENSITY_MAX_LEVEL ? Scratch : Density->Sums;
+		if (Level < DENSITY_MAX_LEVEL) {
+			const uint64_t *Source = Level == DENSITY_MAX_LEVEL - 1 ? Density->Sums : Scratch;
+			for (int Y = 0; Y < Size; ++Y) for (int X = 0; X < Size; ++X) {
+				const uint64_t *Below = Source + 4 * (2 * Y * 2 * Size + 2 * X);
+				uint64_t *Sum = Sums + 4 * (Y * Size + X);
+				for (int J = 0; J < 4; ++J) {
+					Sum[J] = Below[J] + Below[4 + J] + Below[8 * Size + J] + Below[8 * Size + 4 + J];
+				}
+			}
+		}
+		density_level_t *Bins = Density->Levels + Level;
+		if (!Bins->Counts) {
+			Bins->Counts = malloc(Size * Size * sizeof(uint32_t));
+			Bins->Colours = malloc(Size * Size * sizeof(uint32_t));
+		}
+		for (int I = 0; I < Size * Size; ++I) {
+			const uint64_t *Sum = Sums + 4 * I;
+			uint64_t Count = Sum[0];
+			Bins->Counts[I] = Count > UINT32_MAX ? UINT32_MAX : Count;
+			if (!Count) {
+				Bins->Colours[I] = 0;
+				continue;
+			}
+			uint32_t R = (Sum[1] + Count / 2) / Count;
+			uint32_t G = (Sum[2] + Count / 2) / Count;
+			uint32_t B = (Sum[3] + Count / 2) / Count;
+			Bins->Colours[I] = 0xFF000000 | (R << 16) | (G << 8) | B;
+		}
+	}
+	free(Scratch);
+	Density->Dirty = 0;
+}
+
+const density_level_t *density_level(density_t *Density, int Level) {
+	density_finish(Density);
+	return Density->Levels + Level;
+}
+
+void density_free(density_t *Density) {
+	for (int Level = 0; Level <= DENSITY_MAX_LEVEL; ++Level) {
+		free(Density->Levels[Level].Counts);
+		free(Density->Levels[Level].Colours);
+	}
+	free(Density->Sums);
+	free(Density);
+}
@@ -0,0 +1,26 @@
+#ifndef DENSITY_H
+#define DENSITY_H
+
+#include <stdint.h>
+
+#define DENSITY_MAX_LEVEL 10
+
+typedef struct density_t density_t;
+
+// Level L of the pyramid has 2^L x 2^L bins over the bounds, stored row by
+// row, each with its number of points and their average ARGB colour.
+typedef struct {
+	uint32_t *Counts, *Colours;
+	double MinX, MinY, BinX, BinY;
+	int Size;
+} density_level_t;
+
+density_t *density_new(void);
+void density_begin(density_t *Density, double MinX, double MinY, double MaxX, double MaxY);
+void density_add(density_t *Density, const double *X, const double *Y, const uint32_t *Colours, int Count);
+void density_remove(density_t *Density, const double *X, const double *Y, const uint32_t *Colours, int Count);
+void density_finish(density_t *Density);
+const density_level_t *density_level(density_t *Density, int Level);
+void density_free(density_t *Density);
+
+#endif
@@ -0,0 +1,147 @@
+#include "enum_dict.h"
+#include <stdlib.h>
+#include <string.h>
+#include <gc/gc.h>
+
+// Maps enum names to codes in order of first insertion. Code 0 is always the
+// empty name. Names are copied into arena chunks that never move, and Names
+// is only ever replaced by a larger copy, so callers may keep pointers to
+// names but must reload Names after an insert. The same dictionary serves the
+// viewer's fields (from the collected heap) and the CSV loader's threads
+// (from malloc), only the allocator differs.
+
+#define ENUM_DICT_ARENA_MIN 256
+#define ENUM_DICT_ARENA_SIZE 65536
+
+const enum_dict_allocator_t EnumDictGC[1] = {{GC_malloc, GC_malloc_atomic, 0}};
+const enum_dict_allocator_t EnumDictMalloc[1] = {{malloc, malloc, free}};
+
+static inline uint32_t enum_dict_hash(const char *Text, size_t Length) {
+	uint32_t Hash = 2166136261u;
+	for (size_t I = 0; I < Length; ++I) Hash = (Hash ^ (unsigned char)Text[I]) * 16777619u;
+	return Hash;
+}
+
+static void enum_dict_reserve(enum_dict_t *Dict) {
+	const enum_dict_allocator_t *Allocator = Dict->Allocator;
+	Dict->Space = 64;
+	Dict->Names = (const char **)Allocator->Alloc(Dict->Space * sizeof(const char *));
+	Dict->Hashes = (uint32_t *)Allocator->AllocAtomic(Dict->Space * sizeof(uint32_t));
+	Dict->Capacity = 128;
+	Dict->Slots = (int *)Allocator->AllocAtomic(Dict->Capacity * sizeof(int));
+	memset(Dict->Slots, 0, Dict->Capacity * sizeof(int));
+	Dict->Names[0] = "";
+	Dict->Hashes[0] = 0;
+}
+
+// Initializes an empty dictionary, no memory is allocated until the first
+// insert.
+void enum_dict_init(enum_dict_t *Dict, const enum_dict_allocator_t *Allocator) {
+	memset(Dict, 0, sizeof(enum_dict_t));
+	Dict->Allocator = Allocator;
+	Dict->Size = 1;
+}
+
+enum_dict_t *enum_dict_new(void) {
+	enum_dict_t *Dict = (enum_dict_t *)GC_malloc(sizeof(enum_dict_t));
+	enum_dict_init(Dict, EnumDictGC);
+	enum_dict_reserve(Dict);
+	return Dict;
+}
+
+// Releases the memory of a dictionary, leaving it empty.
+void enum_dict_free(enum_dict_t *Dict) {
+	const enum_dict_allocator_t *Allocator = Dict->Allocator;
+	if (Allocator->Free) {
+		Allocator->Free(Dict->Names);
+		Allocator->Free(Dict->Hashes);
+		Allocator->Free(Dict->Slots);
+		// Arena chunks are linked through their first word.
+		for (char *Arena = Dict->Arena; Arena;) {
+			char *Next = *(char **)Arena;
+			Allocator->Free(Arena);
+			Arena = Next;
+		}
+	}
+	enum_dict_init(Dict, Allocator);
+}
+
+// Returns the slot holding Text, or the empty slot where it would go.
+static int enum_dict_slot(enum_dict_t *Dict, const char *Text, size_t Length, uint32_t Hash) {
+	int Mask = Dict->Capacity - 1;
+	int I = Hash & Mask;
+	for (;;) {
+		int Code = Dict->Slots[I];
+		if (!Code) return I;
+		if (Dict->Hashes[Code] == Hash) {
+			const char *Name = Dict->Names[Code];
+			if (!strncmp(Name, Text, Length) && !Name[Length]) return I;
+		}
+		I = (I + 1) & Mask;
+	}
+}
+
+int enum_dict_search(enum_dict_t *Dict, const char *Text, size_t Length) {
+	if (!Length) return 0;
+	if (!Dict->Capacity) return -1;
+	int Code = Dict->Slots[enum_dict_slot(Dict, Text, Length, enum_dict_hash(Text, Length))];
+	return Code ?: -1;
+}
+
+int enum_dict_insert(enum_dict_t *Dict, const char *Text, size_t Length) {
+	if (!Length) return 0;
+	const enum_dict_allocator_t *Allocator = Dict->Allocator;
+	if (!Dict->Space) enum_dict_reserve(Dict);
+	if (2 * (Dict->Size + 1) > Dict->Capacity) {
+		// The hashes are cached, so rehashing does not touch the names.
+		int Capacity = 2 * Dict->Capacity;
+		int *Slots = (int *)Allocator->AllocAtomic(Capacity * sizeof(int));
+		memset(Slots, 0, Capacity * sizeof(int));
+		for (int Code = 1; Code < Dict->Size; ++Code) {
+			int J = Dict->Hashes[Code] & (Capacity - 1);
+			while (Slots[J]) J = (J + 1) & (Capacity - 1);
+			Slots[J] = Code;
+		}
+		if (Allocator->Free) Allocator->Free(Dict->Slots);
+		Dict->Slots = Slots;
+		Dict->Capacity = Capacity;
+	}
+	uint32_t Hash = enum_dict_hash(Text, Length);
+	int Slot = enum_dict_slot(Dict, Text, Length, Hash);
+	if (Dict->Slots[Slot]) return Dict->Slots[Slot];
+	if (Dict->Size == Dict->Space) {
+		int Space = 2 * Dict->Space;
+		const char **Names = (const char **)Allocator->Alloc(Space * sizeof(const char *));
+		memcpy(Names, Dict->Names, Dict->Size * sizeof(const char *));
+		uint32_t *Hashes = (uint32_t *)Allocator->AllocAtomic(Space * sizeof(uint32_t));
+		memcpy(Hashes, Dict->Hashes, Dict->Size * sizeof(uint32_t));
+		if (Allocator->Free) {
+			Allocator->Free(Dict->Names);
+			Allocator->Free(Dict->Hashes);
+		}
+		Dict->Names = Names;
+		Dict->Hashes = Hashes;
+		Dict->Space = Space;
+	}
+	if (Dict->ArenaSize + Length + 1 > Dict->ArenaSpace) {
+		// Chunks grow up to ENUM_DICT_ARENA_SIZE so that small dictionaries
+		// stay small.
+		size_t Space = Dict->ArenaSpace ? 2 * Dict->ArenaSpace : ENUM_DICT_ARENA_MIN;
+		if (Space > ENUM_DICT_ARENA_SIZE) Space = ENUM_DICT_ARENA_SIZE;
+		if (Space < sizeof(char *) + Length + 1) Space = sizeof(char *) + Length + 1;
+		char *Arena = (char *)Allocator->AllocAtomic(Space);
+		*(char **)Arena = Dict->Arena;
+		Dict->Arena = Arena;
+		Dict->ArenaSize = sizeof(char *);
+		Dict->ArenaSpace = Space;
+	}
+	char *Name = Dict->Arena + Dict->ArenaSize;
+	memcpy(Name, Text, Length);
+	Name[Length] = 0;
+	Dict->ArenaSize += Length + 1;
+	int Code = Dict->Size++;
+	Dict->Names[Code] = Name;
+	Dict->Hashes[Code] = Hash;
+	Dict->Slots[Slot] = Code;
+	return Code;
+}
@@ -0,0 +1,35 @@
+#ifndef ENUM_DICT_H
+#define ENUM_DICT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Where a dictionary gets its memory. AllocAtomic is used for memory without
+// pointers. Free is null for a collected heap, the dictionary then leaves
+// replaced arrays to the collector.
+typedef struct {
+	void *(*Alloc)(size_t Size);
+	void *(*AllocAtomic)(size_t Size);
+	void (*Free)(void *Ptr);
+} enum_dict_allocator_t;
+
+extern const enum_dict_allocator_t EnumDictGC[1];
+extern const enum_dict_allocator_t EnumDictMalloc[1];
+
+typedef struct {
+	const enum_dict_allocator_t *Allocator;
+	const char **Names;
+	uint32_t *Hashes;
+	int *Slots;
+	char *Arena;
+	size_t ArenaSize, ArenaSpace;
+	int Size, Space, Capacity;
+} enum_dict_t;
+
+enum_dict_t *enum_dict_new(void);
+void enum_dict_init(enum_dict_t *Dict, const enum_dict_allocator_t *Allocator);
+void enum_dict_free(enum_dict_t *Dict);
+int enum_dict_search(enum_dict_t *Dict, const char *Text, size_t Length);
+int enum_dict_insert(enum_dict_t *Dict, const char *Text, size_t Length);
+
+#endif
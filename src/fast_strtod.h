@@ -0,0 +1,9 @@
+#ifndef FAST_STRTOD_H
+#define FAST_STRTOD_H
+
+#define FAST_DTOA_SIZE 32
+
+double fast_strtod(const char *Text, char **End);
+int fast_dtoa(double Value, char *Buffer);
+
+#endif
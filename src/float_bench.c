@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "libcsv/csv.h"
+#include "fast_strtod.h"
+
+// Compares fast_strtod against strtod on the numeric cells of a CSV file.
+// Usage: float-bench file.csv [iterations]
+
+typedef struct {
+	char *Text;
+	size_t *Offsets;
+	size_t TextSize, TextCapacity;
+	int Row, Count, Capacity;
+} bench_t;
+
+static void bench_field_fn(void *Text, size_t Size, bench_t *Bench) {
+	if (!Bench->Row || !Size) return;
+	char *End;
+	strtod(Text, &End);
+	if (End == (char *)Text) return;
+	if (Bench->Count == Bench->Capacity) {
+		Bench->Capacity = Bench->Capacity ? 2 * Bench->Capacity : 4096;
+		Bench->Offsets = realloc(Bench->Offsets, Bench->Capacity * sizeof(size_t));
+	}
+	if (Bench->TextSize + Size + 1 > Bench->TextCapacity) {
+		Bench->TextCapacity = Bench->TextCapacity ? 2 * Bench->TextCapacity : 65536;
+		while (Bench->TextCapacity < Bench->TextSize + Size + 1) Bench->TextCapacity *= 2;
+		Bench->Text = realloc(Bench->Text, Bench->TextCapacity);
+	}
+	Bench->Offsets[Bench->Count++] = Bench->TextSize;
+	memcpy(Bench->Text + Bench->TextSize, Text, Size + 1);
+	Bench->TextSize += Size + 1;
+}
+
+static void bench_row_fn(int Char, bench_t *Bench) {
+	++Bench->Row;
+}
+
+static double bench_time(void) {
+	struct timespec Time[1];
+	clock_gettime(CLOCK_MONOTONIC, Time);
+	return Time->tv_sec + Time->tv_nsec / 1e9;
+}
+
+int main(int Argc, char **Argv) {
+	if (Argc < 2) {
+		fprintf(stderr, "Usage: %s file.csv [iterations]\n", Argv[0]);
+		return 1;
+	}
+	int Iterations = Argc > 2 ? atoi(Argv[2]) : 5;
+	FILE *File = fopen(Argv[1], "r");
+	if (!File) {
+		fprintf(stderr, "Error reading from %s\n", Argv[1]);
+		return 1;
+	}
+	bench_t Bench[1] = {{0,}};
+	struct csv_parser Parser[1];
+	char Buffer[4096];
+	csv_init(Parser, CSV_APPEND_NULL);
+	size_t Size;
+	while ((Size = fread(Buffer, 1, 4096, File)) > 0) {
+		csv_parse(Parser, Buffer, Size, (void *)bench_field_fn, (void *)bench_row_fn, Bench);
+	}
+	csv_fini(Parser, (void *)bench_field_fn, (void *)bench_row_fn, Bench);
+	csv_free(Parser);
+	fclose(File);
+	if (!Bench->Count) {
+		fprintf(stderr, "No numeric values in %s\n", Argv[1]);
+		return 1;
+	}
+
+	int Mismatches = 0;
+	for (int I = 0; I < Bench->Count; ++I) {
+		const char *Text = Bench->Text + Bench->Offsets[I];
+		double Expected = strtod(Text, 0), Actual = fast_strtod(Text, 0);
+		if (memcmp(&Expected, &Actual, sizeof(double)) && Mismatches++ < 10) {
+			printf("Mismatch: %s -> %.17g (strtod %.17g)\n", Text, Actual, Expected);
+		}
+	}
+
+	double Sum = 0.0, StrtodTime = 0.0, FastTime = 0.0;
+	for (int J = 0; J < Iterations; ++J) {
+		double Start = bench_time();
+		for (int I = 0; I < Bench->Count; ++I) Sum += strtod(Bench->Text + Bench->Offsets[I], 0);
+		double Middle = bench_time();
+		for (int I = 0; I < Bench->Count; ++I) Sum += fast_strtod(Bench->Text + Bench->Offsets[I], 0);
+		double End = bench_time();
+		StrtodTime += Middle - Start;
+		FastTime += End - Middle;
+	}
+	double Total = (double)Bench->Count * Iterations;
+	printf("%d values, %d iterations (checksum %g)\n", Bench->Count, Iterations, Sum);
+	printf("strtod:      %8.2f ns/value\n", 1e9 * StrtodTime / Total);
+	printf("fast_strtod: %8.2f ns/value (%.2fx)\n", 1e9 * FastTime / Total, StrtodTime / FastTime);
+	printf("%d mismatches\n", Mismatches);
+	return Mismatches != 0;
+}
@@ -0,0 +1,767 @@
+#include "kd_tree.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Implicit kd-tree over 2D points.
+// The tree is balanced and complete: node I has children 2I + 1 and 2I + 2,
+// the splits alternate between X and Y starting with X, and every leaf is at
+// the same depth. A node covering positions [Lo, Hi) gives the first
+// (Hi - Lo + 1) / 2 of them to its left child, so the ranges are recomputed
+// while descending and only the split values are stored. Left points are
+// less than or equal to the split and right points greater than or equal.
+// The points themselves are stored in leaf order as separate X, Y and row
+// arrays, and each leaf is a bucket of at most KD_LEAF_SIZE points which is
+// scanned without branches.
+// Every point stays in the tree when rows are filtered out: each leaf keeps a
+// bit mask of its live points and each node the number of live points below
+// it, so filtering only flips the bits of rows that changed and recounts,
+// and queries skip subtrees without live points.
+// Each node also keeps the bounding box of its points. Queries walk the tree
+// with an explicit stack, skip nodes whose boxes miss the query and return
+// whole subtrees inside it as ranges of the point arrays. Counts, and sums of
+// a value per row (kd_values_t), stop at such subtrees too.
+// Polygon queries classify each box as inside, outside or crossing the
+// polygon, so only the points of leaves on its edges are tested one by one.
+// Nearest neighbour queries visit the nearer child first and skip nodes
+// whose boxes are farther than the K-th nearest point found so far.
+
+struct kd_tree_t {
+	double *Splits, *X, *Y, *Boxes;
+	uint32_t *Rows, *Counts, *Slots;
+	uint64_t *Live, *RowLive;
+	int Count, Depth, NumRows, Version;
+};
+
+// Value sums over every point below each node, dead or live, so they only
+// change when the tree is rebuilt.
+struct kd_values_t {
+	kd_tree_t *Tree;
+	double *Values, *Sums, *Mins, *Maxs;
+	uint32_t *Counts;
+	int Version;
+};
+
+kd_tree_t *kd_tree_new(void) {
+	return calloc(1, sizeof(kd_tree_t));
+}
+
+// Points are identified during the build by their ranks in the X and Y
+// orders, so splitting needs no lookups by row: the left half of a node split
+// on X is exactly the points with XRank up to that of its middle point.
+typedef struct {
+	uint32_t Rank[2];
+} kd_point_t;
+
+typedef struct {
+	kd_tree_t *Tree;
+	const char *Coords;
+	size_t Stride;
+	const uint32_t *ByX;
+	kd_point_t *Sorted[2], *Buffer;
+} kd_build_t;
+
+static inline double kd_coord(kd_build_t *Build, uint32_t Row, int Axis) {
+	return ((const double *)(Build->Coords + Row * Build->Stride))[Axis];
+}
+
+// Sorted[Axis][Lo, Hi) holds the points of a node in order along Axis.
+static void kd_build_node(kd_build_t *Build, int Node, int Depth, int Lo, int Hi) {
+	kd_tree_t *Tree = Build->Tree;
+	if (Depth == Tree->Depth) {
+		const kd_point_t *Points = Build->Sorted[0];
+		int Leaf = Node - (1 << Depth) + 1;
+		uint32_t Slot = Leaf * KD_LEAF_SIZE;
+		Tree->Live[Leaf] = ~(uint64_t)0 >> (KD_LEAF_SIZE - (Hi - Lo));
+		double *Box = Tree->Boxes + 4 * Node;
+		Box[0] = Box[1] = INFINITY;
+		Box[2] = Box[3] = -INFINITY;
+		for (int I = Lo; I < Hi; ++I) {
+			uint32_t Row = Build->ByX[Points[I].Rank[0]];
+			double X = kd_coord(Build, Row, 0), Y = kd_coord(Build, Row, 1);
+			Tree->Slots[Row] = Slot + (I - Lo);
+			Tree->Rows[I] = Row;
+			Tree->X[I] = X;
+			Tree->Y[I] = Y;
+			Box[0] = X < Box[0] ? X : Box[0];
+			Box[1] = Y < Box[1] ? Y : Box[1];
+			Box[2] = X > Box[2] ? X : Box[2];
+			Box[3] = Y > Box[3] ? Y : Box[3];
+		}
+		return;
+	}
+	int Axis = Depth & 1, Mid = Lo + (Hi - Lo + 1) / 2;
+	const kd_point_t *Points = Build->Sorted[Axis];
+	uint32_t Last = Points[Mid - 1].Rank[Axis];
+	Tree->Splits[Node] = kd_coord(Build, Build->ByX[Points[Mid - 1].Rank[0]], Axis);
+	// Stable partition of the other order into the two halves, written to
+	// both sides to avoid unpredictable branches
+	kd_point_t *Other = Build->Sorted[!Axis], *Right = Build->Buffer;
+	int Next = Lo, NumRight = 0;
+	for (int I = Lo; I < Hi; ++I) {
+		kd_point_t Point = Other[I];
+		int Left = Point.Rank[Axis] <= Last;
+		Other[Next] = Right[NumRight] = Point;
+		Next += Left;
+		NumRight += !Left;
+	}
+	memcpy(Other + Next, Right, NumRight * sizeof(kd_point_t));
+	kd_build_node(Build, 2 * Node + 1, Depth + 1, Lo, Mid);
+	kd_build_node(Build, 2 * Node + 2, Depth + 1, Mid, Hi);
+}
+
+// Sums the live points of each leaf and then of each node above them.
+static void kd_tree_recount(kd_tree_t *Tree) {
+	int First = (1 << Tree->Depth) - 1;
+	uint32_t *Counts = Tree->Counts;
+	for (int Leaf = 0; Leaf <= First; ++Leaf) Counts[First + Leaf] = __builtin_popcountll(Tree->Live[Leaf]);
+	for (int Node = First; --Node >= 0;) Counts[Node] = Counts[2 * Node + 1] + Counts[2 * Node + 2];
+}
+
+// Boxes are stored as {MinX, MinY, MaxX, MaxY}. Leaf boxes are set by
+// kd_build_node, the boxes of the nodes above are their unions.
+static void kd_tree_bound(kd_tree_t *Tree) {
+	double *Boxes = Tree->Boxes;
+	for (int Node = (1 << Tree->Depth) - 1; --Node >= 0;) {
+		double *Box = Boxes + 4 * Node;
+		const double *Left = Boxes + 4 * (2 * Node + 1), *Right = Left + 4;
+		Box[0] = Left[0] < Right[0] ? Left[0] : Right[0];
+		Box[1] = Left[1] < Right[1] ? Left[1] : Right[1];
+		Box[2] = Left[2] > Right[2] ? Left[2] : Right[2];
+		Box[3] = Left[3] > Right[3] ? Left[3] : Right[3];
+	}
+}
+
+// Rebuilds the tree from Count rows given in X order (ByX) and in Y order
+// (ByY). The X and Y of row R are the first two doubles at Coords + R * Stride
+// bytes, rows are below NumRows. Every point starts out live.
+void kd_tree_build(kd_tree_t *Tree, const double *Coords, size_t Stride, const uint32_t *ByX, const uint32_t *ByY, int Count, int NumRows) {
+	free(Tree->Splits);
+	free(Tree->X);
+	free(Tree->Y);
+	free(Tree->Rows);
+	free(Tree->Boxes);
+	free(Tree->Counts);
+	free(Tree->Slots);
+	free(Tree->Live);
+	free(Tree->RowLive);
+	int Depth = 0;
+	while (((int64_t)Count + (1 << Depth) - 1) >> Depth > KD_LEAF_SIZE) ++Depth;
+	Tree->Count = Count;
+	Tree->Depth = Depth;
+	Tree->NumRows = NumRows;
+	++Tree->Version;
+	Tree->Splits = malloc((1 << Depth) * sizeof(double));
+	Tree->X = malloc((Count + 1) * sizeof(double));
+	Tree->Y = malloc((Count + 1) * sizeof(double));
+	Tree->Rows = malloc((Count + 1) * sizeof(uint32_t));
+	Tree->Boxes = malloc((2 << Depth) * 4 * sizeof(double));
+	Tree->Counts = malloc((2 << Depth) * sizeof(uint32_t));
+	// Rows left out of the tree use the spare mask after the last leaf
+	Tree->Slots = malloc((NumRows + 1) * sizeof(uint32_t));
+	Tree->Live = malloc(((1 << Depth) + 1) * sizeof(uint64_t));
+	Tree->RowLive = malloc((NumRows / 64 + 1) * sizeof(uint64_t));
+	memset(Tree->RowLive, 0xFF, (NumRows / 64 + 1) * sizeof(uint64_t));
+	for (int I = 0; I < NumRows; ++I) Tree->Slots[I] = (1 << Depth) * KD_LEAF_SIZE;
+	memset(Tree->Live, 0, ((1 << Depth) + 1) * sizeof(uint64_t));
+	if (Count) {
+		kd_build_t Build[1] = {{Tree, (const char *)Coords, Stride, ByX}};
+		uint32_t *RankY = malloc(NumRows * sizeof(uint32_t));
+		for (int I = 0; I < Count; ++I) RankY[ByY[I]] = I;
+		kd_point_t *Points = malloc(3 * Count * sizeof(kd_point_t));
+		Build->Sorted[0] = Points;
+		Build->Sorted[1] = Points + Count;
+		Build->Buffer = Points + 2 * Count;
+		for (int I = 0; I < Count; ++I) Build->Sorted[0][I] = (kd_point_t){{I, RankY[ByX[I]]}};
+		for (int I = 0; I < Count; ++I) Build->Sorted[1][Build->Sorted[0][I].Rank[1]] = Build->Sorted[0][I];
+		free(RankY);
+		kd_build_node(Build, 0, 0, 0, Count);
+		free(Points);
+		kd_tree_bound(Tree);
+	}
+	kd_tree_recount(Tree);
+}
+void kd_tree_clear(kd_tree_t *Tree) {
+	Tree->Count = 0;
+	++Tree->Version;
+}
+
+// Returns the number of live points.
+int kd_tree_count(kd_tree_t *Tree) {
+	return Tree->Count ? Tree->Counts[0] : 0;
+}
+
+// Marks the rows whose flag is non zero as live and the rest as filtered out,
+// the flag of row R being the int at Flags + R * Stride bytes. The flags are
+// read in row order and compared 64 at a time with the last ones, only rows
+// that changed touch their leaf masks.
+void kd_tree_filter(kd_tree_t *Tree, const int *Flags, size_t Stride) {
+	if (!Tree->Count) return;
+	uint64_t *Live = Tree->Live, *RowLive = Tree->RowLive;
+	const uint32_t *Slots = Tree->Slots;
+	const char *Flag = (const char *)Flags;
+	int NumRows = Tree->NumRows;
+	for (int Start = 0; Start < NumRows; Start += 64) {
+		int Size = NumRows - Start < 64 ? NumRows - Start : 64;
+		uint64_t Word = 0;
+		for (int I = 0; I < Size; ++I, Flag += Stride) Word |= (uint64_t)(*(const int *)Flag != 0) << I;
+		uint64_t Changed = Word ^ RowLive[Start / 64];
+		if (Size < 64) Changed &= ((uint64_t)1 << Size) - 1;
+		RowLive[Start / 64] ^= Changed;
+		while (Changed) {
+			uint32_t Slot = Slots[Start + __builtin_ctzll(Changed)];
+			Live[Slot / KD_LEAF_SIZE] ^= (uint64_t)1 << (Slot % KD_LEAF_SIZE);
+			Changed &= Changed - 1;
+		}
+	}
+	kd_tree_recount(Tree);
+}
+
+// Marks the Count rows in Rows live (if Live is non zero) or filtered out,
+// for callers that know which rows changed. Only the counts on the paths of
+// the rows that change are adjusted, unless there are enough of them that
+// recounting every node is cheaper.
+void kd_tree_mark(kd_tree_t *Tree, const uint32_t *Rows, int Count, int Live) {
+	if (!Tree->Count) return;
+	uint64_t *LiveMasks = Tree->Live, *RowLive = Tree->RowLive;
+	const uint32_t *Slots = Tree->Slots;
+	uint32_t *Counts = Tree->Counts;
+	int Depth = Tree->Depth, First = (1 << Depth) - 1;
+	int Recount = (int64_t)Count * (Depth + 1) > First + 1;
+	for (int I = 0; I < Count; ++I) {
+		uint32_t Row = Rows[I];
+		if (Row >= Tree->NumRows) continue;
+		uint64_t Bit = (uint64_t)1 << (Row % 64);
+		if (!(RowLive[Row / 64] & Bit) == !Live) continue;
+		RowLive[Row / 64] ^= Bit;
+		uint32_t Slot = Slots[Row];
+		int Leaf = Slot / KD_LEAF_SIZE;
+		LiveMasks[Leaf] ^= (uint64_t)1 << (Slot % KD_LEAF_SIZE);
+		if (Recount || Leaf > First) continue;
+		for (int Node = First + Leaf;; Node = (Node - 1) / 2) {
+			Counts[Node] += Live ? 1 : -1;
+			if (!Node) break;
+		}
+	}
+	if (Recount) kd_tree_recount(Tree);
+}
+
+static inline int kd_box_misses(const double *Box, const double *Min, const double *Max) {
+	return Box[0] > Max[0] || Box[2] < Min[0] || Box[1] > Max[1] || Box[3] < Min[1];
+}
+
+static inline int kd_box_inside(const double *Box, const double *Min, const double *Max) {
+	return Min[0] <= Box[0] && Box[2] <= Max[0] && Min[1] <= Box[1] && Box[3] <= Max[1];
+}
+
+// Polygons are Size vertices stored as X, Y pairs and implicitly closed,
+// points are inside by the even-odd rule.
+static int kd_polygon_contains(const double *Polygon, int Size, double X, double Y) {
+	int Inside = 0;
+	for (int I = 0, J = Size - 1; I < Size; J = I++) {
+		double XI = Polygon[2 * I], YI = Polygon[2 * I + 1];
+		double XJ = Polygon[2 * J], YJ = Polygon[2 * J + 1];
+		if ((YI > Y) != (YJ > Y) && X < XI + (XJ - XI) * (Y - YI) / (YJ - YI)) Inside = !Inside;
+	}
+	return Inside;
+}
+
+// Lists the edges which can cross the rays from points in Box, those that
+// overlap its Y range, by the index of their second vertex. Returns -1 if
+// there are more than KD_LEAF_SIZE.
+static int kd_polygon_edges(const double *Polygon, int Size, const double *Box, int *Edges) {
+	int NumEdges = 0;
+	for (int I = 0, J = Size - 1; I < Size; J = I++) {
+		double YI = Polygon[2 * I + 1], YJ = Polygon[2 * J + 1];
+		if ((YI > YJ ? YI : YJ) <= Box[1] || (YI < YJ ? YI : YJ) > Box[3]) continue;
+		if (NumEdges == KD_LEAF_SIZE) return -1;
+		Edges[NumEdges++] = I;
+	}
+	return NumEdges;
+}
+
+// As kd_polygon_contains() but only testing the listed edges, for points in
+// the box they were listed for.
+static int kd_edges_contain(const double *Polygon, int Size, const int *Edges, int NumEdges, double X, double Y) {
+	if (NumEdges < 0) return kd_polygon_contains(Polygon, Size, X, Y);
+	int Inside = 0;
+	for (int K = 0; K < NumEdges; ++K) {
+		int I = Edges[K], J = I ? I - 1 : Size - 1;
+		double XI = Polygon[2 * I], YI = Polygon[2 * I + 1];
+		double XJ = Polygon[2 * J], YJ = Polygon[2 * J + 1];
+		if ((YI > Y) != (YJ > Y) && X < XI + (XJ - XI) * (Y - YI) / (YJ - YI)) Inside = !Inside;
+	}
+	return Inside;
+}
+
+// An edge misses a box if their bounds do not overlap or all four corners
+// are strictly on one side of its line.
+static int kd_edge_touches(const double *Box, double X1, double Y1, double X2, double Y2) {
+	if ((X1 < X2 ? X2 : X1) < Box[0] || (X1 < X2 ? X1 : X2) > Box[2]) return 0;
+	if ((Y1 < Y2 ? Y2 : Y1) < Box[1] || (Y1 < Y2 ? Y1 : Y2) > Box[3]) return 0;
+	double DX = X2 - X1, DY = Y2 - Y1;
+	double C0 = DX * (Box[1] - Y1) - DY * (Box[0] - X1);
+	double C1 = DX * (Box[1] - Y1) - DY * (Box[2] - X1);
+	double C2 = DX * (Box[3] - Y1) - DY * (Box[0] - X1);
+	double C3 = DX * (Box[3] - Y1) - DY * (Box[2] - X1);
+	if (C0 > 0 && C1 > 0 && C2 > 0 && C3 > 0) return 0;
+	if (C0 < 0 && C1 < 0 && C2 < 0 && C3 < 0) return 0;
+	return 1;
+}
+
+// Returns 1 if Box is inside the polygon, -1 if it is outside and 0 if an
+// edge touches it. With no edge touching, the whole box is on the same side
+// as its corner.
+static int kd_polygon_side(const double *Polygon, int Size, const double *Box) {
+	for (int I = 0, J = Size - 1; I < Size; J = I++) {
+		if (kd_edge_touches(Box, Polygon[2 * J], Polygon[2 * J + 1], Polygon[2 * I], Polygon[2 * I + 1])) return 0;
+	}
+	return kd_polygon_contains(Polygon, Size, Box[0], Box[1]) ? 1 : -1;
+}
+
+void kd_cursor_init(kd_cursor_t *Cursor, kd_tree_t *Tree, double X1, double Y1, double X2, double Y2) {
+	Cursor->Tree = Tree;
+	Cursor->Polygon = 0;
+	Cursor->PolygonSize = 0;
+	Cursor->Min[0] = X1;
+	Cursor->Min[1] = Y1;
+	Cursor->Max[0] = X2;
+	Cursor->Max[1] = Y2;
+	Cursor->Top = 0;
+	if (!Tree->Count) return;
+	kd_frame_t *Frame = Cursor->Stack;
+	Frame->Node = Frame->Depth = Frame->Lo = 0;
+	Frame->Hi = Tree->Count;
+	Frame->Inside = 0;
+	Cursor->Top = 1;
+}
+
+// The polygon must stay valid while the cursor is in use. Polygons with less
+// than 3 vertices contain nothing.
+void kd_cursor_init_polygon(kd_cursor_t *Cursor, kd_tree_t *Tree, const double *Polygon, int Size) {
+	double Box[4] = {INFINITY, INFINITY, -INFINITY, -INFINITY};
+	for (int I = 0; I < Size; ++I) {
+		double X = Polygon[2 * I], Y = Polygon[2 * I + 1];
+		Box[0] = X < Box[0] ? X : Box[0];
+		Box[1] = Y < Box[1] ? Y : Box[1];
+		Box[2] = X > Box[2] ? X : Box[2];
+		Box[3] = Y > Box[3] ? Y : Box[3];
+	}
+	kd_cursor_init(Cursor, Tree, Box[0], Box[1], Box[2], Box[3]);
+	Cursor->Polygon = Polygon;
+	Cursor->PolygonSize = Size;
+	if (Size < 3) Cursor->Top = 0;
+}
+
+// Scans a leaf without branches, copying live points in the query (or all
+// live points if the leaf is inside it) to the cursor. Points of a leaf on the
+// edge of a polygon are also tested against the polygon.
+static int kd_cursor_leaf(kd_cursor_t *Cursor, int Leaf, int Lo, int Hi, int Inside) {
+	const kd_tree_t *Tree = Cursor->Tree;
+	const double *X = Tree->X, *Y = Tree->Y;
+	const uint32_t *Rows = Tree->Rows;
+	double X1 = Cursor->Min[0], X2 = Cursor->Max[0];
+	double Y1 = Cursor->Min[1], Y2 = Cursor->Max[1];
+	uint64_t Live = Tree->Live[Leaf];
+	int NumHits = 0;
+	for (int I = Lo; I < Hi; ++I, Live >>= 1) {
+		Cursor->Rows[NumHits] = Rows[I];
+		Cursor->X[NumHits] = X[I];
+		Cursor->Y[NumHits] = Y[I];
+		NumHits += (Live & 1) & (Inside | ((X[I] >= X1) & (X[I] <= X2) & (Y[I] >= Y1) & (Y[I] <= Y2)));
+	}
+	if (Cursor->Polygon && !Inside && NumHits) {
+		const double *Box = Tree->Boxes + 4 * (Leaf + (1 << Tree->Depth) - 1);
+		int Edges[KD_LEAF_SIZE];
+		int NumEdges = kd_polygon_edges(Cursor->Polygon, Cursor->PolygonSize, Box, Edges);
+		int NumInside = 0;
+		for (int I = 0; I < NumHits; ++I) {
+			if (!kd_edges_contain(Cursor->Polygon, Cursor->PolygonSize, Edges, NumEdges, Cursor->X[I], Cursor->Y[I])) continue;
+			Cursor->Rows[NumInside] = Cursor->Rows[I];
+			Cursor->X[NumInside] = Cursor->X[I];
+			Cursor->Y[NumInside] = Cursor->Y[I];
+			++NumInside;
+		}
+		NumHits = NumInside;
+	}
+	return NumHits;
+}
+
+// Returns the next batch of hits, or 0 once the query is finished.
+int kd_cursor_next(kd_cursor_t *Cursor, kd_batch_t *Batch) {
+	const kd_tree_t *Tree = Cursor->Tree;
+	while (Cursor->Top) {
+		kd_frame_t Frame = Cursor->Stack[--Cursor->Top];
+		uint32_t Count = Tree->Counts[Frame.Node];
+		if (!Count) continue;
+		int Inside = Frame.Inside;
+		if (!Inside) {
+			const double *Box = Tree->Boxes + 4 * Frame.Node;
+			if (kd_box_misses(Box, Cursor->Min, Cursor->Max)) continue;
+			if (Cursor->Polygon) {
+				int Side = kd_polygon_side(Cursor->Polygon, Cursor->PolygonSize, Box);
+				if (Side < 0) continue;
+				Inside = Side > 0;
+			} else {
+				Inside = kd_box_inside(Box, Cursor->Min, Cursor->Max);
+			}
+		}
+		if (Inside && Count == Frame.Hi - Frame.Lo) {
+			Batch->Rows = Tree->Rows + Frame.Lo;
+			Batch->X = Tree->X + Frame.Lo;
+			Batch->Y = Tree->Y + Frame.Lo;
+			Batch->Count = Count;
+			return 1;
+		}
+		if (Frame.Depth == Tree->Depth) {
+			int NumHits = kd_cursor_leaf(Cursor, Frame.Node - (1 << Frame.Depth) + 1, Frame.Lo, Frame.Hi, Inside);
+			if (!NumHits) continue;
+			Batch->Rows = Cursor->Rows;
+			Batch->X = Cursor->X;
+			Batch->Y = Cursor->Y;
+			Batch->Count = NumHits;
+			return 1;
+		}
+		int Mid = Frame.Lo + (Frame.Hi - Frame.Lo + 1) / 2;
+		// Right first, so the left child is visited first
+		Cursor->Stack[Cursor->Top++] = (kd_frame_t){2 * Frame.Node + 2, Frame.Depth + 1, Mid, Frame.Hi, Inside};
+		Cursor->Stack[Cursor->Top++] = (kd_frame_t){2 * Frame.Node + 1, Frame.Depth + 1, Frame.Lo, Mid, Inside};
+	}
+	return 0;
+}
+
+// Calls Fn for every live row with X1 <= X <= X2 and Y1 <= Y <= Y2.
+void kd_tree_range(kd_tree_t *Tree, double X1, double Y1, double X2, double Y2, kd_tree_fn Fn, void *Data) {
+	kd_cursor_t Cursor[1];
+	kd_batch_t Batch[1];
+	kd_cursor_init(Cursor, Tree, X1, Y1, X2, Y2);
+	while (kd_cursor_next(Cursor, Batch)) {
+		for (int I = 0; I < Batch->Count; ++I) Fn(Data, Batch->Rows[I]);
+	}
+}
+
+// Calls Fn for every live row inside the polygon.
+void kd_tree_polygon(kd_tree_t *Tree, const double *Polygon, int Size, kd_tree_fn Fn, void *Data) {
+	kd_cursor_t Cursor[1];
+	kd_batch_t Batch[1];
+	kd_cursor_init_polygon(Cursor, Tree, Polygon, Size);
+	while (kd_cursor_next(Cursor, Batch)) {
+		for (int I = 0; I < Batch->Count; ++I) Fn(Data, Batch->Rows[I]);
+	}
+}
+
+// The K best points found so far are kept in a max-heap on their squared
+// distances, so the farthest of them is at the root and bounds the search.
+typedef struct {
+	const kd_tree_t *Tree;
+	uint32_t *Rows;
+	double *Distances;
+	double X, Y, ScaleX, ScaleY, Worst;
+	int K, Count;
+} kd_nearest_t;
+
+// Moves the hole at I down a heap of Count entries until Row fits.
+static int kd_heap_sift(uint32_t *Rows, double *Distances, int Count, int I, double Distance) {
+	for (;;) {
+		int Child = 2 * I + 1;
+		if (Child >= Count) break;
+		if (Child + 1 < Count && Distances[Child + 1] > Distances[Child]) ++Child;
+		if (Distances[Child] <= Distance) break;
+		Rows[I] = Rows[Child];
+		Distances[I] = Distances[Child];
+		I = Child;
+	}
+	return I;
+}
+
+static void kd_nearest_push(kd_nearest_t *Walk, uint32_t Row, double Distance) {
+	uint32_t *Rows = Walk->Rows;
+	double *Distances = Walk->Distances;
+	int I;
+	if (Walk->Count < Walk->K) {
+		I = Walk->Count++;
+		while (I > 0) {
+			int Parent = (I - 1) / 2;
+			if (Distances[Parent] >= Distance) break;
+			Rows[I] = Rows[Parent];
+			Distances[I] = Distances[Parent];
+			I = Parent;
+		}
+	} else {
+		I = kd_heap_sift(Rows, Distances, Walk->Count, 0, Distance);
+	}
+	Rows[I] = Row;
+	Distances[I] = Distance;
+	if (Walk->Count == Walk->K) Walk->Worst = Distances[0];
+}
+
+// Once the heap is full a point must be strictly nearer than the root.
+static inline int kd_nearest_takes(const kd_nearest_t *Walk, double Distance) {
+	return Distance < Walk->Worst || (Distance == Walk->Worst && Walk->Count < Walk->K);
+}
+
+static inline double kd_box_distance(const kd_nearest_t *Walk, const double *Box) {
+	double DX = Box[0] > Walk->X ? Box[0] - Walk->X : Walk->X > Box[2] ? Walk->X - Box[2] : 0.0;
+	double DY = Box[1] > Walk->Y ? Box[1] - Walk->Y : Walk->Y > Box[3] ? Walk->Y - Box[3] : 0.0;
+	DX *= Walk->ScaleX;
+	DY *= Walk->ScaleY;
+	return DX * DX + DY * DY;
+}
+
+// Visits the child on the side of the query point first, so the heap fills
+// with near points early and the box of the other child is usually pruned.
+static void kd_nearest_node(kd_nearest_t *Walk, int Node, int Depth, int Lo, int Hi) {
+	const kd_tree_t *Tree = Walk->Tree;
+	if (!Tree->Counts[Node]) return;
+	if (!kd_nearest_takes(Walk, kd_box_distance(Walk, Tree->Boxes + 4 * Node))) return;
+	if (Depth == Tree->Depth) {
+		const double *X = Tree->X, *Y = Tree->Y;
+		uint64_t Live = Tree->Live[Node - (1 << Depth) + 1];
+		for (int I = Lo; I < Hi; ++I, Live >>= 1) {
+			if (!(Live & 1)) continue;
+			double DX = (X[I] - Walk->X) * Walk->ScaleX;
+			double DY = (Y[I] - Walk->Y) * Walk->ScaleY;
+			double Distance = DX * DX + DY * DY;
+			if (kd_nearest_takes(Walk, Distance)) kd_nearest_push(Walk, Tree->Rows[I], Distance);
+		}
+		return;
+	}
+	int Mid = Lo + (Hi - Lo + 1) / 2;
+	double Query = (Depth & 1) ? Walk->Y : Walk->X;
+	if (Query <= Tree->Splits[Node]) {
+		kd_nearest_node(Walk, 2 * Node + 1, Depth + 1, Lo, Mid);
+		kd_nearest_node(Walk, 2 * Node + 2, Depth + 1, Mid, Hi);
+	} else {
+		kd_nearest_node(Walk, 2 * Node + 2, Depth + 1, Mid, Hi);
+		kd_nearest_node(Walk, 2 * Node + 1, Depth + 1, Lo, Mid);
+	}
+}
+
+// Finds up to K live rows nearest to (X, Y) and within Radius, storing them
+// nearest first in Rows and their distances in Distances, and returns how
+// many were found. Offsets are scaled by ScaleX and ScaleY before measuring,
+// so distances can be in pixels; pass INFINITY for no radius.
+int kd_tree_nearest(kd_tree_t *Tree, double X, double Y, double ScaleX, double ScaleY, double Radius, int K, uint32_t *Rows, double *Distances) {
+	if (!Tree->Count || K <= 0 || isnan(X) || isnan(Y)) return 0;
+	kd_nearest_t Walk[1] = {{Tree, Rows, Distances, X, Y, ScaleX, ScaleY, Radius * Radius, K, 0}};
+	kd_nearest_node(Walk, 0, 0, 0, Tree->Count);
+	// Heap sort: the farthest remaining point goes to the end each time
+	for (int Count = Walk->Count; Count > 1;) {
+		uint32_t Row = Rows[--Count];
+		double Distance = Distances[Count];
+		Rows[Count] = Rows[0];
+		Distances[Count] = Distances[0];
+		int I = kd_heap_sift(Rows, Distances, Count, 0, Distance);
+		Rows[I] = Row;
+		Distances[I] = Distance;
+	}
+	for (int I = 0; I < Walk->Count; ++I) Distances[I] = sqrt(Distances[I]);
+	return Walk->Count;
+}
+
+// Calls Fn for every live row within Radius of (X, Y), in no particular
+// order, from a range query over the enclosing square.
+void kd_tree_radius(kd_tree_t *Tree, double X, double Y, double Radius, kd_tree_fn Fn, void *Data) {
+	kd_cursor_t Cursor[1];
+	kd_batch_t Batch[1];
+	double Radius2 = Radius * Radius;
+	kd_cursor_init(Cursor, Tree, X - Radius, Y - Radius, X + Radius, Y + Radius);
+	while (kd_cursor_next(Cursor, Batch)) {
+		for (int I = 0; I < Batch->Count; ++I) {
+			double DX = Batch->X[I] - X, DY = Batch->Y[I] - Y;
+			if (DX * DX + DY * DY <= Radius2) Fn(Data, Batch->Rows[I]);
+		}
+	}
+}
+
+typedef struct {
+	const kd_tree_t *Tree;
+	const kd_values_t *Values;
+	kd_summary_t *Summary;
+	double Min[2], Max[2];
+	const double *Polygon;
+	int PolygonSize;
+} kd_summarise_t;
+
+static void kd_summarise_node(kd_summarise_t *Walk, int Node, int Depth, int Lo, int Hi, int Inside) {
+	const kd_tree_t *Tree = Walk->Tree;
+	const kd_values_t *Values = Walk->Values;
+	kd_summary_t *Summary = Walk->Summary;
+	uint32_t Count = Tree->Counts[Node];
+	if (!Count) return;
+	if (!Inside) {
+		const double *Box = Tree->Boxes + 4 * Node;
+		if (kd_box_misses(Box, Walk->Min, Walk->Max)) return;
+		if (Walk->Polygon) {
+			int Side = kd_polygon_side(Walk->Polygon, Walk->PolygonSize, Box);
+			if (Side < 0) return;
+			Inside = Side > 0;
+		} else {
+			Inside = kd_box_inside(Box, Walk->Min, Walk->Max);
+		}
+	}
+	if (Inside && (!Values || Count == Hi - Lo)) {
+		Summary->Count += Count;
+		if (Values) {
+			Summary->NumValues += Values->Counts[Node];
+			Summary->Sum += Values->Sums[Node];
+			if (Values->Mins[Node] < Summary->Min) Summary->Min = Values->Mins[Node];
+			if (Values->Maxs[Node] > Summary->Max) Summary->Max = Values->Maxs[Node];
+		}
+		return;
+	}
+	if (Depth == Tree->Depth) {
+		const double *X = Tree->X, *Y = Tree->Y;
+		const double *Value = Values ? Values->Values : 0;
+		double X1 = Walk->Min[0], X2 = Walk->Max[0];
+		double Y1 = Walk->Min[1], Y2 = Walk->Max[1];
+		double Sum = 0.0, Min = Summary->Min, Max = Summary->Max;
+		uint64_t Live = Tree->Live[Node - (1 << Depth) + 1];
+		int NumHits = 0, NumValues = 0;
+		int Edges[KD_LEAF_SIZE], NumEdges = 0;
+		if (Walk->Polygon && !Inside) NumEdges = kd_polygon_edges(Walk->Polygon, Walk->PolygonSize, Tree->Boxes + 4 * Node, Edges);
+		for (int I = Lo; I < Hi; ++I, Live >>= 1) {
+			int Hit = (Live & 1) & (Inside | ((X[I] >= X1) & (X[I] <= X2) & (Y[I] >= Y1) & (Y[I] <= Y2)));
+			if (Hit && !Inside && Walk->Polygon) Hit = kd_edges_contain(Walk->Polygon, Walk->PolygonSize, Edges, NumEdges, X[I], Y[I]);
+			NumHits += Hit;
+			if (Value) {
+				double V = Value[I];
+				int Valid = Hit & (V == V);
+				NumValues += Valid;
+				Sum += Valid ? V : 0.0;
+				Min = Valid & (V < Min) ? V : Min;
+				Max = Valid & (V > Max) ? V : Max;
+			}
+		}
+		Summary->Count += NumHits;
+		Summary->NumValues += NumValues;
+		Summary->Sum += Sum;
+		Summary->Min = Min;
+		Summary->Max = Max;
+		return;
+	}
+	int Mid = Lo + (Hi - Lo + 1) / 2;
+	kd_summarise_node(Walk, 2 * Node + 1, Depth + 1, Lo, Mid, Inside);
+	kd_summarise_node(Walk, 2 * Node + 2, Depth + 1, Mid, Hi, Inside);
+}
+
+// Returns the number of live rows with X1 <= X <= X2 and Y1 <= Y <= Y2, only
+// visiting the nodes on the edges of the range.
+int kd_tree_range_count(kd_tree_t *Tree, double X1, double Y1, double X2, double Y2) {
+	kd_summary_t Summary[1] = {{0, 0, 0.0, INFINITY, -INFINITY}};
+	kd_summarise_t Walk[1] = {{Tree, 0, Summary, {X1, Y1}, {X2, Y2}}};
+	if (Tree->Count) kd_summarise_node(Walk, 0, 0, 0, Tree->Count, 0);
+	return Summary->Count;
+}
+
+// Sets the bounds of a polygon walk, returning 0 if the polygon contains
+// nothing.
+static int kd_summarise_polygon(kd_summarise_t *Walk, const double *Polygon, int Size) {
+	Walk->Min[0] = Walk->Min[1] = INFINITY;
+	Walk->Max[0] = Walk->Max[1] = -INFINITY;
+	for (int I = 0; I < Size; ++I) {
+		for (int Axis = 0; Axis < 2; ++Axis) {
+			double Value = Polygon[2 * I + Axis];
+			if (Value < Walk->Min[Axis]) Walk->Min[Axis] = Value;
+			if (Value > Walk->Max[Axis]) Walk->Max[Axis] = Value;
+		}
+	}
+	Walk->Polygon = Polygon;
+	Walk->PolygonSize = Size;
+	return Size >= 3 && Walk->Tree->Count;
+}
+
+// Returns the number of live rows inside the polygon, counting subtrees
+// inside it without visiting their points.
+int kd_tree_polygon_count(kd_tree_t *Tree, const double *Polygon, int Size) {
+	kd_summary_t Summary[1] = {{0, 0, 0.0, INFINITY, -INFINITY}};
+	kd_summarise_t Walk[1] = {{Tree, 0, Summary}};
+	if (kd_summarise_polygon(Walk, Polygon, Size)) kd_summarise_node(Walk, 0, 0, 0, Tree->Count, 0);
+	return Summary->Count;
+}
+
+static void kd_values_sum(kd_values_t *Sums, int Node, int Depth, int Lo, int Hi) {
+	if (Depth == Sums->Tree->Depth) {
+		double Sum = 0.0, Min = INFINITY, Max = -INFINITY;
+		int Count = 0;
+		for (int I = Lo; I < Hi; ++I) {
+			double V = Sums->Values[I];
+			int Valid = V == V;
+			Count += Valid;
+			Sum += Valid ? V : 0.0;
+			Min = Valid & (V < Min) ? V : Min;
+			Max = Valid & (V > Max) ? V : Max;
+		}
+		Sums->Sums[Node] = Sum;
+		Sums->Mins[Node] = Min;
+		Sums->Maxs[Node] = Max;
+		Sums->Counts[Node] = Count;
+		return;
+	}
+	int Mid = Lo + (Hi - Lo + 1) / 2, Left = 2 * Node + 1, Right = 2 * Node + 2;
+	kd_values_sum(Sums, Left, Depth + 1, Lo, Mid);
+	kd_values_sum(Sums, Right, Depth + 1, Mid, Hi);
+	Sums->Sums[Node] = Sums->Sums[Left] + Sums->Sums[Right];
+	Sums->Mins[Node] = Sums->Mins[Left] < Sums->Mins[Right] ? Sums->Mins[Left] : Sums->Mins[Right];
+	Sums->Maxs[Node] = Sums->Maxs[Left] > Sums->Maxs[Right] ? Sums->Maxs[Left] : Sums->Maxs[Right];
+	Sums->Counts[Node] = Sums->Counts[Left] + Sums->Counts[Right];
+}
+
+// Values holds one value per row, NaN for missing values. The sums are for
+// the tree as it is now and need building again after kd_tree_build.
+kd_values_t *kd_values_new(kd_tree_t *Tree, const double *Values) {
+	kd_values_t *Sums = malloc(sizeof(kd_values_t));
+	int Count = Tree->Count, NumNodes = 2 << Tree->Depth;
+	Sums->Tree = Tree;
+	Sums->Version = Tree->Version;
+	Sums->Values = malloc((Count + 1) * sizeof(double));
+	Sums->Sums = malloc(NumNodes * sizeof(double));
+	Sums->Mins = malloc(NumNodes * sizeof(double));
+	Sums->Maxs = malloc(NumNodes * sizeof(double));
+	Sums->Counts = malloc(NumNodes * sizeof(uint32_t));
+	for (int I = 0; I < Count; ++I) Sums->Values[I] = Values[Tree->Rows[I]];
+	kd_values_sum(Sums, 0, 0, 0, Count);
+	return Sums;
+}
+
+int kd_values_current(kd_values_t *Values) {
+	return Values->Version == Values->Tree->Version;
+}
+
+// Sums the rows with X1 <= X <= X2 and Y1 <= Y <= Y2 into Summary. Count is
+// the number of live rows and NumValues those without NaN values.
+void kd_values_range(kd_values_t *Values, double X1, double Y1, double X2, double Y2, kd_summary_t *Summary) {
+	kd_tree_t *Tree = Values->Tree;
+	*Summary = (kd_summary_t){0, 0, 0.0, INFINITY, -INFINITY};
+	kd_summarise_t Walk[1] = {{Tree, Values, Summary, {X1, Y1}, {X2, Y2}}};
+	if (Tree->Count) kd_summarise_node(Walk, 0, 0, 0, Tree->Count, 0);
+}
+
+// Sums the rows inside the polygon into Summary, as kd_values_range().
+void kd_values_polygon(kd_values_t *Values, const double *Polygon, int Size, kd_summary_t *Summary) {
+	*Summary = (kd_summary_t){0, 0, 0.0, INFINITY, -INFINITY};
+	kd_summarise_t Walk[1] = {{Values->Tree, Values, Summary}};
+	if (kd_summarise_polygon(Walk, Polygon, Size)) kd_summarise_node(Walk, 0, 0, 0, Values->Tree->Count, 0);
+}
+
+void kd_values_free(kd_values_t *Values) {
+	free(Values->Values);
+	free(Values->Sums);
+	free(Values->Mins);
+	free(Values->Maxs);
+	free(Values->Counts);
+	free(Values);
+}
+
+void kd_tree_free(kd_tree_t *Tree) {
+	free(Tree->Splits);
+	free(Tree->X);
+	free(Tree->Y);
+	free(Tree->Rows);
+	free(Tree->Boxes);
+	free(Tree->Counts);
+	free(Tree->Slots);
+	free(Tree->Live);
+	free(Tree->RowLive);
+	free(Tree);
+}
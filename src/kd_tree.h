@@ -0,0 +1,70 @@
+#ifndef KD_TREE_H
+#define KD_TREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define KD_LEAF_SIZE 64
+#define KD_STACK_SIZE 32
+
+typedef struct kd_tree_t kd_tree_t;
+typedef struct kd_values_t kd_values_t;
+
+typedef void (*kd_tree_fn)(void *Data, uint32_t Row);
+
+// A batch of hits: rows with their coordinates, either a whole subtree that
+// lies inside the query or the hits in one leaf. The arrays stay valid until
+// the next call to kd_cursor_next.
+typedef struct {
+	const uint32_t *Rows;
+	const double *X, *Y;
+	int Count;
+} kd_batch_t;
+
+typedef struct {
+	int Node, Depth, Lo, Hi, Inside;
+} kd_frame_t;
+
+// Count is the number of live rows in a range, and NumValues, Sum, Min and
+// Max are over those whose value is not NaN.
+typedef struct {
+	int Count, NumValues;
+	double Sum, Min, Max;
+} kd_summary_t;
+
+// Iterates over a range or polygon query with an explicit stack, stack
+// allocated by the caller.
+typedef struct {
+	kd_tree_t *Tree;
+	const double *Polygon;
+	int PolygonSize;
+	double Min[2], Max[2];
+	int Top;
+	kd_frame_t Stack[KD_STACK_SIZE];
+	uint32_t Rows[KD_LEAF_SIZE];
+	double X[KD_LEAF_SIZE], Y[KD_LEAF_SIZE];
+} kd_cursor_t;
+
+kd_tree_t *kd_tree_new(void);
+void kd_tree_build(kd_tree_t *Tree, const double *Coords, size_t Stride, const uint32_t *ByX, const uint32_t *ByY, int Count, int NumRows);
+void kd_tree_clear(kd_tree_t *Tree);
+int kd_tree_count(kd_tree_t *Tree);
+void kd_tree_filter(kd_tree_t *Tree, const int *Flags, size_t Stride);
+void kd_tree_mark(kd_tree_t *Tree, const uint32_t *Rows, int Count, int Live);
+void kd_tree_range(kd_tree_t *Tree, double X1, double Y1, double X2, double Y2, kd_tree_fn Fn, void *Data);
+void kd_cursor_init(kd_cursor_t *Cursor, kd_tree_t *Tree, double X1, double Y1, double X2, double Y2);
+void kd_cursor_init_polygon(kd_cursor_t *Cursor, kd_tree_t *Tree, const double *Polygon, int Size);
+int kd_cursor_next(kd_cursor_t *Cursor, kd_batch_t *Batch);
+int kd_tree_nearest(kd_tree_t *Tree, double X, double Y, double ScaleX, double ScaleY, double Radius, int K, uint32_t *Rows, double *Distances);
+void kd_tree_polygon(kd_tree_t *Tree, const double *Polygon, int Size, kd_tree_fn Fn, void *Data);
+int kd_tree_polygon_count(kd_tree_t *Tree, const double *Polygon, int Size);
+void kd_tree_radius(kd_tree_t *Tree, double X, double Y, double Radius, kd_tree_fn Fn, void *Data);
+int kd_tree_range_count(kd_tree_t *Tree, double X1, double Y1, double X2, double Y2);
+kd_values_t *kd_values_new(kd_tree_t *Tree, const double *Values);
+int kd_values_current(kd_values_t *Values);
+void kd_values_range(kd_values_t *Values, double X1, double Y1, double X2, double Y2, kd_summary_t *Summary);
+void kd_values_polygon(kd_values_t *Values, const double *Polygon, int Size, kd_summary_t *Summary);
+void kd_values_free(kd_values_t *Values);
+void kd_tree_free(kd_tree_t *Tree);
+
+#endif
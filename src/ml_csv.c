@@ -3,97 +3,350 @@
 #include "ml_macros.h"
 #include <string.h>
 #include <stdio.h>
+#include <math.h>
 #include <gc.h>
 
 #include "libcsv/csv.h"
+#include "csv_stream.h"
+#include "csv_writer.h"
+#include "fast_strtod.h"
 
-static ml_type_t *CsvT;
+#define CSV_INPUT_SIZE (1 << 20)
 
-typedef struct csv_row_t csv_row_t;
+static ml_type_t *CsvT;
+static ml_type_t *CsvIterT;
+static ml_type_t *CsvColumnT;
+static ml_type_t *CsvColumnIterT;
 
+// Rows parsed ahead of the reader are kept in one flat buffer instead of a
+// list per row. The text of each field is appended to Chars with a trailing
+// NUL, Ends holds the offset just past each field and Rows the number of
+// fields parsed by the end of each row. RowIndex is the first unread row.
 typedef struct csv_t {
 	const ml_type_t *Type;
-	FILE *File;
-	csv_row_t *Head, *Tail;
-	ml_value_t *Row;
+	csv_writer_t *Writer;
+	csv_stream_t *Stream;
+	char *Input;
+	char *Chars;
+	size_t *Ends, *Rows;
+	size_t CharsSize, CharsCapacity;
+	size_t NumFields, FieldsCapacity;
+	size_t NumRows, RowsCapacity, RowIndex;
+	int Finished;
 	struct csv_parser Parser[1];
 } csv_t;
 
-struct csv_row_t {
-	csv_row_t *Next;
-	ml_value_t *Values;
-};
-
 static void field_fn(void *Buffer, size_t Size, csv_t *Csv) {
-	char *Copy = GC_malloc_atomic(Size + 1);
-	memcpy(Copy, Buffer, Size);
-	Copy[Size] = 0;
-	ml_list_append(Csv->Row, ml_string(Copy, Size));
+	if (Csv->CharsSize + Size + 1 > Csv->CharsCapacity) {
+		size_t Capacity = Csv->CharsCapacity * 2;
+		while (Capacity < Csv->CharsSize + Size + 1) Capacity *= 2;
+		Csv->Chars = GC_realloc(Csv->Chars, Capacity);
+		Csv->CharsCapacity = Capacity;
+	}
+	memcpy(Csv->Chars + Csv->CharsSize, Buffer, Size);
+	Csv->CharsSize += Size;
+	Csv->Chars[Csv->CharsSize++] = 0;
+	if (Csv->NumFields == Csv->FieldsCapacity) {
+		Csv->FieldsCapacity *= 2;
+		Csv->Ends = GC_realloc(Csv->Ends, Csv->FieldsCapacity * sizeof(size_t));
+	}
+	Csv->Ends[Csv->NumFields++] = Csv->CharsSize;
 }
 
 static void row_fn(int Delim, csv_t *Csv) {
-	csv_row_t *Row = new(csv_row_t);
-	Row->Values = Csv->Row;
-	Csv->Row = ml_list();
-	if (Csv->Tail) {
-		Csv->Tail->Next = Row;
+	if (Csv->NumRows == Csv->RowsCapacity) {
+		Csv->RowsCapacity *= 2;
+		Csv->Rows = GC_realloc(Csv->Rows, Csv->RowsCapacity * sizeof(size_t));
+	}
+	Csv->Rows[Csv->NumRows++] = Csv->NumFields;
+}
+
+static inline size_t csv_row_start(csv_t *Csv, size_t Row) {
+	return Row ? Csv->Rows[Row - 1] : 0;
+}
+
+static inline size_t csv_field_start(csv_t *Csv, size_t Field) {
+	return Field ? Csv->Ends[Field - 1] : 0;
+}
+
+// Drops rows that have already been read, keeping any partial row.
+static void csv_compact(csv_t *Csv) {
+	size_t Rows = Csv->RowIndex;
+	if (!Rows) return;
+	size_t Fields = Csv->Rows[Rows - 1];
+	size_t Chars = csv_field_start(Csv, Fields);
+	memmove(Csv->Chars, Csv->Chars + Chars, Csv->CharsSize - Chars);
+	Csv->CharsSize -= Chars;
+	for (size_t I = Fields; I < Csv->NumFields; ++I) Csv->Ends[I - Fields] = Csv->Ends[I] - Chars;
+	Csv->NumFields -= Fields;
+	for (size_t I = Rows; I < Csv->NumRows; ++I) Csv->Rows[I - Rows] = Csv->Rows[I] - Fields;
+	Csv->NumRows -= Rows;
+	Csv->RowIndex = 0;
+}
+
+// Parses the next block of input, returning 0 once the input is exhausted.
+static int csv_fill(csv_t *Csv) {
+	if (Csv->Finished) return 0;
+	csv_compact(Csv);
+	size_t Size = csv_stream_read(Csv->Stream, Csv->Input, CSV_INPUT_SIZE);
+	if (Size) {
+		csv_parse(Csv->Parser, Csv->Input, Size, (void *)field_fn, (void *)row_fn, Csv);
 	} else {
-		Csv->Head = Row;
+		// Flushes a last row without a trailing newline.
+		csv_fini(Csv->Parser, (void *)field_fn, (void *)row_fn, Csv);
+		Csv->Finished = 1;
+	}
+	return 1;
+}
+
+// Returns the next row as a list of strings, MLNil at the end of the file or
+// an error. The fields of a row share a single copy of its text.
+static ml_value_t *csv_read_row(csv_t *Csv) {
+	if (!Csv->Stream) return ml_error("FileError", "Trying to read from closed file");
+	while (Csv->RowIndex == Csv->NumRows && csv_fill(Csv));
+	if (Csv->RowIndex == Csv->NumRows) {
+		const char *Error = csv_stream_error(Csv->Stream);
+		if (Error) return ml_error("FileError", "%s", Error);
+		return MLNil;
 	}
-	Csv->Tail = Row;
+	size_t Row = Csv->RowIndex++;
+	size_t First = csv_row_start(Csv, Row), Last = Csv->Rows[Row];
+	size_t Start = csv_field_start(Csv, First), End = csv_field_start(Csv, Last);
+	char *Copy = GC_malloc_atomic(End - Start);
+	memcpy(Copy, Csv->Chars + Start, End - Start);
+	ml_value_t *Values = ml_list();
+	for (size_t I = First; I < Last; ++I) {
+		size_t FieldStart = csv_field_start(Csv, I) - Start;
+		size_t FieldEnd = Csv->Ends[I] - Start;
+		ml_list_append(Values, ml_string(Copy + FieldStart, FieldEnd - FieldStart - 1));
+	}
+	return Values;
 }
 
 static ml_value_t *csv_read_fn(void *Data, int Count, ml_value_t **Args) {
+	return csv_read_row((csv_t *)Args[0]);
+}
+
+typedef struct csv_iter_t {
+	const ml_type_t *Type;
+	csv_t *Csv;
+	ml_value_t *Row;
+	long Index;
+} csv_iter_t;
+
+static void csv_iter_value(ml_state_t *Caller, csv_iter_t *Iter) {
+	ML_CONTINUE(Caller, Iter->Row);
+}
+
+static void csv_iter_key(ml_state_t *Caller, csv_iter_t *Iter) {
+	ML_CONTINUE(Caller, ml_integer(Iter->Index));
+}
+
+static void csv_iter_next(ml_state_t *Caller, csv_iter_t *Iter) {
+	ml_value_t *Row = csv_read_row(Iter->Csv);
+	if (Row == MLNil || Row->Type == MLErrorT) ML_CONTINUE(Caller, Row);
+	Iter->Row = Row;
+	++Iter->Index;
+	ML_CONTINUE(Caller, Iter);
+}
+
+// Iterating over a file reads one row at a time, so no rows are queued.
+static void csv_iterate(ml_state_t *Caller, csv_t *Csv) {
+	ml_value_t *Row = csv_read_row(Csv);
+	if (Row == MLNil || Row->Type == MLErrorT) ML_CONTINUE(Caller, Row);
+	csv_iter_t *Iter = new(csv_iter_t);
+	Iter->Type = CsvIterT;
+	Iter->Csv = Csv;
+	Iter->Row = Row;
+	Iter->Index = 1;
+	ML_CONTINUE(Caller, Iter);
+}
+
+// A column of a batch, either numbers in Reals or strings packed into Chars
+// with Ends holding the offset just past each string's NUL.
+typedef struct csv_column_t {
+	const ml_type_t *Type;
+	double *Reals;
+	char *Chars;
+	size_t *Ends;
+	long Length;
+} csv_column_t;
+
+static ml_value_t *csv_column_value(csv_column_t *Column, long Index) {
+	if (Column->Reals) return ml_real(Column->Reals[Index]);
+	size_t Start = Index ? Column->Ends[Index - 1] : 0;
+	return ml_string(Column->Chars + Start, Column->Ends[Index] - Start - 1);
+}
+
+// Builds column Index of rows First to First + NumRows. The column holds
+// reals if every field parses as a number, empty and missing fields becoming
+// nan, otherwise strings.
+static csv_column_t *csv_column(csv_t *Csv, size_t First, size_t NumRows, size_t Index) {
+	csv_column_t *Column = new(csv_column_t);
+	Column->Type = CsvColumnT;
+	Column->Length = NumRows;
+	double *Reals = GC_malloc_atomic(NumRows * sizeof(double));
+	size_t Length = 0;
+	for (size_t I = 0; I < NumRows; ++I) {
+		size_t Field = csv_row_start(Csv, First + I) + Index;
+		if (Field >= Csv->Rows[First + I]) {
+			++Length;
+			if (Reals) Reals[I] = NAN;
+			continue;
+		}
+		size_t Start = csv_field_start(Csv, Field), Size = Csv->Ends[Field] - Start - 1;
+		Length += Size + 1;
+		if (!Reals) continue;
+		if (!Size) {
+			Reals[I] = NAN;
+			continue;
+		}
+		const char *Text = Csv->Chars + Start;
+		char *End;
+		Reals[I] = fast_strtod(Text, &End);
+		if (End != Text + Size) Reals = 0;
+	}
+	if (Reals) {
+		Column->Reals = Reals;
+		return Column;
+	}
+	char *Chars = Column->Chars = GC_malloc_atomic(Length);
+	size_t *Ends = Column->Ends = GC_malloc_atomic(NumRows * sizeof(size_t));
+	size_t Offset = 0;
+	for (size_t I = 0; I < NumRows; ++I) {
+		size_t Field = csv_row_start(Csv, First + I) + Index;
+		if (Field < Csv->Rows[First + I]) {
+			size_t Start = csv_field_start(Csv, Field), Size = Csv->Ends[Field] - Start;
+			memcpy(Chars + Offset, Csv->Chars + Start, Size);
+			Offset += Size;
+		} else {
+			Chars[Offset++] = 0;
+		}
+		Ends[I] = Offset;
+	}
+	return Column;
+}
+
+// Reads up to N rows at once and returns them as a list of columns, or MLNil
+// at the end of the file. Rows shorter than the longest row in the batch are
+// padded with empty fields.
+static ml_value_t *csv_read_batch_fn(void *Data, int Count, ml_value_t **Args) {
+	ML_CHECK_ARG_TYPE(1, MLIntegerT);
 	csv_t *Csv = (csv_t *)Args[0];
-	if (!Csv->File) return ml_error("FileError", "Trying to read from closed file");
-	char Buffer[256];
-	while (!Csv->Head) {
-		size_t Size = fread(Buffer, 1, 256, Csv->File);
-		if (Size == 0) return MLNil;
-		csv_parse(Csv->Parser, Buffer, Size, (void *)field_fn, (void *)row_fn, Csv);
+	if (!Csv->Stream) return ml_error("FileError", "Trying to read from closed file");
+	long Limit = ml_integer_value(Args[1]);
+	if (Limit <= 0) return ml_error("ValueError", "Batch size must be positive");
+	while (Csv->NumRows - Csv->RowIndex < Limit && csv_fill(Csv));
+	size_t NumRows = Csv->NumRows - Csv->RowIndex;
+	if (!NumRows) {
+		const char *Error = csv_stream_error(Csv->Stream);
+		if (Error) return ml_error("FileError", "%s", Error);
+		return MLNil;
+	}
+	if (NumRows > Limit) NumRows = Limit;
+	size_t First = Csv->RowIndex, NumColumns = 0;
+	for (size_t I = First; I < First + NumRows; ++I) {
+		size_t Width = Csv->Rows[I] - csv_row_start(Csv, I);
+		if (NumColumns < Width) NumColumns = Width;
 	}
-	csv_row_t *Row = Csv->Head;
-	Csv->Head = Row->Next;
-	if (!Row->Next) Csv->Tail = 0;
-	return Row->Values;
+	ml_value_t *Columns = ml_list();
+	for (size_t J = 0; J < NumColumns; ++J) {
+		ml_list_append(Columns, (ml_value_t *)csv_column(Csv, First, NumRows, J));
+	}
+	Csv->RowIndex += NumRows;
+	return Columns;
+}
+
+static ml_value_t *csv_column_size_fn(void *Data, int Count, ml_value_t **Args) {
+	return ml_integer(((csv_column_t *)Args[0])->Length);
+}
+
+static ml_value_t *csv_column_index_fn(void *Data, int Count, ml_value_t **Args) {
+	csv_column_t *Column = (csv_column_t *)Args[0];
+	long Index = ml_integer_value(Args[1]);
+	if (Index <= 0) Index += Column->Length + 1;
+	if (Index <= 0 || Index > Column->Length) return MLNil;
+	return csv_column_value(Column, Index - 1);
+}
+
+typedef struct csv_column_iter_t {
+	const ml_type_t *Type;
+	csv_column_t *Column;
+	long Index;
+} csv_column_iter_t;
+
+static void csv_column_iter_value(ml_state_t *Caller, csv_column_iter_t *Iter) {
+	ML_CONTINUE(Caller, csv_column_value(Iter->Column, Iter->Index));
+}
+
+static void csv_column_iter_key(ml_state_t *Caller, csv_column_iter_t *Iter) {
+	ML_CONTINUE(Caller, ml_integer(Iter->Index + 1));
+}
+
+static void csv_column_iter_next(ml_state_t *Caller, csv_column_iter_t *Iter) {
+	if (++Iter->Index == Iter->Column->Length) ML_CONTINUE(Caller, MLNil);
+	ML_CONTINUE(Caller, Iter);
+}
+
+static void csv_column_iterate(ml_state_t *Caller, csv_column_t *Column) {
+	if (!Column->Length) ML_CONTINUE(Caller, MLNil);
+	csv_column_iter_t *Iter = new(csv_column_iter_t);
+	Iter->Type = CsvColumnIterT;
+	Iter->Column = Column;
+	Iter->Index = 0;
+	ML_CONTINUE(Caller, Iter);
 }
 
 static ml_value_t *StringMethod;
 
+// Reals and integers are formatted directly, other values through the string
+// method.
 static ml_value_t *csv_write_fn(void *Data, int Count, ml_value_t **Args) {
 	csv_t *Csv = (csv_t *)Args[0];
-	if (!Csv->File) return ml_error("FileError", "Trying to write to closed file");
+	if (!Csv->Writer) return ml_error("FileError", "Trying to write to closed file");
 	ml_list_t *Values = (ml_list_t *)Args[1];
-	int Comma = 0;
 	ML_LIST_FOREACH(Values, Iter) {
-		if (Comma) fputc(',', Csv->File);
 		ml_value_t *Field = Iter->Value;
+		if (Field->Type == MLRealT) {
+			csv_writer_real(Csv->Writer, ml_real_value(Field));
+			continue;
+		}
+		if (Field->Type == MLIntegerT) {
+			csv_writer_integer(Csv->Writer, ml_integer_value(Field));
+			continue;
+		}
 		if (Field->Type != MLStringT) {
 			Field = ml_call(StringMethod, 1, &Field);
 			if (Field->Type == MLErrorT) return Field;
 			if (Field->Type != MLStringT) return ml_error("ResultError", "string method did not return string");
 		}
-		csv_fwrite(Csv->File, ml_string_value(Field), ml_string_length(Field));
-		Comma = 1;
+		csv_writer_text(Csv->Writer, ml_string_value(Field), ml_string_length(Field));
 	}
-	fputc('\n', Csv->File);
+	csv_writer_end_row(Csv->Writer);
 	return Args[0];
 }
 
-static ml_value_t *csv_close_fn(void *Data, int Count, ml_value_t **Args) {
-	csv_t *Csv = (csv_t *)Args[0];
-	if (Csv->File) {
-		fclose(Csv->File);
-		Csv->File = 0;
+// Returns -1 if buffered rows could not be written.
+static int csv_close(csv_t *Csv) {
+	int Status = 0;
+	if (Csv->Writer) {
+		Status = csv_writer_close(Csv->Writer);
+		Csv->Writer = 0;
+	}
+	if (Csv->Stream) {
+		csv_stream_close(Csv->Stream);
+		Csv->Stream = 0;
 	}
+	return Status;
+}
+
+static ml_value_t *csv_close_fn(void *Data, int Count, ml_value_t **Args) {
+	if (csv_close((csv_t *)Args[0])) return ml_error("FileError", "Error writing file");
 	return MLNil;
 }
 
 static void csv_finalize(csv_t *Csv, void *Data) {
-	if (Csv->File) {
-		fclose(Csv->File);
-		Csv->File = 0;
-	}
+	csv_close(Csv);
 }
 
 static ml_value_t *csv_open(void *Data, int Count, ml_value_t **Args) {
@@ -107,13 +360,21 @@ static ml_value_t *csv_open(void *Data, int Count, ml_value_t **Args) {
 	ML_CHECK_ARG_TYPE(1, MLStringT);
 	const char *Path = ml_string_value(FileName);
 	const char *Mode = ml_string_value(Args[1]);
-	FILE *File = fopen(Path, Mode);
-	if (!File) return ml_error("FileError", "failed to open %s in mode %s", Path, Mode);
 	csv_t *Csv= new(csv_t);
 	Csv->Type = CsvT;
-	Csv->File = File;
+	// Files opened for reading may be gzip or zstd compressed.
+	if (Mode[0] == 'r') {
+		Csv->Stream = csv_stream_open(Path);
+		if (!Csv->Stream) return ml_error("FileError", "failed to open %s in mode %s", Path, Mode);
+		Csv->Input = GC_malloc_atomic(CSV_INPUT_SIZE);
+		Csv->Chars = GC_malloc_atomic(Csv->CharsCapacity = 4096);
+		Csv->Ends = GC_malloc_atomic((Csv->FieldsCapacity = 256) * sizeof(size_t));
+		Csv->Rows = GC_malloc_atomic((Csv->RowsCapacity = 64) * sizeof(size_t));
+	} else {
+		Csv->Writer = csv_writer_open(Path, Mode);
+		if (!Csv->Writer) return ml_error("FileError", "failed to open %s in mode %s", Path, Mode);
+	}
 	csv_init(Csv->Parser, 0);
-	Csv->Row = ml_list();
 	Csv->Parser->malloc_func = GC_malloc;
 	Csv->Parser->realloc_func = GC_realloc;
 	Csv->Parser->free_func = GC_free;
@@ -123,10 +384,24 @@ static ml_value_t *csv_open(void *Data, int Count, ml_value_t **Args) {
 
 void *ml_csv_init(stringmap_t *Globals) {
 	StringMethod = ml_method("string");
-	CsvT = ml_type(MLAnyT, "csv-file");
+	CsvT = ml_type(MLIteratableT, "csv-file");
+	CsvIterT = ml_type(MLAnyT, "csv-iter");
+	CsvColumnT = ml_type(MLIteratableT, "csv-column");
+	CsvColumnIterT = ml_type(MLAnyT, "csv-column-iter");
+	ml_typed_fn_set(CsvT, ml_iterate, csv_iterate);
+	ml_typed_fn_set(CsvIterT, ml_iter_value, csv_iter_value);
+	ml_typed_fn_set(CsvIterT, ml_iter_key, csv_iter_key);
+	ml_typed_fn_set(CsvIterT, ml_iter_next, csv_iter_next);
+	ml_typed_fn_set(CsvColumnT, ml_iterate, csv_column_iterate);
+	ml_typed_fn_set(CsvColumnIterT, ml_iter_value, csv_column_iter_value);
+	ml_typed_fn_set(CsvColumnIterT, ml_iter_key, csv_column_iter_key);
+	ml_typed_fn_set(CsvColumnIterT, ml_iter_next, csv_column_iter_next);
 	ml_method_by_name("read", 0, csv_read_fn, CsvT, NULL);
+	ml_method_by_name("read_batch", 0, csv_read_batch_fn, CsvT, MLIntegerT, NULL);
 	ml_method_by_name("write", 0, csv_write_fn, CsvT, MLListT, NULL);
 	ml_method_by_name("close", 0, csv_close_fn, CsvT, NULL);
+	ml_method_by_name("size", 0, csv_column_size_fn, CsvColumnT, NULL);
+	ml_method_by_name("[]", 0, csv_column_index_fn, CsvColumnT, MLIntegerT, NULL);
 	stringmap_insert(Globals, "csv_open", ml_cfunction(0, csv_open));
 	return 0;
 }
@@ -0,0 +1,123 @@
+#include "radix_sort.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+// Stable LSD radix sort of (key, row) pairs by key, 11 bits per pass.
+// Passes where every key has the same digit are skipped, so keys from narrow
+// integer fields only take the passes their values need. Each pass splits the
+// pairs into one chunk per thread: the threads count the digits in their
+// chunks, the counts are summed into per thread offsets in digit then thread
+// order, and the threads scatter their chunks to those offsets.
+
+#define RADIX_BITS 11
+#define RADIX_SIZE (1 << RADIX_BITS)
+#define RADIX_PASSES ((64 + RADIX_BITS - 1) / RADIX_BITS)
+#define RADIX_MIN_THREAD_COUNT 65536
+
+typedef struct radix_job_t radix_job_t;
+
+typedef struct {
+	radix_job_t *Job;
+	size_t Counts[RADIX_SIZE];
+	int Start, End;
+} radix_chunk_t;
+
+struct radix_job_t {
+	const uint64_t *Keys;
+	const uint32_t *Rows;
+	uint64_t *NewKeys;
+	uint32_t *NewRows;
+	radix_chunk_t *Chunks;
+	int Shift;
+};
+
+static void *radix_count(radix_chunk_t *Chunk) {
+	const uint64_t *Keys = Chunk->Job->Keys;
+	int Shift = Chunk->Job->Shift;
+	size_t *Counts = Chunk->Counts;
+	memset(Counts, 0, sizeof(Chunk->Counts));
+	for (int I = Chunk->Start; I < Chunk->End; ++I) ++Counts[(Keys[I] >> Shift) & (RADIX_SIZE - 1)];
+	return 0;
+}
+
+// Counts hold the output offsets by now.
+static void *radix_scatter(radix_chunk_t *Chunk) {
+	radix_job_t *Job = Chunk->Job;
+	const uint64_t *Keys = Job->Keys;
+	const uint32_t *Rows = Job->Rows;
+	uint64_t *NewKeys = Job->NewKeys;
+	uint32_t *NewRows = Job->NewRows;
+	int Shift = Job->Shift;
+	size_t *Offsets = Chunk->Counts;
+	for (int I = Chunk->Start; I < Chunk->End; ++I) {
+		uint64_t Key = Keys[I];
+		size_t Offset = Offsets[(Key >> Shift) & (RADIX_SIZE - 1)]++;
+		NewKeys[Offset] = Key;
+		NewRows[Offset] = Rows[I];
+	}
+	return 0;
+}
+
+// Runs Fn on every chunk, on the calling thread if threads can not be started.
+static void radix_run(radix_job_t *Job, int NumChunks, void *(*Fn)(radix_chunk_t *)) {
+	pthread_t Threads[NumChunks];
+	int NumStarted = 0;
+	for (int I = 1; I < NumChunks; ++I) {
+		if (pthread_create(Threads + NumStarted, 0, (void *)Fn, Job->Chunks + I)) {
+			Fn(Job->Chunks + I);
+		} else {
+			++NumStarted;
+		}
+	}
+	Fn(Job->Chunks);
+	for (int I = 0; I < NumStarted; ++I) pthread_join(Threads[I], 0);
+}
+
+// Sorts Keys in place, moving Rows with them.
+void radix_sort(uint64_t *Keys, uint32_t *Rows, int Count, int NumThreads) {
+	if (Count < 2) return;
+	// Bits that differ between any two keys, passes on other digits are skipped
+	uint64_t Differ = 0, First = Keys[0];
+	for (int I = 1; I < Count; ++I) Differ |= Keys[I] ^ First;
+	if (!Differ) return;
+	int NumChunks = Count / RADIX_MIN_THREAD_COUNT;
+	if (NumChunks > NumThreads) NumChunks = NumThreads;
+	if (NumChunks < 1) NumChunks = 1;
+	radix_chunk_t *Chunks = malloc(NumChunks * sizeof(radix_chunk_t));
+	radix_job_t Job[1] = {{Keys, Rows, malloc(Count * sizeof(uint64_t)), malloc(Count * sizeof(uint32_t)), Chunks, 0}};
+	for (int I = 0; I < NumChunks; ++I) {
+		Chunks[I].Job = Job;
+		Chunks[I].Start = (int64_t)Count * I / NumChunks;
+		Chunks[I].End = (int64_t)Count * (I + 1) / NumChunks;
+	}
+	uint64_t *Buffers[2] = {Keys, Job->NewKeys};
+	uint32_t *RowBuffers[2] = {Rows, Job->NewRows};
+	int Current = 0;
+	for (int Pass = 0; Pass < RADIX_PASSES; ++Pass) {
+		int Shift = Pass * RADIX_BITS;
+		if (!((Differ >> Shift) & (RADIX_SIZE - 1))) continue;
+		Job->Shift = Shift;
+		Job->Keys = Buffers[Current];
+		Job->Rows = RowBuffers[Current];
+		Job->NewKeys = Buffers[!Current];
+		Job->NewRows = RowBuffers[!Current];
+		radix_run(Job, NumChunks, radix_count);
+		size_t Offset = 0;
+		for (int Digit = 0; Digit < RADIX_SIZE; ++Digit) {
+			for (int I = 0; I < NumChunks; ++I) {
+				size_t Size = Chunks[I].Counts[Digit];
+				Chunks[I].Counts[Digit] = Offset;
+				Offset += Size;
+			}
+		}
+		radix_run(Job, NumChunks, radix_scatter);
+		Current = !Current;
+	}
+	if (Current) {
+		memcpy(Keys, Buffers[1], Count * sizeof(uint64_t));
+		memcpy(Rows, RowBuffers[1], Count * sizeof(uint32_t));
+	}
+	free(Buffers[1]);
+	free(RowBuffers[1]);
+	free(Chunks);
+}
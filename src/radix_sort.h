@@ -0,0 +1,19 @@
+#ifndef RADIX_SORT_H
+#define RADIX_SORT_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Maps doubles to unsigned keys in the same order. -0.0 sorts with 0.0 and
+// every NaN after +inf, so ties and NaNs sort deterministically.
+static inline uint64_t radix_sort_key(double Value) {
+	if (Value != Value) return UINT64_MAX;
+	if (Value == 0.0) Value = 0.0;
+	uint64_t Bits;
+	memcpy(&Bits, &Value, sizeof(Bits));
+	return (Bits >> 63) ? ~Bits : Bits | ((uint64_t)1 << 63);
+}
+
+void radix_sort(uint64_t *Keys, uint32_t *Rows, int Count, int NumThreads);
+
+#endif
@@ -2,7 +2,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "libcsv/csv.h"
 #include <gc/gc.h>
 #include <minilang.h>
@@ -13,6 +16,16 @@
 #include <ml_gir.h>
 #include <gtk_console.h>
 #include "ml_csv.h"
+#include "csv_loader.h"
+#include "csv_cache.h"
+#include "csv_stream.h"
+#include "csv_writer.h"
+#include "arrow_ipc.h"
+#include "column_map.h"
+#include "kd_tree.h"
+#include "radix_sort.h"
+#include "density.h"
+#include "fast_strtod.h"
 #include "ml_gir.h"
 #include <czmq.h>
 #include "viewer.h"
@@ -23,6 +36,13 @@
 
 #define MAX_CACHED_IMAGES 1024
 #define MAX_VISIBLE_IMAGES 64
+#define MAX_VISIBLE_VALUES 1024
+#define DENSITY_MIN_POINTS (1 << 20)
+#define HOVER_DISTANCE (BOX_SIZE / 2)
+#define LASSO_SPACING 3.0
+#define LASSO_NONE 0
+#define LASSO_OPEN 1
+#define LASSO_CLOSED 2
 #define POINT_COLOUR_CHROMA 0.5
 #define POINT_COLOUR_SATURATION 0.7
 #define POINT_COLOUR_VALUE 0.9
@@ -40,17 +60,31 @@
 #define FIELD_COLUMN_CONNECTED 3
 #define FIELD_COLUMN_REMOTE 4
 
-typedef void filter_fn_t(int Count, node_t *Nodes, double *Input, double Value);
+typedef void filter_fn_t(int Count, uint64_t *Rejected, field_t *Field, int Start, double Value);
 
+// Rejected has a bit set for each row the filter rejects, as of the Applied
+// settings for the first AppliedRows rows, so only the rows whose bits change
+// are passed on when the filter does.
 struct filter_t {
 	filter_t *Next;
 	viewer_t *Viewer;
-	field_t *Field;
-	filter_fn_t *Operator;
+	field_t *Field, *AppliedField;
+	filter_fn_t *Operator, *AppliedOperator;
 	GtkWidget *Widget, *ValueWidget;
-	double Value;
+	uint64_t *Rejected;
+	double Value, AppliedValue;
+	int RejectedSpace, AppliedRows, AppliedGeneration;
 };
 
+// Forgets the filtered rows when the nodes are reallocated or reset.
+static void filters_reset(viewer_t *Viewer) {
+	for (filter_t *Filter = Viewer->Filters; Filter; Filter = Filter->Next) {
+		Filter->Rejected = 0;
+		Filter->RejectedSpace = 0;
+		Filter->AppliedRows = 0;
+	}
+}
+
 #ifdef MINGW
 static char *stpcpy(char *Dest, const char *Source) {
 	while (*Source) *Dest++ = *Source++;
@@ -60,6 +94,259 @@ static char *stpcpy(char *Dest, const char *Source) {
 #define lstat stat
 #endif
 
+// File names are kept in one arena per dataset and nodes store 32-bit offsets
+// into it. Offset 0 is always the empty name.
+static void file_names_init(file_names_t *Names) {
+	Names->Space = 4096;
+	Names->Chars = GC_malloc_atomic(Names->Space);
+	Names->Chars[0] = 0;
+	Names->Size = 1;
+}
+
+static uint32_t file_names_add(file_names_t *Names, const char *Text, size_t Length) {
+	size_t Offset = Names->Size, Size = Offset + Length + 1;
+	if (Size > UINT32_MAX) {
+		fprintf(stderr, "File names exceed 4GB\n");
+		exit(1);
+	}
+	if (Size > Names->Space) {
+		size_t Space = 2 * Names->Space;
+		while (Space < Size) Space *= 2;
+		Names->Chars = GC_realloc(Names->Chars, Space);
+		Names->Space = Space;
+	}
+	memcpy(Names->Chars + Offset, Text, Length);
+	Names->Chars[Offset + Length] = 0;
+	Names->Size = Size;
+	return Offset;
+}
+
+static inline const char *node_file_name(node_t *Node) {
+	return Node->Viewer->FileNames->Chars + Node->FileName;
+}
+
+// GFile objects are only created while an image is being read, the image
+// cache (LoadCache) bounds how many are alive at once.
+static GFile *node_file(node_t *Node) {
+	const char *FileName = node_file_name(Node);
+	const char *ImagePrefix = Node->Viewer->ImagePrefix;
+	if (!ImagePrefix || !ImagePrefix[0]) return g_file_new_for_path(FileName);
+	char *FilePath = GC_malloc_atomic(strlen(ImagePrefix) + strlen(FileName) + 1);
+	strcpy(stpcpy(FilePath, ImagePrefix), FileName);
+	GFile *File = g_file_new_for_path(FilePath);
+	GC_free(FilePath);
+	return File;
+}
+
+// Field values are stored in the narrowest type that holds them: enum codes
+// as u8/u16/u32 and numeric columns as i32 or f32 when no precision is lost.
+// Everything outside the typed kernels goes through these helpers.
+static const char *FieldStorageNames[] = {"f64", "f32", "i32", "u8", "u16", "u32"};
+static const size_t FieldStorageSizes[] = {8, 4, 4, 1, 2, 4};
+static const field_storage_t FieldStorageWider[] = {FIELD_F64, FIELD_F64, FIELD_F64, FIELD_U16, FIELD_U32, FIELD_F64};
+
+#define FIELD_STORAGE_SWITCH(STORAGE, MACRO, ARG) \
+	switch (STORAGE) { \
+	case FIELD_F64: MACRO(double, ARG); break; \
+	case FIELD_F32: MACRO(float, ARG); break; \
+	case FIELD_I32: MACRO(int32_t, ARG); break; \
+	case FIELD_U8: MACRO(uint8_t, ARG); break; \
+	case FIELD_U16: MACRO(uint16_t, ARG); break; \
+	case FIELD_U32: MACRO(uint32_t, ARG); break; \
+	}
+
+typedef struct {
+	double Min, Max;
+	int Integral, Exact;
+} field_scan_t;
+
+#define FIELD_SCAN_INIT {0.0, 0.0, 1, 1}
+
+static void field_scan(field_scan_t *Scan, const double *Values, int Count) {
+	double Min = Scan->Min, Max = Scan->Max;
+	int Integral = Scan->Integral, Exact = Scan->Exact;
+	for (int I = 0; I < Count; ++I) {
+		double Value = Values[I];
+		if (Value < Min) Min = Value;
+		if (Value > Max) Max = Value;
+		if (Value != floor(Value)) Integral = 0;
+		if ((float)Value != Value && Value == Value) Exact = 0;
+	}
+	Scan->Min = Min;
+	Scan->Max = Max;
+	Scan->Integral = Integral;
+	Scan->Exact = Exact;
+}
+
+static int field_storage_holds(field_storage_t Storage, const field_scan_t *Scan) {
+	switch (Storage) {
+	case FIELD_F64: return 1;
+	case FIELD_F32: return Scan->Exact;
+	case FIELD_I32: return Scan->Integral && Scan->Min >= INT32_MIN && Scan->Max <= INT32_MAX;
+	case FIELD_U8: return Scan->Integral && Scan->Min >= 0 && Scan->Max <= UINT8_MAX;
+	case FIELD_U16: return Scan->Integral && Scan->Min >= 0 && Scan->Max <= UINT16_MAX;
+	case FIELD_U32: return Scan->Integral && Scan->Min >= 0 && Scan->Max <= UINT32_MAX;
+	}
+	return 0;
+}
+
+// Picks the narrowest storage that holds every scanned value exactly.
+static field_storage_t field_scan_storage(const field_scan_t *Scan) {
+	static const field_storage_t Preferred[] = {FIELD_U8, FIELD_U16, FIELD_I32, FIELD_U32, FIELD_F32};
+	for (int I = 0; I < sizeof(Preferred) / sizeof(Preferred[0]); ++I) {
+		if (field_storage_holds(Preferred[I], Scan)) return Preferred[I];
+	}
+	return FIELD_F64;
+}
+
+// Values outside the GC heap keep a mapping through Field->Mapping: an Arrow
+// file shared by several fields, a binary cache, or scratch storage owned by
+// one field. Each is released once no field refers to it any more.
+typedef struct {
+	arrow_file_t *File;
+	csv_cache_t *Cache;
+	void *Values;
+	size_t Size;
+} field_mapping_t;
+
+static void field_mapping_finalize(field_mapping_t *Mapping, void *Data) {
+	if (Mapping->File) arrow_file_close(Mapping->File);
+	if (Mapping->Cache) csv_cache_close(Mapping->Cache);
+	if (Mapping->Values) column_map_free(Mapping->Values, Mapping->Size);
+}
+
+static field_mapping_t *field_mapping_new(void) {
+	field_mapping_t *Mapping = new(field_mapping_t);
+	GC_register_finalizer(Mapping, (void *)field_mapping_finalize, 0, 0, 0);
+	return Mapping;
+}
+
+// Large columns go to scratch storage in out of core mode.
+static void field_alloc_values(field_t *Field, field_storage_t Storage, int Capacity) {
+	size_t Size = Capacity * FieldStorageSizes[Storage];
+	void *Values = column_map_alloc(Size);
+	if (Values) {
+		field_mapping_t *Mapping = field_mapping_new();
+		Mapping->Values = Values;
+		Mapping->Size = Size;
+		Field->Values = Values;
+		Field->Mapping = Mapping;
+	} else {
+		Field->Values = GC_malloc_atomic(Size);
+		memset(Field->Values, 0, Size);
+		Field->Mapping = 0;
+	}
+	Field->Storage = Storage;
+	Field->Capacity = Capacity;
+	++Field->Generation;
+}
+
+static inline double field_get(field_t *Field, int Index) {
+#define FIELD_GET(T, _) return ((T *)Field->Values)[Index]
+	FIELD_STORAGE_SWITCH(Field->Storage, FIELD_GET, 0);
+#undef FIELD_GET
+	return 0.0;
+}
+
+static void field_read(field_t *Field, int Start, int Count, double *Output) {
+#define FIELD_READ(T, _) { \
+	const T *Input = (const T *)Field->Values + Start; \
+	for (int I = 0; I < Count; ++I) Output[I] = Input[I]; \
+}
+	FIELD_STORAGE_SWITCH(Field->Storage, FIELD_READ, 0);
+#undef FIELD_READ
+}
+
+static void field_store(void *Values, field_storage_t Storage, int Start, int Count, const double *Input) {
+#define FIELD_STORE(T, _) { \
+	T *Output = (T *)Values + Start; \
+	for (int I = 0; I < Count; ++I) Output[I] = Input[I]; \
+}
+	FIELD_STORAGE_SWITCH(Storage, FIELD_STORE, 0);
+#undef FIELD_STORE
+}
+
+// Converts the values to another storage, also resizing them to Capacity.
+// Callers check that the target holds the values unless truncation is wanted.
+// Scratch storage is released straight away, shared mappings are left to
+// their other fields.
+static void field_convert(field_t *Field, field_storage_t Storage, int Capacity) {
+	void *Old = Field->Values;
+	field_mapping_t *Mapping = Field->Mapping;
+	field_storage_t OldStorage = Field->Storage;
+	int Count = Field->Capacity < Capacity ? Field->Capacity : Capacity;
+	field_alloc_values(Field, Storage, Capacity);
+	field_t Source[1] = {{.Values = Old, .Storage = OldStorage}};
+	double Buffer[1024];
+	for (int Start = 0; Start < Count; Start += 1024) {
+		int Size = Count - Start < 1024 ? Count - Start : 1024;
+		field_read(Source, Start, Size, Buffer);
+		field_store(Field->Values, Storage, Start, Size, Buffer);
+	}
+	if (!Mapping) {
+		GC_free(Old);
+	} else if (Mapping->Values) {
+		column_map_free(Mapping->Values, Mapping->Size);
+		Mapping->Values = 0;
+	}
+}
+
+// Widens the storage along FieldStorageWider until it holds the scan.
+static void field_reserve(field_t *Field, const field_scan_t *Scan) {
+	field_storage_t Storage = Field->Storage;
+	while (!field_storage_holds(Storage, Scan)) Storage = FieldStorageWider[Storage];
+	if (Storage != Field->Storage) field_convert(Field, Storage, Field->Capacity);
+}
+
+static void field_write(field_t *Field, int Start, int Count, const double *Input) {
+	++Field->Generation;
+	if (Field->Storage != FIELD_F64) {
+		field_scan_t Scan[1] = {FIELD_SCAN_INIT};
+		field_scan(Scan, Input, Count);
+		field_reserve(Field, Scan);
+	}
+	field_store(Field->Values, Field->Storage, Start, Count, Input);
+}
+
+static inline void field_set(field_t *Field, int Index, double Value) {
+	field_write(Field, Index, 1, &Value);
+}
+
+// Shrinks a loaded field to Count values in the narrowest lossless storage.
+static void field_narrow(field_t *Field, int Count) {
+	field_scan_t Scan[1] = {FIELD_SCAN_INIT};
+	double Buffer[1024];
+	for (int Start = 0; Start < Count; Start += 1024) {
+		int Size = Count - Start < 1024 ? Count - Start : 1024;
+		field_read(Field, Start, Size, Buffer);
+		field_scan(Scan, Buffer, Size);
+	}
+	field_storage_t Storage = field_scan_storage(Scan);
+	if (Storage != Field->Storage || Count != Field->Capacity) field_convert(Field, Storage, Count);
+}
+
+static int viewer_field_require(viewer_t *Viewer, field_t *Field);
+static void viewer_load_file(viewer_t *Viewer, const char *CsvFileName, const char *ImagePrefix, const char **Projection);
+
+// Brings the enum names and store of a field up to date with its dictionary,
+// appending only the values added since the last call.
+static void field_update_enum(field_t *Field) {
+	enum_dict_t *Dict = Field->EnumDict;
+	int OldSize = Field->EnumStore ? Field->EnumSize : 0;
+	int EnumSize = Dict->Size;
+	if (!Field->EnumStore) Field->EnumStore = gtk_list_store_new(2, G_TYPE_STRING, G_TYPE_DOUBLE);
+	if (Field->EnumNames != Dict->Names) {
+		Field->EnumNames = Dict->Names;
+		Field->EnumValues = (int *)GC_malloc_atomic(Dict->Space * sizeof(int));
+	}
+	for (int J = OldSize; J < EnumSize; ++J) {
+		gtk_list_store_insert_with_values(Field->EnumStore, 0, -1, 0, Dict->Names[J], 1, (double)J, -1);
+	}
+	Field->EnumSize = EnumSize;
+	Field->Range.Min = 0.0;
+	Field->Range.Max = EnumSize;
+}
+
 struct queued_callback_t {
 	queued_callback_t *Next;
 	void (*Callback)(viewer_t *Viewer, json_t *Result, void *Data);
@@ -71,6 +358,8 @@ static stringmap_t EventHandlers[1] = {STRINGMAP_INIT};
 typedef void (*event_handler_t)(viewer_t *Viewer, const char *Event, json_t *Details);
 
 static gboolean remote_msg_fn(viewer_t *Viewer) {
+	// Messages wait in the socket while rows are being saved on other threads
+	if (Viewer->Saving) return TRUE;
 	zmsg_t *Msg = zmsg_recv_nowait(Viewer->RemoteSocket);
 	if (!Msg) return TRUE;
 	zmsg_print(Msg);
@@ -126,235 +415,129 @@ static void remote_request(viewer_t *Viewer, const char *Method, json_t *Request
 	zmsg_send(&Msg, Viewer->RemoteSocket);
 }
 
-typedef struct node_foreach_t {
-	void *Data;
-	node_callback_t *Callback;
-	double X1, Y1, X2, Y2;
-} node_foreach_t;
-
-static void foreach_node_tree_x(node_foreach_t *Foreach, node_t *Node);
-
-static void foreach_node_tree_y(node_foreach_t *Foreach, node_t *Node) {
-	if (Foreach->Y2 < Node->Y) {
-		if (Node->Children[0]) foreach_node_tree_x(Foreach, Node->Children[0]);
-	} else if (Foreach->Y1 > Node->Y) {
-		if (Node->Children[1]) foreach_node_tree_x(Foreach, Node->Children[1]);
+// The selection is the closed lasso if there is one, otherwise the box
+// around the pointer.
+static void selection_cursor(viewer_t *Viewer, kd_cursor_t *Cursor) {
+	if (Viewer->LassoState == LASSO_CLOSED) {
+		kd_cursor_init_polygon(Cursor, Viewer->Tree, Viewer->Lasso, Viewer->LassoSize);
 	} else {
-		if (Foreach->X1 <= Node->X && Foreach->X2 >= Node->X) {
-			Foreach->Callback(Foreach->Data, Node);
-		}
-		if (Node->Children[0]) foreach_node_tree_x(Foreach, Node->Children[0]);
-		if (Node->Children[1]) foreach_node_tree_x(Foreach, Node->Children[1]);
+		double X1 = Viewer->Min.X + (Viewer->Pointer.X - BOX_SIZE / 2) / Viewer->Scale.X;
+		double Y1 = Viewer->Min.Y + (Viewer->Pointer.Y - BOX_SIZE / 2) / Viewer->Scale.Y;
+		double X2 = Viewer->Min.X + (Viewer->Pointer.X + BOX_SIZE / 2) / Viewer->Scale.X;
+		double Y2 = Viewer->Min.Y + (Viewer->Pointer.Y + BOX_SIZE / 2) / Viewer->Scale.Y;
+		kd_cursor_init(Cursor, Viewer->Tree, X1, Y1, X2, Y2);
 	}
 }
 
-static void foreach_node_tree_x(node_foreach_t *Foreach, node_t *Node) {
-	if (Foreach->X2 < Node->X) {
-		if (Node->Children[0]) foreach_node_tree_y(Foreach, Node->Children[0]);
-	} else if (Foreach->X1 > Node->X) {
-		if (Node->Children[1]) foreach_node_tree_y(Foreach, Node->Children[1]);
-	} else {
-		if (Foreach->Y1 <= Node->Y && Foreach->Y2 >= Node->Y) {
-			Foreach->Callback(Foreach->Data, Node);
-		}
-		if (Node->Children[0]) foreach_node_tree_y(Foreach, Node->Children[0]);
-		if (Node->Children[1]) foreach_node_tree_y(Foreach, Node->Children[1]);
+static void foreach_selected(viewer_t *Viewer, void *Data, node_callback_t *Callback) {
+	node_t *Nodes = Viewer->Nodes;
+	kd_cursor_t Cursor[1];
+	kd_batch_t Batch[1];
+	selection_cursor(Viewer, Cursor);
+	while (kd_cursor_next(Cursor, Batch)) {
+		for (int I = 0; I < Batch->Count; ++I) Callback(Data, Nodes + Batch->Rows[I]);
 	}
 }
 
-static inline void foreach_node(viewer_t *Viewer, double X1, double Y1, double X2, double Y2, void *Data, node_callback_t *Callback) {
-	node_foreach_t Foreach = {Data, Callback, X1, Y1, X2, Y2};
-	//clock_t Start = clock();
-	if (Viewer->Root) foreach_node_tree_x(&Foreach, Viewer->Root);
-	//printf("foreach_node:%d @ %lu\n", __LINE__, clock() - Start);
-}
-
-static void merge_sort_x(node_t **Start, node_t **End, node_t **Buffer) {
-	node_t **Mid = Start + (End - Start) / 2;
-	if (Mid - Start > 1) merge_sort_x(Start, Mid, Buffer);
-	if (End - Mid > 1) merge_sort_x(Mid, End, Buffer);
-	node_t **A = Start;
-	node_t **B = Mid;
-	node_t **C = Buffer;
-	double XA = A[0]->X;
-	double XB = B[0]->X;
-	for (;;) {
-		if (XA <= XB) {
-			*C++ = *A++;
-			if (A < Mid) {
-				XA = A[0]->X;
-			} else {
-				memcpy(C, B, (End - B) * sizeof(node_t *));
-				break;
-			}
-		} else {
-			*C++ = *B++;
-			if (B < End) {
-				XB = B[0]->X;
-			} else {
-				memcpy(C, A, (Mid - A) * sizeof(node_t *));
-				break;
-			}
-		}
-	}
-	memcpy(Start, Buffer, (End - Start) * sizeof(node_t *));
+// Sorts the row numbers by Keys, built with radix_sort_key(), which are
+// overwritten.
+static void sort_viewer_rows(uint64_t *Keys, uint32_t *Sorted, int Count) {
+	for (int I = 0; I < Count; ++I) Sorted[I] = I;
+	radix_sort(Keys, Sorted, Count, g_get_num_processors());
 }
 
-static void merge_sort_y(node_t **Start, node_t **End, node_t **Buffer) {
-	node_t **Mid = Start + (End - Start) / 2;
-	if (Mid - Start > 1) merge_sort_y(Start, Mid, Buffer);
-	if (End - Mid > 1) merge_sort_y(Mid, End, Buffer);
-	node_t **A = Start;
-	node_t **B = Mid;
-	node_t **C = Buffer;
-	double YA = A[0]->Y;
-	double YB = B[0]->Y;
-	for (;;) {
-		if (YA <= YB) {
-			*C++ = *A++;
-			if (A < Mid) {
-				YA = A[0]->Y;
-			} else {
-				memcpy(C, B, (End - B) * sizeof(node_t *));
-				break;
-			}
-		} else {
-			*C++ = *B++;
-			if (B < End) {
-				YB = B[0]->Y;
-			} else {
-				memcpy(C, A, (Mid - A) * sizeof(node_t *));
-				break;
-			}
+// Sorted orders of recently used fields, most recent first, so changing axes
+// back and forth only rebuilds the tree. An order is stale once the field is
+// written (Generation) or rows are loaded (Count). The row arrays are evicted
+// from the end of the list once they use more than FIELD_ORDERS_BUDGET bytes.
+#define FIELD_ORDERS_BUDGET ((size_t)256 << 20)
+
+typedef struct field_order_t field_order_t;
+
+struct field_order_t {
+	field_order_t *Next;
+	field_t *Field;
+	uint32_t *Rows;
+	int Count, Generation;
+};
+
+static void field_orders_clear(viewer_t *Viewer) {
+	for (field_order_t *Order = Viewer->FieldOrders; Order; Order = Order->Next) free(Order->Rows);
+	Viewer->FieldOrders = 0;
+	Viewer->FieldOrdersSize = 0;
+}
+
+// Returns the rows in order of Field, valid until the next call.
+static const uint32_t *field_order(viewer_t *Viewer, field_t *Field) {
+	int NumNodes = Viewer->NumNodes;
+	field_order_t **Slot = &Viewer->FieldOrders, *Order;
+	while ((Order = Slot[0])) {
+		if (Order->Field == Field) {
+			Slot[0] = Order->Next;
+			if (Order->Count == NumNodes && Order->Generation == Field->Generation) break;
+			Viewer->FieldOrdersSize -= Order->Count * sizeof(uint32_t);
+			free(Order->Rows);
+			Order = 0;
+			break;
 		}
-	}
-	memcpy(Start, Buffer, (End - Start) * sizeof(node_t *));
-}
-
-static void split_node_list_y(node_t *Root, node_t *HeadX, node_t *HeadY1, int Count1, int Count2);
-
-static void split_node_list_x(node_t *Root, node_t *HeadX1, node_t *HeadY, int Count1, int Count2) {
-	int RootIndex = Root->XIndex;
-	node_t *HeadY1 = 0, *HeadY2 = 0;
-	node_t **SlotY1 = &HeadY1, **SlotY2 = &HeadY2;
-	node_t *Root1 = 0, *Root2 = 0;
-	int Split1 = (1 + Count1) >> 1, Split2 = (1 + Count2) >> 1;
-	//printf("split_node_list_x(%d/%d, X:%d)\n\t", Count1, Count2, RootIndex);
-	//int Actual = 0, Left = 0, Right = 0;
-	for (node_t *Node = HeadY; Node; Node = Node->Children[1]) {
-		//++Actual;
-		//printf(" %d,%d", Node->XIndex, Node->YIndex);
-		if (Node->XIndex < RootIndex) {
-			//++Left;
-			if (--Split1 == 0) {
-				SlotY1[0] = 0;
-				Root1 = Node;
-				//printf("[1]");
-			} else {
-				SlotY1[0] = Node;
-			}
-			SlotY1 = &Node->Children[1];
-		} else if (Node->XIndex > RootIndex) {
-			//++Right;
-			if (--Split2 == 0) {
-				SlotY2[0] = 0;
-				Root2 = Node;
-				//printf("[2]");
-			} else {
-				SlotY2[0] = Node;
-			}
-			SlotY2 = &Node->Children[1];
-		}
-	}
-	//printf(" -> %d/%d/%d\n", Actual, Left, Right);
-	SlotY1[0] = SlotY2[0] = 0;
-	node_t *HeadX2 = Root->Children[0];
-	Root->Children[0] = Root1;
-	Root->Children[1] = Root2;
-	if (Root1) split_node_list_y(Root1, HeadX1, HeadY1, Count1 - (Count1 >> 1) - 1, Count1 >> 1);
-	if (Root2) split_node_list_y(Root2, HeadX2, HeadY2, Count2 - (Count2 >> 1) - 1, Count2 >> 1);
-}
-
-static void split_node_list_y(node_t *Root, node_t *HeadX, node_t *HeadY1, int Count1, int Count2) {
-	int RootIndex = Root->YIndex;
-	node_t *HeadX1 = 0, *HeadX2 = 0;
-	node_t **SlotX1 = &HeadX1, **SlotX2 = &HeadX2;
-	node_t *Root1 = 0, *Root2 = 0;
-	int Split1 = (1 + Count1) >> 1, Split2 = (1 + Count2) >> 1;
-	//printf("split_node_list_y(%d/%d, X:%d)\n\t", Count1, Count2, RootIndex);
-	//int Actual = 0, Left = 0, Right = 0;
-	for (node_t *Node = HeadX; Node; Node = Node->Children[0]) {
-		//++Actual;
-		//printf(" %d,%d", Node->XIndex, Node->YIndex);
-		if (Node->YIndex < RootIndex) {
-			//++Left;
-			if (--Split1 == 0) {
-				SlotX1[0] = 0;
-				Root1 = Node;
-				//printf("[1]");
-			} else {
-				SlotX1[0] = Node;
-			}
-			SlotX1 = &Node->Children[0];
-		} else if (Node->YIndex > RootIndex) {
-			//++Right;
-			if (--Split2 == 0) {
-				SlotX2[0] = 0;
-				Root2 = Node;
-				//printf("[2]");
-			} else {
-				SlotX2[0] = Node;
-			}
-			SlotX2 = &Node->Children[0];
+		Slot = &Order->Next;
+	}
+	if (!Order) {
+		Order = new(field_order_t);
+		Order->Field = Field;
+		Order->Rows = malloc(NumNodes * sizeof(uint32_t) + 1);
+		Order->Count = NumNodes;
+		Order->Generation = Field->Generation;
+		uint64_t *Keys = malloc(NumNodes * sizeof(uint64_t) + 1);
+#define FIELD_KEYS(T, _) { \
+	const T *Values = (const T *)Field->Values; \
+	for (int I = 0; I < NumNodes; ++I) Keys[I] = radix_sort_key(Values[I]); \
+}
+		FIELD_STORAGE_SWITCH(Field->Storage, FIELD_KEYS, 0);
+#undef FIELD_KEYS
+		sort_viewer_rows(Keys, Order->Rows, NumNodes);
+		free(Keys);
+		Viewer->FieldOrdersSize += NumNodes * sizeof(uint32_t);
+	}
+	Order->Next = Viewer->FieldOrders;
+	Viewer->FieldOrders = Order;
+	Slot = &Order->Next;
+	while (Slot[0] && Viewer->FieldOrdersSize > FIELD_ORDERS_BUDGET) {
+		field_order_t *Last = Slot[0];
+		while (Last->Next) {
+			Slot = &Last->Next;
+			Last = Last->Next;
 		}
+		Viewer->FieldOrdersSize -= Last->Count * sizeof(uint32_t);
+		free(Last->Rows);
+		Slot[0] = 0;
+		Slot = &Order->Next;
 	}
-	//printf(" -> %d/%d/%d\n", Actual, Left, Right);
-	SlotX1[0] = SlotX2[0] = 0;
-	node_t *HeadY2 = Root->Children[1];
-	Root->Children[0] = Root1;
-	Root->Children[1] = Root2;
-	if (Root1) split_node_list_x(Root1, HeadX1, HeadY1, Count1 - (Count1 >> 1) - 1, Count1 >> 1);
-	if (Root2) split_node_list_x(Root2, HeadX2, HeadY2, Count2 - (Count2 >> 1) - 1, Count2 >> 1);
+	return Order->Rows;
 }
 
+// Rebuilds the spatial index over all nodes from the sorted orders, filters
+// only mark nodes live or not (kd_tree_filter). Nodes with a NaN coordinate
+// are left out, no range can contain them.
 static void update_node_tree(viewer_t *Viewer) {
-	//clock_t Start = clock();
-	if (Viewer->NumFiltered == 0) {
-		Viewer->Root = 0;
-	} else if (Viewer->NumFiltered == 1) {
-		node_t *Node = Viewer->Nodes;
-		while (!Node->Filtered) ++Node;
-		Node->Children[0] = 0;
-		Node->Children[1] = 0;
-		Viewer->Root = Node;
-	} else {
-		int Count1 = Viewer->NumFiltered >> 1;
-		int MidIndex = Count1 + 1;
-		node_t *HeadX = 0, *HeadY = 0;
-		node_t **SlotX = &HeadX, **SlotY = &HeadY;
-		node_t **NodeX = Viewer->SortedX, **NodeY = Viewer->SortedY;
-		node_t *Root = 0;
-		for (int I = Viewer->NumNodes; --I >= 0; ++NodeX, ++NodeY) {
-			node_t *Node = *NodeX;
-			if (Node->Filtered) {
-				if (--MidIndex == 0) {
-					Root = Node;
-					SlotX[0] = 0;
-				} else {
-					SlotX[0] = Node;
-				}
-				SlotX = &Node->Children[0];
-			}
-			if (NodeY[0]->Filtered) {
-				SlotY[0] = NodeY[0];
-				SlotY = &NodeY[0]->Children[1];
-			}
-		}
-		SlotX[0] = SlotY[0] = 0;
-		split_node_list_x(Root, HeadX, HeadY, Count1, Viewer->NumFiltered - Count1 - 1);
-		Viewer->Root = Root;
+	int NumNodes = Viewer->NumNodes, Count = 0;
+	node_t *Nodes = Viewer->Nodes;
+	uint32_t *ByX = malloc(2 * NumNodes * sizeof(uint32_t) + 1), *ByY = ByX + NumNodes;
+	for (int I = 0; I < NumNodes; ++I) {
+		node_t *Node = Nodes + Viewer->SortedX[I];
+		if (!isnan(Node->X) && !isnan(Node->Y)) ByX[Count++] = Viewer->SortedX[I];
+	}
+	Count = 0;
+	for (int I = 0; I < NumNodes; ++I) {
+		node_t *Node = Nodes + Viewer->SortedY[I];
+		if (!isnan(Node->X) && !isnan(Node->Y)) ByY[Count++] = Viewer->SortedY[I];
 	}
-	//printf("update_node_tree took %lu\n", clock() - Start);
+	kd_tree_build(Viewer->Tree, &Nodes->X, sizeof(node_t), ByX, ByY, Count, NumNodes);
+	free(ByX);
+	kd_tree_filter(Viewer->Tree, &Nodes->Filtered, sizeof(node_t));
+	Viewer->DensityStale = 1;
+	Viewer->HoverNode = 0;
+	Viewer->LassoState = LASSO_NONE;
 }
 
 static ml_value_t *viewer_global_get(viewer_t *Viewer, const char *Name) {
@@ -369,7 +552,7 @@ typedef struct node_ref_t {
 
 static ml_value_t *node_ref_deref(node_ref_t *Ref) {
 	field_t *Field = Ref->Field;
-	double Value = Field->Values[Ref->Node - Ref->Node->Viewer->Nodes];
+	double Value = field_get(Field, Ref->Node - Ref->Node->Viewer->Nodes);
 	if (Field->EnumNames) {
 		if (Value) {
 			return ml_string(Field->EnumNames[(int)Value], -1);
@@ -385,16 +568,11 @@ static void column_values_set(viewer_t *Viewer, json_t *Result, field_t *Field)
 
 }
 
-static int set_enum_name_fn(const char *Name, const double *Value, const char **Names) {
-	Names[(int)Value[0]] = Name;
-	return 0;
-}
-
 static ml_value_t *node_ref_assign(node_ref_t *Ref, ml_value_t *Value) {
 	Value = Value->Type->deref(Value);
 	if (Value->Type == MLErrorT) return Value;
 	field_t *Field = Ref->Field;
-	if (Field->EnumMap) {
+	if (Field->EnumDict) {
 		int Index;
 		if (Value->Type == MLIntegerT) {
 			Index = ml_integer_value(Value);
@@ -403,29 +581,12 @@ static ml_value_t *node_ref_assign(node_ref_t *Ref, ml_value_t *Value) {
 			Index = ml_real_value(Value);
 			if (Index < 0 || Index >= Field->EnumSize) return ml_error("RangeError", "enum index out of range");
 		} else if (Value->Type == MLStringT) {
-			const char *Text = ml_string_value(Value);
-			double **Slot = (double **)stringmap_slot(Field->EnumMap, Text);
-			if (!Slot[0]) {
-				double *Ref2 = Slot[0] = new(double);
-				Ref2[0] = Field->EnumMap->Size;
-				int EnumSize = Field->EnumSize = Field->EnumMap->Size + 1;
-				const char **EnumNames = (const char **)GC_malloc(EnumSize * sizeof(const char *));
-				EnumNames[0] = "";
-				stringmap_foreach(Field->EnumMap, EnumNames, (void *)set_enum_name_fn);
-				Field->EnumNames = EnumNames;
-				gtk_list_store_clear(Field->EnumStore);
-				for (int J = 0; J < EnumSize; ++J) {
-					gtk_list_store_insert_with_values(Field->EnumStore, 0, -1, 0, Field->EnumNames[J], 1, (double)(J + 1), -1);
-				}
-				Field->EnumValues = (int *)GC_malloc_atomic(EnumSize * sizeof(int));
-				Field->Range.Min = 0.0;
-				Field->Range.Max = EnumSize;
-			}
-			Index = Slot[0][0];
+			Index = enum_dict_insert(Field->EnumDict, ml_string_value(Value), ml_string_length(Value));
+			if (Index >= Field->EnumSize) field_update_enum(Field);
 		} else {
 			return ml_error("TypeError", "invalid value for assignment");
 		}
-		Field->Values[Ref->Node - Ref->Node->Viewer->Nodes] = Index;
+		field_set(Field, Ref->Node - Ref->Node->Viewer->Nodes, Index);
 		if (Field->RemoteId) {
 			json_t *Request = json_pack("{sss[i]s[s]}",
 				"column", Field->RemoteId,
@@ -443,7 +604,7 @@ static ml_value_t *node_ref_assign(node_ref_t *Ref, ml_value_t *Value) {
 		} else {
 			return ml_error("TypeError", "invalid value for assignment");
 		}
-		Field->Values[Ref->Node - Ref->Node->Viewer->Nodes] = Value2;
+		field_set(Field, Ref->Node - Ref->Node->Viewer->Nodes, Value2);
 		if (Value2 < Field->Range.Min) Field->Range.Min = Value2;
 		if (Value2 > Field->Range.Max) Field->Range.Max = Value2;
 
@@ -472,6 +633,7 @@ ML_METHOD("[]", NodeT, MLStringT) {
 	viewer_t *Viewer = Node->Viewer;
 	field_t *Field = stringmap_search(Viewer->FieldsByName, Name);
 	if (!Field) return ml_error("FieldError", "no such field %s", Name);
+	if (!viewer_field_require(Viewer, Field)) return ml_error("FieldError", "field %s is not loaded yet", Name);
 	node_ref_t *Ref = new(node_ref_t);
 	Ref->Type = NodeRefT;
 	Ref->Node = Node;
@@ -497,7 +659,7 @@ typedef struct node_image_t {
 } node_image_t;
 
 static ml_value_t *node_image_deref(node_image_t *Ref) {
-	return ml_string(Ref->Node->FileName, -1);
+	return ml_string(GC_strdup(node_file_name(Ref->Node)), -1);
 }
 
 static ml_value_t *node_image_assign(node_image_t *Ref, ml_value_t *Value) {
@@ -505,9 +667,7 @@ static ml_value_t *node_image_assign(node_image_t *Ref, ml_value_t *Value) {
 	if (Value->Type == MLErrorT) return Value;
 	if (Value->Type != MLStringT) return ml_error("TypeError", "Node image must be a string");
 	node_t *Node = Ref->Node;
-	Node->FileName = ml_string_value(Value);
-	g_object_unref(Node->File);
-	Node->File = g_file_new_for_path(Node->FileName);
+	Node->FileName = file_names_add(Node->Viewer->FileNames, ml_string_value(Value), ml_string_length(Value));
 	return Value;
 }
 
@@ -568,14 +728,19 @@ typedef struct fields_t {
 ML_METHOD("[]", FieldsT, MLStringT) {
 	viewer_t *Viewer = ((fields_t *)Args[0])->Viewer;
 	const char *Name = ml_string_value(Args[1]);
-	return (ml_value_t *)stringmap_search(Viewer->FieldsByName, Name) ?: MLNil;
+	field_t *Field = stringmap_search(Viewer->FieldsByName, Name);
+	if (!Field) return MLNil;
+	if (!viewer_field_require(Viewer, Field)) return ml_error("FieldError", "field %s is not loaded yet", Name);
+	return (ml_value_t *)Field;
 }
 
 ML_METHOD("[]", FieldsT, MLIntegerT) {
 	viewer_t *Viewer = ((fields_t *)Args[0])->Viewer;
 	int Index = ml_integer_value(Args[1]) - 1;
 	if (Index < 0 || Index >= Viewer->NumFields) return ml_error("IndexError", "Invalid field index");
-	return (ml_value_t *)Viewer->Fields[Index];
+	field_t *Field = Viewer->Fields[Index];
+	if (!viewer_field_require(Viewer, Field)) return ml_error("FieldError", "field %s is not loaded yet", Field->Name);
+	return (ml_value_t *)Field;
 }
 
 ML_METHOD("new", FieldsT, MLStringT, MLStringT) {
@@ -584,16 +749,11 @@ ML_METHOD("new", FieldsT, MLStringT, MLStringT) {
 	const char *Type = ml_string_value(Args[2]);
 	int NumFields = Viewer->NumFields + 1;
 	field_t **Fields = (field_t **)GC_malloc(NumFields * sizeof(field_t *));
-	field_t *Field = (field_t *)GC_malloc(sizeof(field_t) + Viewer->NumNodes * sizeof(double));
+	field_t *Field = new(field_t);
 	Field->Type = FieldT;
 	if (!strcmp(Type, "string")) {
-		Field->EnumStore = gtk_list_store_new(2, G_TYPE_STRING, G_TYPE_DOUBLE);
-		Field->EnumNames = (const char **)GC_malloc(sizeof(const char *));
-		Field->EnumValues = (int *)GC_malloc_atomic(sizeof(int));
-		Field->EnumNames[0] = "";
-		Field->EnumSize = 1;
-		Field->EnumMap = new(stringmap_t);
-		gtk_list_store_insert_with_values(Field->EnumStore, 0, -1, 0, "", 1, 0.0, -1);
+		Field->EnumDict = enum_dict_new();
+		field_update_enum(Field);
 	}
 	Field->Name = GC_strdup(Name);
 	Field->PreviewColumn = 0;
@@ -602,7 +762,7 @@ ML_METHOD("new", FieldsT, MLStringT, MLStringT) {
 	Field->Sum = Field->Sum2 = 0.0;
 	Field->RemoteGenerations = (json_int_t *)GC_malloc_atomic(Viewer->NumNodes * sizeof(json_int_t));
 	memset(Field->RemoteGenerations, 0, Viewer->NumNodes * sizeof(json_int_t));
-	memset(Field->Values, 0, Viewer->NumNodes * sizeof(double));
+	field_alloc_values(Field, Field->EnumDict ? FIELD_U8 : FIELD_F64, Viewer->NumNodes);
 	for (int I = 0; I < Viewer->NumFields; ++I) Fields[I] = Viewer->Fields[I];
 	Fields[Viewer->NumFields] = Field;
 	stringmap_insert(Viewer->FieldsByName, Field->Name, Field);
@@ -629,11 +789,10 @@ ML_METHOD(MLStringOfMethod, FieldT) {
 
 ML_METHOD("[]", FieldT, MLStringT) {
 	field_t *Field = (field_t *)Args[0];
-	if (!Field->EnumMap) return ml_error("TypeError", "field is not an enum");
-	const char *Name = ml_string_value(Args[1]);
-	double *Ref = stringmap_search(Field->EnumMap, Name);
-	if (Ref) {
-		return ml_real(*Ref);
+	if (!Field->EnumDict) return ml_error("TypeError", "field is not an enum");
+	int Code = enum_dict_search(Field->EnumDict, ml_string_value(Args[1]), ml_string_length(Args[1]));
+	if (Code >= 0) {
+		return ml_real(Code);
 	} else {
 		return ml_error("ValueError", "enum name not found");
 	}
@@ -641,7 +800,7 @@ ML_METHOD("[]", FieldT, MLStringT) {
 
 ML_METHOD("[]", FieldT, MLIntegerT) {
 	field_t *Field = (field_t *)Args[0];
-	if (!Field->EnumMap) return ml_error("TypeError", "field is not an enumeration");
+	if (!Field->EnumDict) return ml_error("TypeError", "field is not an enumeration");
 	int Value = ml_integer_value(Args[1]);
 	if (Value < 0 || Value >= Field->EnumSize) return ml_error("RangeError", "enum value out of range");
 	return ml_string(Field->EnumNames[Value], -1);
@@ -649,7 +808,7 @@ ML_METHOD("[]", FieldT, MLIntegerT) {
 
 ML_METHOD("size", FieldT) {
 	field_t *Field = (field_t *)Args[0];
-	if (!Field->EnumMap) return ml_error("TypeError", "field is not an enumeration");
+	if (!Field->EnumDict) return ml_error("TypeError", "field is not an enumeration");
 	return ml_integer(Field->EnumSize);
 }
 
@@ -663,6 +822,34 @@ ML_METHOD("max", FieldT) {
 	return ml_real(Field->Range.Max);
 }
 
+ML_METHOD("storage", FieldT) {
+	field_t *Field = (field_t *)Args[0];
+	return ml_string(FieldStorageNames[Field->Storage], -1);
+}
+
+// Converts a field to the named storage. Integer storages must hold every
+// value, f32 rounds. Later writes that do not fit widen the storage again.
+ML_METHOD("storage", FieldT, MLStringT) {
+	field_t *Field = (field_t *)Args[0];
+	const char *Name = ml_string_value(Args[1]);
+	for (field_storage_t Storage = FIELD_F64; Storage <= FIELD_U32; ++Storage) {
+		if (strcmp(Name, FieldStorageNames[Storage])) continue;
+		if (Storage != FIELD_F64 && Storage != FIELD_F32) {
+			field_scan_t Scan[1] = {FIELD_SCAN_INIT};
+			double Buffer[1024];
+			for (int Start = 0; Start < Field->Capacity; Start += 1024) {
+				int Size = Field->Capacity - Start < 1024 ? Field->Capacity - Start : 1024;
+				field_read(Field, Start, Size, Buffer);
+				field_scan(Scan, Buffer, Size);
+			}
+			if (!field_storage_holds(Storage, Scan)) return ml_error("RangeError", "values do not fit in %s", Name);
+		}
+		if (Storage != Field->Storage) field_convert(Field, Storage, Field->Capacity);
+		return Args[0];
+	}
+	return ml_error("ValueError", "unknown storage %s", Name);
+}
+
 static ml_value_t *clipboard_fn(viewer_t *Viewer, int Count, ml_value_t **Args) {
 	ml_value_t *AppendMethod = ml_method("append");
 	ML_CHECK_ARG_COUNT(1);
@@ -678,6 +865,17 @@ static ml_value_t *clipboard_fn(viewer_t *Viewer, int Count, ml_value_t **Args)
 	return MLNil;
 }
 
+// Uses the sorted orders from the sidecar cache while a file is being loaded
+// from it.
+static int restore_viewer_indices(viewer_t *Viewer, int XIndex, int YIndex) {
+	if (!Viewer->Cache) return 0;
+	const csv_cache_orders_t *Orders = csv_cache_orders(Viewer->Cache, XIndex, YIndex);
+	if (!Orders) return 0;
+	memcpy(Viewer->SortedX, Orders->SortedX, Viewer->NumNodes * sizeof(uint32_t));
+	memcpy(Viewer->SortedY, Orders->SortedY, Viewer->NumNodes * sizeof(uint32_t));
+	return 1;
+}
+
 static void set_viewer_indices(viewer_t *Viewer, int XIndex, int YIndex) {
 	Viewer->XIndex = XIndex;
 	Viewer->YIndex = YIndex;
@@ -687,20 +885,21 @@ static void set_viewer_indices(viewer_t *Viewer, int XIndex, int YIndex) {
 	field_t *YField = Viewer->Fields[YIndex];
 
 	node_t *Node = Viewer->Nodes;
-	double *XValue = XField->Values;
-	double *YValue = YField->Values;
-	for (int I = NumNodes; --I >= 0;) {
-		Node->X = *XValue;
-		Node->Y = *YValue;
-		++Node;
-		++XValue;
-		++YValue;
-	}
-	merge_sort_x(Viewer->SortedX, Viewer->SortedX + NumNodes, Viewer->SortBuffer);
-	merge_sort_y(Viewer->SortedY, Viewer->SortedY + NumNodes, Viewer->SortBuffer);
-	for (int I = 0; I < NumNodes; ++I) {
-		Viewer->SortedX[I]->XIndex = I;
-		Viewer->SortedY[I]->YIndex = I;
+#define NODE_COPY_X(T, _) { \
+	const T *XValue = (const T *)XField->Values; \
+	for (int I = 0; I < NumNodes; ++I) Node[I].X = XValue[I]; \
+}
+#define NODE_COPY_Y(T, _) { \
+	const T *YValue = (const T *)YField->Values; \
+	for (int I = 0; I < NumNodes; ++I) Node[I].Y = YValue[I]; \
+}
+	FIELD_STORAGE_SWITCH(XField->Storage, NODE_COPY_X, 0);
+	FIELD_STORAGE_SWITCH(YField->Storage, NODE_COPY_Y, 0);
+#undef NODE_COPY_X
+#undef NODE_COPY_Y
+	if (!restore_viewer_indices(Viewer, XIndex, YIndex)) {
+		memcpy(Viewer->SortedX, field_order(Viewer, XField), NumNodes * sizeof(uint32_t));
+		memcpy(Viewer->SortedY, field_order(Viewer, YField), NumNodes * sizeof(uint32_t));
 	}
 	update_node_tree(Viewer);
 	double RangeX = XField->Range.Max - XField->Range.Min;
@@ -731,12 +930,13 @@ static void clear_viewer_indices(viewer_t *Viewer) {
 		Node->Colour = 0xFF000000;
 		++Node;
 	}
-	merge_sort_x(Viewer->SortedX, Viewer->SortedX + NumNodes, Viewer->SortBuffer);
-	merge_sort_y(Viewer->SortedY, Viewer->SortedY + NumNodes, Viewer->SortBuffer);
-	for (int I = 0; I < NumNodes; ++I) {
-		Viewer->SortedX[I]->XIndex = I;
-		Viewer->SortedY[I]->YIndex = I;
-	}
+	uint64_t *Keys = malloc(NumNodes * sizeof(uint64_t) + 1);
+	Node = Viewer->Nodes;
+	for (int I = 0; I < NumNodes; ++I) Keys[I] = radix_sort_key(Node[I].X);
+	sort_viewer_rows(Keys, Viewer->SortedX, NumNodes);
+	for (int I = 0; I < NumNodes; ++I) Keys[I] = radix_sort_key(Node[I].Y);
+	sort_viewer_rows(Keys, Viewer->SortedY, NumNodes);
+	free(Keys);
 	update_node_tree(Viewer);
 	double RangeX = 1.0;
 	double RangeY = 1.0;
@@ -799,15 +999,15 @@ static void filter_enum_field(viewer_t *Viewer, field_t *Field) {
 	int *EnumValues = Field->EnumValues;
 	memset(EnumValues, 0, Field->EnumSize * sizeof(int));
 	int Max = 0;
-	double *Value = Field->Values;
-	for (int I = NumNodes; --I >= 0;) {
-		if (Node->Filtered) {
-			int Index = (int)Value[0];
-			if (Index && !EnumValues[Index]) EnumValues[Index] = ++Max;
-		}
-		++Node;
-		++Value;
-	}
+#define FILTER_ENUM(T, _) { \
+	const T *Value = (const T *)Field->Values; \
+	for (int I = 0; I < NumNodes; ++I) if (Node[I].Filtered) { \
+		int Index = (int)Value[I]; \
+		if (Index && !EnumValues[Index]) EnumValues[Index] = ++Max; \
+	} \
+}
+	FIELD_STORAGE_SWITCH(Field->Storage, FILTER_ENUM, 0);
+#undef FILTER_ENUM
 	Field->Range.Max = Max;
 	printf("Field->Range.Max = %d\n", Max);
 	Field->FilterGeneration = Viewer->FilterGeneration;
@@ -818,38 +1018,53 @@ static void set_viewer_colour_index(viewer_t *Viewer, int CIndex) {
 	int NumNodes = Viewer->NumNodes;
 	field_t *CField = Viewer->Fields[CIndex];
 	node_t *Node = Viewer->Nodes;
-	double *CValue = CField->Values;
+	double CValue[1024];
 	if (CField->EnumStore) {
 		if (CField->FilterGeneration != Viewer->FilterGeneration) {
 			filter_enum_field(Viewer, CField);
 		}
 		int *EnumValues = CField->EnumValues;
 		double Range = CField->Range.Max + 1;
-		for (int I = NumNodes; --I >= 0;) {
-			int Value = EnumValues[(int)CValue[0]];
-			if (Value > 0.0) {
-				set_node_rgb(Node, 6.0 * Value / Range);
-			} else {
+		for (int Start = 0; Start < NumNodes; Start += 1024) {
+			int Size = NumNodes - Start < 1024 ? NumNodes - Start : 1024;
+			field_read(CField, Start, Size, CValue);
+			for (int I = 0; I < Size; ++I) {
+				int Value = EnumValues[(int)CValue[I]];
+				if (Value > 0.0) {
+					set_node_rgb(Node, 6.0 * Value / Range);
+				} else {
 #ifdef USE_GL
-				Node->R = Node->G = Node->B = POINT_COLOUR_SATURATION;
+					Node->R = Node->G = Node->B = POINT_COLOUR_SATURATION;
 #else
-				Node->Colour = 0xFF808080;
+					Node->Colour = 0xFF808080;
 #endif
+				}
+				++Node;
 			}
-			++Node;
-			++CValue;
 		}
 	} else {
 		double Min = CField->Range.Min;
 		double Range = CField->Range.Max - Min;
 		if (Range <= 1.0e-6) Range = 1.0;
 		Range += CField->SD;
-		for (int I = NumNodes; --I >= 0;) {
-			set_node_rgb(Node, 6.0 * (*CValue - Min) / Range);
-			++Node;
-			++CValue;
+		for (int Start = 0; Start < NumNodes; Start += 1024) {
+			int Size = NumNodes - Start < 1024 ? NumNodes - Start : 1024;
+			field_read(CField, Start, Size, CValue);
+			for (int I = 0; I < Size; ++I) {
+				if (!isnan(CValue[I])) {
+					set_node_rgb(Node, 6.0 * (CValue[I] - Min) / Range);
+				} else {
+#ifdef USE_GL
+					Node->R = Node->G = Node->B = POINT_COLOUR_SATURATION;
+#else
+					Node->Colour = 0xFF808080;
+#endif
+				}
+				++Node;
+			}
 		}
 	}
+	Viewer->DensityStale = 1;
 }
 
 static void draw_node_image_loaded(GObject *Source, GAsyncResult *Result, node_t *Node) {
@@ -863,7 +1078,7 @@ static void draw_node_image_loaded(GObject *Source, GAsyncResult *Result, node_t
 	if (Cancelled) return;
 	Node->Pixbuf = gdk_pixbuf_new_from_stream_finish(Result, 0);
 	if (!Node->Pixbuf) {
-		printf("Generating image %s (image read error)\n", Node->FileName);
+		printf("Generating image %s (image read error)\n", node_file_name(Node));
 		guchar *Pixels = GC_malloc_atomic(128 * 192 * 4);
 		cairo_surface_t *Surface = cairo_image_surface_create_for_data(Pixels, CAIRO_FORMAT_ARGB32, 128, 192, 128 * 4);
 		cairo_t *Cairo = cairo_create(Surface);
@@ -880,7 +1095,7 @@ static void draw_node_image_loaded(GObject *Source, GAsyncResult *Result, node_t
 	}
 	if (Node->LoadGeneration == Viewer->LoadGeneration) {
 		gtk_list_store_insert_with_values(Viewer->ImagesStore, 0, -1,
-			0, Node->FileName,
+			0, node_file_name(Node),
 			1, Node->Pixbuf,
 			2, Node,
 		-1);
@@ -894,7 +1109,7 @@ static void draw_node_file_opened(GObject *Source, GAsyncResult *Result, node_t
 		Node->LoadCancel = 0;
 		return;
 	}
-	GFileInputStream *InputStream = g_file_read_finish(Node->File, Result, 0);
+	GFileInputStream *InputStream = g_file_read_finish(G_FILE(Source), Result, 0);
 	if (InputStream) {
 		Node->LoadStream = G_INPUT_STREAM(InputStream);
 		gdk_pixbuf_new_from_stream_at_scale_async(
@@ -922,7 +1137,7 @@ static void draw_node_file_opened(GObject *Source, GAsyncResult *Result, node_t
 		cairo_surface_destroy(Surface);
 		Node->Pixbuf = gdk_pixbuf_new_from_data(Pixels, GDK_COLORSPACE_RGB, TRUE, 8, 128, 192, 128 * 4, (void *)free, 0);
 		gtk_list_store_insert_with_values(Viewer->ImagesStore, 0, -1,
-			0, Node->FileName,
+			0, node_file_name(Node),
 			1, Node->Pixbuf,
 			2, Node,
 		-1);
@@ -932,35 +1147,34 @@ static void draw_node_file_opened(GObject *Source, GAsyncResult *Result, node_t
 static int draw_node_image(viewer_t *Viewer, node_t *Node) {
 	Node->Next = Viewer->Selected;
 	Viewer->Selected = Node;
-	++Viewer->NumVisible;
-	if (Viewer->NumVisible <= MAX_VISIBLE_IMAGES) {
-		Node->LoadGeneration = Viewer->LoadGeneration;
-		if (Node->Pixbuf) {
-			gtk_list_store_insert_with_values(Viewer->ImagesStore, 0, -1,
-				0, Node->FileName,
-				1, Node->Pixbuf,
-				2, Node,
-			-1);
-		} else if (!Node->LoadCancel) {
-			int Index = Viewer->LoadCacheIndex;
-			node_t **Cache = Viewer->LoadCache;
-			while (Cache[Index] && (Cache[Index]->LoadGeneration == Viewer->LoadGeneration)) {
-				Index = (Index + 1) % MAX_CACHED_IMAGES;
-			}
-			if (Cache[Index]) {
-				node_t *OldNode = Cache[Index];
-				if (OldNode->Pixbuf) {
-					g_object_unref(G_OBJECT(OldNode->Pixbuf));
-					OldNode->Pixbuf = 0;
-				} else if (OldNode->LoadCancel) {
-					g_cancellable_cancel(OldNode->LoadCancel);
-				}
+	Node->LoadGeneration = Viewer->LoadGeneration;
+	if (Node->Pixbuf) {
+		gtk_list_store_insert_with_values(Viewer->ImagesStore, 0, -1,
+			0, node_file_name(Node),
+			1, Node->Pixbuf,
+			2, Node,
+		-1);
+	} else if (!Node->LoadCancel) {
+		int Index = Viewer->LoadCacheIndex;
+		node_t **Cache = Viewer->LoadCache;
+		while (Cache[Index] && (Cache[Index]->LoadGeneration == Viewer->LoadGeneration)) {
+			Index = (Index + 1) % MAX_CACHED_IMAGES;
+		}
+		if (Cache[Index]) {
+			node_t *OldNode = Cache[Index];
+			if (OldNode->Pixbuf) {
+				g_object_unref(G_OBJECT(OldNode->Pixbuf));
+				OldNode->Pixbuf = 0;
+			} else if (OldNode->LoadCancel) {
+				g_cancellable_cancel(OldNode->LoadCancel);
 			}
-			Cache[Index] = Node;
-			Viewer->LoadCacheIndex = (Index + 1) % MAX_CACHED_IMAGES;
-			Node->LoadCancel = g_cancellable_new();
-			g_file_read_async(Node->File, G_PRIORITY_DEFAULT, Node->LoadCancel, (void *)draw_node_file_opened, Node);
 		}
+		Cache[Index] = Node;
+		Viewer->LoadCacheIndex = (Index + 1) % MAX_CACHED_IMAGES;
+		Node->LoadCancel = g_cancellable_new();
+		GFile *File = node_file(Node);
+		g_file_read_async(File, G_PRIORITY_DEFAULT, Node->LoadCancel, (void *)draw_node_file_opened, Node);
+		g_object_unref(File);
 	}
 	return 0;
 }
@@ -968,17 +1182,16 @@ static int draw_node_image(viewer_t *Viewer, node_t *Node) {
 static int draw_node_value(viewer_t *Viewer, node_t *Node) {
 	Node->Next = Viewer->Selected;
 	Viewer->Selected = Node;
-	++Viewer->NumVisible;
 	field_t **Fields = Viewer->Fields;
 	int NumFields = Viewer->NumFields;
 	int Index = Node - Viewer->Nodes;
 	GtkTreeIter Iter[1];
 	gtk_list_store_append(Viewer->ValuesStore, Iter);
-	gtk_list_store_set(Viewer->ValuesStore, Iter, 0, Node->FileName, -1);
+	gtk_list_store_set(Viewer->ValuesStore, Iter, 0, node_file_name(Node), -1);
 	for (int I = 0; I < NumFields; ++I) {
 		field_t *Field = Fields[I];
-		if (Field->PreviewColumn) {
-			double Value = Field->Values[Index];
+		if (Field->PreviewColumn && !Field->Lazy) {
+			double Value = field_get(Field, Index);
 			GdkRGBA Colour[1];
 			Colour->alpha = 0.5;
 			if (Field->EnumStore && Value == 0.0) {
@@ -1021,8 +1234,39 @@ static int draw_node_value(viewer_t *Viewer, node_t *Node) {
 	return 0;
 }
 
+// Shows the first Limit nodes in the selection, the rest are only counted.
+static void preview_nodes(viewer_t *Viewer, int Limit, node_callback_t *Callback) {
+	node_t *Nodes = Viewer->Nodes;
+	kd_cursor_t Cursor[1];
+	kd_batch_t Batch[1];
+	selection_cursor(Viewer, Cursor);
+	while (Limit > 0 && kd_cursor_next(Cursor, Batch)) {
+		int Count = Batch->Count < Limit ? Batch->Count : Limit;
+		for (int I = 0; I < Count; ++I) Callback(Viewer, Nodes + Batch->Rows[I]);
+		Limit -= Count;
+	}
+}
+
+// The colour field is summarised in the box when it is numeric, from sums
+// over the tree which are rebuilt after the field or the tree changes.
+static field_t *box_summary_field(viewer_t *Viewer) {
+	if (Viewer->CIndex < 0 || Viewer->CIndex >= Viewer->NumFields) return 0;
+	field_t *Field = Viewer->Fields[Viewer->CIndex];
+	if (Field->EnumStore || Field->Lazy) return 0;
+	kd_values_t *Values = Viewer->BoxValues;
+	if (Values && Viewer->BoxField == Field && Viewer->BoxGeneration == Field->Generation && kd_values_current(Values)) return Field;
+	if (Values) kd_values_free(Values);
+	int NumNodes = Viewer->NumNodes;
+	double *FieldValues = malloc(NumNodes * sizeof(double) + 1);
+	field_read(Field, 0, NumNodes, FieldValues);
+	Viewer->BoxValues = kd_values_new(Viewer->Tree, FieldValues);
+	free(FieldValues);
+	Viewer->BoxField = Field;
+	Viewer->BoxGeneration = Field->Generation;
+	return Field;
+}
+
 static void update_preview(viewer_t *Viewer) {
-	Viewer->NumVisible = 0;
 	double X1 = Viewer->Min.X + (Viewer->Pointer.X - BOX_SIZE / 2) / Viewer->Scale.X;
 	double Y1 = Viewer->Min.Y + (Viewer->Pointer.Y - BOX_SIZE / 2) / Viewer->Scale.Y;
 	double X2 = Viewer->Min.X + (Viewer->Pointer.X + BOX_SIZE / 2) / Viewer->Scale.X;
@@ -1031,22 +1275,42 @@ static void update_preview(viewer_t *Viewer) {
 	if (Viewer->ImagesStore) {
 		++Viewer->LoadGeneration;
 		gtk_list_store_clear(Viewer->ImagesStore);
-		//printf("\n\n%s:%d\n", __FUNCTION__, __LINE__);
-		foreach_node(Viewer, X1, Y1, X2, Y2, Viewer, (node_callback_t *)draw_node_image);
+		preview_nodes(Viewer, MAX_VISIBLE_IMAGES, (node_callback_t *)draw_node_image);
 	} else if (Viewer->ValuesStore) {
 		gtk_list_store_clear(Viewer->ValuesStore);
-		//printf("\n\n%s:%d\n", __FUNCTION__, __LINE__);
-		foreach_node(Viewer, X1, Y1, X2, Y2, Viewer, (node_callback_t *)draw_node_value);
+		preview_nodes(Viewer, MAX_VISIBLE_VALUES, (node_callback_t *)draw_node_value);
+	}
+	char NumVisibleText[256];
+	field_t *Field = box_summary_field(Viewer);
+	kd_summary_t Summary[1];
+	int Lasso = Viewer->LassoState == LASSO_CLOSED;
+	if (Field) {
+		if (Lasso) {
+			kd_values_polygon(Viewer->BoxValues, Viewer->Lasso, Viewer->LassoSize, Summary);
+		} else {
+			kd_values_range(Viewer->BoxValues, X1, Y1, X2, Y2, Summary);
+		}
+		Viewer->NumVisible = Summary->Count;
+	} else if (Lasso) {
+		Viewer->NumVisible = kd_tree_polygon_count(Viewer->Tree, Viewer->Lasso, Viewer->LassoSize);
+	} else {
+		Viewer->NumVisible = kd_tree_range_count(Viewer->Tree, X1, Y1, X2, Y2);
+	}
+	if (Field && Summary->NumValues) {
+		snprintf(NumVisibleText, sizeof(NumVisibleText), "%d points, %s mean %g (%g to %g)",
+			Viewer->NumVisible, Field->Name, Summary->Sum / Summary->NumValues, Summary->Min, Summary->Max
+		);
+	} else {
+		sprintf(NumVisibleText, "%d points", Viewer->NumVisible);
 	}
-	char NumVisibleText[64];
-	sprintf(NumVisibleText, "%d points", Viewer->NumVisible);
 	gtk_label_set_text(Viewer->NumVisibleLabel, NumVisibleText);
 }
 
 static int edit_node_value(viewer_t *Viewer, node_t *Node) {
 	field_t *Field = Viewer->EditField;
 	++Viewer->NumUpdated;
-	double Value = Field->Values[Node - Viewer->Nodes] = Viewer->EditValue;
+	double Value = Viewer->EditValue;
+	field_set(Field, Node - Viewer->Nodes, Value);
 	if (Field == Viewer->Fields[Viewer->CIndex]) {
 		set_node_rgb(Node, 6.0 * (Value - Field->Range.Min) / (Field->Range.Max - Field->Range.Min));
 	}
@@ -1065,7 +1329,8 @@ static int edit_node_value_remote(edit_node_remote_t *Info, node_t *Node) {
 	field_t *Field = Info->Field;
 	++Viewer->NumUpdated;
 	size_t Index = Node - Viewer->Nodes;
-	double Value = Field->Values[Index] = Viewer->EditValue;
+	double Value = Viewer->EditValue;
+	field_set(Field, Index, Value);
 	if (Field == Viewer->Fields[Viewer->CIndex]) {
 		set_node_rgb(Node, 6.0 * (Value - Field->Range.Min) / (Field->Range.Max - Field->Range.Min));
 	}
@@ -1084,39 +1349,13 @@ static void column_values_set_event(viewer_t *Viewer, const char *Event, json_t
 	field_t *Field = stringmap_search(Viewer->RemoteFields, RemoteId);
 	if (!Field) return;
 	int Length = json_array_size(Indices);
-	if (Field->EnumMap) {
-		int EnumUpdated = 0;
+	if (Field->EnumDict) {
 		for (int I = 0; I < Length; ++I) {
 			size_t Index = json_integer_value(json_array_get(Indices, I));
-			const char *Text = json_string_value(json_array_get(Values, I));
-			double Value = 0.0;
-			if (Text && Text[0]) {
-				double *Ref = stringmap_search(Field->EnumMap, Text);
-				if (Ref) {
-					Value = *(double *)Ref;
-				} else {
-					Ref = new(double);
-					stringmap_insert(Field->EnumMap, GC_strdup(Text), Ref);
-					*(double *)Ref = Value = Field->EnumMap->Size;
-					EnumUpdated = 1;
-				}
-			}
-			Field->Values[Index] = Value;
-		}
-		if (EnumUpdated) {
-			int EnumSize = Field->EnumSize = Field->EnumMap->Size + 1;
-			const char **EnumNames = (const char **)GC_malloc(EnumSize * sizeof(const char *));
-			EnumNames[0] = "";
-			stringmap_foreach(Field->EnumMap, EnumNames, (void *)set_enum_name_fn);
-			Field->EnumNames = EnumNames;
-			gtk_list_store_clear(Field->EnumStore);
-			for (int J = 0; J < EnumSize; ++J) {
-				gtk_list_store_insert_with_values(Field->EnumStore, 0, -1, 0, Field->EnumNames[J], 1, (double)(J + 1), -1);
-			}
-			Field->EnumValues = (int *)GC_malloc_atomic(EnumSize * sizeof(int));
-			Field->Range.Min = 0.0;
-			Field->Range.Max = EnumSize;
+			json_t *Text = json_array_get(Values, I);
+			field_set(Field, Index, json_is_string(Text) ? enum_dict_insert(Field->EnumDict, json_string_value(Text), json_string_length(Text)) : 0);
 		}
+		if (Field->EnumDict->Size != Field->EnumSize) field_update_enum(Field);
 	} else {
 		double Min = Field->Range.Min;
 		double Max = Field->Range.Max;
@@ -1124,7 +1363,8 @@ static void column_values_set_event(viewer_t *Viewer, const char *Event, json_t
 		double Sum2 = Field->Sum2;
 		for (int I = 0; I < Length; ++I) {
 			size_t Index = json_integer_value(json_array_get(Indices, I));
-			double Value = Field->Values[Index] = json_number_value(json_array_get(Values, I));
+			double Value = json_number_value(json_array_get(Values, I));
+			field_set(Field, Index, Value);
 			if (Value < Min) Min = Value;
 			if (Value > Max) Max = Value;
 		}
@@ -1157,15 +1397,11 @@ static void column_values_set_event(viewer_t *Viewer, const char *Event, json_t
 static void edit_node_values(viewer_t *Viewer) {
 	if (!Viewer->EditField) return;
 	Viewer->NumUpdated = 0;
-	double X1 = Viewer->Min.X + (Viewer->Pointer.X - BOX_SIZE / 2) / Viewer->Scale.X;
-	double Y1 = Viewer->Min.Y + (Viewer->Pointer.Y - BOX_SIZE / 2) / Viewer->Scale.Y;
-	double X2 = Viewer->Min.X + (Viewer->Pointer.X + BOX_SIZE / 2) / Viewer->Scale.X;
-	double Y2 = Viewer->Min.Y + (Viewer->Pointer.Y + BOX_SIZE / 2) / Viewer->Scale.Y;
 	printf("\n\n%s:%d\n", __FUNCTION__, __LINE__);
 	field_t *Field = Viewer->EditField;
 	if (Field->RemoteId) {
 		edit_node_remote_t Info[1] = {{Viewer, Field, json_array(), json_array()}};
-		foreach_node(Viewer, X1, Y1, X2, Y2, Info, (node_callback_t *)edit_node_value_remote);
+		foreach_selected(Viewer, Info, (node_callback_t *)edit_node_value_remote);
 		json_t *Request = json_pack("{sssoso}",
 			"column", Field->RemoteId,
 			"indices", Info->Indices,
@@ -1173,7 +1409,7 @@ static void edit_node_values(viewer_t *Viewer) {
 		);
 		remote_request(Viewer, "column/values/set", Request, (void *)column_values_set, Field);
 	} else {
-		foreach_node(Viewer, X1, Y1, X2, Y2, Viewer, (node_callback_t *)edit_node_value);
+		foreach_selected(Viewer, Viewer, (node_callback_t *)edit_node_value);
 	}
 	if (Field == Viewer->Fields[Viewer->CIndex]) {
 		++Viewer->FilterGeneration;
@@ -1185,12 +1421,29 @@ static void edit_node_values(viewer_t *Viewer) {
 	viewer_filter_nodes(Viewer);
 }
 
-static inline int redraw_point(viewer_t *Viewer, node_t *Node) {
+#ifndef USE_GL
+static inline void fill_point(viewer_t *Viewer, double PointX, double PointY, unsigned int Colour) {
+	double X = Viewer->Scale.X * (PointX - Viewer->Min.X);
+	double Y = Viewer->Scale.Y * (PointY - Viewer->Min.Y);
+	int X0 = (X - POINT_SIZE / 2) + 0.5;
+	int Y0 = (Y - POINT_SIZE / 2) + 0.5;
+	int Stride = Viewer->CachedStride;
+	unsigned int *Pixels = Viewer->CachedPixels + X0;
+	Pixels = (unsigned int *)((char *)Pixels + Y0 * Stride);
+	int PointSize = POINT_SIZE;
+	for (int J = PointSize; --J >= 0;) {
+		for (int I = 0; I < PointSize; ++I) Pixels[I] = Colour;
+		Pixels = (unsigned int *)((char *)Pixels + Stride);
+	}
+}
+#endif
+
+static inline void redraw_point(viewer_t *Viewer, node_t *Node, double NodeX, double NodeY) {
 #ifdef USE_GL
 	//double X = (Node->X - Viewer->Min.X) / (Viewer->Max.X - Viewer->Min.X);
 	//double Y = (Node->Y - Viewer->Min.Y) / (Viewer->Max.Y - Viewer->Min.Y);
-	double X = Viewer->Scale.X * (Node->X - Viewer->Min.X);
-	double Y = Viewer->Scale.Y * (Node->Y - Viewer->Min.Y);
+	double X = Viewer->Scale.X * (NodeX - Viewer->Min.X);
+	double Y = Viewer->Scale.Y * (NodeY - Viewer->Min.Y);
 	//printf("Point at (%f, %f)\n", X, Y);
 	int Index = Viewer->GLCount;
 	Viewer->GLVertices[3 * Index + 0] = X - POINT_SIZE / 2;
@@ -1216,34 +1469,88 @@ static inline int redraw_point(viewer_t *Viewer, node_t *Node) {
 	Viewer->GLColours[4 * Index + 11] = 1.0;
 	Viewer->GLCount = Index + 3;
 #else
-	double X = Viewer->Scale.X * (Node->X - Viewer->Min.X);
-	double Y = Viewer->Scale.Y * (Node->Y - Viewer->Min.Y);
-	int X0 = (X - POINT_SIZE / 2) + 0.5;
-	int Y0 = (Y - POINT_SIZE / 2) + 0.5;
-	int Stride = Viewer->CachedStride;
-	unsigned int *Pixels = Viewer->CachedPixels + X0;
-	Pixels = (unsigned int *)((char *)Pixels + Y0 * Stride);
-	unsigned int Colour = Node->Colour;
-	int PointSize = POINT_SIZE;
-	for (int J = PointSize; --J >= 0;) {
-		for (int I = 0; I < PointSize; ++I) Pixels[I] = Colour;
-		Pixels = (unsigned int *)((char *)Pixels + Stride);
-	}
+	fill_point(Viewer, NodeX, NodeY, Node->Colour);
 	/*cairo_t *Cairo = Viewer->Cairo;
 	cairo_new_path(Cairo);
 	cairo_rectangle(Cairo, X - POINT_SIZE / 2, Y - POINT_SIZE / 2, POINT_SIZE, POINT_SIZE);
 	cairo_set_source_rgb(Cairo, Node->R, Node->G, Node->B);
 	cairo_fill(Cairo);*/
 #endif
-	return 0;
 }
 
+// Draws the points in view from batches of tree hits, which carry their
+// coordinates so only the colours are read from the nodes.
+static void redraw_points(viewer_t *Viewer) {
+	node_t *Nodes = Viewer->Nodes;
+	kd_cursor_t Cursor[1];
+	kd_batch_t Batch[1];
+	kd_cursor_init(Cursor, Viewer->Tree, Viewer->Min.X, Viewer->Min.Y, Viewer->Max.X, Viewer->Max.Y);
+	while (kd_cursor_next(Cursor, Batch)) {
+		for (int I = 0; I < Batch->Count; ++I) redraw_point(Viewer, Nodes + Batch->Rows[I], Batch->X[I], Batch->Y[I]);
+	}
+}
+
+#ifndef USE_GL
+// Bins every node in the tree into the density pyramid with its colour, the
+// colours are gathered from the nodes a chunk at a time.
+static void update_density(viewer_t *Viewer) {
+	if (!Viewer->Density) Viewer->Density = density_new();
+	density_begin(Viewer->Density, Viewer->DataMin.X, Viewer->DataMin.Y, Viewer->DataMax.X, Viewer->DataMax.Y);
+	node_t *Nodes = Viewer->Nodes;
+	uint32_t Colours[1024];
+	kd_cursor_t Cursor[1];
+	kd_batch_t Batch[1];
+	kd_cursor_init(Cursor, Viewer->Tree, -INFINITY, -INFINITY, INFINITY, INFINITY);
+	while (kd_cursor_next(Cursor, Batch)) {
+		for (int Start = 0; Start < Batch->Count; Start += 1024) {
+			int Size = Batch->Count - Start < 1024 ? Batch->Count - Start : 1024;
+			for (int I = 0; I < Size; ++I) Colours[I] = Nodes[Batch->Rows[Start + I]].Colour;
+			density_add(Viewer->Density, Batch->X + Start, Batch->Y + Start, Colours, Size);
+		}
+	}
+	density_finish(Viewer->Density);
+	Viewer->DensityStale = 0;
+}
+
+// When enough points are in view, draws one point per occupied bin of the
+// coarsest level with bins no wider than a pixel, or of the finest level if
+// its bins are within half a point. Returns 0 if the points should be drawn.
+static int redraw_density(viewer_t *Viewer) {
+	if (kd_tree_range_count(Viewer->Tree, Viewer->Min.X, Viewer->Min.Y, Viewer->Max.X, Viewer->Max.Y) < DENSITY_MIN_POINTS) return 0;
+	double Width = (Viewer->DataMax.X - Viewer->DataMin.X) * Viewer->Scale.X;
+	double Height = (Viewer->DataMax.Y - Viewer->DataMin.Y) * Viewer->Scale.Y;
+	int Level = 0;
+	while (Level < DENSITY_MAX_LEVEL && (Width > (1 << Level) || Height > (1 << Level))) ++Level;
+	if (Width > (POINT_SIZE / 2) * (1 << Level) || Height > (POINT_SIZE / 2) * (1 << Level)) return 0;
+	if (Viewer->DensityStale || !Viewer->Density) update_density(Viewer);
+	const density_level_t *Bins = density_level(Viewer->Density, Level);
+	int Size = Bins->Size;
+	int X1 = floor((Viewer->Min.X - Bins->MinX) / Bins->BinX), X2 = floor((Viewer->Max.X - Bins->MinX) / Bins->BinX);
+	int Y1 = floor((Viewer->Min.Y - Bins->MinY) / Bins->BinY), Y2 = floor((Viewer->Max.Y - Bins->MinY) / Bins->BinY);
+	if (X1 < 0) X1 = 0;
+	if (Y1 < 0) Y1 = 0;
+	if (X2 >= Size) X2 = Size - 1;
+	if (Y2 >= Size) Y2 = Size - 1;
+	for (int J = Y1; J <= Y2; ++J) {
+		double Y = Bins->MinY + (J + 0.5) * Bins->BinY;
+		if (Y < Viewer->Min.Y || Y > Viewer->Max.Y) continue;
+		const uint32_t *Counts = Bins->Counts + J * Size, *Colours = Bins->Colours + J * Size;
+		for (int I = X1; I <= X2; ++I) if (Counts[I]) {
+			double X = Bins->MinX + (I + 0.5) * Bins->BinX;
+			if (X < Viewer->Min.X || X > Viewer->Max.X) continue;
+			fill_point(Viewer, X, Y, Colours[I]);
+		}
+	}
+	return 1;
+}
+#endif
+
 static void redraw_viewer_background(viewer_t *Viewer) {
 #ifdef USE_GL
 	Viewer->GLCount = 0;
 	//clock_t Start = clock();
 	printf("\n\n%s:%d\n", __FUNCTION__, __LINE__);
-	foreach_node(Viewer, Viewer->Min.X, Viewer->Min.Y, Viewer->Max.X, Viewer->Max.Y, Viewer, (node_callback_t *)redraw_point);
+	redraw_points(Viewer);
 	//printf("foreach_node took %d\n", clock() - Start);
 	//printf("rendered %d points\n", Viewer->GLCount);
 	if (Viewer->GLReady) {
@@ -1265,7 +1572,7 @@ static void redraw_viewer_background(viewer_t *Viewer) {
 	Viewer->Cairo = Cairo;
 	clock_t Start = clock();
 	printf("\n\n%s:%d\n", __FUNCTION__, __LINE__);
-	foreach_node(Viewer, Viewer->Min.X, Viewer->Min.Y, Viewer->Max.X, Viewer->Max.Y, Viewer, (node_callback_t *)redraw_point);
+	redraw_points(Viewer);
 	printf("foreach_node took %lu\n", clock() - Start);
 	Viewer->Cairo = 0;
 	cairo_destroy(Cairo);*/
@@ -1352,6 +1659,34 @@ static gboolean render_viewer(GtkGLArea *Widget, GdkGLContext *Context, viewer_t
 	glDisableVertexAttribArray(0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
+	if (Viewer->LassoState != LASSO_NONE) {
+		int Size = Viewer->LassoSize;
+		float *LassoVertices = GC_malloc_atomic(Size * 3 * sizeof(float));
+		float *LassoColours = GC_malloc_atomic(Size * 4 * sizeof(float));
+		for (int I = 0; I < Size; ++I) {
+			const double *Vertex = Viewer->Lasso + 2 * I;
+			LassoVertices[3 * I + 0] = Viewer->Scale.X * (Vertex[0] - Viewer->Min.X);
+			LassoVertices[3 * I + 1] = Viewer->Scale.Y * (Vertex[1] - Viewer->Min.Y);
+			LassoVertices[3 * I + 2] = 0.1;
+			LassoColours[4 * I + 0] = 0.5;
+			LassoColours[4 * I + 1] = 0.5;
+			LassoColours[4 * I + 2] = 1.0;
+			LassoColours[4 * I + 3] = 1.0;
+		}
+		glBindVertexArray(Viewer->GLArrays[1]);
+		glEnableVertexAttribArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, Viewer->GLBuffers[2]);
+		glBufferData(GL_ARRAY_BUFFER, Size * 3 * sizeof(float), LassoVertices, GL_STATIC_DRAW);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void *)0);
+		glEnableVertexAttribArray(1);
+		glBindBuffer(GL_ARRAY_BUFFER, Viewer->GLBuffers[3]);
+		glBufferData(GL_ARRAY_BUFFER, Size * 4 * sizeof(float), LassoColours, GL_STATIC_DRAW);
+		glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, (void *)0);
+		glDrawArrays(Viewer->LassoState == LASSO_CLOSED ? GL_LINE_LOOP : GL_LINE_STRIP, 0, Size);
+		glDisableVertexAttribArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
 	glDisable(GL_BLEND);
 
 	glUseProgram(0);
@@ -1471,7 +1806,7 @@ static void redraw_viewer(GtkWidget *Widget, cairo_t *Cairo, viewer_t *Viewer) {
 		Viewer->Cairo = Cairo;
 		//clock_t Start = clock();
 		//printf("\n\n%s:%d\n", __FUNCTION__, __LINE__);
-		foreach_node(Viewer, Viewer->Min.X, Viewer->Min.Y, Viewer->Max.X, Viewer->Max.Y, Viewer, (node_callback_t *)redraw_point);
+		if (!redraw_density(Viewer)) redraw_points(Viewer);
 		//printf("foreach_node took %lu\n", clock() - Start);
 		Viewer->Cairo = 0;
 		cairo_destroy(Cairo);
@@ -1491,6 +1826,22 @@ static void redraw_viewer(GtkWidget *Widget, cairo_t *Cairo, viewer_t *Viewer) {
 		cairo_set_source_rgba(Cairo, 1.0, 1.0, 0.5, 0.5);
 		cairo_fill(Cairo);
 	}
+	if (Viewer->LassoState != LASSO_NONE) {
+		cairo_new_path(Cairo);
+		for (int I = 0; I < Viewer->LassoSize; ++I) {
+			const double *Vertex = Viewer->Lasso + 2 * I;
+			cairo_line_to(Cairo, Viewer->Scale.X * (Vertex[0] - Viewer->Min.X), Viewer->Scale.Y * (Vertex[1] - Viewer->Min.Y));
+		}
+		cairo_set_source_rgb(Cairo, 1.0, 1.0, 0.5);
+		if (Viewer->LassoState == LASSO_CLOSED) {
+			cairo_close_path(Cairo);
+			cairo_stroke_preserve(Cairo);
+			cairo_set_source_rgba(Cairo, 1.0, 1.0, 0.5, 0.5);
+			cairo_fill(Cairo);
+		} else {
+			cairo_stroke(Cairo);
+		}
+	}
 }
 #endif
 
@@ -1563,14 +1914,49 @@ static gboolean scroll_viewer(GtkWidget *Widget, GdkEventScroll *Event, viewer_t
 	return FALSE;
 }
 
+// Lasso vertices are kept in data coordinates, so the selection stays put
+// while zooming and panning.
+static void lasso_add(viewer_t *Viewer, double PointerX, double PointerY) {
+	if (Viewer->LassoSize == Viewer->LassoSpace) {
+		Viewer->LassoSpace = Viewer->LassoSpace ? 2 * Viewer->LassoSpace : 64;
+		double *Lasso = GC_malloc_atomic(2 * Viewer->LassoSpace * sizeof(double));
+		if (Viewer->LassoSize) memcpy(Lasso, Viewer->Lasso, 2 * Viewer->LassoSize * sizeof(double));
+		Viewer->Lasso = Lasso;
+	}
+	double *Vertex = Viewer->Lasso + 2 * Viewer->LassoSize++;
+	Vertex[0] = Viewer->Min.X + PointerX / Viewer->Scale.X;
+	Vertex[1] = Viewer->Min.Y + PointerY / Viewer->Scale.Y;
+}
+
+// A lasso with less than 3 vertices is dropped and the box is used again.
+static void lasso_close(viewer_t *Viewer) {
+	Viewer->LassoState = Viewer->LassoSize >= 3 ? LASSO_CLOSED : LASSO_NONE;
+	update_preview(Viewer);
+	gtk_widget_queue_draw(Viewer->DrawingArea);
+}
+
+// Shift and drag draws a lasso, shift and click adds polygon vertices until a
+// double click, and shift does not pan in between. A click without shift goes
+// back to the box.
 static gboolean button_press_viewer(GtkWidget *Widget, GdkEventButton *Event, viewer_t *Viewer) {
 	if (Event->button == 1) {
 		Viewer->Pointer.X = Event->x;
 		Viewer->Pointer.Y = Event->y;
-		if (Event->state & GDK_CONTROL_MASK) {
+		if (Event->type == GDK_2BUTTON_PRESS && Viewer->LassoState == LASSO_OPEN) {
+			lasso_close(Viewer);
+		} else if (Event->state & GDK_SHIFT_MASK) {
+			if (Viewer->LassoState != LASSO_OPEN) {
+				Viewer->LassoState = LASSO_OPEN;
+				Viewer->LassoSize = 0;
+				Viewer->ShowBox = 0;
+			}
+			lasso_add(Viewer, Event->x, Event->y);
+			Viewer->LassoDragged = 0;
+		} else if (Event->state & GDK_CONTROL_MASK) {
 			edit_node_values(Viewer);
 			redraw_viewer_background(Viewer);
 		} else {
+			Viewer->LassoState = LASSO_NONE;
 			update_preview(Viewer);
 			Viewer->ShowBox = 0;
 		}
@@ -1590,12 +1976,51 @@ static gboolean button_press_viewer(GtkWidget *Widget, GdkEventButton *Event, vi
 
 static gboolean button_release_viewer(GtkWidget *Widget, GdkEventButton *Event, viewer_t *Viewer) {
 	if (Event->button == 1) {
-		Viewer->ShowBox = 1;
+		if (Viewer->LassoState == LASSO_OPEN) {
+			if (Viewer->LassoDragged) lasso_close(Viewer);
+		} else if (Viewer->LassoState == LASSO_NONE) {
+			Viewer->ShowBox = 1;
+		}
 		gtk_widget_queue_draw(Widget);
 	}
 	return FALSE;
 }
 
+// Shows the nearest point within HOVER_DISTANCE pixels of the pointer in the
+// tooltip of the drawing area, with its position and colour values.
+static void update_hover(viewer_t *Viewer, double PointerX, double PointerY) {
+	double X = Viewer->Min.X + PointerX / Viewer->Scale.X;
+	double Y = Viewer->Min.Y + PointerY / Viewer->Scale.Y;
+	uint32_t Row;
+	double Distance;
+	node_t *Node = 0;
+	if (kd_tree_nearest(Viewer->Tree, X, Y, Viewer->Scale.X, Viewer->Scale.Y, HOVER_DISTANCE, 1, &Row, &Distance)) {
+		Node = Viewer->Nodes + Row;
+	}
+	if (Node == Viewer->HoverNode) return;
+	Viewer->HoverNode = Node;
+	if (!Node) {
+		gtk_widget_set_tooltip_text(Viewer->DrawingArea, NULL);
+		return;
+	}
+	char Text[1024];
+	int Length = snprintf(Text, sizeof(Text), "%s", node_file_name(Node));
+	int Indices[3] = {Viewer->XIndex, Viewer->YIndex, Viewer->CIndex};
+	for (int I = 0; I < 3; ++I) {
+		if (Indices[I] < 0 || Indices[I] >= Viewer->NumFields) continue;
+		if (I == 2 && (Indices[2] == Indices[0] || Indices[2] == Indices[1])) continue;
+		field_t *Field = Viewer->Fields[Indices[I]];
+		if (Field->Lazy || Length >= sizeof(Text)) continue;
+		double Value = field_get(Field, Row);
+		if (Field->EnumNames) {
+			Length += snprintf(Text + Length, sizeof(Text) - Length, "\n%s = %s", Field->Name, Value ? Field->EnumNames[(int)Value] : "");
+		} else {
+			Length += snprintf(Text + Length, sizeof(Text) - Length, "\n%s = %g", Field->Name, Value);
+		}
+	}
+	gtk_widget_set_tooltip_text(Viewer->DrawingArea, Text);
+}
+
 static gboolean motion_notify_viewer(GtkWidget *Widget, GdkEventMotion *Event, viewer_t *Viewer) {
 	if (Event->state & GDK_BUTTON2_MASK) {
 		double DeltaX = (Viewer->Pointer.X - Event->x) / Viewer->Scale.X;
@@ -1606,17 +2031,31 @@ static gboolean motion_notify_viewer(GtkWidget *Widget, GdkEventMotion *Event, v
 		Viewer->Pointer.Y = Event->y;
 		gtk_widget_queue_draw(Widget);
 	} else if (Event->state & GDK_BUTTON1_MASK) {
-		Viewer->Pointer.X = Event->x;
-		Viewer->Pointer.Y = Event->y;
-		update_preview(Viewer);
-	} else if (Event->state & GDK_SHIFT_MASK) {
-		double DeltaX = (Viewer->Pointer.X - Event->x) / Viewer->Scale.X;
-		double DeltaY = (Viewer->Pointer.Y - Event->y) / Viewer->Scale.Y;
-		pan_viewer(Viewer, DeltaX, DeltaY);
+		if (Viewer->LassoState == LASSO_OPEN) {
+			const double *Last = Viewer->Lasso + 2 * (Viewer->LassoSize - 1);
+			double DeltaX = Viewer->Scale.X * (Last[0] - Viewer->Min.X) - Event->x;
+			double DeltaY = Viewer->Scale.Y * (Last[1] - Viewer->Min.Y) - Event->y;
+			if (DeltaX * DeltaX + DeltaY * DeltaY >= LASSO_SPACING * LASSO_SPACING) {
+				lasso_add(Viewer, Event->x, Event->y);
+				Viewer->LassoDragged = 1;
+				gtk_widget_queue_draw(Widget);
+			}
+		} else {
+			Viewer->Pointer.X = Event->x;
+			Viewer->Pointer.Y = Event->y;
+			update_preview(Viewer);
+		}
+	} else if ((Event->state & GDK_SHIFT_MASK) && Viewer->LassoState != LASSO_OPEN) {
+		// Shift pans, except while placing polygon vertices with shift-clicks
+		double DeltaX = (Viewer->Pointer.X - Event->x) / Viewer->Scale.X;
+		double DeltaY = (Viewer->Pointer.Y - Event->y) / Viewer->Scale.Y;
+		pan_viewer(Viewer, DeltaX, DeltaY);
 		redraw_viewer_background(Viewer);
 		Viewer->Pointer.X = Event->x;
 		Viewer->Pointer.Y = Event->y;
 		gtk_widget_queue_draw(Widget);
+	} else {
+		update_hover(Viewer, Event->x, Event->y);
 	}
 	return FALSE;
 }
@@ -1630,8 +2069,20 @@ static void images_selected_foreach(GtkIconView *ImagesView, GtkTreePath *Path,
 	g_free((void *)Value);
 }
 
+static int select_node(viewer_t *Viewer, node_t *Node) {
+	Node->Next = Viewer->Selected;
+	Viewer->Selected = Node;
+	return 0;
+}
+
 static gboolean key_press_viewer(GtkWidget *Widget, GdkEventKey *Event, viewer_t *Viewer) {
 	printf("key_press_viewer()\n");
+	if (Event->keyval == GDK_KEY_Escape && Viewer->LassoState != LASSO_NONE) {
+		Viewer->LassoState = LASSO_NONE;
+		update_preview(Viewer);
+		gtk_widget_queue_draw(Viewer->DrawingArea);
+		return TRUE;
+	}
 	if (!(Event->state & GDK_CONTROL_MASK)) return FALSE;
 	switch (Event->keyval) {
 	case GDK_KEY_s: {
@@ -1645,6 +2096,9 @@ static gboolean key_press_viewer(GtkWidget *Widget, GdkEventKey *Event, viewer_t
 	case GDK_KEY_4: case GDK_KEY_5: case GDK_KEY_6: case GDK_KEY_7:
 	case GDK_KEY_8: case GDK_KEY_9: {
 		ml_value_t *HotkeyFn = Viewer->HotkeyFns[Event->keyval - GDK_KEY_0];
+		// The preview only lists the first nodes in the selection
+		Viewer->Selected = 0;
+		foreach_selected(Viewer, Viewer, (node_callback_t *)select_node);
 		for (node_t *Node = Viewer->Selected; Node; Node = Node->Next) {
 			ml_value_t *Result = ml_inline(HotkeyFn, 1, Node);
 			if (Result->Type == MLErrorT) {
@@ -1845,7 +2299,7 @@ static void dataset_create(viewer_t *Viewer, json_t *Result, connect_info_t *Inf
 	node_t *Node = Viewer->Nodes;
 	int ImagePrefixLength = strlen(Viewer->ImagePrefix);
 	for (int I = 0; I < Viewer->NumNodes; ++I) {
-		json_array_append(Values, json_string(Node[I].FileName));
+		json_array_append(Values, json_string(node_file_name(Node + I)));
 	}
 	remote_request(Viewer, "column/values/set", json_pack("{ssso}", "column", ImagesId, "values", Values), (void *)column_values_set, NULL);
 	gtk_dialog_response(GTK_DIALOG(Info->Dialog), GTK_RESPONSE_CANCEL);
@@ -1869,26 +2323,9 @@ static void connect_images_get(viewer_t *Viewer, json_t *Result, connect_info_t
 	Viewer->ImagePrefix = Info->ImagePrefix;
 	printf("Viewer->ImagePrefix = %s\n", Viewer->ImagePrefix);
 	node_t *Nodes = Viewer->Nodes;
-	int ImagePrefixLength = strlen(Info->ImagePrefix);
 	for (int I = 0; I < Viewer->NumNodes; ++I) {
 		json_t *Json = json_array_get(Result, I);
-		int Size = json_string_length(Json);
-		const char *Text = json_string_value(Json);
-		char *FileName, *FilePath;
-		FileName = GC_malloc(Size + 1);
-		memcpy(FileName, Text, Size);
-		FileName[Size] = 0;
-		if (ImagePrefixLength) {
-			int Length = ImagePrefixLength + Size;
-			FilePath = GC_malloc(Length + 1);
-			memcpy(stpcpy(FilePath, Info->ImagePrefix), Text, Size);
-			FilePath[Length] = 0;
-		} else {
-			FilePath = FileName;
-		}
-		Nodes[I].FileName = FileName;
-		Nodes[I].File = g_file_new_for_path(FilePath);
-		if (FilePath != FileName) GC_free(FilePath);
+		Nodes[I].FileName = file_names_add(Viewer->FileNames, json_string_value(Json), json_string_length(Json));
 	}
 }
 
@@ -1900,17 +2337,18 @@ static void connect_dataset_open(viewer_t *Viewer, json_t *Result, connect_info_
 	Viewer->NumNodes = NumNodes;
 	int NumFields = Viewer->NumFields = 0;
 	node_t *Nodes = Viewer->Nodes = (node_t *)GC_malloc(NumNodes * sizeof(node_t));
-	Viewer->SortedX = (node_t **)GC_malloc(NumNodes * sizeof(node_t *));
-	Viewer->SortedY = (node_t **)GC_malloc(NumNodes * sizeof(node_t *));
-	Viewer->SortBuffer = (node_t **)GC_malloc(NumNodes * sizeof(node_t *));
+	Viewer->SortedX = (uint32_t *)GC_malloc_atomic(NumNodes * sizeof(uint32_t));
+	Viewer->SortedY = (uint32_t *)GC_malloc_atomic(NumNodes * sizeof(uint32_t));
+	field_orders_clear(Viewer);
+	filters_reset(Viewer);
 	Viewer->NumFiltered = NumNodes;
 	memset(Nodes, 0, NumNodes * sizeof(node_t));
+	file_names_init(Viewer->FileNames);
 	for (int I = 0; I < NumNodes; ++I) {
 		Nodes[I].Type = NodeT;
 		Nodes[I].Viewer = Viewer;
 		Nodes[I].Filtered = 1;
-		Viewer->SortedX[I] = &Nodes[I];
-		Viewer->SortedY[I] = &Nodes[I];
+		Viewer->SortedX[I] = Viewer->SortedY[I] = I;
 	}
 	field_t **Fields = Viewer->Fields = (field_t **)GC_malloc(NumFields * sizeof(field_t *));
 	Viewer->RemoteFields[0] = (stringmap_t)STRINGMAP_INIT;
@@ -2011,6 +2449,10 @@ static void connect_clicked(GtkWidget *Button, viewer_t *Viewer) {
 static void x_field_changed(GtkComboBox *Widget, viewer_t *Viewer) {
 	int XIndex = gtk_combo_box_get_active(Widget);
 	if (XIndex >= 0) {
+		if (!viewer_field_require(Viewer, Viewer->Fields[XIndex])) {
+			gtk_combo_box_set_active(Widget, Viewer->XIndex);
+			return;
+		}
 		set_viewer_indices(Viewer, XIndex, Viewer->YIndex);
 		redraw_viewer_background(Viewer);
 		update_preview(Viewer);
@@ -2021,6 +2463,10 @@ static void x_field_changed(GtkComboBox *Widget, viewer_t *Viewer) {
 static void y_field_changed(GtkComboBox *Widget, viewer_t *Viewer) {
 	int YIndex = gtk_combo_box_get_active(Widget);
 	if (YIndex >= 0) {
+		if (!viewer_field_require(Viewer, Viewer->Fields[YIndex])) {
+			gtk_combo_box_set_active(Widget, Viewer->YIndex);
+			return;
+		}
 		set_viewer_indices(Viewer, Viewer->XIndex, YIndex);
 		redraw_viewer_background(Viewer);
 		update_preview(Viewer);
@@ -2031,6 +2477,10 @@ static void y_field_changed(GtkComboBox *Widget, viewer_t *Viewer) {
 static void c_field_changed(GtkComboBox *Widget, viewer_t *Viewer) {
 	int CIndex = gtk_combo_box_get_active(Widget);
 	if (CIndex >= 0) {
+		if (!viewer_field_require(Viewer, Viewer->Fields[CIndex])) {
+			gtk_combo_box_set_active(Widget, Viewer->CIndex);
+			return;
+		}
 		++Viewer->FilterGeneration;
 		set_viewer_colour_index(Viewer, CIndex);
 		redraw_viewer_background(Viewer);
@@ -2042,6 +2492,7 @@ static void c_field_changed(GtkComboBox *Widget, viewer_t *Viewer) {
 static void edit_field_changed(GtkComboBox *Widget, viewer_t *Viewer) {
 	int EditIndex = gtk_combo_box_get_active(GTK_COMBO_BOX(Widget));
 	if (EditIndex >= 0) {
+		if (!viewer_field_require(Viewer, Viewer->Fields[EditIndex])) return;
 		field_t *Field = Viewer->EditField = Viewer->Fields[EditIndex];
 		gtk_combo_box_set_model(GTK_COMBO_BOX(Viewer->EditValueComboBox), GTK_TREE_MODEL(Field->EnumStore));
 		Viewer->EditValue = 0.0;
@@ -2057,22 +2508,16 @@ static void add_field_callback(const char *Name, viewer_t *Viewer, void *Data) {
 	Name = GC_strdup(Name);
 	int NumFields = Viewer->NumFields + 1;
 	field_t **Fields = (field_t **)GC_malloc(NumFields * sizeof(field_t *));
-	field_t *Field = (field_t *)GC_malloc(sizeof(field_t) + Viewer->NumNodes * sizeof(double));
+	field_t *Field = new(field_t);
 	Field->Type = FieldT;
-	Field->EnumStore = gtk_list_store_new(2, G_TYPE_STRING, G_TYPE_DOUBLE);
-
-	Field->EnumNames = (const char **)GC_malloc(sizeof(const char *));
-	Field->EnumValues = (int *)GC_malloc_atomic(sizeof(int));
-	Field->EnumNames[0] = "";
-	Field->EnumSize = 1;
-	Field->EnumMap = new(stringmap_t);
+	Field->EnumDict = enum_dict_new();
+	field_update_enum(Field);
 	Field->Name = Name;
 	Field->PreviewColumn = 0;
 	Field->PreviewVisible = 1;
 	Field->FilterGeneration = 0;
 	Field->Sum = Field->Sum2 = 0.0;
-	gtk_list_store_insert_with_values(Field->EnumStore, 0, -1, 0, "", 1, 0.0, -1);
-	memset(Field->Values, 0, Viewer->NumNodes * sizeof(double));
+	field_alloc_values(Field, Field->EnumDict ? FIELD_U8 : FIELD_F64, Viewer->NumNodes);
 	for (int I = 0; I < Viewer->NumFields; ++I) Fields[I] = Viewer->Fields[I];
 	Fields[Viewer->NumFields] = Field;
 	stringmap_insert(Viewer->FieldsByName, Field->Name, Field);
@@ -2090,20 +2535,9 @@ static void add_field_clicked(GtkWidget *Button, viewer_t *Viewer) {
 static void add_value_callback(const char *Name, viewer_t *Viewer, void *Data) {
 	field_t *Field = Viewer->EditField;
 	if (!Field || !Field->EnumStore) return;
-	Name = GC_strdup(Name);
-	double Value = Viewer->EditValue = gtk_tree_model_iter_n_children(GTK_TREE_MODEL(Field->EnumStore), 0);
-	gtk_list_store_insert_with_values(Field->EnumStore, 0, -1, 0, Name, 1, Value, -1);
-	const char **EnumNames = (const char **)GC_malloc((Value + 1) * sizeof(const char *));
-	memcpy(EnumNames, Field->EnumNames, Value * sizeof(const char *));
-	EnumNames[(int)Value] = Name;
-	GC_free(Field->EnumNames);
-	Field->EnumNames = EnumNames;
-	GC_free(Field->EnumValues);
-	Field->EnumSize = Value + 1;
-	Field->EnumValues = (int *)GC_malloc_atomic(Field->EnumSize * sizeof(int));
-	double *Ref = new(double);
-	*Ref = Value;
-	stringmap_insert(Field->EnumMap, Name, Ref);
+	int Value = enum_dict_insert(Field->EnumDict, Name, strlen(Name));
+	field_update_enum(Field);
+	Viewer->EditValue = Value;
 	gtk_combo_box_set_active(GTK_COMBO_BOX(Viewer->EditValueComboBox), Value);
 	if (Field == Viewer->Fields[Viewer->CIndex]) {
 		++Viewer->FilterGeneration;
@@ -2117,73 +2551,251 @@ static void add_value_clicked(GtkWidget *Button, viewer_t *Viewer) {
 	text_input_dialog("Add Value", NULL, Viewer, (text_dialog_callback_t *)add_value_callback, 0);
 }
 
-static void filter_operator_equal(int Count, node_t *Node, double *Input, double Value) {
-	while (--Count >= 0) {
-		if (Input[0] != Value) Node->Filtered = 0;
-		++Node;
-		++Input;
-	}
+// Each operator sets the bits in Rejected of the rows it rejects, reading the
+// field in its own storage type from row Start onwards. Bit I is row Start + I
+// and the bits after the last row are cleared.
+#define FILTER_REJECT(T, REJECT) { \
+	const T *Input = (const T *)Field->Values + Start; \
+	memset(Rejected, 0, ((Count + 63) / 64) * sizeof(uint64_t)); \
+	for (int I = 0; I < Count; ++I) Rejected[I / 64] |= (uint64_t)((double)Input[I] REJECT Value) << (I % 64); \
 }
 
-static void filter_operator_not_equal(int Count, node_t *Node, double *Input, double Value) {
-	while (--Count >= 0) {
-		if (Input[0] == Value) Node->Filtered = 0;
-		++Node;
-		++Input;
-	}
+#define FILTER_OPERATOR(NAME, REJECT) \
+static void filter_operator_ ## NAME(int Count, uint64_t *Rejected, field_t *Field, int Start, double Value) { \
+	FIELD_STORAGE_SWITCH(Field->Storage, FILTER_REJECT, REJECT); \
 }
 
-static void filter_operator_less(int Count, node_t *Node, double *Input, double Value) {
-	while (--Count >= 0) {
-		if (Input[0] >= Value) Node->Filtered = 0;
-		++Node;
-		++Input;
+FILTER_OPERATOR(equal, !=)
+FILTER_OPERATOR(not_equal, ==)
+FILTER_OPERATOR(less, >=)
+FILTER_OPERATOR(greater, <=)
+FILTER_OPERATOR(less_or_equal, >)
+FILTER_OPERATOR(greater_or_equal, <)
+
+#define FILTER_BLOCK_SIZE 4096
+
+typedef struct {
+	uint32_t *Rows;
+	int Count, Space;
+} filter_changes_t;
+
+static void filter_changes_add(filter_changes_t *Changes, uint32_t Row) {
+	if (Changes->Count == Changes->Space) {
+		Changes->Space = Changes->Space ? 2 * Changes->Space : 1024;
+		Changes->Rows = realloc(Changes->Rows, Changes->Space * sizeof(uint32_t));
+	}
+	Changes->Rows[Changes->Count++] = Row;
+}
+
+// New rows start out accepted.
+static void filter_reserve(filter_t *Filter, int NumRows) {
+	int Space = (NumRows + 63) / 64;
+	if (Space <= Filter->RejectedSpace) return;
+	if (Space < 2 * Filter->RejectedSpace) Space = 2 * Filter->RejectedSpace;
+	uint64_t *Rejected = (uint64_t *)GC_malloc_atomic(Space * sizeof(uint64_t));
+	if (Filter->RejectedSpace) memcpy(Rejected, Filter->Rejected, Filter->RejectedSpace * sizeof(uint64_t));
+	memset(Rejected + Filter->RejectedSpace, 0, (Space - Filter->RejectedSpace) * sizeof(uint64_t));
+	Filter->Rejected = Rejected;
+	Filter->RejectedSpace = Space;
+}
+
+static void filter_mark_applied(filter_t *Filter, int NumRows) {
+	Filter->AppliedField = Filter->Field;
+	Filter->AppliedOperator = Filter->Operator;
+	Filter->AppliedValue = Filter->Value;
+	Filter->AppliedRows = NumRows;
+	Filter->AppliedGeneration = Filter->Field ? Filter->Field->Generation : 0;
+}
+
+// Re-tests rows First to Last a block at a time, from the start of the word
+// holding First, and records the rows whose bits change. A filter without a
+// field or operator rejects nothing.
+static void filter_update_rows(filter_t *Filter, int First, int Last, filter_changes_t *Changes) {
+	uint64_t Block[FILTER_BLOCK_SIZE / 64];
+	uint64_t *Rejected = Filter->Rejected;
+	for (int Start = First & ~63; Start < Last; Start += FILTER_BLOCK_SIZE) {
+		int Count = Last - Start < FILTER_BLOCK_SIZE ? Last - Start : FILTER_BLOCK_SIZE;
+		if (Filter->Operator && Filter->Field) {
+			Filter->Operator(Count, Block, Filter->Field, Start, Filter->Value);
+		} else {
+			memset(Block, 0, sizeof(Block));
+		}
+		for (int I = 0; I < (Count + 63) / 64; ++I) {
+			uint64_t Changed = Block[I] ^ Rejected[Start / 64 + I];
+			Rejected[Start / 64 + I] ^= Changed;
+			while (Changed) {
+				filter_changes_add(Changes, Start + 64 * I + __builtin_ctzll(Changed));
+				Changed &= Changed - 1;
+			}
+		}
 	}
 }
 
-static void filter_operator_greater(int Count, node_t *Node, double *Input, double Value) {
-	while (--Count >= 0) {
-		if (Input[0] <= Value) Node->Filtered = 0;
-		++Node;
-		++Input;
+// Returns the first position in Rows, sorted by field_order(), whose key is
+// above Key (if Above is non zero) or not below it.
+static int field_order_search(field_t *Field, const uint32_t *Rows, int Count, uint64_t Key, int Above) {
+	int Lo = 0, Hi = Count;
+	while (Lo < Hi) {
+		int Mid = Lo + (Hi - Lo) / 2;
+		uint64_t MidKey = radix_sort_key(field_get(Field, Rows[Mid]));
+		if (Above ? MidKey <= Key : MidKey < Key) {
+			Lo = Mid + 1;
+		} else {
+			Hi = Mid;
+		}
 	}
+	return Lo;
 }
 
-static void filter_operator_less_or_equal(int Count, node_t *Node, double *Input, double Value) {
-	while (--Count >= 0) {
-		if (Input[0] > Value) Node->Filtered = 0;
-		++Node;
-		++Input;
+// Only rows with values between the old and new values can change, or equal
+// to either of them for equal and not equal, so only those are re-tested,
+// found in the sorted order of the field. Zero is searched from -0.0 to 0.0
+// since they have different keys. Returns 0 without changing anything if
+// there are too many rows for this to be worth it.
+static int filter_update_value(viewer_t *Viewer, filter_t *Filter, filter_changes_t *Changes) {
+	field_t *Field = Filter->Field;
+	int NumNodes = Viewer->NumNodes;
+	double Old = Filter->AppliedValue, New = Filter->Value;
+	if (isnan(Old) || isnan(New)) return 0;
+	double Ranges[2][2] = {{Old, Old}, {New, New}};
+	int NumRanges = 2;
+	if (Filter->Operator != filter_operator_equal && Filter->Operator != filter_operator_not_equal) {
+		Ranges[0][0] = Old < New ? Old : New;
+		Ranges[0][1] = Old < New ? New : Old;
+		NumRanges = 1;
+	}
+	const uint32_t *Rows = field_order(Viewer, Field);
+	int Bounds[2][2], Count = 0;
+	for (int J = 0; J < NumRanges; ++J) {
+		double Min = Ranges[J][0] == 0.0 ? -0.0 : Ranges[J][0];
+		double Max = Ranges[J][1] == 0.0 ? 0.0 : Ranges[J][1];
+		Bounds[J][0] = field_order_search(Field, Rows, NumNodes, radix_sort_key(Min), 0);
+		Bounds[J][1] = field_order_search(Field, Rows, NumNodes, radix_sort_key(Max), 1);
+		Count += Bounds[J][1] - Bounds[J][0];
+	}
+	if (Count > NumNodes / 8) return 0;
+	uint64_t *Rejected = Filter->Rejected;
+	for (int J = 0; J < NumRanges; ++J) {
+		for (int I = Bounds[J][0]; I < Bounds[J][1]; ++I) {
+			uint32_t Row = Rows[I];
+			uint64_t Word;
+			Filter->Operator(1, &Word, Field, Row, New);
+			if ((Word ^ (Rejected[Row / 64] >> (Row % 64))) & 1) {
+				Rejected[Row / 64] ^= (uint64_t)1 << (Row % 64);
+				filter_changes_add(Changes, Row);
+			}
+		}
 	}
+	return 1;
 }
 
-static void filter_operator_greater_or_equal(int Count, node_t *Node, double *Input, double Value) {
-	while (--Count >= 0) {
-		if (Input[0] < Value) Node->Filtered = 0;
-		++Node;
-		++Input;
+// Brings the bits of a filter up to date with its settings, a filter whose
+// value alone changed re-tests the rows between the values if it can.
+static void filter_update(viewer_t *Viewer, filter_t *Filter, filter_changes_t *Changes) {
+	int NumNodes = Viewer->NumNodes;
+	field_t *Field = Filter->Field;
+	int Active = Filter->Operator && Field;
+	filter_reserve(Filter, NumNodes);
+	int Current = Filter->AppliedRows == NumNodes && Filter->AppliedField == Field && Filter->AppliedOperator == Filter->Operator;
+	if (Active && Filter->AppliedGeneration != Field->Generation) Current = 0;
+	if (Current && (!Active || Filter->AppliedValue == Filter->Value)) return;
+	if (!Current || !filter_update_value(Viewer, Filter, Changes)) filter_update_rows(Filter, 0, NumNodes, Changes);
+	filter_mark_applied(Filter, NumNodes);
+}
+
+// Sets Filtered on the changed rows from the bits of every filter and keeps
+// only the rows whose Filtered changed, those now visible first. Rows may be
+// listed more than once. Returns the number now visible.
+static int viewer_filter_changes(viewer_t *Viewer, filter_changes_t *Changes) {
+	node_t *Nodes = Viewer->Nodes;
+	uint32_t *Rows = Changes->Rows;
+	int Count = 0;
+	for (int I = 0; I < Changes->Count; ++I) {
+		uint32_t Row = Rows[I];
+		int Filtered = 1;
+		for (filter_t *Filter = Viewer->Filters; Filter; Filter = Filter->Next) {
+			if ((Filter->Rejected[Row / 64] >> (Row % 64)) & 1) {
+				Filtered = 0;
+				break;
+			}
+		}
+		if (Nodes[Row].Filtered == Filtered) continue;
+		Nodes[Row].Filtered = Filtered;
+		Viewer->NumFiltered += Filtered ? 1 : -1;
+		Rows[Count++] = Row;
+	}
+	Changes->Count = Count;
+	int NumVisible = 0;
+	for (int I = 0; I < Count; ++I) if (Nodes[Rows[I]].Filtered) {
+		uint32_t Row = Rows[I];
+		Rows[I] = Rows[NumVisible];
+		Rows[NumVisible++] = Row;
+	}
+	return NumVisible;
+}
+
+// Recomputes the enum colour mapping, returning non zero if it changed.
+static int filter_enum_changed(viewer_t *Viewer, field_t *Field) {
+	int EnumSize = Field->EnumSize, Max = Field->Range.Max;
+	int *Old = malloc(EnumSize * sizeof(int) + 1);
+	memcpy(Old, Field->EnumValues, EnumSize * sizeof(int));
+	filter_enum_field(Viewer, Field);
+	int Changed = Field->Range.Max != Max || memcmp(Old, Field->EnumValues, EnumSize * sizeof(int));
+	free(Old);
+	return Changed;
+}
+
+#ifndef USE_GL
+// Adds the rows to the density pyramid or removes them, with the colours
+// they were binned with. Rows with a NaN coordinate are not in it.
+static void update_density_rows(viewer_t *Viewer, const uint32_t *Rows, int Count, int Visible) {
+	node_t *Nodes = Viewer->Nodes;
+	double X[1024], Y[1024];
+	uint32_t Colours[1024];
+	int Size = 0;
+	for (int I = 0; I < Count; ++I) {
+		node_t *Node = Nodes + Rows[I];
+		if (!isnan(Node->X) && !isnan(Node->Y)) {
+			X[Size] = Node->X;
+			Y[Size] = Node->Y;
+			Colours[Size] = Node->Colour;
+			++Size;
+		}
+		if (Size < 1024 && I < Count - 1) continue;
+		if (Visible) {
+			density_add(Viewer->Density, X, Y, Colours, Size);
+		} else {
+			density_remove(Viewer->Density, X, Y, Colours, Size);
+		}
+		Size = 0;
 	}
 }
+#endif
 
+// Only the filters whose settings or fields changed are re-tested, and only
+// the rows whose Filtered changes are passed to the tree and the density
+// pyramid. Nodes are only recoloured if the colour field is an enum whose
+// mapping to the visible values changed.
 static void viewer_filter_nodes(viewer_t *Viewer) {
-	int NumNodes = Viewer->NumNodes;
-	node_t *Node = Viewer->Nodes;
-	for (int I = NumNodes; --I >= 0;) {
-		Node->Filtered = 1;
-		++Node;
-	}
-	for (filter_t *Filter = Viewer->Filters; Filter; Filter = Filter->Next) {
-		if (Filter->Operator && Filter->Field) {
-			Filter->Operator(Viewer->NumNodes, Viewer->Nodes, Filter->Field->Values, Filter->Value);
+	filter_changes_t Changes[1] = {{0, 0, 0}};
+	for (filter_t *Filter = Viewer->Filters; Filter; Filter = Filter->Next) filter_update(Viewer, Filter, Changes);
+	int NumVisible = viewer_filter_changes(Viewer, Changes);
+	if (Changes->Count) {
+		++Viewer->FilterGeneration;
+		kd_tree_mark(Viewer->Tree, Changes->Rows, NumVisible, 1);
+		kd_tree_mark(Viewer->Tree, Changes->Rows + NumVisible, Changes->Count - NumVisible, 0);
+		if (Viewer->CIndex >= 0 && Viewer->CIndex < Viewer->NumFields) {
+			field_t *CField = Viewer->Fields[Viewer->CIndex];
+			if (CField->EnumStore && filter_enum_changed(Viewer, CField)) set_viewer_colour_index(Viewer, Viewer->CIndex);
+		}
+#ifndef USE_GL
+		if (Viewer->Density && !Viewer->DensityStale) {
+			update_density_rows(Viewer, Changes->Rows, NumVisible, 1);
+			update_density_rows(Viewer, Changes->Rows + NumVisible, Changes->Count - NumVisible, 0);
 		}
+#endif
 	}
-	++Viewer->FilterGeneration;
-	Node = Viewer->Nodes;
-	int NumFiltered = 0;
-	for (int I = NumNodes; --I >= 0; ++Node) if (Node->Filtered) ++NumFiltered;
-	Viewer->NumFiltered = NumFiltered;
-	set_viewer_colour_index(Viewer, Viewer->CIndex);
-	update_node_tree(Viewer);
+	free(Changes->Rows);
 	redraw_viewer_background(Viewer);
 	update_preview(Viewer);
 	gtk_widget_queue_draw(Viewer->DrawingArea);
@@ -2195,9 +2807,10 @@ static void filter_enum_value_changed_ui(GtkComboBox *Widget, filter_t *Filter)
 }
 
 static void filter_enum_entry_changed_ui(GtkEntry *Widget, filter_t *Filter) {
-	double *Ref = stringmap_search(Filter->Field->EnumMap, gtk_entry_get_text(GTK_ENTRY(Widget)));
-	if (Ref) {
-		Filter->Value = *(double *)Ref;
+	const char *Text = gtk_entry_get_text(GTK_ENTRY(Widget));
+	int Code = enum_dict_search(Filter->Field->EnumDict, Text, strlen(Text));
+	if (Code > 0) {
+		Filter->Value = Code;
 		viewer_filter_nodes(Filter->Viewer);
 	}
 }
@@ -2236,7 +2849,9 @@ static void filter_field_change(filter_t *Filter, field_t *Field) {
 
 static void filter_field_changed_ui(GtkComboBox *Widget, filter_t *Filter) {
 	viewer_t *Viewer = Filter->Viewer;
-	field_t *Field = Filter->Field = Viewer->Fields[gtk_combo_box_get_active(GTK_COMBO_BOX(Widget))];
+	field_t *Field = Viewer->Fields[gtk_combo_box_get_active(GTK_COMBO_BOX(Widget))];
+	if (!viewer_field_require(Viewer, Field)) return;
+	Filter->Field = Field;
 	filter_field_change(Filter, Field);
 }
 
@@ -2253,14 +2868,17 @@ static void filter_operator_changed_ui(GtkComboBox *Widget, filter_t *Filter) {
 	viewer_filter_nodes(Filter->Viewer);
 }
 
+// The filter stops rejecting rows before it is removed, so the rows it had
+// rejected are passed on as changes.
 static void filter_remove_ui(GtkWidget *Button, filter_t *Filter) {
 	if (Filter->Field) --(Filter->Field->FilterCount);
 	viewer_t *Viewer = Filter->Viewer;
+	Filter->Operator = 0;
+	viewer_filter_nodes(Viewer);
 	filter_t **Slot = &Viewer->Filters;
 	while (Slot[0] != Filter) Slot = &Slot[0]->Next;
 	Slot[0] = Slot[0]->Next;
 	gtk_widget_destroy(Filter->Widget);
-	viewer_filter_nodes(Viewer);
 }
 
 static filter_t *filter_create(viewer_t *Viewer, field_t *Field, int Operator) {
@@ -2346,7 +2964,7 @@ static ml_value_t *filter_fn(viewer_t *Viewer, int Count, ml_value_t **Args) {
 	}
 	filter_t *Filter = filter_create(Viewer, Field, Operator);
 	ml_value_t *Value = Args[2];
-	if (Field->EnumMap) {
+	if (Field->EnumDict) {
 		int Index;
 		if (Value->Type == MLIntegerT) {
 			Index = ml_integer_value(Value);
@@ -2355,10 +2973,8 @@ static ml_value_t *filter_fn(viewer_t *Viewer, int Count, ml_value_t **Args) {
 			Index = ml_real_value(Value);
 			if (Index < 0 || Index >= Field->EnumSize) return ml_error("RangeError", "enum index out of range");
 		} else if (Value->Type == MLStringT) {
-			double *Ref2 = stringmap_search(Field->EnumMap, ml_string_value(Value));
-			if (Ref2) {
-				Index = *(double *)Ref2;
-			} else {
+			Index = enum_dict_search(Field->EnumDict, ml_string_value(Value), ml_string_length(Value));
+			if (Index < 0) {
 				return ml_error("ValueError", "enum name not found");
 			}
 		} else {
@@ -2569,40 +3185,27 @@ static void columns_remote_list(viewer_t *Viewer, json_t *Result, GtkListStore *
 }
 
 static void column_values_get(viewer_t *Viewer, json_t *Result, field_t *Field) {
-	double *Values = Field->Values;
-	if (Field->EnumMap) {
+	double *Values = (double *)GC_malloc_atomic(Viewer->NumNodes * sizeof(double));
+	if (Field->EnumDict) {
+		enum_dict_t *Dict = Field->EnumDict;
 		for (int Index = 0; Index < Viewer->NumNodes; ++Index) {
-			double Value = 0.0;
-			const char *Text = json_string_value(json_array_get(Result, Index));
-			if (Text && Text[0]) {
-				double *Ref = stringmap_search(Field->EnumMap, Text);
-				if (Ref) {
-					Value = *(double *)Ref;
-				} else {
-					Ref = new(double);
-					stringmap_insert(Field->EnumMap, GC_strdup(Text), Ref);
-					*(double *)Ref = Value = Field->EnumMap->Size;
-				}
-			}
-			Values[Index] = Value;
+			json_t *Text = json_array_get(Result, Index);
+			Values[Index] = json_is_string(Text) ? enum_dict_insert(Dict, json_string_value(Text), json_string_length(Text)) : 0;
 		}
-		int EnumSize = Field->EnumSize = Field->EnumMap->Size + 1;
-		const char **EnumNames = (const char **)GC_malloc(EnumSize * sizeof(const char *));
-		EnumNames[0] = "";
-		stringmap_foreach(Field->EnumMap, EnumNames, (void *)set_enum_name_fn);
-		Field->EnumNames = EnumNames;
-		GtkListStore *EnumStore = Field->EnumStore = gtk_list_store_new(2, G_TYPE_STRING, G_TYPE_DOUBLE);
-		for (int J = 0; J < EnumSize; ++J) {
-			gtk_list_store_insert_with_values(Field->EnumStore, 0, -1, 0, Field->EnumNames[J], 1, (double)(J + 1), -1);
-		}
-		Field->EnumValues = (int *)GC_malloc_atomic(EnumSize * sizeof(int));
-		Field->Range.Min = 0.0;
-		Field->Range.Max = EnumSize;
+		field_write(Field, 0, Viewer->NumNodes, Values);
+		field_update_enum(Field);
 	} else {
 		double Min = INFINITY, Max = -INFINITY;
 		double Sum = 0.0, Sum2 = 0.0;
 		for (int Index = 0; Index < Viewer->NumNodes; ++Index) {
-			double Value = Values[Index] = json_number_value(json_array_get(Result, Index));
+			json_t *Item = json_array_get(Result, Index);
+			double Value;
+			if (json_is_string(Item)) {
+				Value = fast_strtod(json_string_value(Item), 0);
+			} else {
+				Value = json_number_value(Item);
+			}
+			Values[Index] = Value;
 			if (Value < Min) Min = Value;
 			if (Value > Max) Max = Value;
 			Sum += Value;
@@ -2614,7 +3217,9 @@ static void column_values_get(viewer_t *Viewer, json_t *Result, field_t *Field)
 		Field->Sum = Sum2;
 		double Mean = Sum / Viewer->NumNodes;
 		Field->SD = sqrt((Sum2 / Viewer->NumNodes) - Mean * Mean);
+		field_write(Field, 0, Viewer->NumNodes, Values);
 	}
+	GC_free(Values);
 }
 
 typedef struct columns_list_t {
@@ -2636,16 +3241,11 @@ static void column_open_clicked(GtkWidget *Button, columns_list_t *Info) {
 		gtk_list_store_remove(Info->FieldsModel, Iter);
 		int NumFields = Viewer->NumFields + 1;
 		field_t **Fields = (field_t **)GC_malloc(NumFields * sizeof(field_t *));
-		field_t *Field = (field_t *)GC_malloc(sizeof(field_t) + Viewer->NumNodes * sizeof(double));
+		field_t *Field = new(field_t);
 		Field->Type = FieldT;
 		if (!strcmp(Type, "string")) {
-			Field->EnumStore = gtk_list_store_new(2, G_TYPE_STRING, G_TYPE_DOUBLE);
-			Field->EnumNames = (const char **)GC_malloc(sizeof(const char *));
-			Field->EnumValues = (int *)GC_malloc_atomic(sizeof(int));
-			Field->EnumNames[0] = "";
-			Field->EnumSize = 1;
-			Field->EnumMap = new(stringmap_t);
-			gtk_list_store_insert_with_values(Field->EnumStore, 0, -1, 0, "", 1, 0.0, -1);
+			Field->EnumDict = enum_dict_new();
+			field_update_enum(Field);
 		}
 		Field->Name = GC_strdup(Name);
 		Field->PreviewColumn = 0;
@@ -2655,7 +3255,7 @@ static void column_open_clicked(GtkWidget *Button, columns_list_t *Info) {
 		Field->RemoteId = RemoteId;
 		Field->RemoteGenerations = (json_int_t *)GC_malloc_atomic(Viewer->NumNodes * sizeof(json_int_t));
 		memset(Field->RemoteGenerations, 0, Viewer->NumNodes * sizeof(json_int_t));
-		memset(Field->Values, 0, Viewer->NumNodes * sizeof(double));
+		field_alloc_values(Field, Field->EnumDict ? FIELD_U8 : FIELD_F64, Viewer->NumNodes);
 		for (int I = 0; I < Viewer->NumFields; ++I) Fields[I] = Viewer->Fields[I];
 		Fields[Viewer->NumFields] = Field;
 		stringmap_insert(Viewer->FieldsByName, Field->Name, Field);
@@ -2687,11 +3287,11 @@ static void column_create(viewer_t *Viewer, json_t *Result, column_create_remote
 	json_t *Values = json_array();
 	if (Field->EnumNames) {
 		for (int I = 0; I < Viewer->NumNodes; ++I) {
-			json_array_append(Values, json_string(Field->EnumNames[(int)Field->Values[I]]));
+			json_array_append(Values, json_string(Field->EnumNames[(int)field_get(Field, I)]));
 		}
 	} else {
 		for (int I = 0; I < Viewer->NumNodes; ++I) {
-			json_array_append(Values, json_real(Field->Values[I]));
+			json_array_append(Values, json_real(field_get(Field, I)));
 		}
 	}
 	json_t *Request = json_pack("{ssso}", "column", Field->RemoteId, "values", Values);
@@ -2704,7 +3304,7 @@ static void column_create(viewer_t *Viewer, json_t *Result, column_create_remote
 static void column_create_remote(const char *Result, viewer_t *Viewer, column_create_remote_t *Info) {
 	json_t *Request = json_pack("{ssss}",
 		"name", Result,
-		"type", Info->Field->EnumMap ? "string" : "real"
+		"type", Info->Field->EnumDict ? "string" : "real"
 	);
 	Info->Name = GC_strdup(Result);
 	remote_request(Viewer, "column/create", Request, (void *)column_create, Info);
@@ -2730,29 +3330,21 @@ static void column_connected_toggled(GtkCellRendererToggle *Renderer, char *Path
 typedef struct columns_load_t {
 	viewer_t *Viewer;
 	GtkListStore *ColumnsStore;
-	field_t **Fields;
-	int NumFields, FieldIndex, RowIndex;
+	int NumFields, RowIndex;
 } columns_load_t;
 
 static void columns_header_field_fn(void *Data, size_t Length, columns_load_t *Info) {
+	if (Info->RowIndex) return;
+	// The first column holds the image names, which are always loaded.
+	if (Info->NumFields++ == 0) return;
 	char *Name = GC_malloc_atomic(Length + 1);
 	memcpy(Name, Data, Length);
 	Name[Length] = 0;
 	gtk_list_store_insert_with_values(Info->ColumnsStore, 0, -1, 0, Name, 1, FALSE, -1);
-	++Info->NumFields;
 }
 
 static void columns_header_record_fn(int Delim, columns_load_t *Info) {
-
-}
-
-static void columns_data_field_fn(void *Data, size_t Length, columns_load_t *Info) {
-
-}
-
-static void columns_data_record_fn(int Delim, columns_load_t *Info) {
-	Info->FieldIndex = 0;
-	++Info->RowIndex;
+	Info->RowIndex = 1;
 }
 
 static void column_selected_toggled(GtkCellRendererToggle *Renderer, char *Path, columns_load_t *Info) {
@@ -2763,6 +3355,8 @@ static void column_selected_toggled(GtkCellRendererToggle *Renderer, char *Path,
 	gtk_list_store_set(Info->ColumnsStore, Iter, 1, !Selected, -1);
 }
 
+// Opens a file loading only the selected columns up front, the rest are
+// loaded when first used.
 static void columns_load_clicked(GtkWidget *Button, viewer_t *Viewer) {
 	GtkWidget *FileChooser = gtk_file_chooser_dialog_new(
 		"Select CSV file",
@@ -2778,27 +3372,30 @@ static void columns_load_clicked(GtkWidget *Button, viewer_t *Viewer) {
 	}
 	char *FileName = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(FileChooser));
 	gtk_widget_destroy(FileChooser);
-	FILE *File = fopen(FileName, "r");
-	if (!File) return;
+	csv_stream_t *Stream = csv_stream_open(FileName);
+	if (!Stream) {
+		g_free(FileName);
+		return;
+	}
 	columns_load_t Info[1];
 	Info->Viewer = Viewer;
 	Info->ColumnsStore = gtk_list_store_new(2, G_TYPE_STRING, G_TYPE_BOOLEAN);
-	Info->NumFields = 0;
+	Info->NumFields = Info->RowIndex = 0;
 	struct csv_parser Parser[1];
 	csv_init(Parser, 0);
-	char Buffer[129];
-	if (!fgets(Buffer, 129, File)) return;
-	int Length = strlen(Buffer);
-	while (Length == 128) {
+	char Buffer[4096];
+	size_t Length;
+	while (!Info->RowIndex && (Length = csv_stream_read(Stream, Buffer, 4096))) {
 		csv_parse(Parser, Buffer, Length, (void *)columns_header_field_fn, (void *)columns_header_record_fn, Info);
-		if (!fgets(Buffer, 129, File)) return;
-		int Length = strlen(Buffer);
 	}
-	csv_parse(Parser, Buffer, Length, (void *)columns_header_field_fn, (void *)columns_header_record_fn, Info);
+	if (!Info->RowIndex) csv_fini(Parser, (void *)columns_header_field_fn, (void *)columns_header_record_fn, Info);
+	csv_free(Parser);
+	csv_stream_close(Stream);
 	GtkWidget *Dialog = gtk_dialog_new_with_buttons(
 		"Select Columns",
 		GTK_WINDOW(Viewer->MainWindow),
 		GTK_DIALOG_MODAL,
+		"Cancel", GTK_RESPONSE_CANCEL,
 		"Open", GTK_RESPONSE_ACCEPT,
 		NULL
 	);
@@ -2807,34 +3404,32 @@ static void columns_load_clicked(GtkWidget *Button, viewer_t *Viewer) {
 	GtkWidget *FieldsScrolled = gtk_scrolled_window_new(0, 0);
 	GtkWidget *FieldsView = gtk_tree_view_new_with_model(GTK_TREE_MODEL(Info->ColumnsStore));
 	GtkCellRenderer *SelectRenderer = gtk_cell_renderer_toggle_new();
-	g_signal_connect(G_OBJECT(SelectRenderer), "toggled", G_CALLBACK(column_selected_toggled), Viewer);
+	g_signal_connect(G_OBJECT(SelectRenderer), "toggled", G_CALLBACK(column_selected_toggled), Info);
 	gtk_tree_view_append_column(GTK_TREE_VIEW(FieldsView), gtk_tree_view_column_new_with_attributes("Name", gtk_cell_renderer_text_new(), "text", 0, NULL));
-	gtk_tree_view_append_column(GTK_TREE_VIEW(FieldsView), gtk_tree_view_column_new_with_attributes("Visible", SelectRenderer, "active", 1, NULL));
+	gtk_tree_view_append_column(GTK_TREE_VIEW(FieldsView), gtk_tree_view_column_new_with_attributes("Load", SelectRenderer, "active", 1, NULL));
 	gtk_container_add(GTK_CONTAINER(FieldsScrolled), FieldsView);
 	gtk_box_pack_start(GTK_BOX(ContentArea), FieldsScrolled, TRUE, TRUE, 2);
 	gtk_widget_show_all(Dialog);
-	gtk_dialog_run(GTK_DIALOG(Dialog));
+	int Response = gtk_dialog_run(GTK_DIALOG(Dialog));
 	gtk_widget_destroy(Dialog);
-	field_t **Fields = anew(field_t *, Info->NumFields);
+	if (Response != GTK_RESPONSE_ACCEPT) {
+		g_free(FileName);
+		return;
+	}
+	const char **Projection = anew(const char *, Info->NumFields + 1);
 	GtkTreeIter Iter[1];
-	int I = 0;
+	int NumSelected = 0;
 	if (gtk_tree_model_get_iter_first(GTK_TREE_MODEL(Info->ColumnsStore), Iter)) do {
 		gboolean Selected;
-		gtk_tree_model_get(GTK_TREE_MODEL(Info->ColumnsStore), Iter, 1, &Selected, -1);
-		if (Selected) {
-			field_t *Field = Fields[I] = (field_t *)GC_malloc(sizeof(field_t) + Viewer->NumNodes * sizeof(double));
-			Field->Type = FieldT;
-			Field->EnumMap = 0;
-			Field->Range.Min = INFINITY;
-			Field->Range.Max = -INFINITY;
-			Field->PreviewColumn = 0;
-			Field->PreviewVisible = 1;
-			Field->FilterGeneration = 0;
-			Field->Sum = Field->Sum2 = 0.0;
-			Fields[I] = Field;
-		}
+		char *Name;
+		gtk_tree_model_get(GTK_TREE_MODEL(Info->ColumnsStore), Iter, 0, &Name, 1, &Selected, -1);
+		if (Selected) Projection[NumSelected++] = GC_strdup(Name);
+		g_free(Name);
 	} while (gtk_tree_model_iter_next(GTK_TREE_MODEL(Info->ColumnsStore), Iter));
-
+	g_object_unref(Info->ColumnsStore);
+	while (gtk_events_pending()) gtk_main_iteration();
+	viewer_load_file(Viewer, GC_strdup(FileName), Viewer->ImagePrefix, Projection);
+	g_free(FileName);
 }
 
 static void show_columns_clicked(GtkWidget *Button, viewer_t *Viewer) {
@@ -2891,9 +3486,88 @@ static void show_columns_clicked(GtkWidget *Button, viewer_t *Viewer) {
 	gtk_widget_show_all(Window);
 }
 
+typedef struct {
+	viewer_t *Viewer;
+	GtkProgressBar *ProgressBar;
+} viewer_save_t;
+
+static void viewer_save_row(csv_writer_t *Writer, int Row, viewer_save_t *Save) {
+	viewer_t *Viewer = Save->Viewer;
+	const char *FileName = node_file_name(Viewer->Nodes + Row);
+	csv_writer_text(Writer, FileName, strlen(FileName));
+	for (int I = 0; I < Viewer->NumFields; ++I) {
+		field_t *Field = Viewer->Fields[I];
+		if (Field->EnumNames) {
+			const char *Value = Field->EnumNames[(int)field_get(Field, Row)];
+			csv_writer_text(Writer, Value, strlen(Value));
+		} else {
+			csv_writer_real(Writer, field_get(Field, Row));
+		}
+	}
+	csv_writer_end_row(Writer);
+}
+
+// The save threads read the nodes, file names and field values directly, so
+// nothing may be saved while a background load is still growing them.
+static int viewer_save_ready(viewer_t *Viewer) {
+	if (!Viewer->Loader) return 1;
+	console_printf(Viewer->Console, "Wait for loading to finish before saving\n");
+	return 0;
+}
+
+static void viewer_save_progress(int Rows, viewer_save_t *Save) {
+	int NumNodes = Save->Viewer->NumNodes;
+	char ProgressText[32];
+	sprintf(ProgressText, "%d / %d rows", Rows, NumNodes);
+	gtk_progress_bar_set_text(Save->ProgressBar, ProgressText);
+	gtk_progress_bar_set_fraction(Save->ProgressBar, NumNodes ? (double)Rows / NumNodes : 1.0);
+	while (gtk_events_pending()) gtk_main_iteration();
+}
+
+static int viewer_save_is_arrow(const char *FileName) {
+	const char *Extension = strrchr(FileName, '.');
+	return Extension && (!strcmp(Extension, ".arrow") || !strcmp(Extension, ".arrows"));
+}
+
+static const char *viewer_save_arrow_name(int Row, viewer_t *Viewer) {
+	return node_file_name(Viewer->Nodes + Row);
+}
+
+// Writes the fields in their current storage, enum fields as dictionaries.
+// Names ending in .arrows are written in the stream format, others in the
+// file format.
+static void viewer_save_arrow(viewer_t *Viewer, const char *FileName) {
+	if (!viewer_save_ready(Viewer)) return;
+	int Stream = !strcmp(strrchr(FileName, '.'), ".arrows");
+	int NumNodes = Viewer->NumNodes, NumFields = Viewer->NumFields;
+	arrow_writer_t *Writer = arrow_writer_open(FileName, NumNodes, NumFields + 1, Stream);
+	if (!Writer) {
+		console_printf(Viewer->Console, "Error opening %s for writing\n", FileName);
+		return;
+	}
+	arrow_writer_text(Writer, "filename", (arrow_text_fn)viewer_save_arrow_name, Viewer);
+	// Enum codes held as floats are copied to integer indices first
+	uint32_t **Indices = calloc(NumFields, sizeof(uint32_t *));
+	for (int I = 0; I < NumFields; ++I) {
+		field_t *Field = Viewer->Fields[I];
+		if (!Field->EnumNames) {
+			arrow_writer_column(Writer, Field->Name, (arrow_type_t)Field->Storage, Field->Values, 0, 0);
+		} else if (Field->Storage == FIELD_F64 || Field->Storage == FIELD_F32) {
+			uint32_t *Codes = Indices[I] = malloc(NumNodes * sizeof(uint32_t));
+			for (int J = 0; J < NumNodes; ++J) Codes[J] = field_get(Field, J);
+			arrow_writer_column(Writer, Field->Name, ARROW_UINT32, Codes, Field->EnumNames, Field->EnumSize);
+		} else {
+			arrow_writer_column(Writer, Field->Name, (arrow_type_t)Field->Storage, Field->Values, Field->EnumNames, Field->EnumSize);
+		}
+	}
+	if (arrow_writer_close(Writer)) console_printf(Viewer->Console, "Error writing %s\n", FileName);
+	for (int I = 0; I < NumFields; ++I) free(Indices[I]);
+	free(Indices);
+}
+
 static void viewer_save_file(GtkWidget *Button, viewer_t *Viewer) {
 	GtkWidget *FileChooser = gtk_file_chooser_dialog_new(
-		"Save as CSV file",
+		"Save as CSV or Arrow file",
 		GTK_WINDOW(Viewer->MainWindow),
 		GTK_FILE_CHOOSER_ACTION_SAVE,
 		"Cancel", GTK_RESPONSE_CANCEL,
@@ -2906,7 +3580,28 @@ static void viewer_save_file(GtkWidget *Button, viewer_t *Viewer) {
 	}
 	char *FileName = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(FileChooser));
 	gtk_widget_destroy(FileChooser);
+	for (int I = 0; I < Viewer->NumFields; ++I) {
+		if (!viewer_field_require(Viewer, Viewer->Fields[I])) {
+			g_free(FileName);
+			return;
+		}
+	}
+	if (viewer_save_is_arrow(FileName)) {
+		viewer_save_arrow(Viewer, FileName);
+		g_free(FileName);
+		return;
+	}
 
+	if (!viewer_save_ready(Viewer)) {
+		g_free(FileName);
+		return;
+	}
+	csv_writer_t *Writer = csv_writer_open(FileName, "wb");
+	if (!Writer) {
+		console_printf(Viewer->Console, "Error opening %s for writing\n", FileName);
+		g_free(FileName);
+		return;
+	}
 	GtkProgressBar *ProgressBar = GTK_PROGRESS_BAR(gtk_progress_bar_new());
 	gtk_progress_bar_set_show_text(ProgressBar, TRUE);
 	GtkWidget *InfoContainerArea = gtk_info_bar_get_content_area(GTK_INFO_BAR(Viewer->InfoBar));
@@ -2914,268 +3609,570 @@ static void viewer_save_file(GtkWidget *Button, viewer_t *Viewer) {
 	gtk_info_bar_set_message_type(GTK_INFO_BAR(Viewer->InfoBar), GTK_MESSAGE_INFO);
 	gtk_widget_show(GTK_WIDGET(ProgressBar));
 	gtk_widget_show(Viewer->InfoBar);
-	FILE *File = fopen(FileName, "wb");
-	g_free(FileName);
+	// Rows are formatted on other threads while the progress is shown, so
+	// input is blocked and remote updates are held back to keep the fields
+	// from changing underneath them.
+	gtk_grab_add(GTK_WIDGET(ProgressBar));
+	Viewer->Saving = 1;
 	field_t **Fields = Viewer->Fields;
-	node_t *Nodes = Viewer->Nodes;
 	int NumFields = Viewer->NumFields;
-	int NumNodes = Viewer->NumNodes;
-	csv_fwrite(File, "filename", strlen("filename"));
-	for (int I = 0; I < NumFields; ++I) {
-		fputc(',', File);
-		csv_fwrite(File, Fields[I]->Name, strlen(Fields[I]->Name));
-	}
-	fputc('\n', File);
-	char ProgressText[32];
-	for (int J = 0; J < NumNodes; ++J) {
-		csv_fwrite(File, Nodes[J].FileName, strlen(Nodes[J].FileName));
-		for (int I = 0; I < NumFields; ++I) {
-			fputc(',', File);
-			field_t *Field = Fields[I];
-			if (Field->EnumNames) {
-				const char *Value = Field->EnumNames[(int)Field->Values[J]];
-				csv_fwrite(File, Value, strlen(Value));
-			} else {
-				fprintf(File, "%f", Field->Values[J]);
-			}
-		}
-		fputc('\n', File);
-		if (J % 10000 == 0) {
-			sprintf(ProgressText, "%d / %d rows", J, NumNodes);
-			gtk_progress_bar_set_text(ProgressBar, ProgressText);
-			gtk_progress_bar_set_fraction(ProgressBar, (double)J / NumNodes);
-			while (gtk_events_pending()) gtk_main_iteration();
-		}
-	}
-	fclose(File);
-	sprintf(ProgressText, "%d / %d rows", NumNodes, NumNodes);
-	gtk_progress_bar_set_text(ProgressBar, ProgressText);
-	gtk_progress_bar_set_fraction(ProgressBar, 1.0);
-	while (gtk_events_pending()) gtk_main_iteration();
+	csv_writer_text(Writer, "filename", strlen("filename"));
+	for (int I = 0; I < NumFields; ++I) csv_writer_text(Writer, Fields[I]->Name, strlen(Fields[I]->Name));
+	csv_writer_end_row(Writer);
+	viewer_save_t Save[1] = {{Viewer, ProgressBar}};
+	csv_writer_rows(Writer, Viewer->NumNodes, g_get_num_processors(), (csv_writer_row_fn)viewer_save_row, (csv_writer_progress_fn)viewer_save_progress, Save);
+	Viewer->Saving = 0;
+	if (csv_writer_close(Writer)) console_printf(Viewer->Console, "Error writing %s\n", FileName);
+	g_free(FileName);
+	gtk_grab_remove(GTK_WIDGET(ProgressBar));
 	gtk_widget_destroy(GTK_WIDGET(ProgressBar));
 	gtk_widget_hide(Viewer->InfoBar);
 }
 
+static field_t *viewer_alloc_field(const char *Name, field_storage_t Storage, int NumNodes) {
+	field_t *Field = new(field_t);
+	Field->Type = FieldT;
+	field_alloc_values(Field, Storage, NumNodes);
+	Field->Name = Name;
+	Field->PreviewColumn = 0;
+	Field->PreviewVisible = 1;
+	Field->FilterGeneration = 0;
+	return Field;
+}
+
+#define LOAD_SPARE_ROWS 65536
+#define LOAD_SAMPLE_ROWS 1024
+
+// Values are stored straight into the fields as doubles, which are sized once
+// the columns are typed for the rows the file is expected to hold and grown
+// if it holds more, then narrowed once the whole file is loaded.
+typedef struct {
+	const char *Name;
+	enum_dict_t *EnumDict;
+	field_t *Field;
+	range_t Range;
+	double Sum, Sum2;
+} csv_column_t;
+
+typedef struct {
+	const char *Text;
+	size_t Size;
+	int Row, Index;
+} csv_cell_t;
+
 typedef struct {
 	viewer_t *Viewer;
 	GtkProgressBar *ProgressBar;
-	field_t **Fields;
-	node_t *Nodes;
-	const char *ImagePrefix;
-	int NumNodes, Index, Row, ImagePrefixLength;
+	csv_column_t *Columns;
+	uint32_t *FileNames;
+	csv_cell_t *Sample;
+	size_t FileSize, BytesRead;
+	int NumColumns, MaxColumns, Capacity, Index, Row;
+	int SampleSize, MaxSample, Typed;
+	file_names_t Names[1];
 } csv_node_loader_t;
 
+static void load_nodes_add_column(csv_node_loader_t *Loader, void *Text, size_t Size) {
+	if (Loader->NumColumns == Loader->MaxColumns) {
+		Loader->MaxColumns = Loader->MaxColumns ? 2 * Loader->MaxColumns : 16;
+		csv_column_t *Columns = (csv_column_t *)GC_malloc(Loader->MaxColumns * sizeof(csv_column_t));
+		memcpy(Columns, Loader->Columns, Loader->NumColumns * sizeof(csv_column_t));
+		Loader->Columns = Columns;
+	}
+	csv_column_t *Column = Loader->Columns + Loader->NumColumns++;
+	char *Name = GC_malloc_atomic(Size + 1);
+	memcpy(Name, Text, Size);
+	Name[Size] = 0;
+	Column->Name = Name;
+	Column->EnumDict = 0;
+	Column->Field = viewer_alloc_field(Name, FIELD_F64, 0);
+	Column->Range.Min = INFINITY;
+	Column->Range.Max = -INFINITY;
+	Column->Sum = Column->Sum2 = 0.0;
+}
+
+// Returns the number of rows expected from the bytes read for the first
+// NumRows rows, with some to spare.
+static int load_nodes_estimate(csv_node_loader_t *Loader, int NumRows) {
+	double Estimate = 2.0 * NumRows + LOAD_SPARE_ROWS;
+	if (Loader->BytesRead && Loader->FileSize) {
+		double Expected = (double)NumRows * Loader->FileSize / Loader->BytesRead;
+		Estimate = Expected + Expected / 8 + LOAD_SPARE_ROWS;
+	}
+	return Estimate < INT_MAX ? Estimate : INT_MAX;
+}
+
+// Makes room for row Row in the fields and file names.
+static void load_nodes_reserve(csv_node_loader_t *Loader, int Row) {
+	if (Row < Loader->Capacity) return;
+	int Capacity = load_nodes_estimate(Loader, Row + 1);
+	uint32_t *FileNames = (uint32_t *)GC_malloc_atomic(Capacity * sizeof(uint32_t));
+	if (Loader->Capacity) memcpy(FileNames, Loader->FileNames, Loader->Capacity * sizeof(uint32_t));
+	memset(FileNames + Loader->Capacity, 0, (Capacity - Loader->Capacity) * sizeof(uint32_t));
+	if (Loader->FileNames) GC_free(Loader->FileNames);
+	Loader->FileNames = FileNames;
+	for (int I = 0; I < Loader->NumColumns; ++I) field_convert(Loader->Columns[I].Field, FIELD_F64, Capacity);
+	Loader->Capacity = Capacity;
+}
+
+// Converts the numbers already loaded into a column into enum values, used
+// when text is found in a column after the sampled rows.
+static void load_nodes_convert_column(csv_column_t *Column, int NumRows) {
+	enum_dict_t *Dict = Column->EnumDict = enum_dict_new();
+	Column->Range.Min = 0.0;
+	Column->Range.Max = -INFINITY;
+	Column->Sum = Column->Sum2 = 0.0;
+	char Buffer[FAST_DTOA_SIZE];
+	for (int Row = 0; Row < NumRows; ++Row) {
+		double *Value = (double *)Column->Field->Values + Row;
+		*Value = isnan(*Value) ? 0 : enum_dict_insert(Dict, Buffer, fast_dtoa(*Value, Buffer));
+		if (Column->Range.Max < *Value) Column->Range.Max = *Value;
+		Column->Sum += *Value;
+		Column->Sum2 += *Value * *Value;
+	}
+}
+
+static void load_nodes_field(csv_node_loader_t *Loader, int Row, int Index, const char *Text, size_t Size) {
+	if (!Index) {
+		load_nodes_reserve(Loader, Row);
+		Loader->FileNames[Row] = file_names_add(Loader->Names, Text, Size);
+	} else if (Index <= Loader->NumColumns) {
+		csv_column_t *Column = Loader->Columns + (Index - 1);
+		char Buffer[FAST_DTOA_SIZE];
+		double Value;
+		insert:
+		if (Column->EnumDict) {
+			// Numbers are named as in the parallel loader.
+			Size = csv_enum_name(&Text, Size, Buffer);
+			Value = enum_dict_insert(Column->EnumDict, Text, Size);
+		} else if (!Size) {
+			// Empty fields are missing values, only text converts a column.
+			Value = NAN;
+		} else {
+			char *End;
+			Value = fast_strtod(Text, &End);
+			if (End != Text + Size) {
+				load_nodes_convert_column(Column, Row);
+				goto insert;
+			}
+		}
+		((double *)Column->Field->Values)[Row] = Value;
+		if (isnan(Value)) return;
+		if (Column->Range.Min > Value) Column->Range.Min = Value;
+		if (Column->Range.Max < Value) Column->Range.Max = Value;
+		Column->Sum += Value;
+		Column->Sum2 += Value * Value;
+	}
+}
+
+// Decides the column types from the sampled rows, a column is numeric if
+// every sampled value is a number, and then loads the sampled rows.
+static void load_nodes_type_columns(csv_node_loader_t *Loader) {
+	Loader->Typed = 1;
+	if (Loader->Row) load_nodes_reserve(Loader, Loader->Row - 1);
+	for (int I = 0; I < Loader->SampleSize; ++I) {
+		csv_cell_t *Cell = Loader->Sample + I;
+		if (Cell->Index < 1 || Cell->Index > Loader->NumColumns) continue;
+		csv_column_t *Column = Loader->Columns + (Cell->Index - 1);
+		if (Column->EnumDict || !Cell->Size) continue;
+		char *End;
+		fast_strtod(Cell->Text, &End);
+		if (End != Cell->Text + Cell->Size) {
+			Column->Range.Min = 0.0;
+			Column->EnumDict = enum_dict_new();
+		}
+	}
+	for (int I = 0; I < Loader->SampleSize; ++I) {
+		csv_cell_t *Cell = Loader->Sample + I;
+		load_nodes_field(Loader, Cell->Row, Cell->Index, Cell->Text, Cell->Size);
+	}
+	Loader->Sample = 0;
+	Loader->SampleSize = Loader->MaxSample = 0;
+}
+
 static void load_nodes_field_callback(void *Text, size_t Size, csv_node_loader_t *Loader) {
 	if (!Loader->Row) {
-		if (Loader->Index) {
-			char *FieldName = GC_malloc(Size + 1);
-			memcpy(FieldName, Text, Size);
-			FieldName[Size] = 0;
-			Loader->Fields[Loader->Index - 1]->Name = FieldName;
+		if (Loader->Index) load_nodes_add_column(Loader, Text, Size);
+	} else if (!Loader->Typed) {
+		if (Loader->SampleSize == Loader->MaxSample) {
+			Loader->MaxSample = Loader->MaxSample ? 2 * Loader->MaxSample : 1024;
+			csv_cell_t *Sample = (csv_cell_t *)GC_malloc(Loader->MaxSample * sizeof(csv_cell_t));
+			memcpy(Sample, Loader->Sample, Loader->SampleSize * sizeof(csv_cell_t));
+			Loader->Sample = Sample;
 		}
+		csv_cell_t *Cell = Loader->Sample + Loader->SampleSize++;
+		char *Copy = GC_malloc_atomic(Size + 1);
+		memcpy(Copy, Text, Size + 1);
+		Cell->Text = Copy;
+		Cell->Size = Size;
+		Cell->Row = Loader->Row - 1;
+		Cell->Index = Loader->Index;
 	} else {
-		if (!Loader->Index) {
-			char *FileName, *FilePath;
-			FileName = GC_malloc(Size + 1);
-			memcpy(FileName, Text, Size);
-			FileName[Size] = 0;
-			if (Loader->ImagePrefixLength) {
-				int Length = Loader->ImagePrefixLength + Size;
-				FilePath = GC_malloc(Length + 1);
-				memcpy(stpcpy(FilePath, Loader->ImagePrefix), Text, Size);
-				FilePath[Length] = 0;
-			} else {
-				FilePath = FileName;
-			}
-			Loader->Nodes[Loader->Row - 1].FileName = FileName;
-			Loader->Nodes[Loader->Row - 1].File = g_file_new_for_path(FilePath);
-			if (FilePath != FileName) GC_free(FilePath);
-		} else {
-			int Index = Loader->Index - 1;
-			field_t *Field = Loader->Fields[Index];
-			double Value;
-			insert:
-			if (Field->EnumMap) {
-				if (Size) {
-					double *Ref = stringmap_search(Field->EnumMap, Text);
-					if (Ref) {
-						Value = *(double *)Ref;
-					} else {
-						Ref = new(double);
-						stringmap_insert(Field->EnumMap, GC_strdup(Text), Ref);
-						*(double *)Ref = Value = Field->EnumMap->Size;
-					}
-				} else {
-					Value = 0.0;
-				}
-			} else {
-				char *End;
-				Value = strtod(Text, &End);
-				if (End == Text) {
-					if (Loader->Row != 1) {
-						// TODO: Convert all previously loaded values to enums
-						fprintf(stderr, "Convert previous values into enums has not been done yet!");
-						exit(1);
-					}
-					Field->Range.Min = 0.0;
-					Field->EnumMap = new(stringmap_t);
-					goto insert;
-				}
-			}
-			Field->Values[Loader->Row - 1] = Value;
-			if (Field->Range.Min > Value) Field->Range.Min = Value;
-			if (Field->Range.Max < Value) Field->Range.Max = Value;
-			Field->Sum += Value;
-			Field->Sum2 += Value * Value;
-		}
+		load_nodes_field(Loader, Loader->Row - 1, Loader->Index, Text, Size);
 	}
 	++Loader->Index;
 }
 
 static void load_nodes_row_callback(int Char, csv_node_loader_t *Loader) {
+	// Fields missing from short rows are empty.
+	if (Loader->Row) while (Loader->Index && Loader->Index <= Loader->NumColumns) load_nodes_field_callback("", 0, Loader);
 	Loader->Index = 0;
 	++Loader->Row;
+	if (!Loader->Typed && Loader->Row > LOAD_SAMPLE_ROWS) load_nodes_type_columns(Loader);
 	if (Loader->Row % 10000 == 0) {
 		char ProgressText[32];
-		sprintf(ProgressText, "%d / %d rows", Loader->Row, Loader->NumNodes);
+		sprintf(ProgressText, "%d rows", Loader->Row);
 		gtk_progress_bar_set_text(Loader->ProgressBar, ProgressText);
-		gtk_progress_bar_set_fraction(Loader->ProgressBar, (double)Loader->Row / (double)Loader->NumNodes);
+		if (Loader->FileSize) gtk_progress_bar_set_fraction(Loader->ProgressBar, (double)Loader->BytesRead / (double)Loader->FileSize);
 		while (gtk_events_pending()) gtk_main_iteration();
 	}
 }
 
-static void count_nodes_field_callback(void *Text, size_t Size, csv_node_loader_t *Loader) {
-	++Loader->Index;
-}
-
-static void count_nodes_row_callback(int Char, csv_node_loader_t *Loader) {
-	if (!Loader->Row) {
-		int NumValues = Loader->Viewer->NumFields = Loader->Index - 1;
+static node_t *viewer_alloc_nodes(viewer_t *Viewer, int NumNodes) {
+	node_t *Nodes = Viewer->Nodes = (node_t *)GC_malloc(NumNodes * sizeof(node_t));
+	Viewer->NumNodes = NumNodes;
+	Viewer->SortedX = (uint32_t *)GC_malloc_atomic(NumNodes * sizeof(uint32_t));
+	Viewer->SortedY = (uint32_t *)GC_malloc_atomic(NumNodes * sizeof(uint32_t));
+	field_orders_clear(Viewer);
+	filters_reset(Viewer);
+	Viewer->NumFiltered = NumNodes;
+	memset(Nodes, 0, NumNodes * sizeof(node_t));
+	for (int I = 0; I < NumNodes; ++I) {
+		Nodes[I].Type = NodeT;
+		Nodes[I].Viewer = Viewer;
+		Nodes[I].Filtered = 1;
+		Viewer->SortedX[I] = Viewer->SortedY[I] = I;
 	}
-	Loader->Index = 0;
-	++Loader->Row;
-	if (Loader->Row % 10000 == 0) printf("Counted row %d\n", Loader->Row);
+	return Nodes;
 }
 
-static void viewer_load_file(viewer_t *Viewer, const char *CsvFileName, const char *ImagePrefix) {
-	char *Path = g_path_get_dirname(CsvFileName);
-	chdir(Path);
-	g_free(Path);
-
-	Viewer->ImagePrefix = ImagePrefix;
-	int ImagePrefixLength = ImagePrefix ? strlen(ImagePrefix) : 0;
-	csv_node_loader_t Loader[1] = {{Viewer, 0, 0, 0, ImagePrefix, 0, 0, 0, ImagePrefixLength}};
+static void viewer_load_file_serial(viewer_t *Viewer, const char *CsvFileName, GtkProgressBar *ProgressBar) {
+	csv_node_loader_t Loader[1] = {{Viewer, ProgressBar, 0, 0, 0, 0, 0, 0, 0, 0, 0}};
 	char Buffer[4096];
 	struct csv_parser Parser[1];
 
-	console_printf(Viewer->Console, "Counting rows...\n");
-	FILE *File = fopen(CsvFileName, "r");
-	if (!File) {
+	csv_stream_t *Stream = csv_stream_open(CsvFileName);
+	if (!Stream) {
 		fprintf(stderr, "Error reading from %s\n", CsvFileName);
 		exit(1);
 	}
+	file_names_init(Loader->Names);
+	struct stat Stat[1];
+	if (!stat(CsvFileName, Stat)) Loader->FileSize = Stat->st_size;
 	csv_init(Parser, CSV_APPEND_NULL);
-	size_t Count = fread(Buffer, 1, 4096, File);
+	size_t Count = csv_stream_read(Stream, Buffer, 4096);
 	while (Count > 0) {
-		csv_parse(Parser, Buffer, Count, (void *)count_nodes_field_callback, (void *)count_nodes_row_callback, Loader);
-		Count = fread(Buffer, 1, 4096, File);
+		Loader->BytesRead = csv_stream_position(Stream);
+		csv_parse(Parser, Buffer, Count, (void *)load_nodes_field_callback, (void *)load_nodes_row_callback, Loader);
+		Count = csv_stream_read(Stream, Buffer, 4096);
 	}
-	fclose(File);
-	csv_fini(Parser, (void *)count_nodes_field_callback, (void *)count_nodes_row_callback, Loader);
+	const char *Error = csv_stream_error(Stream);
+	if (Error) fprintf(stderr, "Error reading from %s: %s\n", CsvFileName, Error);
+	csv_stream_close(Stream);
+	csv_fini(Parser, (void *)load_nodes_field_callback, (void *)load_nodes_row_callback, Loader);
 	csv_free(Parser);
+	if (!Loader->Typed) load_nodes_type_columns(Loader);
 
-	int NumNodes = Viewer->NumNodes = Loader->Row - 1;
-	int NumFields = Viewer->NumFields;
-	node_t *Nodes = Viewer->Nodes = (node_t *)GC_malloc(NumNodes * sizeof(node_t));
-	Viewer->SortedX = (node_t **)GC_malloc(NumNodes * sizeof(node_t *));
-	Viewer->SortedY = (node_t **)GC_malloc(NumNodes * sizeof(node_t *));
-	Viewer->SortBuffer = (node_t **)GC_malloc(NumNodes * sizeof(node_t *));
-	Viewer->NumFiltered = NumNodes;
-	memset(Nodes, 0, NumNodes * sizeof(node_t));
+	int NumNodes = Loader->Row ? Loader->Row - 1 : 0;
+	int NumFields = Viewer->NumFields = Loader->NumColumns;
+	// The fields are narrowed first so their spare rows are released before
+	// the nodes are allocated.
+	field_t **Fields = Viewer->Fields = (field_t **)GC_malloc(NumFields * sizeof(field_t *));
+	for (int I = 0; I < NumFields; ++I) {
+		csv_column_t *Column = Loader->Columns + I;
+		field_t *Field = Fields[I] = Column->Field;
+		Field->EnumDict = Column->EnumDict;
+		Field->Range = Column->Range;
+		Field->Sum = Column->Sum;
+		Field->Sum2 = Column->Sum2;
+		field_narrow(Field, NumNodes);
+	}
+	node_t *Nodes = viewer_alloc_nodes(Viewer, NumNodes);
+	Viewer->FileNames[0] = Loader->Names[0];
+	for (int I = 0; I < NumNodes; ++I) Nodes[I].FileName = Loader->FileNames[I];
+	if (Loader->FileNames) GC_free(Loader->FileNames);
+}
+
+static field_t *viewer_alloc_column_field(csv_loader_column_t *Column, field_storage_t Storage, int NumNodes) {
+	field_t *Field = viewer_alloc_field(GC_strdup(Column->Name), Storage, NumNodes);
+	Field->Range.Min = Column->Min;
+	Field->Range.Max = Column->Max;
+	Field->Sum = Column->Sum;
+	Field->Sum2 = Column->Sum2;
+	if (Column->EnumNames) {
+		enum_dict_t *Dict = Field->EnumDict = enum_dict_new();
+		for (int J = 1; J < Column->EnumSize; ++J) enum_dict_insert(Dict, Column->EnumNames[J], strlen(Column->EnumNames[J]));
+	}
+	return Field;
+}
+
+// In out of core mode the cached doubles are used in place and the fields
+// take over the cache, which is then closed once they are collected. Returns
+// 1 in that case.
+static int viewer_load_file_cached(viewer_t *Viewer, csv_cache_t *Cache) {
+	int NumNodes = csv_cache_num_rows(Cache);
+	int NumFields = Viewer->NumFields = csv_cache_num_columns(Cache);
+	node_t *Nodes = viewer_alloc_nodes(Viewer, NumNodes);
+	// The cached names are already contiguous, so they are copied in one go.
+	size_t NamesSize;
+	const char *Names = csv_cache_file_names(Cache, &NamesSize);
+	if (NamesSize >= UINT32_MAX) {
+		fprintf(stderr, "File names exceed 4GB\n");
+		exit(1);
+	}
+	file_names_t *FileNames = Viewer->FileNames;
+	FileNames->Size = FileNames->Space = NamesSize + 1;
+	FileNames->Chars = GC_malloc_atomic(FileNames->Space);
+	FileNames->Chars[0] = 0;
+	memcpy(FileNames->Chars + 1, Names, NamesSize);
+	for (int I = 0; I < NumNodes; ++I) Nodes[I].FileName = 1 + (csv_cache_file_name(Cache, I) - Names);
+	field_t **Fields = Viewer->Fields = (field_t **)GC_malloc(NumFields * sizeof(field_t *));
+	field_mapping_t *Mapping = 0;
+	if (column_map_enabled() && NumFields) {
+		Mapping = field_mapping_new();
+		Mapping->Cache = Cache;
+	}
+	for (int I = 0; I < NumFields; ++I) {
+		const double *Values = csv_cache_values(Cache, I);
+		if (Mapping) {
+			field_t *Field = Fields[I] = viewer_alloc_column_field(csv_cache_column(Cache, I), FIELD_F64, 0);
+			Field->Values = (void *)Values;
+			Field->Capacity = NumNodes;
+			Field->Mapping = Mapping;
+			continue;
+		}
+		field_scan_t Scan[1] = {FIELD_SCAN_INIT};
+		field_scan(Scan, Values, NumNodes);
+		field_t *Field = Fields[I] = viewer_alloc_column_field(csv_cache_column(Cache, I), field_scan_storage(Scan), NumNodes);
+		field_store(Field->Values, Field->Storage, 0, NumNodes, Values);
+	}
+	return Mapping != 0;
+}
+
+// Text columns other than the file names are read as enum fields.
+static void viewer_load_arrow_text(field_t *Field, arrow_column_t *Column, int NumNodes) {
+	enum_dict_t *Dict = Field->EnumDict = enum_dict_new();
+	double *Values = malloc(NumNodes * sizeof(double));
 	for (int I = 0; I < NumNodes; ++I) {
-		Nodes[I].Type = NodeT;
-		Nodes[I].Viewer = Viewer;
-		Nodes[I].Filtered = 1;
-		Viewer->SortedX[I] = &Nodes[I];
-		Viewer->SortedY[I] = &Nodes[I];
+		size_t Length;
+		const char *Text = arrow_column_text(Column, I, &Length);
+		Values[I] = enum_dict_insert(Dict, Text, Length);
+	}
+	field_scan_t Scan[1] = {{0.0, Dict->Size, 1, 1}};
+	field_alloc_values(Field, field_scan_storage(Scan), NumNodes);
+	field_store(Field->Values, Field->Storage, 0, NumNodes, Values);
+	free(Values);
+}
+
+// Dictionary indices are used as enum codes unless the dictionary repeats a
+// value, in which case they are recoded into allocated values.
+static void viewer_load_arrow_enum(field_t *Field, arrow_column_t *Column, int NumNodes) {
+	enum_dict_t *Dict = Field->EnumDict = enum_dict_new();
+	int *Codes = malloc(Column->EnumSize * sizeof(int)), Recode = 0;
+	Codes[0] = 0;
+	for (int J = 1; J < Column->EnumSize; ++J) {
+		Codes[J] = enum_dict_insert(Dict, Column->EnumNames[J], strlen(Column->EnumNames[J]));
+		if (Codes[J] != J) Recode = 1;
+	}
+	if (Recode) {
+		field_t Source[1] = {{.Values = Field->Values, .Storage = Field->Storage}};
+		field_scan_t Scan[1] = {{0.0, Dict->Size, 1, 1}};
+		field_alloc_values(Field, field_scan_storage(Scan), NumNodes);
+		double Buffer[1024];
+		for (int Start = 0; Start < NumNodes; Start += 1024) {
+			int Size = NumNodes - Start < 1024 ? NumNodes - Start : 1024;
+			field_read(Source, Start, Size, Buffer);
+			for (int I = 0; I < Size; ++I) Buffer[I] = Codes[(int)Buffer[I]];
+			field_store(Field->Values, Field->Storage, Start, Size, Buffer);
+		}
 	}
+	free(Codes);
+}
+
+// Loads an Arrow IPC file written by viewer_save_arrow or any Arrow library.
+// Numeric and dictionary index buffers in a field storage type are used in
+// place from the file mapping, other columns are converted by the reader and
+// then narrowed. A leading text column holds the file names.
+static void viewer_load_file_arrow(viewer_t *Viewer, const char *FileName) {
+	const char *Error;
+	arrow_file_t *File = arrow_file_open(FileName, &Error);
+	if (!File) {
+		fprintf(stderr, "Error reading from %s: %s\n", FileName, Error);
+		exit(1);
+	}
+	field_mapping_t *Mapping = field_mapping_new();
+	Mapping->File = File;
+	int NumNodes = arrow_file_num_rows(File);
+	int NumColumns = arrow_file_num_columns(File), First = 0;
+	node_t *Nodes = viewer_alloc_nodes(Viewer, NumNodes);
+	file_names_init(Viewer->FileNames);
+	if (NumColumns && arrow_file_column(File, 0)->Type == ARROW_UTF8) {
+		arrow_column_t *Column = arrow_file_column(File, 0);
+		for (int I = 0; I < NumNodes; ++I) {
+			size_t Length;
+			const char *Text = arrow_column_text(Column, I, &Length);
+			Nodes[I].FileName = file_names_add(Viewer->FileNames, Text, Length);
+		}
+		First = 1;
+	}
+	int NumFields = Viewer->NumFields = NumColumns - First;
 	field_t **Fields = Viewer->Fields = (field_t **)GC_malloc(NumFields * sizeof(field_t *));
 	for (int I = 0; I < NumFields; ++I) {
-		field_t *Field = Fields[I] = (field_t *)GC_malloc(sizeof(field_t) + NumNodes * sizeof(double));
-		Field->Type = FieldT;
-		Field->EnumMap = 0;
-		Field->Range.Min = INFINITY;
-		Field->Range.Max = -INFINITY;
-		Field->PreviewColumn = 0;
-		Field->PreviewVisible = 1;
-		Field->FilterGeneration = 0;
-		Field->Sum = Field->Sum2 = 0.0;
-		Fields[I] = Field;
+		arrow_column_t *Column = arrow_file_column(File, First + I);
+		field_t *Field = Fields[I] = viewer_alloc_field(GC_strdup(Column->Name), FIELD_U8, 0);
+		if (Column->Type == ARROW_UTF8) {
+			viewer_load_arrow_text(Field, Column, NumNodes);
+			continue;
+		}
+		// arrow_type_t matches field_storage_t up to ARROW_UTF8
+		Field->Values = (void *)Column->Values;
+		Field->Storage = (field_storage_t)Column->Type;
+		Field->Capacity = NumNodes;
+		Field->Mapping = Mapping;
+		if (Column->EnumNames) {
+			viewer_load_arrow_enum(Field, Column, NumNodes);
+		} else {
+			double Min = INFINITY, Max = -INFINITY, Sum = 0.0, Sum2 = 0.0;
+			double Buffer[1024];
+			for (int Start = 0; Start < NumNodes; Start += 1024) {
+				int Size = NumNodes - Start < 1024 ? NumNodes - Start : 1024;
+				field_read(Field, Start, Size, Buffer);
+				for (int J = 0; J < Size; ++J) {
+					double Value = Buffer[J];
+					if (Min > Value) Min = Value;
+					if (Max < Value) Max = Value;
+					Sum += Value;
+					Sum2 += Value * Value;
+				}
+			}
+			Field->Range.Min = Min;
+			Field->Range.Max = Max;
+			Field->Sum = Sum;
+			Field->Sum2 = Sum2;
+		}
+		if (!Column->Mapped) field_narrow(Field, NumNodes);
 	}
-	Viewer->RemoteFields[0] = (stringmap_t)STRINGMAP_INIT;
-#ifdef USE_GL
-	Viewer->GLVertices = (float *)GC_malloc_atomic(NumNodes * 3 * 3 * sizeof(float));
-	Viewer->GLColours = (float *)GC_malloc_atomic(NumNodes * 3 * 4 * sizeof(float));
-#endif
-	console_printf(Viewer->Console, "Loading rows...\n");
-	File = fopen(CsvFileName, "r");
-	Loader->Nodes = Nodes;
-	Loader->Fields = Fields;
-	Loader->Row = Loader->Index = 0;
-	Loader->NumNodes = NumNodes;
-	Loader->ProgressBar = GTK_PROGRESS_BAR(gtk_progress_bar_new());
-	gtk_progress_bar_set_show_text(Loader->ProgressBar, TRUE);
-	GtkWidget *InfoContainerArea = gtk_info_bar_get_content_area(GTK_INFO_BAR(Viewer->InfoBar));
-	gtk_container_add(GTK_CONTAINER(InfoContainerArea), GTK_WIDGET(Loader->ProgressBar));
-	gtk_info_bar_set_message_type(GTK_INFO_BAR(Viewer->InfoBar), GTK_MESSAGE_INFO);
-	gtk_widget_show(GTK_WIDGET(Loader->ProgressBar));
-	gtk_widget_show(Viewer->InfoBar);
-	csv_init(Parser, CSV_APPEND_NULL);
-	Count = fread(Buffer, 1, 4096, File);
-	while (Count > 0) {
-		csv_parse(Parser, Buffer, Count, (void *)load_nodes_field_callback, (void *)load_nodes_row_callback, Loader);
-		Count = fread(Buffer, 1, 4096, File);
+}
+
+static void viewer_save_cache(viewer_t *Viewer, const char *CsvFileName, csv_cache_key_t *Key) {
+	int NumNodes = Viewer->NumNodes, NumFields = Viewer->NumFields;
+	csv_cache_writer_t *Writer = csv_cache_create(CsvFileName, Key, NumNodes, NumFields);
+	if (!Writer) return;
+	// The cache format keeps doubles, narrow fields are widened one at a time.
+	double *Values = malloc(NumNodes * sizeof(double));
+	for (int I = 0; I < NumFields; ++I) {
+		field_t *Field = Viewer->Fields[I];
+		csv_loader_column_t Column = {Field->Name, Field->EnumNames, Field->EnumSize, Field->Range.Min, Field->Range.Max, Field->Sum, Field->Sum2};
+		field_read(Field, 0, NumNodes, Values);
+		csv_cache_write_column(Writer, &Column, Values);
 	}
-	fclose(File);
-	csv_fini(Parser, (void *)load_nodes_field_callback, (void *)load_nodes_row_callback, Loader);
-	csv_free(Parser);
-	char ProgressText[32];
-	sprintf(ProgressText, "%d / %d rows", NumNodes, NumNodes);
-	gtk_progress_bar_set_text(Loader->ProgressBar, ProgressText);
-	gtk_progress_bar_set_fraction(Loader->ProgressBar, 1.0);
-	while (gtk_events_pending()) gtk_main_iteration();
+	free(Values);
+	node_t *Nodes = Viewer->Nodes;
+	for (int I = 0; I < NumNodes; ++I) csv_cache_write_file_name(Writer, node_file_name(Nodes + I));
+	if (Viewer->XIndex >= 0 && Viewer->YIndex >= 0) {
+		csv_cache_orders_t Orders = {(const int32_t *)Viewer->SortedX, (const int32_t *)Viewer->SortedY};
+		csv_cache_write_orders(Writer, Viewer->XIndex, Viewer->YIndex, &Orders);
+	}
+	if (csv_cache_finish(Writer)) console_printf(Viewer->Console, "Saved cache for %s\n", CsvFileName);
+}
+
+// Fills in the enum names, stores and statistics of a field, extending them
+// with any enum values added since the last call.
+static void viewer_update_field(viewer_t *Viewer, field_t *Field) {
+	if (Field->EnumDict) {
+		field_update_enum(Field);
+	} else {
+		double Mean = Field->Sum / Viewer->NumNodes;
+		Field->SD = sqrt((Field->Sum2 / Viewer->NumNodes) - Mean * Mean);
+	}
+}
 
+// Loads a column left out of a projected load the first time it is used.
+// Returns 0 while the file is still loading, since the row index is not
+// complete until then.
+static int viewer_field_require(viewer_t *Viewer, field_t *Field) {
+	if (!Field->Lazy) return 1;
+	if (!Viewer->CsvIndex) {
+		console_printf(Viewer->Console, "%s can be used once loading finishes\n", Field->Name);
+		return 0;
+	}
+	int Index = 0;
+	while (Viewer->Fields[Index] != Field) ++Index;
+	int NumNodes = Viewer->NumNodes;
+	double *Values = malloc(NumNodes * sizeof(double));
+	csv_loader_column_t Column[1];
+	csv_index_load(Viewer->CsvIndex, Index, Values, Column, g_get_num_processors());
+	field_scan_t Scan[1] = {FIELD_SCAN_INIT};
+	field_scan(Scan, Values, NumNodes);
+	field_alloc_values(Field, field_scan_storage(Scan), NumNodes);
+	field_store(Field->Values, Field->Storage, 0, NumNodes, Values);
+	free(Values);
+	Field->Range.Min = Column->Min;
+	Field->Range.Max = Column->Max;
+	Field->Sum = Column->Sum;
+	Field->Sum2 = Column->Sum2;
+	if (Column->EnumNames) {
+		enum_dict_t *Dict = Field->EnumDict = enum_dict_new();
+		for (int J = 1; J < Column->EnumSize; ++J) enum_dict_insert(Dict, Column->EnumNames[J], strlen(Column->EnumNames[J]));
+	}
+	Field->Lazy = 0;
+	viewer_update_field(Viewer, Field);
+	console_printf(Viewer->Console, "Loaded column %s\n", Field->Name);
+	return 1;
+}
+
+static void viewer_show_fields(viewer_t *Viewer) {
 	gtk_list_store_clear(Viewer->FieldsStore);
-	for (int I = 0; I < NumFields; ++I) {
-		field_t *Field = Fields[I];
+	for (int I = 0; I < Viewer->NumFields; ++I) {
+		field_t *Field = Viewer->Fields[I];
 		gtk_list_store_insert_with_values(Viewer->FieldsStore, 0, -1, FIELD_COLUMN_NAME, Field->Name, FIELD_COLUMN_FIELD, Field, FIELD_COLUMN_VISIBLE, TRUE, -1);
 		stringmap_insert(Viewer->FieldsByName, Field->Name, Field);
-		if (Field->EnumMap) {
-			int EnumSize = Field->EnumSize = Field->EnumMap->Size + 1;
-			const char **EnumNames = (const char **)GC_malloc(EnumSize * sizeof(const char *));
-			EnumNames[0] = "";
-			stringmap_foreach(Field->EnumMap, EnumNames, (void *)set_enum_name_fn);
-			Field->EnumNames = EnumNames;
-			GtkListStore *EnumStore = Field->EnumStore = gtk_list_store_new(2, G_TYPE_STRING, G_TYPE_DOUBLE);
-			for (int J = 0; J < EnumSize; ++J) {
-				gtk_list_store_insert_with_values(Field->EnumStore, 0, -1, 0, Field->EnumNames[J], 1, (double)(J + 1), -1);
-			}
-			Field->EnumValues = (int *)GC_malloc_atomic(EnumSize * sizeof(int));
-			Field->Range.Min = 0.0;
-			Field->Range.Max = EnumSize;
-		} else {
-			double Mean = Field->Sum / Viewer->NumNodes;
-			Field->SD = sqrt((Field->Sum2 / Viewer->NumNodes) - Mean * Mean);
-		}
 	}
+}
 
-	if (NumFields >= 2) {
-		gtk_combo_box_set_active(GTK_COMBO_BOX(Viewer->XComboBox), 0);
-		gtk_combo_box_set_active(GTK_COMBO_BOX(Viewer->YComboBox), 1);
-		gtk_combo_box_set_active(GTK_COMBO_BOX(Viewer->CComboBox), Viewer->NumFields - 1);
+// Picks the first two loaded fields for X and Y and the last for colour.
+static void viewer_select_fields(viewer_t *Viewer) {
+	int Loaded[2], NumLoaded = 0, Last = -1;
+	for (int I = 0; I < Viewer->NumFields; ++I) {
+		if (Viewer->Fields[I]->Lazy) continue;
+		if (NumLoaded < 2) Loaded[NumLoaded++] = I;
+		Last = I;
+	}
+	if (NumLoaded >= 2) {
+		gtk_combo_box_set_active(GTK_COMBO_BOX(Viewer->XComboBox), Loaded[0]);
+		gtk_combo_box_set_active(GTK_COMBO_BOX(Viewer->YComboBox), Loaded[1]);
+		gtk_combo_box_set_active(GTK_COMBO_BOX(Viewer->CComboBox), Last);
 	} else {
 		clear_viewer_indices(Viewer);
 	}
+}
+
+static GtkProgressBar *viewer_show_progress(viewer_t *Viewer) {
+	GtkProgressBar *ProgressBar = GTK_PROGRESS_BAR(gtk_progress_bar_new());
+	gtk_progress_bar_set_show_text(ProgressBar, TRUE);
+	GtkWidget *InfoContainerArea = gtk_info_bar_get_content_area(GTK_INFO_BAR(Viewer->InfoBar));
+	gtk_container_add(GTK_CONTAINER(InfoContainerArea), GTK_WIDGET(ProgressBar));
+	gtk_info_bar_set_message_type(GTK_INFO_BAR(Viewer->InfoBar), GTK_MESSAGE_INFO);
+	gtk_widget_show(GTK_WIDGET(ProgressBar));
+	gtk_widget_show(Viewer->InfoBar);
+	return ProgressBar;
+}
+
+// Common tail of every load path, the sidecar cache is saved if Key is given.
+static void viewer_load_file_done(viewer_t *Viewer, const char *CsvFileName, GtkProgressBar *ProgressBar, csv_cache_t *Cache, csv_cache_key_t *Key) {
+	int NumNodes = Viewer->NumNodes;
+	char ProgressText[32];
+	sprintf(ProgressText, "%d / %d rows", NumNodes, NumNodes);
+	gtk_progress_bar_set_text(ProgressBar, ProgressText);
+	gtk_progress_bar_set_fraction(ProgressBar, 1.0);
+	while (gtk_events_pending()) gtk_main_iteration();
+	if (Cache) {
+		csv_cache_close(Cache);
+	} else if (Key) {
+		gtk_progress_bar_set_text(ProgressBar, "Saving cache");
+		while (gtk_events_pending()) gtk_main_iteration();
+		viewer_save_cache(Viewer, CsvFileName, Key);
+	}
 
 	nodes_iter_t *NodesIter = new(nodes_iter_t);
 	NodesIter->Type = NodesT;
@@ -3188,7 +4185,7 @@ static void viewer_load_file(viewer_t *Viewer, const char *CsvFileName, const ch
 	FieldsValue->Viewer = Viewer;
 	stringmap_insert(Viewer->Globals, "Fields", (ml_value_t *)FieldsValue);
 
-	gtk_widget_destroy(GTK_WIDGET(Loader->ProgressBar));
+	gtk_widget_destroy(GTK_WIDGET(ProgressBar));
 	gtk_widget_hide(Viewer->InfoBar);
 	redraw_viewer_background(Viewer);
 	gtk_widget_queue_draw(Viewer->DrawingArea);
@@ -3198,13 +4195,338 @@ static void viewer_load_file(viewer_t *Viewer, const char *CsvFileName, const ch
 	gtk_window_set_title(GTK_WINDOW(Viewer->MainWindow), Title);
 }
 
+#ifndef MINGW
+#define LOAD_STEP_INTERVAL 33
+#define LOAD_STEP_TIME 20000
+#define LOAD_FIRST_MILESTONE 65536
+
+// Background load of a CSV file.
+// Row blocks from the csv loader are copied into nodes and fields allocated
+// for the row capacity up front, but only become visible (by raising
+// Viewer->NumNodes) at milestones, which start at LOAD_FIRST_MILESTONE rows
+// and double each time. At each milestone the field statistics are updated
+// and the axes, colours and node tree are rebuilt for the rows so far.
+struct viewer_loader_t {
+	viewer_t *Viewer;
+	csv_loader_t *CsvLoader;
+	GtkProgressBar *ProgressBar;
+	GtkWidget *CancelButton;
+	const char *CsvFileName;
+	csv_cache_key_t CacheKey[1];
+	guint TimeoutId;
+	int HasCacheKey, Allocated, Shown, NumRows, Milestone;
+};
+
+static void viewer_loader_alloc(viewer_loader_t *Loader, int Capacity) {
+	viewer_t *Viewer = Loader->Viewer;
+	csv_loader_t *CsvLoader = Loader->CsvLoader;
+	int NumFields = Viewer->NumFields = csv_loader_num_columns(CsvLoader);
+	viewer_alloc_nodes(Viewer, Capacity);
+	file_names_init(Viewer->FileNames);
+	Viewer->NumNodes = 0;
+	Viewer->NumFiltered = 0;
+	kd_tree_clear(Viewer->Tree);
+	Viewer->XIndex = Viewer->YIndex = -1;
+	Viewer->CIndex = 0;
+	field_t **Fields = Viewer->Fields = (field_t **)GC_malloc(NumFields * sizeof(field_t *));
+	for (int I = 0; I < NumFields; ++I) {
+		csv_loader_column_t *Column = csv_loader_column(CsvLoader, I);
+		if (csv_loader_selected(CsvLoader, I)) {
+			Fields[I] = viewer_alloc_column_field(Column, Column->EnumNames ? FIELD_U8 : FIELD_F64, Capacity);
+		} else {
+			// Columns outside the projection are loaded through the index later
+			Fields[I] = viewer_alloc_column_field(Column, FIELD_F64, 0);
+			Fields[I]->Lazy = 1;
+		}
+	}
+#ifdef USE_GL
+	Viewer->GLVertices = (float *)GC_malloc_atomic(Capacity * 3 * 3 * sizeof(float));
+	Viewer->GLColours = (float *)GC_malloc_atomic(Capacity * 3 * 4 * sizeof(float));
+#endif
+	viewer_show_fields(Viewer);
+	Loader->Allocated = 1;
+}
+
+static void viewer_loader_add_enums(viewer_loader_t *Loader, field_t *Field, int Index) {
+	csv_loader_column_t *Column = csv_loader_column(Loader->CsvLoader, Index);
+	enum_dict_t *Dict = Field->EnumDict;
+	for (int Code = Dict->Size; Code < Column->EnumSize; ++Code) {
+		enum_dict_insert(Dict, Column->EnumNames[Code], strlen(Column->EnumNames[Code]));
+	}
+}
+
+static void viewer_loader_add(viewer_loader_t *Loader, csv_loader_block_t *Block) {
+	viewer_t *Viewer = Loader->Viewer;
+	int Start = Loader->NumRows, NumRows = Block->NumRows;
+	node_t *Nodes = Viewer->Nodes + Start;
+	for (int I = 0; I < NumRows; ++I) {
+		const char *FileName = Block->Names + Block->NameOffsets[I];
+		Nodes[I].FileName = file_names_add(Viewer->FileNames, FileName, strlen(FileName));
+	}
+	for (int J = 0; J < Viewer->NumFields; ++J) {
+		field_t *Field = Viewer->Fields[J];
+		if (Field->Lazy) continue;
+		field_write(Field, Start, NumRows, Block->Values[J]);
+		if (Field->EnumDict) viewer_loader_add_enums(Loader, Field, J);
+	}
+	Loader->NumRows += NumRows;
+}
+
+// Makes the rows added since the last milestone visible.
+static void viewer_loader_update(viewer_loader_t *Loader) {
+	viewer_t *Viewer = Loader->Viewer;
+	int Start = Viewer->NumNodes, NumNodes = Loader->NumRows;
+	Viewer->NumFiltered += NumNodes - Start;
+	Viewer->NumNodes = NumNodes;
+	// Only the new rows are tested, the tree is rebuilt below. Appending
+	// rows changes the generation of the fields but not their old values.
+	filter_changes_t Changes[1] = {{0, 0, 0}};
+	for (filter_t *Filter = Viewer->Filters; Filter; Filter = Filter->Next) {
+		int Applied = Filter->AppliedRows == Start && Filter->AppliedField == Filter->Field;
+		Applied = Applied && Filter->AppliedOperator == Filter->Operator && Filter->AppliedValue == Filter->Value;
+		filter_reserve(Filter, NumNodes);
+		filter_update_rows(Filter, Start, NumNodes, Changes);
+		if (Applied) filter_mark_applied(Filter, NumNodes);
+	}
+	viewer_filter_changes(Viewer, Changes);
+	free(Changes->Rows);
+	for (int I = 0; I < Viewer->NumFields; ++I) {
+		field_t *Field = Viewer->Fields[I];
+		if (Field->Lazy) continue;
+		csv_loader_column_t *Column = csv_loader_column(Loader->CsvLoader, I);
+		Field->Range.Min = Column->Min;
+		Field->Range.Max = Column->Max;
+		Field->Sum = Column->Sum;
+		Field->Sum2 = Column->Sum2;
+		viewer_update_field(Viewer, Field);
+	}
+	++Viewer->FilterGeneration;
+	if (!Loader->Shown) {
+		Loader->Shown = 1;
+		viewer_select_fields(Viewer);
+	} else {
+		if (Viewer->XIndex >= 0 && Viewer->YIndex >= 0) {
+			set_viewer_indices(Viewer, Viewer->XIndex, Viewer->YIndex);
+		} else if (Viewer->NumFields < 2) {
+			clear_viewer_indices(Viewer);
+		}
+		if (Viewer->CIndex >= 0 && Viewer->CIndex < Viewer->NumFields) set_viewer_colour_index(Viewer, Viewer->CIndex);
+		redraw_viewer_background(Viewer);
+		update_preview(Viewer);
+		gtk_widget_queue_draw(Viewer->DrawingArea);
+	}
+}
+
+// Converts a numeric field to enum values after the csv loader finds text in
+// it, the visible rows are updated straight away. The codes are converted in
+// place as doubles and then narrowed.
+static void viewer_loader_retype(viewer_loader_t *Loader, int Index) {
+	viewer_t *Viewer = Loader->Viewer;
+	field_t *Field = Viewer->Fields[Index];
+	if (Field->Storage != FIELD_F64) field_convert(Field, FIELD_F64, Field->Capacity);
+	csv_loader_convert(Loader->CsvLoader, Index, (double *)Field->Values, Loader->NumRows);
+	enum_dict_t *Dict = Field->EnumDict = enum_dict_new();
+	viewer_loader_add_enums(Loader, Field, Index);
+	field_scan_t Scan[1] = {{0.0, Dict->Size, 1, 1}};
+	field_convert(Field, field_scan_storage(Scan), Field->Capacity);
+	console_printf(Viewer->Console, "Converted %s to enum values\n", Field->Name);
+	for (filter_t *Filter = Viewer->Filters; Filter; Filter = Filter->Next) {
+		if (Filter->Field == Field) Filter->AppliedField = 0;
+	}
+	if (Loader->Shown) viewer_loader_update(Loader);
+}
+
+// Discards the rows loaded so far when the csv loader starts again.
+static void viewer_loader_reset(viewer_loader_t *Loader) {
+	viewer_t *Viewer = Loader->Viewer;
+	node_t *Nodes = Viewer->Nodes;
+	for (int I = 0; I < Loader->NumRows; ++I) {
+		Nodes[I].Filtered = 1;
+		Viewer->SortedX[I] = Viewer->SortedY[I] = I;
+	}
+	for (int I = 0; I < Viewer->NumFields; ++I) {
+		field_t *Field = Viewer->Fields[I];
+		if (Field->Lazy) continue;
+		Field->EnumSize = 0;
+		if (csv_loader_column(Loader->CsvLoader, I)->EnumNames) {
+			Field->EnumDict = enum_dict_new();
+			if (Field->EnumStore) gtk_list_store_clear(Field->EnumStore);
+		} else {
+			// Columns converted to enums start out as numbers again
+			Field->EnumDict = 0;
+			Field->EnumStore = 0;
+			Field->EnumNames = 0;
+			if (Field->Storage != FIELD_F64) field_alloc_values(Field, FIELD_F64, Field->Capacity);
+		}
+	}
+	Loader->NumRows = 0;
+	Loader->Milestone = LOAD_FIRST_MILESTONE;
+	Viewer->NumNodes = 0;
+	Viewer->NumFiltered = 0;
+	filters_reset(Viewer);
+	kd_tree_clear(Viewer->Tree);
+	field_orders_clear(Viewer);
+	redraw_viewer_background(Viewer);
+	gtk_widget_queue_draw(Viewer->DrawingArea);
+}
+
+static void viewer_loader_finish(viewer_loader_t *Loader, int Complete) {
+	viewer_t *Viewer = Loader->Viewer;
+	if (!Loader->Allocated) viewer_loader_alloc(Loader, 0);
+	if (!Loader->Shown || Viewer->NumNodes != Loader->NumRows) viewer_loader_update(Loader);
+	int NumLazy = 0;
+	for (int I = 0; I < Viewer->NumFields; ++I) {
+		field_t *Field = Viewer->Fields[I];
+		if (Field->Lazy) {
+			++NumLazy;
+		} else {
+			field_narrow(Field, Viewer->NumNodes);
+		}
+	}
+	// The cache only holds complete files, so projected loads are not saved.
+	if (NumLazy) Viewer->CsvIndex = csv_loader_index(Loader->CsvLoader);
+	csv_loader_close(Loader->CsvLoader);
+	gtk_widget_destroy(Loader->CancelButton);
+	Viewer->Loader = 0;
+	if (!Complete) console_printf(Viewer->Console, "Loading cancelled after %d rows\n", Loader->NumRows);
+	viewer_load_file_done(Viewer, Loader->CsvFileName, Loader->ProgressBar, 0, Complete && Loader->HasCacheKey && !NumLazy ? Loader->CacheKey : 0);
+}
+
+static gboolean viewer_loader_step(viewer_loader_t *Loader) {
+	viewer_t *Viewer = Loader->Viewer;
+	gint64 Deadline = g_get_monotonic_time() + LOAD_STEP_TIME;
+	csv_loader_block_t *Block;
+	for (;;) {
+		csv_loader_status_t Status = csv_loader_next(Loader->CsvLoader, &Block);
+		if (Status == CSV_LOADER_WAIT) break;
+		if (!Loader->Allocated) viewer_loader_alloc(Loader, csv_loader_capacity(Loader->CsvLoader));
+		switch (Status) {
+		case CSV_LOADER_ROWS:
+			viewer_loader_add(Loader, Block);
+			if (Loader->NumRows >= Loader->Milestone) {
+				viewer_loader_update(Loader);
+				Loader->Milestone *= 2;
+			}
+			break;
+		case CSV_LOADER_RESET:
+			console_printf(Viewer->Console, "Irregular quoting, reloading rows...\n");
+			viewer_loader_reset(Loader);
+			break;
+		case CSV_LOADER_RETYPE:
+			viewer_loader_retype(Loader, csv_loader_retyped(Loader->CsvLoader));
+			break;
+		default:
+			viewer_loader_finish(Loader, 1);
+			return G_SOURCE_REMOVE;
+		}
+		if (g_get_monotonic_time() > Deadline) break;
+	}
+	double Progress = csv_loader_progress(Loader->CsvLoader);
+	char ProgressText[32];
+	sprintf(ProgressText, "%d rows", Loader->NumRows);
+	gtk_progress_bar_set_text(Loader->ProgressBar, ProgressText);
+	gtk_progress_bar_set_fraction(Loader->ProgressBar, Progress > 1.0 ? 1.0 : Progress);
+	return G_SOURCE_CONTINUE;
+}
+
+static void viewer_loader_cancel_clicked(GtkWidget *Button, viewer_loader_t *Loader) {
+	g_source_remove(Loader->TimeoutId);
+	viewer_loader_finish(Loader, 0);
+}
+
+// Stops a background load without keeping its rows, used when another file
+// is opened.
+static void viewer_loader_abort(viewer_loader_t *Loader) {
+	g_source_remove(Loader->TimeoutId);
+	csv_loader_close(Loader->CsvLoader);
+	gtk_widget_destroy(Loader->CancelButton);
+	gtk_widget_destroy(GTK_WIDGET(Loader->ProgressBar));
+	Loader->Viewer->Loader = 0;
+}
+
+static void viewer_load_file_background(viewer_t *Viewer, csv_loader_t *CsvLoader, const char *CsvFileName, GtkProgressBar *ProgressBar, csv_cache_key_t *Key) {
+	viewer_loader_t *Loader = new(viewer_loader_t);
+	Loader->Viewer = Viewer;
+	Loader->CsvLoader = CsvLoader;
+	Loader->ProgressBar = ProgressBar;
+	Loader->CsvFileName = GC_strdup(CsvFileName);
+	if (Key) {
+		Loader->CacheKey[0] = Key[0];
+		Loader->HasCacheKey = 1;
+	}
+	Loader->Milestone = LOAD_FIRST_MILESTONE;
+	GtkWidget *CancelButton = Loader->CancelButton = gtk_button_new_with_label("Cancel");
+	GtkWidget *InfoContainerArea = gtk_info_bar_get_content_area(GTK_INFO_BAR(Viewer->InfoBar));
+	gtk_box_pack_end(GTK_BOX(InfoContainerArea), CancelButton, FALSE, FALSE, 0);
+	g_signal_connect(G_OBJECT(CancelButton), "clicked", G_CALLBACK(viewer_loader_cancel_clicked), Loader);
+	gtk_widget_show(CancelButton);
+	Viewer->Loader = Loader;
+	Loader->TimeoutId = g_timeout_add(LOAD_STEP_INTERVAL, G_SOURCE_FUNC(viewer_loader_step), Loader);
+}
+#endif
+
+// Projection lists the columns to parse up front, the others are loaded on
+// first use. It is only honoured by the background loader; cached, Arrow and
+// compressed files are always loaded in full.
+static void viewer_load_file(viewer_t *Viewer, const char *CsvFileName, const char *ImagePrefix, const char **Projection) {
+#ifndef MINGW
+	if (Viewer->Loader) viewer_loader_abort(Viewer->Loader);
+#endif
+	if (Viewer->CsvIndex) {
+		csv_index_close(Viewer->CsvIndex);
+		Viewer->CsvIndex = 0;
+	}
+	char *Path = g_path_get_dirname(CsvFileName);
+	chdir(Path);
+	g_free(Path);
+
+	Viewer->ImagePrefix = ImagePrefix;
+	Viewer->RemoteFields[0] = (stringmap_t)STRINGMAP_INIT;
+	console_printf(Viewer->Console, "Loading rows...\n");
+	GtkProgressBar *ProgressBar = viewer_show_progress(Viewer);
+	csv_cache_key_t CacheKey[1];
+	int IsArrow = arrow_file_check(CsvFileName), CacheMapped = 0;
+	int HasCacheKey = !IsArrow && csv_cache_key(CsvFileName, CacheKey);
+	csv_cache_t *Cache = HasCacheKey ? csv_cache_open(CsvFileName, CacheKey) : 0;
+	if (IsArrow) {
+		viewer_load_file_arrow(Viewer, CsvFileName);
+	} else if (Cache) {
+		CacheMapped = viewer_load_file_cached(Viewer, Cache);
+	} else {
+#ifndef MINGW
+		csv_loader_t *CsvLoader = csv_loader_open(CsvFileName, sysconf(_SC_NPROCESSORS_ONLN), Projection);
+		if (CsvLoader) {
+			viewer_load_file_background(Viewer, CsvLoader, CsvFileName, ProgressBar, HasCacheKey ? CacheKey : 0);
+			return;
+		}
+#endif
+		viewer_load_file_serial(Viewer, CsvFileName, ProgressBar);
+	}
+	int NumNodes = Viewer->NumNodes;
+#ifdef USE_GL
+	Viewer->GLVertices = (float *)GC_malloc_atomic(NumNodes * 3 * 3 * sizeof(float));
+	Viewer->GLColours = (float *)GC_malloc_atomic(NumNodes * 3 * 4 * sizeof(float));
+#endif
+	viewer_show_fields(Viewer);
+	for (int I = 0; I < Viewer->NumFields; ++I) viewer_update_field(Viewer, Viewer->Fields[I]);
+	Viewer->Cache = Cache;
+	viewer_select_fields(Viewer);
+	Viewer->Cache = 0;
+	if (CacheMapped) {
+		// The fields close the cache themselves
+		Cache = 0;
+		HasCacheKey = 0;
+	}
+	viewer_load_file_done(Viewer, CsvFileName, ProgressBar, Cache, HasCacheKey ? CacheKey : 0);
+}
+
 static void prefix_directory_set(GtkFileChooser *Widget, GtkEntry *Entry) {
 	gtk_entry_set_text(Entry, gtk_file_chooser_get_filename(Widget));
 }
 
 static void viewer_open_file(GtkWidget *Button, viewer_t *Viewer) {
 	GtkWidget *FileChooser = gtk_file_chooser_dialog_new(
-		"Open a CSV file",
+		"Open a CSV or Arrow file",
 		GTK_WINDOW(Viewer->MainWindow),
 		GTK_FILE_CHOOSER_ACTION_OPEN,
 		"Cancel", GTK_RESPONSE_CANCEL,
@@ -3249,7 +4571,7 @@ static void viewer_open_file(GtkWidget *Button, viewer_t *Viewer) {
 	}
 	gtk_widget_destroy(Dialog);
 	while (gtk_events_pending()) gtk_main_iteration();
-	viewer_load_file(Viewer, FileName, ImagePrefix);
+	viewer_load_file(Viewer, FileName, ImagePrefix, 0);
 }
 
 static GtkWidget *create_viewer_action_bar(viewer_t *Viewer) {
@@ -3561,6 +4883,89 @@ static ml_value_t *remote_fn(viewer_t *Viewer, int Count, ml_value_t **Args) {
 	return MLNil;
 }
 
+// The query point of nearest() and within() is either a node, which is left
+// out of the results, or an X and a Y. Returns the index of the next argument.
+static int query_point_args(int Count, ml_value_t **Args, node_t **Self, double *X, double *Y) {
+	if (Args[0]->Type == NodeT) {
+		node_t *Node = *Self = (node_t *)Args[0];
+		*X = Node->X;
+		*Y = Node->Y;
+		return 1;
+	}
+	*Self = 0;
+	if (Count < 2 || !ml_is(Args[0], MLNumberT) || !ml_is(Args[1], MLNumberT)) return 0;
+	*X = ml_real_value(Args[0]);
+	*Y = ml_real_value(Args[1]);
+	return 2;
+}
+
+// nearest(Node, K[, Radius]) or nearest(X, Y, K[, Radius]) returns up to K
+// visible nodes nearest to the point and within Radius, nearest first.
+static ml_value_t *nearest_fn(viewer_t *Viewer, int Count, ml_value_t **Args) {
+	ML_CHECK_ARG_COUNT(2);
+	node_t *Self;
+	double X, Y;
+	int Next = query_point_args(Count, Args, &Self, &X, &Y);
+	if (!Next) return ml_error("TypeError", "nearest expects a node or X and Y");
+	ML_CHECK_ARG_COUNT(Next + 1);
+	ML_CHECK_ARG_TYPE(Next, MLIntegerT);
+	// No more than every live point can be found
+	long Requested = ml_integer_value(Args[Next]);
+	int NumLive = kd_tree_count(Viewer->Tree);
+	int K = Requested < NumLive ? Requested : NumLive;
+	double Radius = INFINITY;
+	if (Count > Next + 1) {
+		ML_CHECK_ARG_TYPE(Next + 1, MLNumberT);
+		Radius = ml_real_value(Args[Next + 1]);
+	}
+	ml_value_t *List = ml_list();
+	if (K <= 0) return List;
+	int Limit = K < NumLive ? K + (Self != 0) : K;
+	uint32_t *Rows = malloc(Limit * sizeof(uint32_t));
+	double *Distances = malloc(Limit * sizeof(double));
+	if (!Rows || !Distances) {
+		free(Rows);
+		free(Distances);
+		return ml_error("MemoryError", "not enough memory for %d nodes", Limit);
+	}
+	int Found = kd_tree_nearest(Viewer->Tree, X, Y, 1.0, 1.0, Radius, Limit, Rows, Distances);
+	for (int I = 0; I < Found && K > 0; ++I) {
+		node_t *Node = Viewer->Nodes + Rows[I];
+		if (Node == Self) continue;
+		ml_list_append(List, (ml_value_t *)Node);
+		--K;
+	}
+	free(Rows);
+	free(Distances);
+	return List;
+}
+
+typedef struct {
+	viewer_t *Viewer;
+	node_t *Self;
+	ml_value_t *List;
+} within_t;
+
+static void within_node(within_t *Within, uint32_t Row) {
+	node_t *Node = Within->Viewer->Nodes + Row;
+	if (Node != Within->Self) ml_list_append(Within->List, (ml_value_t *)Node);
+}
+
+// within(Node, Radius) or within(X, Y, Radius) returns the visible nodes
+// within Radius of the point, in no particular order.
+static ml_value_t *within_fn(viewer_t *Viewer, int Count, ml_value_t **Args) {
+	ML_CHECK_ARG_COUNT(2);
+	within_t Within[1] = {{Viewer, 0, ml_list()}};
+	double X, Y;
+	int Next = query_point_args(Count, Args, &Within->Self, &X, &Y);
+	if (!Next) return ml_error("TypeError", "within expects a node or X and Y");
+	ML_CHECK_ARG_COUNT(Next + 1);
+	ML_CHECK_ARG_TYPE(Next, MLNumberT);
+	double Radius = ml_real_value(Args[Next]);
+	if (!isnan(X) && !isnan(Y)) kd_tree_radius(Viewer->Tree, X, Y, Radius, (kd_tree_fn)within_node, Within);
+	return Within->List;
+}
+
 static ml_value_t *random_fn(viewer_t *Viewer, int Count, ml_value_t **Args) {
 	return ml_real((double)rand() / RAND_MAX);
 }
@@ -3580,6 +4985,7 @@ static void destroy_viewer(GtkWidget *Widget, viewer_t *Viewer) {
 
 static viewer_t *create_viewer(int Argc, char *Argv[]) {
 	viewer_t *Viewer = new(viewer_t);
+	Viewer->Tree = kd_tree_new();
 #ifdef USE_GL
 	Viewer->GLVertices = 0;
 	Viewer->GLColours = 0;
@@ -3592,6 +4998,7 @@ static viewer_t *create_viewer(int Argc, char *Argv[]) {
 	Viewer->FilterGeneration = 1;
 	Viewer->LoadGeneration = 0;
 	Viewer->LoadCache = (node_t **)GC_malloc(MAX_CACHED_IMAGES * sizeof(node_t *));
+	file_names_init(Viewer->FileNames);
 	Viewer->LoadCacheIndex = 0;
 	Viewer->ShowBox = 0;
 	Viewer->RedrawBackground = 0;
@@ -3632,6 +5039,8 @@ static viewer_t *create_viewer(int Argc, char *Argv[]) {
 	stringmap_insert(Viewer->Globals, "connect", ml_cfunction(Viewer, (void *)connect_fn));
 	stringmap_insert(Viewer->Globals, "remote", ml_cfunction(Viewer, (void *)remote_fn));
 	stringmap_insert(Viewer->Globals, "random", ml_cfunction(Viewer, (void *)random_fn));
+	stringmap_insert(Viewer->Globals, "nearest", ml_cfunction(Viewer, (void *)nearest_fn));
+	stringmap_insert(Viewer->Globals, "within", ml_cfunction(Viewer, (void *)within_fn));
 
 	GtkWidget *MainWindow = Viewer->MainWindow = gtk_window_new(GTK_WINDOW_TOPLEVEL);
 	gtk_window_set_title(GTK_WINDOW(Viewer->MainWindow), "DataViewer");
@@ -3695,6 +5104,7 @@ static viewer_t *create_viewer(int Argc, char *Argv[]) {
 
 	const char *CsvFileName = 0;
 	const char *ImagePrefix = 0;
+	const char **Projection = 0;
 	for (int I = 1; I < Argc; ++I) {
 		if (Argv[I][0] == '-') {
 			if (Argv[I][1] == 'p') {
@@ -3703,6 +5113,26 @@ static viewer_t *create_viewer(int Argc, char *Argv[]) {
 					exit(1);
 				}
 				ImagePrefix = Argv[I];
+			} else if (Argv[I][1] == 'c') {
+				if (++I >= Argc) {
+					puts("Missing column names");
+					exit(1);
+				}
+				int NumColumns = 1;
+				for (const char *P = Argv[I]; *P; ++P) if (*P == ',') ++NumColumns;
+				Projection = anew(const char *, NumColumns + 1);
+				char *Names = GC_strdup(Argv[I]);
+				for (int J = 0; J < NumColumns; ++J) {
+					Projection[J] = Names;
+					while (*Names && *Names != ',') ++Names;
+					if (*Names) *Names++ = 0;
+				}
+			} else if (Argv[I][1] == 'o') {
+				if (++I >= Argc) {
+					puts("Missing scratch directory");
+					exit(1);
+				}
+				if (!column_map_init(Argv[I])) exit(1);
 			}
 		} else {
 			CsvFileName = Argv[I];
@@ -3715,7 +5145,7 @@ static viewer_t *create_viewer(int Argc, char *Argv[]) {
 
 	if (CsvFileName) {
 		while (gtk_events_pending()) gtk_main_iteration();
-		viewer_load_file(Viewer, CsvFileName, ImagePrefix);
+		viewer_load_file(Viewer, CsvFileName, ImagePrefix, Projection);
 	}
 
 	return Viewer;
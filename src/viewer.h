@@ -1,10 +1,12 @@
 #ifndef VIEWER_H
 #define VIEWER_H
 
+#include <stdint.h>
 #include <gtk/gtk.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
 #include <stringmap.h>
 #include <jansson.h>
+#include "enum_dict.h"
 
 typedef struct node_t node_t;
 typedef int node_callback_t(void *Data, node_t *Node);
@@ -12,6 +14,7 @@ typedef struct field_t field_t;
 typedef struct filter_t filter_t;
 typedef struct viewer_t viewer_t;
 typedef struct queued_callback_t queued_callback_t;
+typedef struct viewer_loader_t viewer_loader_t;
 
 typedef struct {
 	double X, Y;
@@ -21,21 +24,32 @@ typedef struct {
 	double Min, Max;
 } range_t;
 
+typedef struct {
+	char *Chars;
+	size_t Size, Space;
+} file_names_t;
+
+typedef enum {
+	FIELD_F64,
+	FIELD_F32,
+	FIELD_I32,
+	FIELD_U8,
+	FIELD_U16,
+	FIELD_U32
+} field_storage_t;
+
 extern ml_type_t NodeT[];
 extern ml_type_t FieldT[];
 
 struct node_t {
 	const ml_type_t *Type;
-	node_t *Children[2];
 	node_t *Next;
 	viewer_t *Viewer;
-	const char *FileName;
 	GdkPixbuf *Pixbuf;
 	GCancellable *LoadCancel;
 	GInputStream *LoadStream;
-	GFile *File;
 	double X, Y;
-	int XIndex, YIndex;
+	uint32_t FileName;
 #ifdef USE_GL
 	double R, G, B;
 #else
@@ -48,20 +62,25 @@ struct node_t {
 struct field_t {
 	const ml_type_t *Type;
 	const char *Name;
-	stringmap_t *EnumMap;
+	enum_dict_t *EnumDict;
 	GtkListStore *EnumStore;
 	const char **EnumNames;
 	int *EnumValues;
 	GtkTreeViewColumn *PreviewColumn;
 	const char *RemoteId;
 	json_int_t *RemoteGenerations;
+	void *Values;
+	void *Mapping;
 	range_t Range;
+	field_storage_t Storage;
+	int Capacity;
+	int Lazy;
 	int EnumSize;
 	int PreviewVisible;
 	int FilterCount;
 	int FilterGeneration;
+	int Generation;
 	double Sum, Sum2, SD;
-	double Values[];
 };
 
 struct viewer_t {
@@ -78,9 +97,8 @@ struct viewer_t {
 	GtkListStore *OperatorsStore;
 	GtkClipboard *Clipboard;
 	GtkMenu *NodeMenu;
-	node_t *Nodes, *Root, *Selected;
-	node_t **SortBuffer;
-	node_t **SortedX, **SortedY;
+	node_t *Nodes, *Selected, *HoverNode;
+	uint32_t *SortedX, *SortedY;
 	cairo_t *Cairo;
 	node_t **LoadCache;
 	node_t *ActiveNode;
@@ -89,7 +107,17 @@ struct viewer_t {
 	console_t *Console;
 	zsock_t *RemoteSocket;
 	queued_callback_t *QueuedCallbacks;
+	struct csv_cache_t *Cache;
+	struct kd_tree_t *Tree;
+	struct field_order_t *FieldOrders;
+	struct kd_values_t *BoxValues;
+	field_t *BoxField;
+	struct density_t *Density;
+	viewer_loader_t *Loader;
+	struct csv_index_t *CsvIndex;
 	const char *ImagePrefix;
+	double *Lasso;
+	file_names_t FileNames[1];
 	stringmap_t Globals[1];
 	stringmap_t FieldsByName[1];
 	stringmap_t RemoteFields[1];
@@ -110,6 +138,11 @@ struct viewer_t {
 	int LoadCacheIndex;
 	int ShowBox, RedrawBackground;
 	int LastCallbackIndex;
+	int BoxGeneration;
+	int DensityStale;
+	int Saving;
+	int LassoSize, LassoSpace, LassoState, LassoDragged;
+	size_t FieldOrdersSize;
 #ifdef USE_GL
 	int GLCount, GLReady;
 	GLuint GLArrays[2], GLBuffers[4];